@@ -2,6 +2,75 @@
  * @file LU.c
  * @author Navid Shamszadeh
  * @brief LU factorization algorithms for strided and non-strided matrices.
+ * @details Right-looking blocked LU with partial pivoting, PA = LU. Each block column (panel) is factored
+ * recursively, splitting its columns in half, so most of the panel work is itself a matrix multiplication. The
+ * trailing matrix update, which is almost all of the flops, goes through the blocked GEMM engine in gemm.h.
+ * L (unit lower triangular) and U overwrite A. The routines live in lu.h (luTemplate.h), shared with the float
+ * factorization and the mixed-precision solver.
  * @date 2021-05-16
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "../lu.h"
+
+int main(int argc, char* argv[]) {
+    int N = atoi(argv[1]);
+    srandom(time(NULL));
+
+    // random matrix with entries in [-1, 1] and a right-hand side built from a known solution
+    double *A = (double *)malloc((size_t)N * N * sizeof(double));
+    double *LU = (double *)malloc((size_t)N * N * sizeof(double));
+    double *x = (double *)malloc(N * sizeof(double));
+    double *b = (double *)malloc(N * sizeof(double));
+    int *pivots = (int *)malloc(N * sizeof(int));
+    for (int i = 0; i < N * N; i++) {
+        A[i] = 2.0 * random() / RAND_MAX - 1.0;
+    }
+    for (int i = 0; i < N; i++) {
+        x[i] = 2.0 * random() / RAND_MAX - 1.0;
+    }
+    gemmGeneralDouble(N, N, 1, 1.0, A, N, x, 1, 0.0, b, 1);
+    memcpy(LU, A, (size_t)N * N * sizeof(double));
+
+    // time the factorization
+    clock_t start = clock();
+    int info = luFactorStrided(N, LU, N, pivots);
+    clock_t end = clock();
+    double cpu_time = (double)(end - start) / CLOCKS_PER_SEC;
+    if (info != 0) {
+        fprintf(stderr, "Error: U[%d][%d] is exactly zero!\n", info - 1, info - 1);
+    }
+
+    // solve and compute the scaled residual ||A x - b|| / (||A|| ||x||) in the max norm
+    double *solution = (double *)malloc(N * sizeof(double));
+    memcpy(solution, b, N * sizeof(double));
+    luSolveStrided(N, 1, LU, N, pivots, solution, 1);
+    double norm_A = 0.0, norm_x = 0.0, norm_r = 0.0, error = 0.0;
+    for (int i = 0; i < N; i++) {
+        double row_sum = 0.0, r = -b[i];
+        for (int j = 0; j < N; j++) {
+            row_sum += fabs(A[j + (long int)N * i]);
+            r += A[j + (long int)N * i] * solution[j];
+        }
+        norm_A = fmax(norm_A, row_sum);
+        norm_x = fmax(norm_x, fabs(solution[i]));
+        norm_r = fmax(norm_r, fabs(r));
+        error = fmax(error, fabs(solution[i] - x[i]));
+    }
+    double residual = norm_r / (norm_A * norm_x);
+
+    printf("luFactorStrided: %e (%.2f GFLOP/s) \t residual: %e \t max error: %e\n",
+           cpu_time, 2.0 / 3.0 * N * (double)N * N / cpu_time * 1e-9, residual, error);
+
+    free(A);
+    free(LU);
+    free(x);
+    free(b);
+    free(solution);
+    free(pivots);
+    return (info != 0 || residual > 1e-10) ? -1 : 0;
+}
@@ -0,0 +1,314 @@
+/**
+ * @file cholesky.c
+ * @author Navid Shamszadeh
+ * @brief Tiled Cholesky factorization A = L L^T scheduled as a task graph with OpenMP.
+ * @details The matrix is viewed as an nt x nt grid of CHOLESKY_TILE x CHOLESKY_TILE tiles. Every tile operation
+ * (POTRF on a diagonal tile, TRSM on a tile below it, SYRK on a later diagonal tile, GEMM on the other tiles of the
+ * trailing matrix) is an OpenMP task whose depend clauses name the tiles it reads and writes. The runtime starts a
+ * task as soon as its inputs are ready, so the factorization of the next panel overlaps the rest of the current
+ * trailing update instead of waiting at a barrier after each step. Panel tasks get a higher priority so the critical
+ * path runs first (set OMP_MAX_TASK_PRIORITY to enable priorities).
+ * @date 2021-05-18
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include "../gemm.h"
+#include "../perf.h"
+
+// rows and columns of the tiles the task graph is built on
+#define CHOLESKY_TILE 192
+// rows per block of the triangular update of a diagonal tile
+#define CHOLESKY_SYRK_BLOCK 48
+
+/**
+ * @brief Unblocked Cholesky factorization of an n x n tile, lower triangle only.
+ *
+ * @param n Order of the tile
+ * @param A Tile with row stride lda, its lower triangle is overwritten with L
+ * @param lda Leading dimension of A
+ * @return 0 on success, or j + 1 if the leading minor of order j + 1 is not positive definite
+ */
+int choleskyTilePotrf(int n, double *A, int lda) {
+    for (int j = 0; j < n; j++) {
+        double *row_j = A + (long int)lda * j;
+        double d = row_j[j];
+        for (int k = 0; k < j; k++) {
+            d -= row_j[k] * row_j[k];
+        }
+        if (d <= 0.0 || isnan(d))
+            return j + 1;
+        d = sqrt(d);
+        row_j[j] = d;
+        for (int i = j + 1; i < n; i++) {
+            double *row_i = A + (long int)lda * i;
+            double s = row_i[j];
+            for (int k = 0; k < j; k++) {
+                s -= row_i[k] * row_j[k];
+            }
+            row_i[j] = s / d;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Solves X L^T = B in place for an m x n tile B and an n x n lower triangular tile L.
+ *
+ * @param m Number of rows of B
+ * @param n Number of columns of B and order of L
+ * @param L Lower triangular tile with row stride ldl
+ * @param ldl Leading dimension of L
+ * @param B Tile with row stride ldb, overwritten with X
+ * @param ldb Leading dimension of B
+ */
+void choleskyTileTrsm(int m, int n, const double *L, int ldl, double *B, int ldb) {
+    for (int r = 0; r < m; r++) {
+        double *row = B + (long int)ldb * r;
+        for (int j = 0; j < n; j++) {
+            const double *l = L + (long int)ldl * j;
+            double s = row[j];
+            for (int k = 0; k < j; k++) {
+                s -= l[k] * row[k];
+            }
+            row[j] = s / l[j];
+        }
+    }
+}
+
+/**
+ * @brief Doubles of scratch one thread needs for choleskyTileUpdate on tiles of size nb.
+ */
+size_t choleskyScratchSize(int nb) {
+    return (size_t)nb * nb + (size_t)CHOLESKY_SYRK_BLOCK * CHOLESKY_SYRK_BLOCK;
+}
+
+/**
+ * @brief C -= A B^T for an m x k tile A, an n x k tile B and an m x n tile C, through the blocked GEMM engine.
+ * @details B^T is formed in scratch first; that costs O(nk) against the O(mnk) product. When lower is nonzero C is
+ * a diagonal tile (A == B, m == n) and only its lower triangle is updated (SYRK): every block of
+ * CHOLESKY_SYRK_BLOCK rows updates the part left of its diagonal block directly, and only the small diagonal block
+ * is computed in full into scratch, so the upper half is mostly never computed.
+ *
+ * @param m Number of rows of A and C
+ * @param n Number of rows of B and columns of C
+ * @param k Number of columns of A and B
+ * @param A Tile with row stride lda
+ * @param lda Leading dimension of A
+ * @param B Tile with row stride ldb
+ * @param ldb Leading dimension of B
+ * @param C Tile with row stride ldc
+ * @param ldc Leading dimension of C
+ * @param lower Nonzero to update only the lower triangle of C
+ * @param scratch choleskyScratchSize(nb) doubles for tiles of at most nb rows and columns
+ */
+void choleskyTileUpdate(int m, int n, int k, const double *A, int lda, const double *B, int ldb, double *C, int ldc, int lower, double *scratch) {
+    double *B_t = scratch;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < k; j++) {
+            B_t[i + (long int)n * j] = B[j + (long int)ldb * i];
+        }
+    }
+    if (!lower) {
+        gemmGeneralDouble(m, k, n, -1.0, A, lda, B_t, n, 1.0, C, ldc);
+        return;
+    }
+    double *product = scratch + (long int)n * k;
+    for (int i0 = 0; i0 < m; i0 += CHOLESKY_SYRK_BLOCK) {
+        int ib = (m - i0 < CHOLESKY_SYRK_BLOCK) ? m - i0 : CHOLESKY_SYRK_BLOCK;
+        const double *A_rows = A + (long int)lda * i0;
+        double *C_rows = C + (long int)ldc * i0;
+        gemmGeneralDouble(ib, k, i0, -1.0, A_rows, lda, B_t, n, 1.0, C_rows, ldc);
+        gemmGeneralDouble(ib, k, ib, 1.0, A_rows, lda, B_t + i0, n, 0.0, product, ib);
+        for (int i = 0; i < ib; i++) {
+            for (int j = 0; j <= i; j++) {
+                C_rows[i0 + j + (long int)ldc * i] -= product[j + (long int)ib * i];
+            }
+        }
+    }
+}
+
+/**
+ * @brief Creates the tasks of the tiled Cholesky factorization in the current team and waits for them.
+ * @details Called by a single thread; the other threads of its team run the tasks.
+ *
+ * @param N Order of A
+ * @param A Matrix with row stride lda
+ * @param lda Leading dimension of A
+ * @param nb Tile size
+ * @param nt Number of tile rows
+ * @param tile nt * nt dependency tokens
+ * @param scratch choleskyScratchSize(nb) doubles for every thread of the team, indexed by thread number
+ * @param info Set to j + 1 if the leading minor of order j + 1 is not positive definite
+ */
+static void choleskyTiledTasks(int N, double *A, int lda, int nb, int nt, char *tile, double *scratch, int *info) {
+#define SCRATCH (scratch + choleskyScratchSize(nb) * omp_get_thread_num())
+#define TILE(i, j) (A + (long int)(j) * nb + (long int)lda * (i) * nb)
+#define SIZE(i) ((i) == nt - 1 ? N - (i) * nb : nb)
+    for (int k = 0; k < nt; k++) {
+        #pragma omp task depend(inout: tile[k * nt + k]) priority(2)
+        {
+            int tile_info = choleskyTilePotrf(SIZE(k), TILE(k, k), lda);
+            if (tile_info != 0) {
+                #pragma omp critical
+                if (*info == 0 || k * nb + tile_info < *info)
+                    *info = k * nb + tile_info;
+            }
+        }
+        for (int i = k + 1; i < nt; i++) {
+            #pragma omp task depend(in: tile[k * nt + k]) depend(inout: tile[i * nt + k]) priority(1)
+            choleskyTileTrsm(SIZE(i), SIZE(k), TILE(k, k), lda, TILE(i, k), lda);
+        }
+        for (int i = k + 1; i < nt; i++) {
+            #pragma omp task depend(in: tile[i * nt + k]) depend(inout: tile[i * nt + i])
+            choleskyTileUpdate(SIZE(i), SIZE(i), SIZE(k), TILE(i, k), lda, TILE(i, k), lda, TILE(i, i), lda, 1, SCRATCH);
+            for (int j = k + 1; j < i; j++) {
+                #pragma omp task depend(in: tile[i * nt + k], tile[j * nt + k]) depend(inout: tile[i * nt + j])
+                choleskyTileUpdate(SIZE(i), SIZE(j), SIZE(k), TILE(i, k), lda, TILE(j, k), lda, TILE(i, j), lda, 0, SCRATCH);
+            }
+        }
+    }
+    #pragma omp taskwait
+#undef TILE
+#undef SIZE
+#undef SCRATCH
+}
+
+/**
+ * @brief Tiled Cholesky factorization of a strided symmetric positive definite N x N matrix, A = L L^T.
+ * @details Only the lower triangle of A is referenced and it is overwritten with L. Called outside a parallel region
+ * it opens its own and factors A with all its threads. Inside a parallel region it must be called by one thread
+ * only (e.g. from a single or masked construct): that thread creates the tasks and the other threads of the team run
+ * them once they reach a task scheduling point such as the barrier closing the construct. Every thread of a team
+ * calling it on the same matrix is a data race.
+ *
+ * @param N Order of A
+ * @param A Matrix with row stride lda
+ * @param lda Leading dimension of A
+ * @param nb Tile size, at least 1
+ * @return 0 on success, j + 1 if the leading minor of order j + 1 is not positive definite, or -1 if nb < 1
+ */
+int choleskyTiled(int N, double *A, int lda, int nb) {
+    if (nb < 1)
+        return -1;
+    PERF_BEGIN();
+    int nt = (N + nb - 1) / nb;
+    int info = 0;
+    // one dependency token per tile; the tasks name tokens rather than tile memory so ragged tiles need no care
+    char *tile = (char *)malloc((size_t)nt * nt + 1);
+    // the tile updates run on every thread of the team, each with its own scratch allocated once here
+    int threads = omp_in_parallel() ? omp_get_num_threads() : omp_get_max_threads();
+    double *scratch = (double *)malloc(choleskyScratchSize(nb) * threads * sizeof(double));
+
+    if (omp_in_parallel()) {
+        choleskyTiledTasks(N, A, lda, nb, nt, tile, scratch, &info);
+    } else {
+        #pragma omp parallel num_threads(threads)
+        #pragma omp single
+        choleskyTiledTasks(N, A, lda, nb, nt, tile, scratch, &info);
+    }
+
+    free(tile);
+    free(scratch);
+    PERF_END("choleskyTiled", N, nb, 1);
+    return info;
+}
+
+/**
+ * @brief Tiled Cholesky factorization of a row-pointer matrix.
+ * @details The rows must be evenly spaced in memory, as they are when carved out of a single A[0] block.
+ *
+ * @param N Order of A
+ * @param A Symmetric positive definite matrix, its lower triangle is overwritten with L
+ * @return 0 on success, or j + 1 if the leading minor of order j + 1 is not positive definite
+ */
+int cholesky(int N, double **A) {
+    int lda = (N > 1) ? (int)(A[1] - A[0]) : N;
+    for (int i = 2; i < N; i++) {
+        if (A[i] - A[i - 1] != lda) {
+            fprintf(stderr, "Error: cholesky needs evenly spaced rows!\n");
+            exit(-1);
+        }
+    }
+    return choleskyTiled(N, A[0], lda, CHOLESKY_TILE);
+}
+
+int main(int argc, char* argv[]) {
+    int N = (argc > 1) ? atoi(argv[1]) : 0;
+    int nb = (argc > 2) ? atoi(argv[2]) : CHOLESKY_TILE;
+    if (N < 1 || nb < 1) {
+        fprintf(stderr, "Usage: %s N [tile size >= 1]\n", argv[0]);
+        return -1;
+    }
+    srandom(1);
+
+    // random symmetric matrix made positive definite by diagonal dominance
+    double *A = (double *)malloc((size_t)N * N * sizeof(double));
+    double *L = (double *)malloc((size_t)N * N * sizeof(double));
+    for (int i = 0; i < N; i++) {
+        for (int j = 0; j < i; j++) {
+            A[j + (long int)N * i] = A[i + (long int)N * j] = 2.0 * random() / RAND_MAX - 1.0;
+        }
+        A[i + (long int)N * i] = N;
+    }
+
+    // factor with 1, 2, 4, ... threads up to all of them and report the scaling
+    int max_threads = omp_get_max_threads();
+    double base_time = 0.0;
+    int info = 0;
+    for (int threads = 1; ; threads = (threads * 2 < max_threads) ? threads * 2 : max_threads) {
+        memcpy(L, A, (size_t)N * N * sizeof(double));
+        omp_set_num_threads(threads);
+        double start = omp_get_wtime();
+        info = choleskyTiled(N, L, N, nb);
+        double elapsed = omp_get_wtime() - start;
+        if (threads == 1)
+            base_time = elapsed;
+        printf("choleskyTiled threads: %d \t time: %e \t GFLOP/s: %.2f \t speedup: %.2f\n",
+               threads, elapsed, N * (double)N * N / 3.0 / elapsed * 1e-9, base_time / elapsed);
+        if (threads == max_threads)
+            break;
+    }
+    if (info != 0) {
+        fprintf(stderr, "Error: leading minor of order %d is not positive definite!\n", info);
+        free(A);
+        free(L);
+        return -1;
+    }
+
+    // verify: solve L L^T y = A x for a random x and compare
+    double *x = (double *)malloc(N * sizeof(double));
+    double *y = (double *)malloc(N * sizeof(double));
+    for (int i = 0; i < N; i++) {
+        x[i] = 2.0 * random() / RAND_MAX - 1.0;
+    }
+    gemmGeneralDouble(N, N, 1, 1.0, A, N, x, 1, 0.0, y, 1);
+    for (int i = 0; i < N; i++) {
+        double s = y[i];
+        for (int k = 0; k < i; k++) {
+            s -= L[k + (long int)N * i] * y[k];
+        }
+        y[i] = s / L[i + (long int)N * i];
+    }
+    for (int i = N - 1; i >= 0; i--) {
+        double s = y[i];
+        for (int k = i + 1; k < N; k++) {
+            s -= L[i + (long int)N * k] * y[k];
+        }
+        y[i] = s / L[i + (long int)N * i];
+    }
+    double error = 0.0;
+    for (int i = 0; i < N; i++) {
+        error = fmax(error, fabs(y[i] - x[i]));
+    }
+    printf("max error: %e\n", error);
+
+    free(A);
+    free(L);
+    free(x);
+    free(y);
+    return error > 1e-8 ? -1 : 0;
+}
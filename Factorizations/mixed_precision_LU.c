@@ -0,0 +1,141 @@
+/**
+ * @file mixed_precision_LU.c
+ * @author Navid Shamszadeh
+ * @brief Mixed-precision solve of A X = B (float LU factorization plus iterative refinement in double) against a
+ * plain double LU solve.
+ * @details Reports the refinement steps, whether the solver fell back to double, the time of each phase, the speedup
+ * of the float factorization over the double one and of the whole solve over the double solve, and the backward and
+ * forward errors of both. By default A is random; --cond c builds
+ * A = H1 S H2 with Householder reflectors H1, H2 and singular values spread geometrically from 1 to 1 / c, so the
+ * fallback can be exercised with c beyond about 1e10.
+ * Run with e.g. ./mixed_precision_lu 4000 1 --cond 1e3
+ * @date 2021-05-22
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "../lu.h"
+
+/**
+ * @brief Fills the N x N matrix A = (I - 2 u u^T) diag(s) (I - 2 v v^T) for random unit vectors u and v, whose
+ * singular values are s_i = cond^(-i / (N - 1)).
+ */
+void mixedConditionedMatrix(int N, double cond, double *A) {
+    double *u = (double *)malloc(N * sizeof(double));
+    double *v = (double *)malloc(N * sizeof(double));
+    double *s = (double *)malloc(N * sizeof(double));
+    double norm_u = 0.0, norm_v = 0.0;
+    for (int i = 0; i < N; i++) {
+        u[i] = 2.0 * random() / RAND_MAX - 1.0;
+        v[i] = 2.0 * random() / RAND_MAX - 1.0;
+        s[i] = pow(cond, -(double)i / (N > 1 ? N - 1 : 1));
+        norm_u += u[i] * u[i];
+        norm_v += v[i] * v[i];
+    }
+    double usv = 0.0;
+    for (int i = 0; i < N; i++) {
+        u[i] /= sqrt(norm_u);
+        v[i] /= sqrt(norm_v);
+    }
+    for (int i = 0; i < N; i++) {
+        usv += u[i] * s[i] * v[i];
+    }
+    // (I - 2uu^T) S (I - 2vv^T) = S - 2 u (S u)^T - 2 (S v) v^T + 4 (u^T S v) u v^T
+    for (int i = 0; i < N; i++) {
+        for (int j = 0; j < N; j++) {
+            A[j + (long int)N * i] = (i == j ? s[i] : 0.0) - 2.0 * u[i] * s[j] * u[j] - 2.0 * s[i] * v[i] * v[j]
+                                   + 4.0 * usv * u[i] * v[j];
+        }
+    }
+    free(u);
+    free(v);
+    free(s);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s N [nrhs] [--cond c]\n", argv[0]);
+        return -1;
+    }
+    int N = atoi(argv[1]);
+    int nrhs = (argc > 2 && argv[2][0] != '-') ? atoi(argv[2]) : 1;
+    double cond = 0.0;
+    for (int a = 2; a < argc; a++) {
+        if (strcmp(argv[a], "--cond") == 0 && a + 1 < argc)
+            cond = atof(argv[++a]);
+    }
+    srandom(time(NULL));
+
+    double *A = (double *)malloc((size_t)N * N * sizeof(double));
+    double *LU = (double *)malloc((size_t)N * N * sizeof(double));
+    double *X_true = (double *)malloc((size_t)N * nrhs * sizeof(double));
+    double *B = (double *)malloc((size_t)N * nrhs * sizeof(double));
+    double *X_double = (double *)malloc((size_t)N * nrhs * sizeof(double));
+    double *X_mixed = (double *)malloc((size_t)N * nrhs * sizeof(double));
+    int *pivots = (int *)malloc(N * sizeof(int));
+    if (A == NULL || LU == NULL || X_true == NULL || B == NULL || X_double == NULL || X_mixed == NULL || pivots == NULL) {
+        fprintf(stderr, "Error: could not allocate the matrices!\n");
+        exit(-1);
+    }
+    if (cond > 0.0) {
+        mixedConditionedMatrix(N, cond, A);
+    } else {
+        for (long int i = 0; i < (long int)N * N; i++) {
+            A[i] = 2.0 * random() / RAND_MAX - 1.0;
+        }
+    }
+    for (long int i = 0; i < (long int)N * nrhs; i++) {
+        X_true[i] = 2.0 * random() / RAND_MAX - 1.0;
+    }
+    gemmGeneralDouble(N, N, nrhs, 1.0, A, N, X_true, nrhs, 0.0, B, nrhs);
+
+    // double reference: factor a copy of A and solve
+    double start = benchmarkNow();
+    memcpy(LU, A, (size_t)N * N * sizeof(double));
+    memcpy(X_double, B, (size_t)N * nrhs * sizeof(double));
+    int info = luFactorStrided(N, LU, N, pivots);
+    double double_factor_time = benchmarkNow() - start;
+    luSolveStrided(N, nrhs, LU, N, pivots, X_double, nrhs);
+    double double_time = benchmarkNow() - start;
+    if (info != 0) {
+        fprintf(stderr, "Error: U[%d][%d] is exactly zero!\n", info - 1, info - 1);
+    }
+
+    start = benchmarkNow();
+    lu_mixed_stats_t stats;
+    int mixed_info = luSolveMixed(N, nrhs, A, N, B, nrhs, X_mixed, nrhs, &stats);
+    double mixed_time = benchmarkNow() - start;
+
+    double double_backward = luBackwardError(N, nrhs, A, N, B, nrhs, X_double, nrhs);
+    double double_error = 0.0, mixed_error = 0.0, norm_x = 0.0;
+    for (long int i = 0; i < (long int)N * nrhs; i++) {
+        double_error = fmax(double_error, fabs(X_double[i] - X_true[i]));
+        mixed_error = fmax(mixed_error, fabs(X_mixed[i] - X_true[i]));
+        norm_x = fmax(norm_x, fabs(X_true[i]));
+    }
+
+    printf("double LU solve: %e (factor %e) \t backward error: %e \t forward error: %e\n", double_time, double_factor_time,
+           double_backward, double_error / norm_x);
+    printf("luSolveMixed: %e (float factor %e, refinement %e, fallback %e) \t %d refinement steps, %s%s \t speedup: %.2fx\n",
+           mixed_time, stats.factorTime, stats.refineTime, stats.fallbackTime, stats.iterations,
+           luMixedStatusNames[stats.status], stats.fallback ? " (fell back to double)" : "", double_time / mixed_time);
+    printf("luSolveMixed backward error: %e \t forward error: %e\n", stats.backwardError, mixed_error / norm_x);
+    printf("float factorization speedup over double (%s): %.2fx\n", simdIsaNames[simdIsa], double_factor_time / stats.factorTime);
+
+    // the mixed solve must be as backward stable as the double one
+    int errors = (info != 0 || mixed_info != 0 || stats.backwardError > fmax(10.0 * double_backward, N * DBL_EPSILON));
+    if (errors)
+        fprintf(stderr, "Error! luSolveMixed backward error %e against %e in double.\n", stats.backwardError, double_backward);
+
+    free(A);
+    free(LU);
+    free(X_true);
+    free(B);
+    free(X_double);
+    free(X_mixed);
+    free(pivots);
+    return errors ? -1 : 0;
+}
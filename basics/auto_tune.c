@@ -0,0 +1,234 @@
+/**
+ * @file auto_tune.c
+ * @author Navid Shamszadeh
+ * @brief Searches the tuning parameters of tune.h on the current host and stores the winners in the cache file.
+ * @details Searches one parameter at a time with the others fixed, in the order they depend on each other: the
+ * unrolling of the double GEMM micro-kernel, then the GEMM blocks KC, MC and NC (on double, whose 8-byte elements
+ * fill the caches exactly like the long int of matrixMultiplyStrided), the transpose tile, the LU block (with the
+ * tuned GEMM underneath) and finally the thread count of each threaded kernel. Every candidate is timed with
+ * benchmarkRun and the one with the lowest median wins. Tune with the thread count production runs use, since the
+ * thread search only tries counts up to it. Programs pick the results up at startup through tuneInit.
+ * Run with e.g. ./auto_tune --size 1024 --trials 5, or ./auto_tune --show to print what is stored for this host.
+ * @date 2021-05-23
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../benchmark.h"
+#include "../threads.h"
+#include "../lu.h"
+
+/**
+ * @brief Operands of the timed kernels, all for one problem size N.
+ */
+typedef struct {
+    int N;
+    double *A;
+    double *B;
+    double *C;
+    double *LU;
+    int *pivots;
+    long int *X;
+    long int *Y;
+    long int *Z;
+    long int *x;
+    long int *y;
+} tune_operands_t;
+
+void tuneGemm(void *args) {
+    tune_operands_t *op = (tune_operands_t *)args;
+    gemmGeneralDouble(op->N, op->N, op->N, 1.0, op->A, op->N, op->B, op->N, 0.0, op->C, op->N);
+}
+
+void tuneTranspose(void *args) {
+    tune_operands_t *op = (tune_operands_t *)args;
+    transposeStrided(op->N, op->N, op->X, op->N, op->Y, op->N);
+}
+
+void tuneLu(void *args) {
+    tune_operands_t *op = (tune_operands_t *)args;
+    memcpy(op->LU, op->A, (size_t)op->N * op->N * sizeof(double));
+    luFactorStrided(op->N, op->LU, op->N, op->pivots);
+}
+
+void tuneParallelAdd(void *args) {
+    tune_operands_t *op = (tune_operands_t *)args;
+    parallelAdd((long int)op->N * op->N, op->X, op->Y, op->Z);
+}
+
+void tuneParallelGemv(void *args) {
+    tune_operands_t *op = (tune_operands_t *)args;
+    parallelGemv(op->N, op->N, op->X, op->N, op->x, op->y);
+}
+
+void tuneParallelGemm(void *args) {
+    tune_operands_t *op = (tune_operands_t *)args;
+    parallelGemm(op->N, op->N, op->N, 1, op->X, op->N, op->Y, op->N, 0, op->Z, op->N);
+}
+
+void tuneParallelTranspose(void *args) {
+    tune_operands_t *op = (tune_operands_t *)args;
+    parallelTranspose(op->N, op->N, op->X, op->N, op->Y, op->N);
+}
+
+/**
+ * @brief Times kernel for every candidate value of *param and leaves the fastest one in *param.
+ *
+ * @param name Parameter name printed in the log
+ * @param param Parameter in tuneParams to vary
+ * @param candidates Values to try
+ * @param count Number of candidates
+ * @param kernel Kernel to time
+ * @param op Operands of the kernel
+ * @param trials Timed calls per candidate
+ * @return Median time of the winner in seconds
+ */
+double tuneSearch(const char *name, int *param, const int *candidates, int count, void (*kernel)(void *), tune_operands_t *op, int trials) {
+    int best = candidates[0];
+    double best_time = -1.0;
+    for (int c = 0; c < count; c++) {
+        *param = candidates[c];
+        // the unroll factor is baked into the micro-kernel pointers
+        if (param == &tuneParams.gemmUnroll)
+            gemmInit();
+        benchmark_stats_t stats = benchmarkRun(kernel, op, 1, trials);
+        printf("  %-18s %6d: %e s\n", name, candidates[c], stats.median);
+        if (best_time < 0.0 || stats.median < best_time) {
+            best = candidates[c];
+            best_time = stats.median;
+        }
+    }
+    *param = best;
+    if (param == &tuneParams.gemmUnroll)
+        gemmInit();
+    printf("%-20s -> %d\n", name, best);
+    return best_time;
+}
+
+int main(int argc, char* argv[]) {
+    int N = 1024, trials = 3, dry_run = 0, show = 0;
+    char path[TUNE_LINE_LENGTH];
+    tuneCachePath(path);
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--size") == 0 && a + 1 < argc) {
+            N = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--trials") == 0 && a + 1 < argc) {
+            trials = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--file") == 0 && a + 1 < argc) {
+            snprintf(path, sizeof(path), "%s", argv[++a]);
+        } else if (strcmp(argv[a], "--dry-run") == 0) {
+            dry_run = 1;
+        } else if (strcmp(argv[a], "--show") == 0) {
+            show = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [--size N] [--trials t] [--file path] [--dry-run] [--show]\n", argv[0]);
+            return -1;
+        }
+    }
+    char key[TUNE_KEY_LENGTH];
+    tuneHostKey(key);
+    printf("host: %s\ncache file: %s\n", key, path);
+    if (show) {
+        tune_params_t stored = {0};
+        if (tuneLoad(path, &stored) != 0) {
+            printf("no entry for this host\n");
+            return 0;
+        }
+        tunePrint(stdout, &stored);
+        return 0;
+    }
+    if (N < 64 || trials < 1) {
+        fprintf(stderr, "Error: the size must be at least 64 and the number of trials at least 1.\n");
+        return -1;
+    }
+
+    tune_operands_t op = {N};
+    long int elements = (long int)N * N;
+    op.A = (double *)malloc(elements * sizeof(double));
+    op.B = (double *)malloc(elements * sizeof(double));
+    op.C = (double *)malloc(elements * sizeof(double));
+    op.LU = (double *)malloc(elements * sizeof(double));
+    op.pivots = (int *)malloc(N * sizeof(int));
+    op.X = (long int *)malloc(elements * sizeof(long int));
+    op.Y = (long int *)malloc(elements * sizeof(long int));
+    op.Z = (long int *)malloc(elements * sizeof(long int));
+    op.x = (long int *)malloc(N * sizeof(long int));
+    op.y = (long int *)malloc(N * sizeof(long int));
+    if (op.A == NULL || op.B == NULL || op.C == NULL || op.LU == NULL || op.pivots == NULL || op.X == NULL ||
+        op.Y == NULL || op.Z == NULL || op.x == NULL || op.y == NULL) {
+        fprintf(stderr, "Error: could not allocate the operands!\n");
+        return -1;
+    }
+    for (long int i = 0; i < elements; i++) {
+        op.A[i] = 2.0 * random() / RAND_MAX - 1.0;
+        op.B[i] = 2.0 * random() / RAND_MAX - 1.0;
+        op.X[i] = i % 1000;
+        op.Y[i] = i % 997;
+    }
+    for (int i = 0; i < N; i++) {
+        op.x[i] = i % 100;
+    }
+
+    // search from the compile-time defaults, not from whatever was loaded at startup
+    tune_params_t loaded = tuneParams;
+    memset(&tuneParams, 0, sizeof(tuneParams));
+    gemmInit();
+    printf("searching on %s with N = %d, %d trials per candidate, up to %d threads\n", simdIsaNames[simdIsa], N,
+           trials, threadsConfig.count);
+
+    const int unrolls[] = {1, 2, 4};
+    const int kcs[] = {128, 192, 256, 384, 512};
+    const int mcs[] = {48, 72, 96, 144, 192, 288};
+    const int ncs[] = {512, 1024, 2048, 4096};
+    const int tiles[] = {8, 16, 32, 64};
+    const int lu_blocks[] = {32, 64, 96, 128, 192, 256};
+    tuneParams.gemmKc = GEMM_KC;
+    tuneParams.gemmMc = GEMM_MC;
+    tuneParams.gemmNc = GEMM_NC;
+    tuneSearch("gemm_unroll", &tuneParams.gemmUnroll, unrolls, 3, tuneGemm, &op, trials);
+    tuneSearch("gemm_kc", &tuneParams.gemmKc, kcs, 5, tuneGemm, &op, trials);
+    tuneSearch("gemm_mc", &tuneParams.gemmMc, mcs, 6, tuneGemm, &op, trials);
+    double gemm_time = tuneSearch("gemm_nc", &tuneParams.gemmNc, ncs, 4, tuneGemm, &op, trials);
+    tuneSearch("transpose_tile", &tuneParams.transposeTile, tiles, 4, tuneTranspose, &op, trials);
+    tuneSearch("lu_block", &tuneParams.luBlock, lu_blocks, 6, tuneLu, &op, trials);
+
+    // thread counts 1, 2, 4, ... up to the configured count
+    int thread_counts[32], counts = 0;
+    for (int t = 1; t < threadsConfig.count && counts < 31; t *= 2) {
+        thread_counts[counts++] = t;
+    }
+    thread_counts[counts++] = threadsConfig.count;
+    void (*threaded[TUNE_KERNELS])(void *) = {tuneParallelAdd, tuneParallelGemv, tuneParallelGemm, tuneParallelTranspose};
+    for (int k = 0; k < TUNE_KERNELS && counts > 1; k++) {
+        char name[32];
+        snprintf(name, sizeof(name), "threads_%s", tuneKernelNames[k]);
+        tuneSearch(name, &tuneParams.threads[k], thread_counts, counts, threaded[k], &op, trials);
+    }
+    printf("tuned GEMM: %.2f GFLOP/s\n", 2.0 * N * N * (double)N / gemm_time * 1e-9);
+    printf("before: ");
+    tunePrint(stdout, &loaded);
+    printf("after:  ");
+    tunePrint(stdout, &tuneParams);
+
+    int status = 0;
+    if (!dry_run) {
+        status = tuneSave(path, &tuneParams);
+        if (status != 0)
+            fprintf(stderr, "Error: could not write %s!\n", path);
+        else
+            printf("saved to %s\n", path);
+    }
+
+    free(op.A);
+    free(op.B);
+    free(op.C);
+    free(op.LU);
+    free(op.pivots);
+    free(op.X);
+    free(op.Y);
+    free(op.Z);
+    free(op.x);
+    free(op.y);
+    return status;
+}
@@ -0,0 +1,234 @@
+/**
+ * @file batched_matrix_multiply.c
+ * @author Navid Shamszadeh
+ * @brief Batched small matrix multiplication, LU factorization and solve, against the general kernels called in a
+ * loop.
+ * @details Builds count random n x n double matrices, multiplies them pairwise through gemmGeneralDouble once per
+ * matrix and through the strided, pointer-array and interleaved batched calls, factors them with the strided and
+ * interleaved batched LU and solves one right-hand side per matrix, checking every result. The GEMMs and the
+ * interleaving are timed with benchmarkRun (warm-up calls, then the median of the trials), so the output buffers are
+ * already faulted in and the times are those of the kernels. The in-place factorizations and solves run once, on
+ * outputs that are touched beforehand.
+ * Run with e.g. ./batched_matrix_multiply 100000 8 [trials]
+ * @date 2021-05-21
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "../benchmark.h"
+#include "../kernels.h"
+#include "../batch.h"
+
+/**
+ * @brief Largest relative difference between two arrays of n values.
+ */
+double batchedDifference(long int n, const double *a, const double *b) {
+    double error = 0.0, norm = 0.0;
+    for (long int i = 0; i < n; i++) {
+        error = fmax(error, fabs(a[i] - b[i]));
+        norm = fmax(norm, fabs(b[i]));
+    }
+    return (norm > 0.0) ? error / norm : error;
+}
+
+/**
+ * @brief C_b = A_b * B_b for every matrix of the batch, one call of the general GEMM engine per matrix.
+ */
+void batchedGemmLoop(long int count, int n, const double *A, const double *B, double *C) {
+    long int size = (long int)n * n;
+    for (long int b = 0; b < count; b++) {
+        gemmGeneralDouble(n, n, n, 1.0, A + size * b, n, B + size * b, n, 0.0, C + size * b, n);
+    }
+}
+
+/**
+ * @brief Operands of the timed GEMM variants.
+ */
+typedef struct {
+    long int count;
+    int n;
+    const double *A, *B;
+    const double **A_ptr, **B_ptr;
+    double **C_ptr;
+    double *C_loop, *C_strided;
+    double *A_i, *B_i, *C_i; // interleaved copies
+} batched_operands_t;
+
+void benchLoop(void *args) {
+    batched_operands_t *op = (batched_operands_t *)args;
+    batchedGemmLoop(op->count, op->n, op->A, op->B, op->C_loop);
+}
+
+void benchStrided(void *args) {
+    batched_operands_t *op = (batched_operands_t *)args;
+    long int size = (long int)op->n * op->n;
+    batchGemmStridedDouble(op->count, op->n, op->n, op->n, op->A, size, op->B, size, op->C_strided, size);
+}
+
+void benchPointers(void *args) {
+    batched_operands_t *op = (batched_operands_t *)args;
+    batchGemmPointersDouble(op->count, op->n, op->n, op->n, op->A_ptr, op->B_ptr, op->C_ptr);
+}
+
+void benchInterleave(void *args) {
+    batched_operands_t *op = (batched_operands_t *)args;
+    long int size = (long int)op->n * op->n;
+    batchInterleaveDouble(op->count, op->n, op->n, op->A, size, op->A_i);
+    batchInterleaveDouble(op->count, op->n, op->n, op->B, size, op->B_i);
+}
+
+void benchInterleaved(void *args) {
+    batched_operands_t *op = (batched_operands_t *)args;
+    batchGemmInterleavedDouble(op->count, op->n, op->n, op->n, op->A_i, op->B_i, op->C_i);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s count n [trials]\n", argv[0]);
+        return -1;
+    }
+    long int count = atol(argv[1]);
+    int n = atoi(argv[2]);
+    int trials = (argc > 3) ? atoi(argv[3]) : BENCHMARK_TRIALS;
+    if (trials < 1)
+        trials = 1;
+    long int size = (long int)n * n;
+    long int interleaved = batchInterleavedSize(count, n, n);
+    srandom(time(NULL));
+
+    double *A = (double *)malloc(count * size * sizeof(double));
+    double *B = (double *)malloc(count * size * sizeof(double));
+    double *C_loop = (double *)malloc(count * size * sizeof(double));
+    double *C_strided = (double *)malloc(count * size * sizeof(double));
+    double *C_pointers = (double *)malloc(count * size * sizeof(double));
+    double *C_interleaved = (double *)malloc(count * size * sizeof(double));
+    double *A_i = (double *)malloc(interleaved * sizeof(double));
+    double *B_i = (double *)malloc(interleaved * sizeof(double));
+    double *C_i = (double *)malloc(interleaved * sizeof(double));
+    const double **A_ptr = (const double **)malloc(count * sizeof(double *));
+    const double **B_ptr = (const double **)malloc(count * sizeof(double *));
+    double **C_ptr = (double **)malloc(count * sizeof(double *));
+    int *pivots = (int *)malloc(count * n * sizeof(int));
+    int *pivots_i = (int *)malloc(interleaved / n * sizeof(int));
+    int *info = (int *)malloc(count * sizeof(int));
+    int *info_i = (int *)malloc((count + BATCH_LANES) * sizeof(int));
+    double *x = (double *)malloc(count * n * sizeof(double));
+    double *rhs = (double *)malloc(count * n * sizeof(double));
+    double *rhs_i = (double *)malloc(interleaved / n * sizeof(double));
+    if (A == NULL || B == NULL || C_loop == NULL || C_strided == NULL || C_pointers == NULL || C_interleaved == NULL
+        || A_i == NULL || B_i == NULL || C_i == NULL || A_ptr == NULL || B_ptr == NULL || C_ptr == NULL
+        || pivots == NULL || pivots_i == NULL || info == NULL || info_i == NULL || x == NULL || rhs == NULL || rhs_i == NULL) {
+        fprintf(stderr, "Error: could not allocate the batch!\n");
+        exit(-1);
+    }
+    for (long int i = 0; i < count * size; i++) {
+        A[i] = 2.0 * random() / RAND_MAX - 1.0;
+        B[i] = 2.0 * random() / RAND_MAX - 1.0;
+    }
+    for (long int b = 0; b < count; b++) {
+        A_ptr[b] = A + size * b;
+        B_ptr[b] = B + size * b;
+        C_ptr[b] = C_pointers + size * b;
+    }
+
+    // GEMM: the general engine in a loop, then the batched calls, each median of trials after warm-up calls
+    batched_operands_t op = {count, n, A, B, A_ptr, B_ptr, C_ptr, C_loop, C_strided, A_i, B_i, C_i};
+    double loop_time = benchmarkRun(benchLoop, &op, BENCHMARK_WARMUP, trials).median;
+    double strided_time = benchmarkRun(benchStrided, &op, BENCHMARK_WARMUP, trials).median;
+    double pointers_time = benchmarkRun(benchPointers, &op, BENCHMARK_WARMUP, trials).median;
+    double interleave_time = benchmarkRun(benchInterleave, &op, BENCHMARK_WARMUP, trials).median;
+    double interleaved_time = benchmarkRun(benchInterleaved, &op, BENCHMARK_WARMUP, trials).median;
+    batchDeinterleaveDouble(count, n, n, C_i, C_interleaved, size);
+
+    int errors = 0;
+    double gemm_error = fmax(batchedDifference(count * size, C_strided, C_loop),
+                             fmax(batchedDifference(count * size, C_pointers, C_loop), batchedDifference(count * size, C_interleaved, C_loop)));
+    if (gemm_error > 1e-12) {
+        fprintf(stderr, "Error! batched GEMM differs from the loop by %e.\n", gemm_error);
+        errors = 1;
+    }
+
+    // LU and solve: b = A x for a known x, factor A (strided and interleaved) and solve for x again
+    for (long int i = 0; i < count * n; i++) {
+        x[i] = 2.0 * random() / RAND_MAX - 1.0;
+    }
+    for (long int b = 0; b < count; b++) {
+        gemvDouble(n, n, A + size * b, n, x + (long int)n * b, rhs + (long int)n * b);
+    }
+    batchInterleaveDouble(count, n, n, A, size, A_i);
+    batchInterleaveDouble(count, n, 1, rhs, n, rhs_i);
+    // the factorizations work in place and run once, so at least their outputs must not fault in while timed
+    memset(pivots, 0, count * n * sizeof(int));
+    memset(pivots_i, 0, interleaved / n * sizeof(int));
+    memset(info, 0, count * sizeof(int));
+    memset(info_i, 0, (count + BATCH_LANES) * sizeof(int));
+
+    double start = benchmarkNow();
+    batchLuStridedDouble(count, n, A, size, pivots, info);
+    double lu_time = benchmarkNow() - start;
+
+    // the pivots are applied to the right-hand sides, then two batched triangular solves finish the solve
+    start = benchmarkNow();
+    for (long int b = 0; b < count; b++) {
+        double *r = rhs + (long int)n * b;
+        for (int k = 0; k < n; k++) {
+            int p = pivots[(long int)n * b + k];
+            double temp = r[k];
+            r[k] = r[p];
+            r[p] = temp;
+        }
+    }
+    batchTriangularSolveStridedDouble(count, n, 1, 1, 1, A, size, rhs, n);
+    batchTriangularSolveStridedDouble(count, n, 1, 0, 0, A, size, rhs, n);
+    double trsm_time = benchmarkNow() - start;
+
+    start = benchmarkNow();
+    batchLuInterleavedDouble(count, n, A_i, pivots_i, info_i);
+    double lu_interleaved_time = benchmarkNow() - start;
+    start = benchmarkNow();
+    batchLuSolveInterleavedDouble(count, n, A_i, pivots_i, rhs_i);
+    double solve_interleaved_time = benchmarkNow() - start;
+    double *x_interleaved = C_interleaved; // reused, C is checked already
+    batchDeinterleaveDouble(count, n, 1, rhs_i, x_interleaved, n);
+
+    int singular = 0;
+    for (long int b = 0; b < count; b++) {
+        singular |= (info[b] != 0) || (info_i[b] != 0);
+    }
+    double solve_error = fmax(batchedDifference(count * n, rhs, x), batchedDifference(count * n, x_interleaved, x));
+    if (!singular && solve_error > 1e-6) {
+        fprintf(stderr, "Error! batched LU solve differs from the known solution by %e.\n", solve_error);
+        errors = 1;
+    }
+
+    double gflops = 2.0 * n * (double)n * n * count * 1e-9;
+    printf("gemm loop: %e \t batchGemmStrided: %e (%.2fx) \t batchGemmPointers: %e \t batchGemmInterleaved: %e (%.2fx, interleaving %e) \t %.2f GFLOP/s\n",
+           loop_time, strided_time, loop_time / strided_time, pointers_time, interleaved_time, loop_time / interleaved_time,
+           interleave_time, gflops / fmin(strided_time, interleaved_time));
+    printf("batchLuStrided: %e \t batchTriangularSolveStrided x2: %e \t batchLuInterleaved: %e \t batchLuSolveInterleaved: %e \t solve error: %e%s\n",
+           lu_time, trsm_time, lu_interleaved_time, solve_interleaved_time, solve_error, singular ? " (singular matrices in the batch)" : "");
+
+    free(A);
+    free(B);
+    free(C_loop);
+    free(C_strided);
+    free(C_pointers);
+    free(C_interleaved);
+    free(A_i);
+    free(B_i);
+    free(C_i);
+    free(A_ptr);
+    free(B_ptr);
+    free(C_ptr);
+    free(pivots);
+    free(pivots_i);
+    free(info);
+    free(info_i);
+    free(x);
+    free(rhs);
+    free(rhs_i);
+    return errors ? -1 : 0;
+}
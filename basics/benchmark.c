@@ -0,0 +1,487 @@
+/**
+ * @file benchmark.c
+ * @author Navid Shamszadeh
+ * @brief Benchmark driver for the basic kernels (add, GEMV, GEMM, transpose) over a sweep of sizes.
+ * @details Every kernel is run on square N x N strided matrices for each size of the sweep, in its single threaded
+ * SIMD/blocked variant and its threaded variant, and add and GEMV also on int, float and double data to show the
+ * effect of the element size on the bandwidth bound kernels. The report lists median/min/stddev wall time, GFLOP/s and GB/s
+ * against a STREAM triad baseline measured at startup, as a table or as CSV/JSON for tracking over time.
+ * --numa off,firsttouch,bind,interleave repeats every kernel with the operands placed by each policy of numa.h
+ * (variant names get an @policy suffix, the page placement goes to stderr), which shows what serial initialization
+ * costs the threaded kernels on a multi-socket machine; combine it with NLA_PIN=compact or scatter. Without --numa,
+ * NLA_NUMA=policy runs with that one policy.
+ * Before the fused updates are timed they are checked against their unfused counterparts; a mismatch is reported
+ * on stderr and makes the driver exit with an error.
+ * Run with e.g. ./benchmark --csv --sizes 256,512,1024 --kernels gemm,gemv --trials 20 > results.csv
+ * @date 2021-05-18
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../benchmark.h"
+#include "../threads.h"
+#include "../matrix.h"
+#include "../fused.h"
+#include "../numa.h"
+
+// default sizes swept when --sizes is not given
+#define BENCHMARK_DEFAULT_SIZES "256,512,1024,2048"
+
+/**
+ * @brief Operands shared by all kernels of one size.
+ */
+typedef struct {
+    int N;
+    matrix_type_t type; // element type the buffers are currently filled with
+    long int *A;
+    long int *B;
+    long int *C;
+    long int *x;
+    long int *y;
+    long int *D; // third operand of the fused updates
+    long int *z;
+    long int *T; // N x N scratch of the unfused updates
+    long int *t; // N scratch of the unfused updates
+} benchmark_operands_t;
+
+/**
+ * @brief Fills A, B and x with small values of the given element type. The buffers are sized for long int, the
+ * largest type.
+ */
+void benchmarkFill(benchmark_operands_t *op, matrix_type_t type) {
+    long int elements = (long int)op->N * op->N;
+    for (long int i = 0; i < elements; i++) {
+        long int a = i % 1000, b = i % 997, c = i % 13;
+        switch (type) {
+        case MATRIX_LONG: op->A[i] = a; op->B[i] = b; op->C[i] = c; op->D[i] = c; break;
+        case MATRIX_DOUBLE: ((double *)op->A)[i] = a; ((double *)op->B)[i] = b; ((double *)op->C)[i] = c; ((double *)op->D)[i] = c; break;
+        case MATRIX_FLOAT: ((float *)op->A)[i] = a; ((float *)op->B)[i] = b; ((float *)op->C)[i] = c; ((float *)op->D)[i] = c; break;
+        case MATRIX_INT: ((int *)op->A)[i] = a; ((int *)op->B)[i] = b; ((int *)op->C)[i] = c; ((int *)op->D)[i] = c; break;
+        }
+    }
+    for (int i = 0; i < op->N; i++) {
+        switch (type) {
+        case MATRIX_LONG: op->x[i] = i % 100; op->z[i] = i % 7; break;
+        case MATRIX_DOUBLE: ((double *)op->x)[i] = i % 100; ((double *)op->z)[i] = i % 7; break;
+        case MATRIX_FLOAT: ((float *)op->x)[i] = i % 100; ((float *)op->z)[i] = i % 7; break;
+        case MATRIX_INT: ((int *)op->x)[i] = i % 100; ((int *)op->z)[i] = i % 7; break;
+        }
+    }
+    op->type = type;
+}
+
+#define BENCHMARK_TYPED(T, S)                                                     \
+    void benchAdd##S(void *args) {                                                \
+        benchmark_operands_t *op = (benchmark_operands_t *)args;                  \
+        kernelAdd((long int)op->N * op->N, (T *)op->A, (T *)op->B, (T *)op->C);   \
+    }                                                                             \
+    void benchGemv##S(void *args) {                                               \
+        benchmark_operands_t *op = (benchmark_operands_t *)args;                  \
+        kernelGemv(op->N, op->N, (T *)op->A, op->N, (T *)op->x, (T *)op->y);      \
+    }
+
+BENCHMARK_TYPED(int, Int)
+BENCHMARK_TYPED(float, Float)
+BENCHMARK_TYPED(double, Double)
+
+/*
+ * Fused updates against the same updates built from single operations, on double data:
+ *   add3      C = A + B + D
+ *   axpby     C = 2 A + 0.5 C
+ *   expr      C = 2 A + B .* D - A
+ *   gemv+add  y = A x + z
+ */
+
+void benchAdd3Unfused(void *args) {
+    benchmark_operands_t *op = (benchmark_operands_t *)args;
+    long int n = (long int)op->N * op->N;
+    vectorAddDouble(n, (double *)op->A, (double *)op->B, (double *)op->C);
+    vectorAddDouble(n, (double *)op->C, (double *)op->D, (double *)op->C);
+}
+
+void benchAdd3Fused(void *args) {
+    benchmark_operands_t *op = (benchmark_operands_t *)args;
+    const double *operands[3] = {(double *)op->A, (double *)op->B, (double *)op->D};
+    addMultipleDouble((long int)op->N * op->N, 3, operands, NULL, (double *)op->C);
+}
+
+void benchAxpbyUnfused(void *args) {
+    benchmark_operands_t *op = (benchmark_operands_t *)args;
+    long int n = (long int)op->N * op->N;
+    double *A = (double *)op->A, *C = (double *)op->C, *T = (double *)op->T;
+    for (long int i = 0; i < n; i++) {
+        T[i] = 2.0 * A[i];
+    }
+    for (long int i = 0; i < n; i++) {
+        C[i] *= 0.5;
+    }
+    vectorAddDouble(n, T, C, C);
+}
+
+void benchAxpbyFused(void *args) {
+    benchmark_operands_t *op = (benchmark_operands_t *)args;
+    axpbyDouble((long int)op->N * op->N, 2.0, (double *)op->A, 0.5, (double *)op->C);
+}
+
+void benchExprUnfused(void *args) {
+    benchmark_operands_t *op = (benchmark_operands_t *)args;
+    long int n = (long int)op->N * op->N;
+    double *A = (double *)op->A, *B = (double *)op->B, *C = (double *)op->C, *D = (double *)op->D, *T = (double *)op->T;
+    for (long int i = 0; i < n; i++) {
+        T[i] = B[i] * D[i];
+    }
+    for (long int i = 0; i < n; i++) {
+        C[i] = 2.0 * A[i];
+    }
+    vectorAddDouble(n, C, T, C);
+    axpyDouble(n, -1.0, A, C);
+}
+
+void benchExprFused(void *args) {
+    benchmark_operands_t *op = (benchmark_operands_t *)args;
+    expr_t e;
+    exprInit(&e);
+    int a = exprVector(&e, (double *)op->A);
+    int root = exprSub(&e, exprAdd(&e, exprScale(&e, 2.0, a), exprMul(&e, exprVector(&e, (double *)op->B), exprVector(&e, (double *)op->D))), a);
+    exprEvaluate(&e, root, (long int)op->N * op->N, (double *)op->C);
+}
+
+void benchGemvAddUnfused(void *args) {
+    benchmark_operands_t *op = (benchmark_operands_t *)args;
+    double *t = (double *)op->t;
+    gemvDouble(op->N, op->N, (double *)op->A, op->N, (double *)op->x, t);
+    vectorAddDouble(op->N, t, (double *)op->z, (double *)op->y);
+}
+
+void benchGemvAddFused(void *args) {
+    benchmark_operands_t *op = (benchmark_operands_t *)args;
+    gemvGeneralDouble(op->N, op->N, 1.0, (double *)op->A, op->N, (double *)op->x, 1.0, (double *)op->z, (double *)op->y);
+}
+
+/**
+ * @brief Runs every fused update once against its unfused counterpart on the same inputs and compares the results.
+ * @details The operands hold small integers, so every intermediate is exact in double and both results must match
+ * to the last bit whatever order the operations run in.
+ *
+ * @return The number of fused updates whose result differs
+ */
+int benchmarkCheckFused(benchmark_operands_t *op) {
+    long int n = (long int)op->N * op->N;
+    double *C = (double *)op->C, *y = (double *)op->y;
+    double *expected = (double *)malloc((n > op->N ? n : op->N) * sizeof(double));
+    double *input = (double *)malloc(n * sizeof(double));
+    struct {
+        const char *name;
+        void (*unfused)(void *);
+        void (*fused)(void *);
+        double *out; // result of both
+        long int len;
+        int updates; // 1 if the result is also an input, restored before the fused run
+    } checks[] = {
+        {"add3", benchAdd3Unfused, benchAdd3Fused, C, n, 0},
+        {"axpby", benchAxpbyUnfused, benchAxpbyFused, C, n, 1},
+        {"expr", benchExprUnfused, benchExprFused, C, n, 0},
+        {"gemv+add", benchGemvAddUnfused, benchGemvAddFused, y, op->N, 0},
+    };
+    int failures = 0;
+    benchmarkFill(op, MATRIX_DOUBLE);
+    for (size_t c = 0; c < sizeof(checks) / sizeof(checks[0]); c++) {
+        memcpy(input, checks[c].out, checks[c].len * sizeof(double));
+        checks[c].unfused(op);
+        memcpy(expected, checks[c].out, checks[c].len * sizeof(double));
+        if (checks[c].updates)
+            memcpy(checks[c].out, input, checks[c].len * sizeof(double));
+        else
+            memset(checks[c].out, 0, checks[c].len * sizeof(double));
+        checks[c].fused(op);
+        for (long int i = 0; i < checks[c].len; i++) {
+            if (checks[c].out[i] != expected[i]) {
+                fprintf(stderr, "Error: fused %s gives %e at %ld, unfused %e!\n", checks[c].name, checks[c].out[i], i, expected[i]);
+                failures++;
+                break;
+            }
+        }
+        memcpy(checks[c].out, input, checks[c].len * sizeof(double));
+    }
+    free(expected);
+    free(input);
+    return failures;
+}
+
+void benchAddSimd(void *args) {
+    benchmark_operands_t *op = (benchmark_operands_t *)args;
+    simdAdd((long int)op->N * op->N, op->A, op->B, op->C);
+}
+
+void benchAddThreaded(void *args) {
+    benchmark_operands_t *op = (benchmark_operands_t *)args;
+    parallelAdd((long int)op->N * op->N, op->A, op->B, op->C);
+}
+
+void benchGemvSimd(void *args) {
+    benchmark_operands_t *op = (benchmark_operands_t *)args;
+    simdGemv(op->N, op->N, op->A, op->N, op->x, op->y);
+}
+
+void benchGemvThreaded(void *args) {
+    benchmark_operands_t *op = (benchmark_operands_t *)args;
+    parallelGemv(op->N, op->N, op->A, op->N, op->x, op->y);
+}
+
+void benchGemmBlocked(void *args) {
+    benchmark_operands_t *op = (benchmark_operands_t *)args;
+    gemmStrided(op->N, op->N, op->N, op->A, op->N, op->B, op->N, op->C, op->N, 0);
+}
+
+void benchGemmThreaded(void *args) {
+    benchmark_operands_t *op = (benchmark_operands_t *)args;
+    parallelGemm(op->N, op->N, op->N, 1, op->A, op->N, op->B, op->N, 0, op->C, op->N);
+}
+
+void benchTransposeTiled(void *args) {
+    benchmark_operands_t *op = (benchmark_operands_t *)args;
+    transposeStrided(op->N, op->N, op->A, op->N, op->C, op->N);
+}
+
+void benchTransposeThreaded(void *args) {
+    benchmark_operands_t *op = (benchmark_operands_t *)args;
+    parallelTranspose(op->N, op->N, op->A, op->N, op->C, op->N);
+}
+
+/**
+ * @brief One benchmarked kernel variant with its operation and traffic counts for an N x N problem.
+ */
+typedef struct {
+    const char *kernel;
+    const char *variant;
+    void (*run)(void *);
+    int threaded;
+    matrix_type_t type;
+    double (*flops)(double N);
+    double (*elements)(double N); // elements moved per call, times the element size gives the traffic
+} benchmark_case_t;
+
+double addFlops(double N) { return N * N; }
+double addElements(double N) { return 3.0 * N * N; }
+double gemvFlops(double N) { return 2.0 * N * N; }
+double gemvElements(double N) { return N * N + 2.0 * N; }
+double gemmFlops(double N) { return 2.0 * N * N * N; }
+double gemmElements(double N) { return 3.0 * N * N; }
+double transposeFlops(double N) { (void)N; return 0.0; }
+double transposeElements(double N) { return 2.0 * N * N; }
+double add3Flops(double N) { return 2.0 * N * N; }
+double add3Elements(double N) { return 4.0 * N * N; }
+double axpbyFlops(double N) { return 3.0 * N * N; }
+double exprFlops(double N) { return 4.0 * N * N; }
+double gemvAddFlops(double N) { return 2.0 * N * N + N; }
+double gemvAddElements(double N) { return N * N + 3.0 * N; }
+
+const benchmark_case_t benchmarkCases[] = {
+    {"add", "simd", benchAddSimd, 0, MATRIX_LONG, addFlops, addElements},
+    {"add", "threaded", benchAddThreaded, 1, MATRIX_LONG, addFlops, addElements},
+    {"add", "int32", benchAddInt, 0, MATRIX_INT, addFlops, addElements},
+    {"add", "float", benchAddFloat, 0, MATRIX_FLOAT, addFlops, addElements},
+    {"add", "double", benchAddDouble, 0, MATRIX_DOUBLE, addFlops, addElements},
+    {"gemv", "simd", benchGemvSimd, 0, MATRIX_LONG, gemvFlops, gemvElements},
+    {"gemv", "threaded", benchGemvThreaded, 1, MATRIX_LONG, gemvFlops, gemvElements},
+    {"gemv", "int32", benchGemvInt, 0, MATRIX_INT, gemvFlops, gemvElements},
+    {"gemv", "float", benchGemvFloat, 0, MATRIX_FLOAT, gemvFlops, gemvElements},
+    {"gemv", "double", benchGemvDouble, 0, MATRIX_DOUBLE, gemvFlops, gemvElements},
+    {"gemm", "blocked", benchGemmBlocked, 0, MATRIX_LONG, gemmFlops, gemmElements},
+    {"gemm", "threaded", benchGemmThreaded, 1, MATRIX_LONG, gemmFlops, gemmElements},
+    {"transpose", "tiled", benchTransposeTiled, 0, MATRIX_LONG, transposeFlops, transposeElements},
+    {"transpose", "threaded", benchTransposeThreaded, 1, MATRIX_LONG, transposeFlops, transposeElements},
+    {"add3", "unfused", benchAdd3Unfused, 0, MATRIX_DOUBLE, add3Flops, add3Elements},
+    {"add3", "fused", benchAdd3Fused, 0, MATRIX_DOUBLE, add3Flops, add3Elements},
+    {"axpby", "unfused", benchAxpbyUnfused, 0, MATRIX_DOUBLE, axpbyFlops, addElements},
+    {"axpby", "fused", benchAxpbyFused, 0, MATRIX_DOUBLE, axpbyFlops, addElements},
+    {"expr", "unfused", benchExprUnfused, 0, MATRIX_DOUBLE, exprFlops, add3Elements},
+    {"expr", "fused", benchExprFused, 0, MATRIX_DOUBLE, exprFlops, add3Elements},
+    {"gemv+add", "unfused", benchGemvAddUnfused, 0, MATRIX_DOUBLE, gemvAddFlops, gemvAddElements},
+    {"gemv+add", "fused", benchGemvAddFused, 0, MATRIX_DOUBLE, gemvAddFlops, gemvAddElements},
+};
+
+/**
+ * @brief Checks whether name appears in a comma separated list.
+ */
+int listContains(const char *list, const char *name) {
+    size_t length = strlen(name);
+    for (const char *p = list; p != NULL && *p; ) {
+        const char *comma = strchr(p, ',');
+        size_t item = comma ? (size_t)(comma - p) : strlen(p);
+        if (item == length && strncmp(p, name, length) == 0)
+            return 1;
+        p = comma ? comma + 1 : NULL;
+    }
+    return 0;
+}
+
+void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [--csv | --json] [--sizes N1,N2,...] [--kernels add,gemv,gemm,transpose,add3,axpby,expr,gemv+add] "
+            "[--warmup W] [--trials T] [--no-stream] [--numa off,firsttouch,bind,interleave]\n", program);
+}
+
+/**
+ * @brief Allocates the operands of size N. With a NUMA policy the pages are placed with numaPlace, row by row like
+ * the threaded add and GEMV split their work, before anything is written to them; without one (policy < 0) they
+ * come from malloc and are placed by whichever thread fills them first.
+ *
+ * @return 0 on success, -1 if an allocation failed
+ */
+int benchmarkAllocate(benchmark_operands_t *op, int N, int policy) {
+    size_t elements = (size_t)N * N;
+    long int **matrices[5] = {&op->A, &op->B, &op->C, &op->D, &op->T};
+    long int **vectors[4] = {&op->x, &op->y, &op->z, &op->t};
+    op->N = N;
+    int status = 0;
+    for (int m = 0; m < 5; m++) {
+        *matrices[m] = (long int *)((policy < 0) ? malloc(elements * sizeof(long int)) : numaAlloc(elements * sizeof(long int)));
+        if (*matrices[m] == NULL)
+            return -1;
+        if (policy >= 0 && numaPlace(*matrices[m], N, N * sizeof(long int), TUNE_GEMV, (numa_policy_t)policy) != 0)
+            status = -1;
+    }
+    for (int v = 0; v < 4; v++) {
+        *vectors[v] = (long int *)((policy < 0) ? malloc(N * sizeof(long int)) : numaAlloc(N * sizeof(long int)));
+        if (*vectors[v] == NULL)
+            return -1;
+    }
+    if (status != 0)
+        fprintf(stderr, "Warning: mbind failed, the %s pages were placed by first touch.\n", numaPolicyNames[policy]);
+    return 0;
+}
+
+/**
+ * @brief Releases the operands allocated by benchmarkAllocate with the same policy.
+ */
+void benchmarkRelease(benchmark_operands_t *op, int policy) {
+    size_t elements = (size_t)op->N * op->N;
+    long int *matrices[5] = {op->A, op->B, op->C, op->D, op->T};
+    long int *vectors[4] = {op->x, op->y, op->z, op->t};
+    for (int m = 0; m < 5; m++) {
+        if (policy < 0)
+            free(matrices[m]);
+        else
+            numaFree(matrices[m], elements * sizeof(long int));
+    }
+    for (int v = 0; v < 4; v++) {
+        if (policy < 0)
+            free(vectors[v]);
+        else
+            numaFree(vectors[v], op->N * sizeof(long int));
+    }
+}
+
+int main(int argc, char* argv[]) {
+    benchmark_format_t format = BENCHMARK_TEXT;
+    const char *sizes = BENCHMARK_DEFAULT_SIZES;
+    const char *kernels = NULL;
+    int warmup = BENCHMARK_WARMUP;
+    int trials = BENCHMARK_TRIALS;
+    int stream = 1;
+    const char *numa = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0) {
+            format = BENCHMARK_CSV;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            format = BENCHMARK_JSON;
+        } else if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+            sizes = argv[++i];
+        } else if (strcmp(argv[i], "--kernels") == 0 && i + 1 < argc) {
+            kernels = argv[++i];
+        } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+            warmup = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--trials") == 0 && i + 1 < argc) {
+            trials = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--no-stream") == 0) {
+            stream = 0;
+        } else if (strcmp(argv[i], "--numa") == 0 && i + 1 < argc) {
+            numa = argv[++i];
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (trials < 1)
+        trials = 1;
+    // NLA_NUMA is the default placement when --numa does not choose
+    const char *numa_default = getenv("NLA_NUMA");
+    if (numa == NULL && numa_default != NULL && strcmp(numa_default, numaPolicyNames[numaConfig.policy]) == 0)
+        numa = numa_default;
+
+    int errors = 0;
+    double stream_bandwidth = stream ? benchmarkStreamTriad(BENCHMARK_STREAM_SIZE, BENCHMARK_TRIALS) : 0.0;
+    benchmark_report_t report;
+    benchmarkReportBegin(&report, stdout, format, stream_bandwidth);
+
+    for (const char *p = sizes; p != NULL && *p; ) {
+        int N = atoi(p);
+        const char *comma = strchr(p, ',');
+        p = comma ? comma + 1 : NULL;
+        if (N <= 0)
+            continue;
+
+        // policy -1 is the plain malloc of a run without --numa
+        for (int policy = (numa != NULL) ? NUMA_OFF : -1; policy <= (numa != NULL ? NUMA_INTERLEAVE : -1); policy++) {
+            if (policy >= 0 && !listContains(numa, numaPolicyNames[policy]))
+                continue;
+            benchmark_operands_t op;
+            size_t elements = (size_t)N * N;
+            if (benchmarkAllocate(&op, N, policy) != 0) {
+                fprintf(stderr, "Error: could not allocate the operands!\n");
+                return -1;
+            }
+            benchmarkFill(&op, MATRIX_LONG);
+            if (policy < 0) {
+                // touch everything once with the threaded add's partitioning so first touch does not land in a trial
+                parallelAdd((long int)elements, op.A, op.B, op.C);
+            } else {
+                long int counts[NUMA_MAX_NODES];
+                long int pages = numaPageNodes(op.A, elements * sizeof(long int), counts);
+                fprintf(stderr, "numa %s, N = %d: pages of A per node:", numaPolicyNames[policy], N);
+                for (int node = 0; node < numaConfig.nodes; node++) {
+                    fprintf(stderr, " %.0f%%", pages > 0 ? 100.0 * counts[node] / pages : 0.0);
+                }
+                fprintf(stderr, "\n");
+            }
+
+            // the fused updates must agree with the unfused ones before they are timed against them
+            const char *fused_kernels[4] = {"add3", "axpby", "expr", "gemv+add"};
+            int check = 0;
+            for (int k = 0; k < 4; k++) {
+                check |= (kernels == NULL || listContains(kernels, fused_kernels[k]));
+            }
+            if (check)
+                errors += benchmarkCheckFused(&op);
+
+            for (size_t c = 0; c < sizeof(benchmarkCases) / sizeof(benchmarkCases[0]); c++) {
+                const benchmark_case_t *bench = &benchmarkCases[c];
+                if (kernels != NULL && !listContains(kernels, bench->kernel))
+                    continue;
+                if (op.type != bench->type)
+                    benchmarkFill(&op, bench->type);
+                char variant[64];
+                if (policy < 0)
+                    snprintf(variant, sizeof(variant), "%s", bench->variant);
+                else
+                    snprintf(variant, sizeof(variant), "%s@%s", bench->variant, numaPolicyNames[policy]);
+                benchmark_result_t result;
+                result.kernel = bench->kernel;
+                result.variant = variant;
+                result.N = N;
+                result.M = N;
+                result.K = (strcmp(bench->kernel, "gemm") == 0) ? N : 0;
+                result.threads = bench->threaded ? threadsConfig.count : 1;
+                result.flops = bench->flops(N);
+                result.bytes = bench->elements(N) * matrixTypeSizes[bench->type];
+                result.stats = benchmarkRun(bench->run, &op, warmup, trials);
+                benchmarkReportAdd(&report, &result);
+            }
+            benchmarkRelease(&op, policy);
+        }
+    }
+
+    benchmarkReportEnd(&report);
+    return errors ? -1 : 0;
+}
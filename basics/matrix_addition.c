@@ -6,8 +6,13 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include "../printMatrix.h"
+#include "../benchmark.h"
+#include "../simd.h"
+#include "../threads.h"
+#include "../matrix.h"
 
 /**
  * @brief Serially adds matrices matrix_A and matrix_B and stores the result in matrix_C
@@ -19,16 +24,19 @@
  * @param matrix_C Matrix to store the sum of matrix_A and matrix_B.
  */
 void matrixAddSerial(int N, int M, long int **matrix_A, long int **matrix_B, long int **matrix_C) {
+    PERF_BEGIN();
     for (int i = 0; i < N; i++) {
         for (int j = 0; j < M; j++) {
             matrix_C[i][j] = matrix_A[i][j] + matrix_B[i][j];
         }
     }
+    PERF_END("matrixAddSerial", N, M, 1);
 }
 
 /**
  * @brief Serially adds matrices matrix_A and matrix_B and stores the result in matrix_C.
- * @details The input matrices are strided arrays, i.e., they are allocated as 1-dimensional NxM sized arrays indexed by A[i][j] = A[j + N * i]
+ * @details The input matrices are strided arrays, i.e., they are allocated as 1-dimensional NxM sized arrays indexed by A[i][j] = A[j + N * i].
+ * Since the matrices are contiguous the sum is a single streaming pass, done by the SIMD kernel selected in simd.h.
  * @param N Number of rows 
  * @param M Number of columns 
  * @param matrix_A First matrix summand
@@ -36,11 +44,21 @@ void matrixAddSerial(int N, int M, long int **matrix_A, long int **matrix_B, lon
  * @param matrix_C Matrix to store the sum of matrix_A and matrix_B
  */
 void matrixAddSerialStrided(int N, int M, long int *matrix_A, long int *matrix_B, long int *matrix_C) {
-    for (int i = 0; i < N; i++) {
-        for (int j = 0; j < M; j++) {
-            matrix_C[j + M * i] = matrix_A[j + M * i] + matrix_B[j + M * i];
-        }
-    }
+    PERF_BEGIN();
+    simdAdd((long int)N * M, matrix_A, matrix_B, matrix_C);
+    PERF_END("matrixAddSerialStrided", N, M, 1);
+}
+
+/**
+ * @brief Adds strided matrices matrix_A and matrix_B with the threading layer and stores the result in matrix_C.
+ * @param N Number of rows 
+ * @param M Number of columns 
+ * @param matrix_A First matrix summand
+ * @param matrix_B Second matrix summand
+ * @param matrix_C Matrix to store the sum of matrix_A and matrix_B
+ */
+void matrixAddThreadedStrided(int N, int M, long int *matrix_A, long int *matrix_B, long int *matrix_C) {
+    parallelAdd((long int)N * M, matrix_A, matrix_B, matrix_C);
 }
 
 int main(int argc, char* argv[]) {
@@ -48,20 +66,24 @@ int main(int argc, char* argv[]) {
     int M = atoi(argv[2]);
     srandom(time(NULL));
 
-    // allocate memory for the non strided matrices
-    long int **A = (long int **)malloc(N * sizeof(long int *));
-    long int **B = (long int **)malloc(N * sizeof(long int *));
-    long int **C = (long int **)malloc(N * sizeof(long int *));
-
-    A[0] = (long int *)malloc(N * M * sizeof(long int));
-    B[0] = (long int *)malloc(N * M * sizeof(long int));
-    C[0] = (long int *)malloc(N * M * sizeof(long int));
-    
-    for (int i = 1; i < N; i++) {
-        A[i] = A[0] + i * M;
-        B[i] = B[0] + i * M;
-        C[i] = C[0] + i * M;
+    // one arena holds every matrix; the row-pointer versions are views of the same buffers, so nothing is copied
+    matrix_arena_t arena;
+    if (matrixArenaCreate(&arena, 5 * matrixBytes(N, M, MATRIX_LONG) + 3 * matrixAlignUp(N * sizeof(long int *))) != 0) {
+        fprintf(stderr, "Error: could not allocate the matrices!\n");
+        exit(-1);
     }
+    matrix_t A_matrix = matrixCreatePacked(&arena, N, M, MATRIX_LONG);
+    matrix_t B_matrix = matrixCreatePacked(&arena, N, M, MATRIX_LONG);
+    matrix_t C_matrix = matrixCreatePacked(&arena, N, M, MATRIX_LONG);
+    matrix_t C_strided_matrix = matrixCreatePacked(&arena, N, M, MATRIX_LONG);
+    matrix_t C_threaded_matrix = matrixCreatePacked(&arena, N, M, MATRIX_LONG);
+    long int **A = (long int **)matrixRowPointers(&arena, &A_matrix);
+    long int **B = (long int **)matrixRowPointers(&arena, &B_matrix);
+    long int **C = (long int **)matrixRowPointers(&arena, &C_matrix);
+    long int *A_strided = (long int *)A_matrix.data;
+    long int *B_strided = (long int *)B_matrix.data;
+    long int *C_strided = (long int *)C_strided_matrix.data;
+    long int *C_threaded = (long int *)C_threaded_matrix.data;
 
     // fill the summand matrices with random integers
     for (int i = 0; i < N; i++) {
@@ -82,39 +104,25 @@ int main(int argc, char* argv[]) {
     // printf("\n");
 
     // declare timer variables
-    clock_t start, end;
-    double cpu_time_used1, cpu_time_used2;
+    double start, end;
+    double wall_time_used1, wall_time_used2;
 
     // time the execution of serial matrix sum
-    start = clock();
+    start = benchmarkNow();
     matrixAddSerial(N, M, A, B, C);
-    end = clock();
-    cpu_time_used1 = (double)(end - start) / CLOCKS_PER_SEC;
+    end = benchmarkNow();
+    wall_time_used1 = end - start;
 
-    // allocate memory for the strided matrices
-    long int *A_strided = (long int *)malloc(N * M * sizeof(long int));
-    long int *B_strided = (long int *)malloc(N * M * sizeof(long int));
-    long int *C_strided = (long int *)malloc(N * M * sizeof(long int));
-
-    // copy the data from the original summand arrays to the strided arrays
-    for (int i = 0; i < N; i++) {
-        for (int j = 0; j < M; j++) {
-            A_strided[j + M * i] = A[i][j];
-            B_strided[j + M * i] = B[i][j];
-        }
-    }
-
-    // printing strided matrices for debugging purposes
-    // printMatrixStrided(N, M, A_strided);
-    // printf("\n");
-    // printMatrixStrided(N, M, B_strided);
-    // printf("\n\n");
-    
-    // time the execution of serial matrix strided sum
-    start = clock();
+    // time the execution of serial matrix strided sum on the same inputs
+    start = benchmarkNow();
     matrixAddSerialStrided(N, M, A_strided, B_strided, C_strided);
-    end = clock();
-    cpu_time_used2 = (double)(end - start) / CLOCKS_PER_SEC;
+    end = benchmarkNow();
+    wall_time_used2 = end - start;
+
+    // time the threaded strided sum
+    start = benchmarkNow();
+    matrixAddThreadedStrided(N, M, A_strided, B_strided, C_threaded);
+    double wall_time_used3 = benchmarkNow() - start;
 
     // printf sum matrices for debugging purposes
     // printMatrix(N, M, C);
@@ -123,34 +131,27 @@ int main(int argc, char* argv[]) {
     // printf("\n");
 
     // output the result
-    printf("matrixAddSerial: %e \t matrixAddSerialStrided: %e.\n", cpu_time_used1, cpu_time_used2);
+    printf("matrixAddSerial: %e \t matrixAddSerialStrided (%s): %e \t matrixAddThreadedStrided (%d threads): %e.\n",
+           wall_time_used1, simdIsaNames[simdIsa], wall_time_used2, threadsConfig.count, wall_time_used3);
+
+    // add the bottom right quadrant through sub-matrix views, in place into the threaded result
+    matrix_t B_view = matrixView(&B_matrix, N / 2, M / 2, N - N / 2, M - M / 2);
+    matrix_t C_view = matrixView(&C_threaded_matrix, N / 2, M / 2, N - N / 2, M - M / 2);
+    matrixAdd(&C_view, &B_view, &C_view);
+
     // verify the results
-    for (int i = 0; i < N; i++) {
+    int errors = 0;
+    for (int i = 0; i < N && !errors; i++) {
         for (int j = 0; j < M; j++) {
-            if (C[i][j] != C_strided[j + M * i]) {
-                fprintf(stderr, "Error: C[%d][%d] = %ld != C_strided[%d + %d * %d] = %ld!\n", i, j, C[i][j], j, N, i, C_strided[j + M * i]);
-                free(A[0]);
-                free(A);
-                free(B[0]);
-                free(B);
-                free(A_strided);
-                free(B_strided);
-                free(C[0]);
-                free(C);
-                free(C_strided);
-                exit(-1);
+            long int quadrant = (i >= N / 2 && j >= M / 2) ? B[i][j] : 0;
+            if (C[i][j] != C_strided[j + M * i] || C[i][j] + quadrant != C_threaded[j + M * i]) {
+                fprintf(stderr, "Error: C[%d][%d] = %ld != C_strided[%d + %d * %d] = %ld (threaded %ld)!\n", i, j, C[i][j], j, M, i, C_strided[j + M * i], C_threaded[j + M * i]);
+                errors = 1;
+                break;
             }
         }
     }
 
-    free(A[0]);
-    free(A);
-    free(B[0]);
-    free(B);
-    free(A_strided);
-    free(B_strided);
-    free(C[0]);
-    free(C);
-    free(C_strided);
-    return 0;
-}
\ No newline at end of file
+    matrixArenaDestroy(&arena);
+    return errors ? -1 : 0;
+}
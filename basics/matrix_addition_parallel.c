@@ -2,39 +2,212 @@
  * @file matrix_addition_parallel.c
  * @author Navid Shamszadeh
  * @brief Implementation of parallel matrix addition algorithms using open-mpi.
+ * @details Matrices are split into contiguous blocks of rows, one per rank. When N is not divisible by the number of
+ * ranks the first N % size ranks get one extra row. Run with e.g. mpirun -np 4 ./parallel_matrix_add N M [repeats].
  * @date 2021-05-14
  */
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <openmpi-x86_64/mpi.h>
+#include <time.h>
+#include <mpi.h>
+#include "../printMatrix.h"
+#include "../distributed.h"
 
 /**
- * @brief Adds matrices matrix_A and matrix_B in parallel and stores the result in matrix_C
- * @param N Number of rows 
+ * @brief Adds two resident row blocks, C = A + B. Purely local, no communication.
+ * @details The three blocks must come from the same decomposition. C may alias A or B. The local sum is threaded
+ * with the rank's share of the node's cores (see hybridInit).
+ *
+ * @param block_A First summand
+ * @param block_B Second summand
+ * @param block_C Block to store the sum
+ */
+void matrixAddResident(const row_block_t *block_A, const row_block_t *block_B, row_block_t *block_C) {
+    parallelAdd((long int)block_A->rows * block_A->M, block_A->local, block_B->local, block_C->local);
+}
+
+/**
+ * @brief Adds matrices matrix_A and matrix_B in parallel and stores the result in matrix_C.
+ * @details The input matrices are strided arrays, i.e., they are allocated as 1-dimensional NxM sized arrays indexed by A[i][j] = A[j + N * i].
+ * The matrices only need to be valid on rank 0; they are scattered by rows, added locally and gathered back to rank 0.
+ * Must be called by every rank of MPI_COMM_WORLD.
+ * @param N Number of rows
  * @param M Number of columns
  * @param matrix_A First matrix summand
  * @param matrix_B Second matrix summand
  * @param matrix_C Matrix to store the sum of matrix_A and matrix_B
+ * @param timing If not NULL, receives the time this rank spent computing and communicating
  */
-void matrixAddParallel(int N, int M, long int **matrix_A, long int **matrix_B, long int **matrix_C) {
+void matrixAddParallelStrided(int N, int M, long int *matrix_A, long int *matrix_B, long int *matrix_C, mpi_timing_t *timing) {
+    row_block_t block_A, block_B;
+
+    double start = MPI_Wtime();
+    rowBlockScatter(N, M, matrix_A, 0, MPI_COMM_WORLD, &block_A);
+    rowBlockScatter(N, M, matrix_B, 0, MPI_COMM_WORLD, &block_B);
+    double scattered = MPI_Wtime();
+
+    // the sum overwrites block_A so only two local blocks are needed
+    matrixAddResident(&block_A, &block_B, &block_A);
+    double added = MPI_Wtime();
 
+    rowBlockGather(&block_A, matrix_C, 0, MPI_COMM_WORLD);
+    double gathered = MPI_Wtime();
+
+    if (timing != NULL) {
+        timing->compute = added - scattered;
+        timing->communication = (scattered - start) + (gathered - added);
+    }
+    free(block_A.local);
+    free(block_B.local);
 }
 
 /**
- * @brief Adds matrices matrix_A and matrix_B in parallel and stores the result in matrix_C.
- * @details The input matrices are strided arrays, i.e., they are allocated as 1-dimensional NxM sized arrays indexed by A[i][j] = A[j + N * i]
+ * @brief Adds matrices matrix_A and matrix_B in parallel and stores the result in matrix_C
+ * @details The matrices only need to be valid on rank 0. Rows carved out of a single A[0] block are sent as is,
+ * otherwise they are copied into a contiguous buffer first. Must be called by every rank of MPI_COMM_WORLD.
  * @param N Number of rows
  * @param M Number of columns
  * @param matrix_A First matrix summand
  * @param matrix_B Second matrix summand
  * @param matrix_C Matrix to store the sum of matrix_A and matrix_B
+ * @param timing If not NULL, receives the time this rank spent computing and communicating
  */
-void matrixAddParallelStrided(int N, int M, long int *matrix_A, long int *matrix_B, long int *matrix_C) {
+void matrixAddParallel(int N, int M, long int **matrix_A, long int **matrix_B, long int **matrix_C, mpi_timing_t *timing) {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    long int **rows[3] = {matrix_A, matrix_B, matrix_C};
+    long int *base[3] = {NULL, NULL, NULL};
+    int copied[3] = {0, 0, 0};
+    if (rank == 0) {
+        for (int m = 0; m < 3; m++) {
+            for (int i = 1; i < N && !copied[m]; i++) {
+                copied[m] = rows[m][i] != rows[m][0] + (long int)M * i;
+            }
+            if (copied[m]) {
+                base[m] = (long int *)malloc((size_t)N * M * sizeof(long int));
+                for (int i = 0; i < N && m < 2; i++) {
+                    memcpy(base[m] + (long int)M * i, rows[m][i], M * sizeof(long int));
+                }
+            } else {
+                base[m] = rows[m][0];
+            }
+        }
+    }
+
+    matrixAddParallelStrided(N, M, base[0], base[1], base[2], timing);
 
+    if (rank == 0) {
+        if (copied[2]) {
+            for (int i = 0; i < N; i++) {
+                memcpy(matrix_C[i], base[2] + (long int)M * i, M * sizeof(long int));
+            }
+        }
+        for (int m = 0; m < 3; m++) {
+            if (copied[m])
+                free(base[m]);
+        }
+    }
 }
 
 int main(int argc, char* argv[]) {
-    
-    return 0;
-}
\ No newline at end of file
+    hybridInit(&argc, &argv);
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (argc < 3) {
+        if (rank == 0)
+            fprintf(stderr, "Usage: %s N M [repeats]\n", argv[0]);
+        MPI_Finalize();
+        return -1;
+    }
+    int N = atoi(argv[1]);
+    int M = atoi(argv[2]);
+    int repeats = (argc > 3) ? atoi(argv[3]) : 10;
+
+    // only rank 0 holds the full matrices
+    long int **A = NULL, **B = NULL, **C = NULL;
+    long int *C_strided = NULL;
+    if (rank == 0) {
+        srandom(time(NULL));
+        A = (long int **)malloc(N * sizeof(long int *));
+        B = (long int **)malloc(N * sizeof(long int *));
+        C = (long int **)malloc(N * sizeof(long int *));
+        A[0] = (long int *)malloc(N * M * sizeof(long int));
+        B[0] = (long int *)malloc(N * M * sizeof(long int));
+        C[0] = (long int *)malloc(N * M * sizeof(long int));
+        for (int i = 1; i < N; i++) {
+            A[i] = A[0] + i * M;
+            B[i] = B[0] + i * M;
+            C[i] = C[0] + i * M;
+        }
+        for (int i = 0; i < N; i++) {
+            for (int j = 0; j < M; j++) {
+                A[i][j] = random() % 1000;
+                B[i][j] = random() % 1000;
+            }
+        }
+        C_strided = (long int *)malloc(N * M * sizeof(long int));
+    }
+
+    // one-shot additions: scatter, add, gather
+    mpi_timing_t timing;
+    matrixAddParallel(N, M, A, B, C, &timing);
+    printRankTimings("matrixAddParallel", timing);
+    matrixAddParallelStrided(N, M, rank == 0 ? A[0] : NULL, rank == 0 ? B[0] : NULL, C_strided, &timing);
+    printRankTimings("matrixAddParallelStrided", timing);
+    int errors = 0;
+    if (rank == 0 && memcmp(C[0], C_strided, (size_t)N * M * sizeof(long int)) != 0) {
+        fprintf(stderr, "Error: matrixAddParallel and matrixAddParallelStrided disagree!\n");
+        errors = 1;
+    }
+
+    // resident mode: distribute once, then C <- C + B repeatedly without any communication
+    row_block_t block_B, block_C;
+    double start = MPI_Wtime();
+    rowBlockScatter(N, M, rank == 0 ? B[0] : NULL, 0, MPI_COMM_WORLD, &block_B);
+    rowBlockScatter(N, M, rank == 0 ? A[0] : NULL, 0, MPI_COMM_WORLD, &block_C);
+    double distributed = MPI_Wtime();
+    for (int r = 0; r < repeats; r++) {
+        matrixAddResident(&block_C, &block_B, &block_C);
+    }
+    double added = MPI_Wtime();
+    rowBlockGather(&block_C, C_strided, 0, MPI_COMM_WORLD);
+    double gathered = MPI_Wtime();
+    // the additions themselves never communicate; distributing and collecting the operands is paid once
+    timing.compute = (added - distributed) / (repeats > 0 ? repeats : 1);
+    timing.communication = 0.0;
+    printRankTimings("matrixAddResident (per addition)", timing);
+    timing.compute = 0.0;
+    timing.communication = (distributed - start) + (gathered - added);
+    printRankTimings("matrixAddResident (one-time scatter and gather)", timing);
+
+    // verify on rank 0: the one-shot result against the serial sum, the resident result against A + repeats * B
+    if (rank == 0) {
+        for (int i = 0; i < N && !errors; i++) {
+            for (int j = 0; j < M; j++) {
+                long int expected = A[i][j] + repeats * B[i][j];
+                if (C[i][j] != A[i][j] + B[i][j] || C_strided[j + M * i] != expected) {
+                    fprintf(stderr, "Error: C[%d][%d] = %ld, C_strided[%d + %d * %d] = %ld, expected %ld and %ld!\n",
+                            i, j, C[i][j], j, M, i, C_strided[j + M * i], A[i][j] + B[i][j], expected);
+                    errors = 1;
+                    break;
+                }
+            }
+        }
+        free(A[0]);
+        free(A);
+        free(B[0]);
+        free(B);
+        free(C[0]);
+        free(C);
+        free(C_strided);
+    }
+    free(block_B.local);
+    free(block_C.local);
+
+    MPI_Finalize();
+    return errors ? -1 : 0;
+}
@@ -7,8 +7,15 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <math.h>
 #include "../printMatrix.h"
+#include "../benchmark.h"
+#include "../gemm.h"
+#include "../threads.h"
+#include "../matrix.h"
+#include "../strassen.h"
 
 /**
  * @brief Matrix multiplication of matrices A and B, result stored in matrix C
@@ -21,19 +28,148 @@
  * @param matrix_C Should be of size  N x K
  */
 void matrixMultiply(int N, int M, int K, long int **matrix_A, long int **matrix_B, long int **matrix_C) {
-    // C[i][j] == A[i][] * B[][j] (dot product of row i of A with column j of B)
+    PERF_BEGIN();
+    gemmRows(N, M, K, matrix_A, matrix_B, matrix_C);
+    PERF_END("matrixMultiply", N, M, K);
+}
+
+/**
+ * @brief Matrix multiplication of strided matrices (one dimensional arrays of size N x M and M x K)
+ * @details Uses the packed, cache-blocked engine in gemm.h.
+ * 
+ * @param N Number of rows for matrix A
+ * @param M Number of columns for matrix A and rows for matrix B
+ * @param K Number of columns for matrix B
+ * @param matrix_A Should be a one-dimensional array of size N x M
+ * @param matrix_B Should be a one-dimensional array of size M x K
+ * @param matrix_C Should be a one-dimensional array of size N x K
+ */
+void matrixMultiplyStrided(int N, int M, int K, long int *matrix_A, long int *matrix_B, long int *matrix_C) {
+    PERF_BEGIN();
+    gemmStrided(N, M, K, matrix_A, M, matrix_B, K, matrix_C, K, 0);
+    PERF_END("matrixMultiplyStrided", N, M, K);
+}
+
+/**
+ * @brief Matrix multiplication of strided matrices, split into blocks of C over the threading layer
+ * 
+ * @param N Number of rows for matrix A
+ * @param M Number of columns for matrix A and rows for matrix B
+ * @param K Number of columns for matrix B
+ * @param matrix_A Should be a one-dimensional array of size N x M
+ * @param matrix_B Should be a one-dimensional array of size M x K
+ * @param matrix_C Should be a one-dimensional array of size N x K
+ */
+void matrixMultiplyThreadedStrided(int N, int M, int K, long int *matrix_A, long int *matrix_B, long int *matrix_C) {
+    parallelGemm(N, M, K, 1, matrix_A, M, matrix_B, K, 0, matrix_C, K);
+}
+
+/**
+ * @brief Strassen-Winograd multiplication of strided matrices, with the blocked engine below the cutoff.
+ * 
+ * @param N Number of rows for matrix A
+ * @param M Number of columns for matrix A and rows for matrix B
+ * @param K Number of columns for matrix B
+ * @param matrix_A Should be a one-dimensional array of size N x M
+ * @param matrix_B Should be a one-dimensional array of size M x K
+ * @param matrix_C Should be a one-dimensional array of size N x K
+ * @param cutoff Dimension at or below which the blocked engine takes over
+ * @param workspace Arena with strassenWorkspaceBytes free
+ */
+void matrixMultiplyStrassenStrided(int N, int M, int K, long int *matrix_A, long int *matrix_B, long int *matrix_C, int cutoff, matrix_arena_t *workspace) {
+    matrix_t A = matrixWrap(N, M, M, MATRIX_LONG, matrix_A);
+    matrix_t B = matrixWrap(M, K, K, MATRIX_LONG, matrix_B);
+    matrix_t C = matrixWrap(N, K, K, MATRIX_LONG, matrix_C);
+    strassenMultiplyMatrix(&A, &B, &C, cutoff, workspace);
+}
+
+/**
+ * @brief Extended precision reference product of double or float matrices, reference = A B as a packed N x K array.
+ */
+void matrixMultiplyReference(const matrix_t *A, const matrix_t *B, long double *reference) {
+    int N = A->rows, M = A->cols, K = B->cols;
+    int single = (A->type == MATRIX_FLOAT);
+    memset(reference, 0, (size_t)N * K * sizeof(long double));
     for (int i = 0; i < N; i++) {
-        for (int j = 0; j < K; j++) {
-            matrix_C[i][j] = 0;
-            for (int k = 0; k < M; k++) {
-                matrix_C[i][j] += matrix_A[i][k] * matrix_B[k][j];
+        long double *row = reference + (long int)K * i;
+        for (int k = 0; k < M; k++) {
+            long double a = single ? MATRIX_AT(float, A, i, k) : MATRIX_AT(double, A, i, k);
+            for (int j = 0; j < K; j++) {
+                row[j] += a * (single ? MATRIX_AT(float, B, k, j) : MATRIX_AT(double, B, k, j));
             }
         }
     }
 }
 
 /**
- * @brief Matrix multiplication of strided matrices (one dimensional arrays of size N x M and M x K)
+ * @brief Max norm of C - reference over the max norm of reference, with C double or float and reference the packed
+ * long double product from matrixMultiplyReference.
+ */
+double matrixRelativeError(const matrix_t *C, const long double *reference) {
+    long double error = 0.0L, norm = 0.0L;
+    for (int i = 0; i < C->rows; i++) {
+        for (int j = 0; j < C->cols; j++) {
+            long double r = reference[j + (long int)C->cols * i];
+            long double c = (C->type == MATRIX_FLOAT) ? MATRIX_AT(float, C, i, j) : MATRIX_AT(double, C, i, j);
+            error = fmaxl(error, fabsl(c - r));
+            norm = fmaxl(norm, fabsl(r));
+        }
+    }
+    return (double)((norm > 0.0L) ? error / norm : error);
+}
+
+/**
+ * @brief Times Strassen-Winograd against the blocked engine on random double and float matrices in [-1, 1] and
+ * prints how far each result is from the long double product of the same inputs.
+ */
+void matrixMultiplyStrassenAccuracy(int N, int M, int K, int cutoff, matrix_arena_t *workspace) {
+    matrix_type_t types[2] = {MATRIX_DOUBLE, MATRIX_FLOAT};
+    matrix_t A[2], B[2], C_classic[2], C_strassen[2];
+    for (int t = 0; t < 2; t++) {
+        A[t] = matrixCreate(NULL, N, M, types[t]);
+        B[t] = matrixCreate(NULL, M, K, types[t]);
+        C_classic[t] = matrixCreate(NULL, N, K, types[t]);
+        C_strassen[t] = matrixCreate(NULL, N, K, types[t]);
+    }
+    for (int i = 0; i < N; i++) {
+        for (int j = 0; j < M; j++) {
+            MATRIX_AT(double, &A[0], i, j) = 2.0 * random() / RAND_MAX - 1.0;
+            MATRIX_AT(float, &A[1], i, j) = (float)MATRIX_AT(double, &A[0], i, j);
+        }
+    }
+    for (int i = 0; i < M; i++) {
+        for (int j = 0; j < K; j++) {
+            MATRIX_AT(double, &B[0], i, j) = 2.0 * random() / RAND_MAX - 1.0;
+            MATRIX_AT(float, &B[1], i, j) = (float)MATRIX_AT(double, &B[0], i, j);
+        }
+    }
+    double classic_time[2], strassen_time[2];
+    for (int t = 0; t < 2; t++) {
+        double start = benchmarkNow();
+        matrixMultiplyMatrix(&A[t], &B[t], &C_classic[t]);
+        classic_time[t] = benchmarkNow() - start;
+        start = benchmarkNow();
+        strassenMultiplyMatrix(&A[t], &B[t], &C_strassen[t], cutoff, workspace);
+        strassen_time[t] = benchmarkNow() - start;
+    }
+    long double *reference = (long double *)malloc(((size_t)N * K + 1) * sizeof(long double));
+    for (int t = 0; t < 2; t++) {
+        matrixMultiplyReference(&A[t], &B[t], reference);
+        printf("%s: classic %e \t strassen %e (%.2fx) \t relative error classic %e \t strassen %e\n",
+               matrixTypeNames[types[t]], classic_time[t], strassen_time[t], classic_time[t] / strassen_time[t],
+               matrixRelativeError(&C_classic[t], reference), matrixRelativeError(&C_strassen[t], reference));
+    }
+    free(reference);
+    for (int t = 0; t < 2; t++) {
+        matrixFree(&A[t]);
+        matrixFree(&B[t]);
+        matrixFree(&C_classic[t]);
+        matrixFree(&C_strassen[t]);
+    }
+}
+
+/**
+ * @brief Reference triple loop matrix multiplication of strided matrices, kept as a baseline for the blocked engine.
  * 
  * @param N Number of rows for matrix A
  * @param M Number of columns for matrix A and rows for matrix B
@@ -42,7 +178,8 @@ void matrixMultiply(int N, int M, int K, long int **matrix_A, long int **matrix_
  * @param matrix_B Should be a one-dimensional array of size M x K
  * @param matrix_C Should be a one-dimensional array of size N x K
  */
-void matrixMultiplyStrided(int N, int M, int K, long int *matrix_A, long int *matrix_B, long int *matrix_C) {
+void matrixMultiplyStridedNaive(int N, int M, int K, long int *matrix_A, long int *matrix_B, long int *matrix_C) {
+    PERF_BEGIN();
     for (int i = 0; i < N; i++) {
         for (int j = 0; j < K; j++) {
             matrix_C[j + K * i] = 0;
@@ -51,6 +188,7 @@ void matrixMultiplyStrided(int N, int M, int K, long int *matrix_A, long int *ma
             }
         }
     }
+    PERF_END("matrixMultiplyStridedNaive", N, M, K);
 }
 
 int main(int argc, char* argv[]) {
@@ -58,27 +196,42 @@ int main(int argc, char* argv[]) {
     int N = atoi(argv[1]);
     int M = atoi(argv[2]);
     int K = atoi(argv[3]);
+    // an optional fourth argument turns on Strassen-Winograd with that cutoff (0 for the default)
+    int strassen = argc > 4;
+    int cutoff = strassen ? atoi(argv[4]) : 0;
+    if (strassen && cutoff <= 0)
+        cutoff = STRASSEN_CUTOFF;
 
     // generate a random seed
     srandom(time(NULL));
 
-    // allocate memory for the non strided matrices
-    long int **A = (long int **)malloc(N * sizeof(long int *));
-    long int **B = (long int **)malloc(M * sizeof(long int *));
-    long int **C = (long int **)malloc(N * sizeof(long int *));
-
-    A[0] = (long int *)malloc(N * M * sizeof(long int));
-    B[0] = (long int *)malloc(M * K * sizeof(long int));
-    C[0] = (long int *)malloc(N * K * sizeof(long int));
-
-    for (int i = 1; i < N; i++) {
-        A[i] = A[0] + i * M;
-    }
-    for (int i = 1; i < M; i++) {
-        B[i] = B[0] + i * K;
+    // one arena holds every matrix; the row-pointer versions are views of the same buffers, so nothing is copied
+    matrix_arena_t arena;
+    size_t bytes = matrixBytes(N, M, MATRIX_LONG) + matrixBytes(M, K, MATRIX_LONG) + 5 * matrixBytes(N, K, MATRIX_LONG)
+                 + matrixAlignUp(N * sizeof(long int *)) * 2 + matrixAlignUp(M * sizeof(long int *));
+    if (matrixArenaCreate(&arena, bytes) != 0) {
+        fprintf(stderr, "Error: could not allocate the matrices!\n");
+        exit(-1);
     }
-    for (int i = 1; i < N; i++) {
-        C[i] = C[0] + i * K;
+    matrix_t A_matrix = matrixCreatePacked(&arena, N, M, MATRIX_LONG);
+    matrix_t B_matrix = matrixCreatePacked(&arena, M, K, MATRIX_LONG);
+    matrix_t C_matrix = matrixCreatePacked(&arena, N, K, MATRIX_LONG);
+    long int **A = (long int **)matrixRowPointers(&arena, &A_matrix);
+    long int **B = (long int **)matrixRowPointers(&arena, &B_matrix);
+    long int **C = (long int **)matrixRowPointers(&arena, &C_matrix);
+    long int *A_strided = (long int *)A_matrix.data;
+    long int *B_strided = (long int *)B_matrix.data;
+    long int *C_strided = (long int *)matrixCreatePacked(&arena, N, K, MATRIX_LONG).data;
+    long int *C_naive = (long int *)matrixCreatePacked(&arena, N, K, MATRIX_LONG).data;
+    long int *C_threaded = (long int *)matrixCreatePacked(&arena, N, K, MATRIX_LONG).data;
+    matrix_arena_t workspace = {NULL, 0, 0};
+    long int *C_strassen = NULL;
+    if (strassen) {
+        C_strassen = (long int *)malloc((size_t)N * K * sizeof(long int));
+        if (C_strassen == NULL || matrixArenaCreate(&workspace, strassenWorkspaceBytes(N, M, K, MATRIX_DOUBLE, cutoff)) != 0) {
+            fprintf(stderr, "Error: could not allocate the Strassen workspace!\n");
+            exit(-1);
+        }
     }
 
     // fill matrices A and B with random integers before computing their product
@@ -94,65 +247,69 @@ int main(int argc, char* argv[]) {
     }
 
     // call the matrix multiply function and time its runtime
-    clock_t start = clock();
+    double start = benchmarkNow();
     matrixMultiply(N, M, K, A, B, C);
-    clock_t end = clock();
-    double cpu_time1 = (double)(end - start) / CLOCKS_PER_SEC;
+    double end = benchmarkNow();
+    double wall_time1 = end - start;
 
-    // allocate memory for the strided matrices
-    long int *A_strided = (long int *)malloc(N * M * sizeof(long int));
-    long int *B_strided = (long int *)malloc(M * K * sizeof(long int));
-    long int *C_strided = (long int *)malloc(N * K * sizeof(long int));
+    // call the strided matrix multiply function on the same inputs and time the runtime
+    start = benchmarkNow();
+    matrixMultiplyStrided(N, M, K, A_strided, B_strided, C_strided);
+    end = benchmarkNow();
+    double wall_time2 = end - start;
 
-    // copy the values of A and B into the strided versions
-    for (int i = 0; i < N; i++) {
-        for (int j = 0; j < M; j++) {
-            A_strided[j + M * i] = A[i][j];
-        }
-    }
-    for (int i = 0; i < M; i++) {
-        for (int j = 0; j < K; j++) {
-            B_strided[j + K * i] = B[i][j];
-        }
+    // call the reference triple loop as a baseline and to check the blocked engine against
+    start = benchmarkNow();
+    matrixMultiplyStridedNaive(N, M, K, A_strided, B_strided, C_naive);
+    end = benchmarkNow();
+    double wall_time3 = end - start;
+
+    // call the threaded blocked engine
+    start = benchmarkNow();
+    matrixMultiplyThreadedStrided(N, M, K, A_strided, B_strided, C_threaded);
+    double wall_time4 = benchmarkNow() - start;
+
+    // Strassen-Winograd, opt-in
+    double wall_time5 = 0.0;
+    if (strassen) {
+        start = benchmarkNow();
+        matrixMultiplyStrassenStrided(N, M, K, A_strided, B_strided, C_strassen, cutoff, &workspace);
+        wall_time5 = benchmarkNow() - start;
     }
 
-    // call the strided matrix multiply function and time the runtime
-    start = clock();
-    matrixMultiplyStrided(N, M, K, A_strided, B_strided, C_strided);
-    end = clock();
-    double cpu_time2 = (double)(end - start) / CLOCKS_PER_SEC;
+    // multiply the top rows of A by the left columns of B through views, into an aligned padded matrix
+    int rows = (N + 1) / 2, cols = (K + 1) / 2;
+    matrix_t A_top = matrixView(&A_matrix, 0, 0, rows, M);
+    matrix_t B_left = matrixView(&B_matrix, 0, 0, M, cols);
+    matrix_t C_block = matrixCreate(&arena, rows, cols, MATRIX_LONG);
+    matrixMultiplyMatrix(&A_top, &B_left, &C_block);
 
-    // compare the values of C and C_strided to make sure they are equal, if not then safely abort the program
-    for (int i = 0; i < N; i++) {
+    // compare the values of C, C_strided, C_naive, C_threaded and C_block to make sure they are equal
+    int errors = 0;
+    for (int i = 0; i < N && !errors; i++) {
         for (int j = 0; j < K; j++) {
-            if (C[i][j] != C_strided[j + i * K]) {
+            int in_block = i < rows && j < cols;
+            if (C[i][j] != C_strided[j + i * K] || C_naive[j + i * K] != C_strided[j + i * K] || C_threaded[j + i * K] != C_strided[j + i * K]
+                || (in_block && MATRIX_AT(long int, &C_block, i, j) != C_strided[j + i * K])
+                || (strassen && C_strassen[j + i * K] != C_strided[j + i * K])) {
                 fprintf(stderr, "Error: C[%d][%d] = %ld != C_strided[%d + %d * %d] = %ld!\n", i, j, C[i][j], j, K, i, C_strided[j + K * i]);
-                free(A[0]);
-                free(A);
-                free(B[0]);
-                free(B);
-                free(C[0]);
-                free(C);
-                free(A_strided);
-                free(B_strided);
-                free(C_strided);
-                exit(-1);
+                errors = 1;
+                break;
             }
         }
     }
 
     // print the results of the timers
-    printf("matrixMultiply: %e \t matrixMultiplyStided: %e\n", cpu_time1, cpu_time2);
-    
-    // free all allocated memory and exit
-    free(A[0]);
-    free(A);
-    free(B[0]);
-    free(B);
-    free(C[0]);
-    free(C);
-    free(A_strided);
-    free(B_strided);
-    free(C_strided);
-    return 0;
-}
\ No newline at end of file
+    printf("matrixMultiply: %e \t matrixMultiplyStided: %e \t matrixMultiplyStridedNaive: %e \t matrixMultiplyThreadedStrided (%d threads): %e\n",
+           wall_time1, wall_time2, wall_time3, threadsConfig.count, wall_time4);
+    if (strassen) {
+        printf("matrixMultiplyStrassenStrided (cutoff %d): %e (%.2fx the blocked engine)\n", cutoff, wall_time5, wall_time2 / wall_time5);
+        matrixMultiplyStrassenAccuracy(N, M, K, cutoff, &workspace);
+        matrixArenaDestroy(&workspace);
+        free(C_strassen);
+    }
+
+    // every matrix lives in the arena
+    matrixArenaDestroy(&arena);
+    return errors ? -1 : 0;
+}
@@ -0,0 +1,252 @@
+/**
+ * @file matrix_multiply_parallel.c
+ * @author Navid Shamszadeh
+ * @brief Distributed matrix multiplication over a 2D process grid (SUMMA) using open-mpi.
+ * @details A, B and C are split into 2D blocks over a Pr x Pc grid. The inner dimension is walked in panels: the
+ * owners of each panel of A broadcast it along their grid row, the owners of the matching panel of B broadcast it
+ * along their grid column, and every process adds the product of the two panels to its block of C with the serial
+ * blocked GEMM, threaded over the rank's share of the node's cores. The broadcasts for the next panel are posted before the current panel is multiplied so the
+ * communication overlaps the local update.
+ * Run with e.g. mpirun -np 6 ./parallel_matrix_multiply N M K [panel width] [Pr Pc].
+ * @date 2021-05-17
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <mpi.h>
+#include "../printMatrix.h"
+#include "../gemm.h"
+#include "../distributed.h"
+
+// default width of the panels of A and B broadcast in each SUMMA step
+#define SUMMA_PANEL_WIDTH 256
+// rows of C updated between two polls of the outstanding broadcasts
+#define SUMMA_POLL_ROWS 256
+
+/**
+ * @brief Finds the rank owning index idx in the block decomposition of N elements over size ranks.
+ *
+ * @param N Number of elements
+ * @param size Number of ranks
+ * @param idx Global index
+ * @return The owning rank
+ */
+int blockOwner(int N, int size, int idx) {
+    int base = N / size;
+    int extra = N % size;
+    if (idx < extra * (base + 1))
+        return idx / (base + 1);
+    return extra + (idx - extra * (base + 1)) / base;
+}
+
+/**
+ * @brief One panel of the inner dimension and the requests broadcasting it.
+ */
+typedef struct {
+    int k0;               // first index of the panel in the inner dimension
+    int kb;               // width of the panel
+    long int *A;          // rows(C) x kb panel of A
+    long int *B;          // kb x cols(C) panel of B
+    MPI_Request requests[2];
+} summa_panel_t;
+
+/**
+ * @brief Fills in the panel starting at k0 and posts its broadcasts.
+ * @details The panel never crosses a block boundary of A's columns or B's rows, so each half has a single owner.
+ */
+void summaPostPanel(const process_grid_t *grid, const grid_block_t *block_A, const grid_block_t *block_B, int k0, int nb, summa_panel_t *panel) {
+    int M = block_A->M;
+    int owner_col = blockOwner(M, grid->Pc, k0);
+    int owner_row = blockOwner(M, grid->Pr, k0);
+    int a_first, a_cols, b_first, b_rows;
+    rowBlockRange(M, grid->Pc, owner_col, &a_cols, &a_first);
+    rowBlockRange(M, grid->Pr, owner_row, &b_rows, &b_first);
+
+    int kb = nb;
+    if (kb > M - k0)
+        kb = M - k0;
+    if (kb > a_first + a_cols - k0)
+        kb = a_first + a_cols - k0;
+    if (kb > b_first + b_rows - k0)
+        kb = b_first + b_rows - k0;
+    panel->k0 = k0;
+    panel->kb = kb;
+
+    if (grid->my_col == owner_col) {
+        for (int i = 0; i < block_A->rows; i++) {
+            memcpy(panel->A + (long int)kb * i, block_A->local + (k0 - block_A->first_col) + (long int)block_A->cols * i, kb * sizeof(long int));
+        }
+    }
+    if (grid->my_row == owner_row) {
+        memcpy(panel->B, block_B->local + (long int)block_B->cols * (k0 - block_B->first_row), (size_t)kb * block_B->cols * sizeof(long int));
+    }
+    MPI_Ibcast(panel->A, block_A->rows * kb, MPI_LONG, owner_col, grid->row_comm, &panel->requests[0]);
+    MPI_Ibcast(panel->B, kb * block_B->cols, MPI_LONG, owner_row, grid->col_comm, &panel->requests[1]);
+}
+
+/**
+ * @brief Distributed matrix multiplication C = A * B with SUMMA on a process grid.
+ * @details block_A, block_B and block_C must come from gridBlockScatter/gridBlockRange on the same grid, with
+ * A of size N x M, B of size M x K and C of size N x K. Must be called by every process of the grid.
+ *
+ * @param grid Process grid
+ * @param block_A This process's block of A
+ * @param block_B This process's block of B
+ * @param block_C This process's block of C, overwritten with the product
+ * @param nb Panel width
+ * @param timing If not NULL, receives the time this process spent computing and communicating
+ * @return 0 on success, -1 if nb is not positive
+ */
+int matrixMultiplySUMMA(const process_grid_t *grid, const grid_block_t *block_A, const grid_block_t *block_B, grid_block_t *block_C, int nb, mpi_timing_t *timing) {
+    // a panel of no columns would never advance the loop over k
+    if (nb < 1)
+        return -1;
+    int M = block_A->M;
+    int rows = block_C->rows;
+    int cols = block_C->cols;
+    double compute = 0.0;
+    double start = MPI_Wtime();
+
+    if (M == 0) {
+        memset(block_C->local, 0, (size_t)rows * cols * sizeof(long int));
+    }
+
+    // double buffered panels: the broadcast of one overlaps the update with the other
+    summa_panel_t panels[2];
+    for (int p = 0; p < 2; p++) {
+        panels[p].A = (long int *)malloc(((size_t)rows * nb + 1) * sizeof(long int));
+        panels[p].B = (long int *)malloc(((size_t)nb * cols + 1) * sizeof(long int));
+    }
+
+    int current = 0;
+    if (M > 0)
+        summaPostPanel(grid, block_A, block_B, 0, nb, &panels[current]);
+    for (int k0 = 0; k0 < M; ) {
+        summa_panel_t *panel = &panels[current];
+        summa_panel_t *next = &panels[1 - current];
+        int k1 = k0 + panel->kb;
+
+        MPI_Waitall(2, panel->requests, MPI_STATUSES_IGNORE);
+        if (k1 < M)
+            summaPostPanel(grid, block_A, block_B, k1, nb, next);
+
+        // update C in chunks of rows, polling the next broadcast in between so it progresses during the update
+        for (int i0 = 0; i0 < rows; i0 += SUMMA_POLL_ROWS) {
+            int mc = (rows - i0 < SUMMA_POLL_ROWS) ? rows - i0 : SUMMA_POLL_ROWS;
+            double t0 = MPI_Wtime();
+            parallelGemm(mc, panel->kb, cols, 1, panel->A + (long int)panel->kb * i0, panel->kb, panel->B, cols,
+                         k0 > 0 ? 1 : 0, block_C->local + (long int)cols * i0, cols);
+            compute += MPI_Wtime() - t0;
+            if (k1 < M) {
+                int done;
+                MPI_Testall(2, next->requests, &done, MPI_STATUSES_IGNORE);
+            }
+        }
+
+        k0 = k1;
+        current = 1 - current;
+    }
+
+    for (int p = 0; p < 2; p++) {
+        free(panels[p].A);
+        free(panels[p].B);
+    }
+
+    if (timing != NULL) {
+        timing->compute = compute;
+        timing->communication = MPI_Wtime() - start - compute;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    hybridInit(&argc, &argv);
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    int nb = (argc > 4) ? atoi(argv[4]) : SUMMA_PANEL_WIDTH;
+    if (argc < 4 || nb < 1) {
+        if (rank == 0)
+            fprintf(stderr, "Usage: %s N M K [panel width >= 1] [Pr Pc]\n", argv[0]);
+        MPI_Finalize();
+        return -1;
+    }
+    int N = atoi(argv[1]);
+    int M = atoi(argv[2]);
+    int K = atoi(argv[3]);
+    int Pr = (argc > 6) ? atoi(argv[5]) : 0;
+    int Pc = (argc > 6) ? atoi(argv[6]) : 0;
+
+    process_grid_t grid;
+    if (processGridCreate(MPI_COMM_WORLD, Pr, Pc, &grid) != 0) {
+        if (rank == 0)
+            fprintf(stderr, "Usage: %s N M K [panel width >= 1] [Pr Pc], with Pr * Pc processes\n", argv[0]);
+        MPI_Finalize();
+        return -1;
+    }
+    int grid_rank;
+    MPI_Comm_rank(grid.grid, &grid_rank);
+
+    // only grid rank 0 holds the full matrices
+    long int *A = NULL, *B = NULL, *C = NULL;
+    if (grid_rank == 0) {
+        srandom(time(NULL));
+        A = (long int *)malloc(N * M * sizeof(long int));
+        B = (long int *)malloc(M * K * sizeof(long int));
+        C = (long int *)malloc(N * K * sizeof(long int));
+        for (int i = 0; i < N * M; i++) {
+            A[i] = random() % 1000;
+        }
+        for (int i = 0; i < M * K; i++) {
+            B[i] = random() % 1000;
+        }
+    }
+
+    grid_block_t block_A, block_B, block_C;
+    gridBlockScatter(&grid, N, M, A, &block_A);
+    gridBlockScatter(&grid, M, K, B, &block_B);
+    gridBlockRange(&grid, N, K, grid.my_row, grid.my_col, &block_C);
+    block_C.local = (long int *)malloc(((size_t)block_C.rows * block_C.cols + 1) * sizeof(long int));
+
+    mpi_timing_t timing;
+    MPI_Barrier(grid.grid);
+    double start = MPI_Wtime();
+    matrixMultiplySUMMA(&grid, &block_A, &block_B, &block_C, nb, &timing);
+    MPI_Barrier(grid.grid);
+    double elapsed = MPI_Wtime() - start;
+
+    gridBlockGather(&grid, &block_C, C);
+    if (grid_rank == 0)
+        printf("matrixMultiplySUMMA on a %d x %d grid: %e\n", grid.Pr, grid.Pc, elapsed);
+    printRankTimings("matrixMultiplySUMMA", timing);
+
+    // verify against the serial blocked GEMM on grid rank 0
+    int errors = 0;
+    if (grid_rank == 0) {
+        long int *C_serial = (long int *)malloc(N * K * sizeof(long int));
+        start = MPI_Wtime();
+        gemmStrided(N, M, K, A, M, B, K, C_serial, K, 0);
+        printf("matrixMultiplyStrided: %e\n", MPI_Wtime() - start);
+        for (int i = 0; i < N && !errors; i++) {
+            for (int j = 0; j < K; j++) {
+                if (C[j + K * i] != C_serial[j + K * i]) {
+                    fprintf(stderr, "Error: C[%d + %d * %d] = %ld != C_serial[%d + %d * %d] = %ld!\n", j, K, i, C[j + K * i], j, K, i, C_serial[j + K * i]);
+                    errors = 1;
+                    break;
+                }
+            }
+        }
+        free(C_serial);
+        free(A);
+        free(B);
+        free(C);
+    }
+
+    free(block_A.local);
+    free(block_B.local);
+    free(block_C.local);
+    processGridFree(&grid);
+    MPI_Finalize();
+    return errors ? -1 : 0;
+}
@@ -0,0 +1,178 @@
+/**
+ * @file matrix_out_of_core.c
+ * @author Navid Shamszadeh
+ * @brief Out-of-core matrix vector and matrix matrix multiplication on memory mapped matrix files.
+ * @details Writes an N x M matrix A and an M x K matrix B of doubles to matrix files tile by tile, so neither is ever
+ * held in memory, drops them from the page cache and measures the cold sequential read bandwidth of A's file. Then
+ * times the streaming GEMV y = A x and the tiled GEMM C = A B (C written to a third file) from a cold cache and checks
+ * sampled entries of the results against values recomputed from the formulas that generated A and B.
+ * Run with e.g. ./matrix_out_of_core 40000 40000 256 --dir /scratch --tile 1024; files are removed unless --keep is
+ * given.
+ * @date 2021-05-20
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../benchmark.h"
+#include "../matrixFile.h"
+
+// rows of A and entries of C checked against the formulas
+#define OOC_SAMPLES 64
+
+double oocA(long int i, long int j) { return (double)((i * 7 + j * 3) % 11) - 5.0; }
+double oocB(long int i, long int j) { return (double)((i * 5 + j) % 9) - 4.0; }
+double oocX(long int j) { return (double)(j % 5) - 2.0; }
+
+/**
+ * @brief Fills a new matrix file from a formula one tile at a time, releasing every tile once it is written.
+ */
+int oocWrite(const char *path, int rows, int cols, int tile, double (*value)(long int, long int)) {
+    matrix_file_t f;
+    if (matrixFileCreate(path, rows, cols, MATRIX_DOUBLE, tile, &f) != 0)
+        return -1;
+    for (int i0 = 0; i0 < rows; i0 += f.header.tile_rows) {
+        int ib = (rows - i0 < f.header.tile_rows) ? rows - i0 : (int)f.header.tile_rows;
+        for (int i = i0; i < i0 + ib; i++) {
+            for (int j = 0; j < cols; j++) {
+                MATRIX_AT(double, &f.matrix, i, j) = value(i, j);
+            }
+        }
+        matrixFileRelease(&f, i0, ib);
+    }
+    fsync(f.fd);
+    matrixFileClose(&f);
+    return 0;
+}
+
+/**
+ * @brief Writes back and drops a whole file from the page cache, so the next read comes from the disk.
+ */
+void oocDropCache(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+/**
+ * @brief Cold sequential read bandwidth of a file in GB/s, the ceiling for the streaming kernels.
+ */
+double oocReadBandwidth(const char *path) {
+    oocDropCache(path);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0.0;
+    size_t size = MATRIX_FILE_TILE_BYTES;
+    char *buffer = (char *)malloc(size);
+    double total = 0.0, start = benchmarkNow();
+    for (ssize_t got; (got = read(fd, buffer, size)) > 0; ) {
+        total += got;
+    }
+    double seconds = benchmarkNow() - start;
+    free(buffer);
+    close(fd);
+    oocDropCache(path);
+    return total / seconds * 1e-9;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s N M K [--dir D] [--tile rows] [--keep]\n", argv[0]);
+        return -1;
+    }
+    int N = atoi(argv[1]);
+    int M = atoi(argv[2]);
+    int K = atoi(argv[3]);
+    const char *dir = "/tmp";
+    int tile = 0;
+    int keep = 0;
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+            dir = argv[++i];
+        else if (strcmp(argv[i], "--tile") == 0 && i + 1 < argc)
+            tile = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--keep") == 0)
+            keep = 1;
+    }
+    char path_A[4096], path_B[4096], path_C[4096];
+    snprintf(path_A, sizeof(path_A), "%s/ooc_A.mat", dir);
+    snprintf(path_B, sizeof(path_B), "%s/ooc_B.mat", dir);
+    snprintf(path_C, sizeof(path_C), "%s/ooc_C.mat", dir);
+
+    double start = benchmarkNow();
+    if (oocWrite(path_A, N, M, tile, oocA) != 0 || oocWrite(path_B, M, K, tile, oocB) != 0)
+        return -1;
+    double write_time = benchmarkNow() - start;
+    double disk_bandwidth = oocReadBandwidth(path_A);
+
+    matrix_file_t A, B, C;
+    if (matrixFileOpen(path_A, &A) != 0 || matrixFileOpen(path_B, &B) != 0
+        || matrixFileCreate(path_C, N, K, MATRIX_DOUBLE, tile, &C) != 0)
+        return -1;
+    double *x = (double *)malloc(M * sizeof(double));
+    double *y = (double *)malloc(N * sizeof(double));
+    for (int j = 0; j < M; j++) {
+        x[j] = oocX(j);
+    }
+    double A_bytes = (double)A.header.rows * A.header.ld * sizeof(double);
+
+    // streaming GEMV from a cold cache
+    start = benchmarkNow();
+    matrixFileGemv(&A, x, y);
+    double gemv_time = benchmarkNow() - start;
+
+    // tiled GEMM from a cold cache
+    oocDropCache(path_A);
+    oocDropCache(path_B);
+    start = benchmarkNow();
+    int status = matrixFileGemm(&A, &B, &C);
+    double gemm_time = benchmarkNow() - start;
+
+    // check sampled rows of y and entries of C against the formulas
+    int errors = (status != 0);
+    for (int s = 0; s < OOC_SAMPLES && N > 0; s++) {
+        long int i = (long int)N * s / OOC_SAMPLES;
+        double sum = 0.0;
+        for (long int j = 0; j < M; j++) {
+            sum += oocA(i, j) * oocX(j);
+        }
+        if (sum != y[i]) {
+            fprintf(stderr, "Error! y[%ld] = %f != %f.\n", i, y[i], sum);
+            errors = 1;
+            break;
+        }
+        long int j = (long int)K * s / OOC_SAMPLES;
+        if (K == 0)
+            continue;
+        sum = 0.0;
+        for (long int k = 0; k < M; k++) {
+            sum += oocA(i, k) * oocB(k, j);
+        }
+        if (sum != MATRIX_AT(double, &C.matrix, i, j)) {
+            fprintf(stderr, "Error! C[%ld][%ld] = %f != %f.\n", i, j, MATRIX_AT(double, &C.matrix, i, j), sum);
+            errors = 1;
+            break;
+        }
+    }
+
+    printf("write: %e s \t cold read: %.3f GB/s \t tile: %ld rows\n", write_time, disk_bandwidth, (long int)A.header.tile_rows);
+    printf("matrixFileGemv: %e (%.3f GB/s, %.1f%% of read) \t matrixFileGemm: %e (%.2f GFLOP/s)\n",
+           gemv_time, A_bytes / gemv_time * 1e-9, disk_bandwidth > 0 ? 100.0 * A_bytes / gemv_time * 1e-9 / disk_bandwidth : 0.0,
+           gemm_time, 2.0 * N * (double)M * K / gemm_time * 1e-9);
+
+    matrixFileClose(&A);
+    matrixFileClose(&B);
+    matrixFileClose(&C);
+    if (!keep) {
+        unlink(path_A);
+        unlink(path_B);
+        unlink(path_C);
+    }
+    free(x);
+    free(y);
+    return errors ? -1 : 0;
+}
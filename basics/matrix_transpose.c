@@ -9,28 +9,33 @@
 #include <stdlib.h>
 #include <time.h>
 #include "../printMatrix.h"
+#include "../benchmark.h"
+#include "../transpose.h"
+#include "../threads.h"
+#include "../matrix.h"
 
 
-void printArray(int size, long int *arr) {
-    printf("[");
-    for (int i = 0; i < size; i++) {
-        if (i != size - 1)
-            printf("%ld, ", arr[i]);
-        else
-            printf("%ld]\n", arr[i]);
-    }
-}
-
 /**
  * @brief Computes the transpose of matrix A. If A is not square (N != M) then it stores the result in A_t, otherwise the operation is done in-place.
+ * @details Rows carved out of a single A[0] block go through the tiled kernels in transpose.h, other layouts fall back to a tiled loop over the row pointers.
  * 
  * @param N Number of rows of A
  * @param M Number of columns of A
  * @param A Matrix
- * @param A_t Matrix to store the transpose of A if A is not square
+ * @param A_t Matrix of size M x N to store the transpose of A if A is not square
  */
 void matrixTranspose(int N, int M, long int **A, long int **A_t) {
+    PERF_BEGIN();
+    int contiguous = 1;
+    for (int i = 1; i < N && contiguous; i++) {
+        contiguous = A[i] - A[i - 1] == A[1] - A[0];
+    }
     if (N == M) {
+        if (contiguous && N > 1) {
+            transposeSquareInPlace(N, A[0], (int)(A[1] - A[0]));
+            PERF_END("matrixTranspose", N, M, 1);
+            return;
+        }
         for (int i = 0; i < N; i++) {
             for (int j = i + 1; j < M; j++) {
                 // swap A[i][j] with A[j][i]
@@ -39,63 +44,166 @@ void matrixTranspose(int N, int M, long int **A, long int **A_t) {
                 A[j][i] = temp;
             }
         }
-    }else {
-        // store the transpose in A_t
-        for (int i = 0; i < N; i++) {
-            for (int j = i; j < M; j++) {
-                // store A[i][j] in A_t[j][i]
-                // store A[j][i] in A_t[i][j]
-                A_t[i][j] = A[j][i];
-                A_t[j][i] = A[i][j];
+    } else {
+        for (int i = 1; i < M && contiguous; i++) {
+            contiguous = A_t[i] - A_t[i - 1] == A_t[1] - A_t[0];
+        }
+        if (contiguous && N > 1 && M > 1) {
+            transposeStrided(N, M, A[0], (int)(A[1] - A[0]), A_t[0], (int)(A_t[1] - A_t[0]));
+            PERF_END("matrixTranspose", N, M, 1);
+            return;
+        }
+        // store A[i][j] in A_t[j][i], one tile at a time
+        for (int i0 = 0; i0 < N; i0 += TRANSPOSE_TILE) {
+            for (int j0 = 0; j0 < M; j0 += TRANSPOSE_TILE) {
+                for (int i = i0; i < N && i < i0 + TRANSPOSE_TILE; i++) {
+                    for (int j = j0; j < M && j < j0 + TRANSPOSE_TILE; j++) {
+                        A_t[j][i] = A[i][j];
+                    }
+                }
             }
         }
     }
+    PERF_END("matrixTranspose", N, M, 1);
 }
 
 /**
  * @brief Matrix transpose on strided matrix. Since A is strided, we can still perform the transpose in-place if N != M
+ * @details O(NM): tile swaps for square matrices, bitmap-marked cycle following otherwise (see transposeInPlace).
  * 
  * @param N Number of rows of A
  * @param M Number of columns of A
  * @param A Input matrix 
  */
 void matrixTransposeStrided(int N, int M, long int *A) {
-    for (int k = 0; k < N * M; k++) {
-        printArray(N * M, A);
-        int idx = k;
-        do // calculate index in the original array
-        {
-            idx = (idx % N) * M + (idx / N); // what the hell is this 
-        } while (idx < k);
-        // swap A[k] with A[idx]
-        long int temp = A[k];
-        A[k] = A[idx];
-        A[idx] = temp;
-    }
+    PERF_BEGIN();
+    transposeInPlace(N, M, A);
+    PERF_END("matrixTransposeStrided", N, M, 1);
+}
+
+/**
+ * @brief Out-of-place matrix transpose on strided matrices.
+ * 
+ * @param N Number of rows of A
+ * @param M Number of columns of A
+ * @param A Input matrix of size N x M
+ * @param A_t Output matrix of size M x N
+ */
+void matrixTransposeStridedOutOfPlace(int N, int M, long int *A, long int *A_t) {
+    PERF_BEGIN();
+    transposeStrided(N, M, A, M, A_t, N);
+    PERF_END("matrixTransposeStridedOutOfPlace", N, M, 1);
+}
+
+/**
+ * @brief Out-of-place matrix transpose on strided matrices, split into bands of rows over the threading layer.
+ * 
+ * @param N Number of rows of A
+ * @param M Number of columns of A
+ * @param A Input matrix of size N x M
+ * @param A_t Output matrix of size M x N
+ */
+void matrixTransposeThreadedStrided(int N, int M, long int *A, long int *A_t) {
+    parallelTranspose(N, M, A, M, A_t, N);
 }
 
 int main(int argc, char* argv[]) {
     int N = atoi(argv[1]);
     int M = atoi(argv[2]);
 
-    srandom(time(NULL));
+    // one arena holds every matrix, the row-pointer matrices are views of strided ones. The in-place transposes
+    // overwrite their input, so the row pointer and the strided versions need their own copy of A.
+    matrix_arena_t arena;
+    if (matrixArenaCreate(&arena, 6 * matrixBytes(N, M, MATRIX_LONG) + matrixAlignUp(N * sizeof(long int *)) + matrixAlignUp(M * sizeof(long int *))) != 0) {
+        fprintf(stderr, "Error: could not allocate the matrices!\n");
+        exit(-1);
+    }
+    matrix_t A_matrix = matrixCreatePacked(&arena, N, M, MATRIX_LONG);
+    matrix_t A_t_matrix = matrixCreatePacked(&arena, M, N, MATRIX_LONG);
+    long int **A = (long int **)matrixRowPointers(&arena, &A_matrix);
+    long int **A_t = (long int **)matrixRowPointers(&arena, &A_t_matrix);
+    long int *A_strided = (long int *)matrixCreatePacked(&arena, N, M, MATRIX_LONG).data;
+    long int *A_strided_t = (long int *)matrixCreatePacked(&arena, M, N, MATRIX_LONG).data;
+    long int *A_threaded_t = (long int *)matrixCreatePacked(&arena, M, N, MATRIX_LONG).data;
 
-    long int *A = (long int *)malloc(N * M * sizeof(long int));
+    // every element holds its own index so the transpose is easy to check
     for (int i = 0; i < N; i++) {
         for (int j = 0; j < M; j++) {
-            A[j + M * i] = (long int)(j + M * i);
+            A[i][j] = (long int)(j + M * i);
+            A_strided[j + M * i] = (long int)(j + M * i);
         }
     }
 
-    printf("A:\n");
-    printMatrixStrided(N, M, A);
-    printf("\n");
-    matrixTransposeStrided(N, M, A);
-    printf("A_T:\n");
-    printMatrixStrided(M, N, A);
-    printf("\n");
+    // print small matrices for debugging purposes
+    if (N * M <= 100) {
+        printf("A:\n");
+        printMatrixStrided(N, M, A_strided);
+        printf("\n");
+    }
+
+    // time the row pointer transpose (in-place when square)
+    double start = benchmarkNow();
+    matrixTranspose(N, M, A, A_t);
+    double end = benchmarkNow();
+    double wall_time1 = end - start;
+    long int **result = (N == M) ? A : A_t;
+
+    // time the out-of-place strided transpose
+    start = benchmarkNow();
+    matrixTransposeStridedOutOfPlace(N, M, A_strided, A_strided_t);
+    end = benchmarkNow();
+    double wall_time2 = end - start;
+
+    // time the threaded out-of-place transpose
+    start = benchmarkNow();
+    matrixTransposeThreadedStrided(N, M, A_strided, A_threaded_t);
+    double wall_time4 = benchmarkNow() - start;
+
+    // time the in-place strided transpose
+    start = benchmarkNow();
+    matrixTransposeStrided(N, M, A_strided);
+    end = benchmarkNow();
+    double wall_time3 = end - start;
+
+    if (N * M <= 100) {
+        printf("A_T:\n");
+        printMatrixStrided(M, N, A_strided);
+        printf("\n");
+    }
+
+    // transpose the top left block of A^T back through a view, into an aligned padded matrix
+    int rows = (M + 1) / 2, cols = (N + 1) / 2;
+    matrix_t A_strided_t_matrix = matrixWrap(M, N, N, MATRIX_LONG, A_strided_t);
+    matrix_t A_t_block = matrixView(&A_strided_t_matrix, 0, 0, rows, cols);
+    matrix_t A_block = matrixCreate(&arena, cols, rows, MATRIX_LONG);
+    matrixTransposeMatrix(&A_t_block, &A_block);
+
+    // verify all four transposes: A_T[i][j] = A[j][i] = i + M * j
+    int errors = 0;
+    for (int i = 0; i < cols && !errors; i++) {
+        for (int j = 0; j < rows; j++) {
+            if (MATRIX_AT(long int, &A_block, i, j) != (long int)(j + M * i)) {
+                fprintf(stderr, "Error: block transpose at (%d, %d) should be %ld, got %ld!\n", i, j, (long int)(j + M * i), MATRIX_AT(long int, &A_block, i, j));
+                errors = 1;
+                break;
+            }
+        }
+    }
+    for (int i = 0; i < M && !errors; i++) {
+        for (int j = 0; j < N; j++) {
+            long int expected = (long int)(i + M * j);
+            if (result[i][j] != expected || A_strided_t[j + N * i] != expected || A_strided[j + N * i] != expected || A_threaded_t[j + N * i] != expected) {
+                fprintf(stderr, "Error: A_T[%d][%d] should be %ld, got %ld (row pointer), %ld (out-of-place), %ld (in-place)!\n",
+                        i, j, expected, result[i][j], A_strided_t[j + N * i], A_strided[j + N * i]);
+                errors = 1;
+                break;
+            }
+        }
+    }
 
-    free(A);
+    printf("matrixTranspose: %e \t matrixTransposeStridedOutOfPlace (%s): %e \t matrixTransposeStrided: %e \t matrixTransposeThreadedStrided (%d threads): %e\n",
+           wall_time1, simdIsaNames[simdIsa], wall_time2, wall_time3, threadsConfig.count, wall_time4);
 
-    return 0;
-}
\ No newline at end of file
+    matrixArenaDestroy(&arena);
+    return errors ? -1 : 0;
+}
@@ -9,6 +9,10 @@
 #include <stdlib.h>
 #include <time.h>
 #include "../printMatrix.h"
+#include "../benchmark.h"
+#include "../simd.h"
+#include "../threads.h"
+#include "../matrix.h"
 
 /**
  * @brief Matrix vector multiplication. 
@@ -20,16 +24,19 @@
  * @param b Output vector for the product Ax.
  */
 void matrixVectorMultiply(int N, int M, long int **A, long int *x, long int *b) {
+    PERF_BEGIN();
     for (int i = 0; i < N; i++) {
         b[i] = 0;
         for (int j = 0; j < M; j++) {
             b[i] += A[i][j] * x[j];
         }
     }
+    PERF_END("matrixVectorMultiply", N, M, 1);
 }
 
 /**
  * @brief Strided matrix vector multiply.
+ * @details Dispatched to the SIMD kernel selected in simd.h.
  * 
  * @param N Number of rows of A and the number of rows of b
  * @param M Number of columns of A and the number of rows of x
@@ -38,12 +45,22 @@ void matrixVectorMultiply(int N, int M, long int **A, long int *x, long int *b)
  * @param b Output vector 
  */
 void matrixVectorMultiplyStrided(int N, int M, long int *A, long int *x, long int *b) {
-    for (int i = 0; i < N; i++) {
-        b[i] = 0;
-        for (int j = 0; j < M; j++) {
-            b[i] += A[j + M * i] * x[j];
-        }
-    }
+    PERF_BEGIN();
+    simdGemv(N, M, A, M, x, b);
+    PERF_END("matrixVectorMultiplyStrided", N, M, 1);
+}
+
+/**
+ * @brief Strided matrix vector multiply split by rows over the threading layer.
+ * 
+ * @param N Number of rows of A and the number of rows of b
+ * @param M Number of columns of A and the number of rows of x
+ * @param A Matrix
+ * @param x Input vector
+ * @param b Output vector 
+ */
+void matrixVectorMultiplyThreadedStrided(int N, int M, long int *A, long int *x, long int *b) {
+    parallelGemv(N, M, A, M, x, b);
 }
 
 int main(int argc, char* argv[]) {
@@ -53,15 +70,23 @@ int main(int argc, char* argv[]) {
     // get a random seem
     srandom(time(NULL));
 
-    // allocate memory for matrix and vectors
-    long int **A = (long int **)malloc(N * sizeof(long int *));
-    long int *x = (long int *)malloc(M * sizeof(long int));
-    long int *b = (long int *)malloc(N * sizeof(long int));
-
-    A[0] = (long int *)malloc(N * M * sizeof(long int));
-    for (int i = 1; i < N; i++) {
-        A[i] = A[0] + i * M;
+    // one arena holds the matrix and the vectors; A is a row-pointer view of the strided matrix, nothing is copied
+    matrix_arena_t arena;
+    size_t bytes = matrixBytes(N, M, MATRIX_LONG) + matrixBytes(1, M, MATRIX_LONG) + 5 * matrixBytes(1, N, MATRIX_LONG)
+                 + matrixAlignUp(N * sizeof(long int *));
+    if (matrixArenaCreate(&arena, bytes) != 0) {
+        fprintf(stderr, "Error: could not allocate the matrix!\n");
+        exit(-1);
     }
+    matrix_t A_matrix = matrixCreatePacked(&arena, N, M, MATRIX_LONG);
+    long int **A = (long int **)matrixRowPointers(&arena, &A_matrix);
+    long int *A_strided = (long int *)A_matrix.data;
+    long int *x = (long int *)matrixArenaAlloc(&arena, M * sizeof(long int));
+    long int *b = (long int *)matrixArenaAlloc(&arena, N * sizeof(long int));
+    long int *b_strided = (long int *)matrixArenaAlloc(&arena, N * sizeof(long int));
+    long int *b_threaded = (long int *)matrixArenaAlloc(&arena, N * sizeof(long int));
+    long int *b_left = (long int *)matrixArenaAlloc(&arena, N * sizeof(long int));
+    long int *b_right = (long int *)matrixArenaAlloc(&arena, N * sizeof(long int));
 
     // fill A and x with random numbers
     for (int i = 0; i < M; i++) {
@@ -74,47 +99,51 @@ int main(int argc, char* argv[]) {
     }
 
     // call the function and time its runtime
-    clock_t start = clock();
+    double start = benchmarkNow();
     matrixVectorMultiply(N, M, A, x, b);
-    clock_t end = clock();
-    double cpu_time1 = (double)(end - start) / CLOCKS_PER_SEC;
+    double end = benchmarkNow();
+    double wall_time1 = end - start;
 
-    // allocate memory for strided matrix and its result vector
-    long int *A_strided = (long int *)malloc(N * M * sizeof(long int));
-    long int *b_strided = (long int *)malloc(N * sizeof(long int));
+    // call strided matrix vector multiply function on the same matrix and time its runtime
+    start = benchmarkNow();
+    matrixVectorMultiplyStrided(N, M, A_strided, x, b_strided);
+    end = benchmarkNow();
+    double wall_time2 = end - start;
 
-    // fill A_strided with the contents of A
-    for (int i = 0; i < N; i++) {
-        for (int j = 0; j < M; j++) {
-            A_strided[j + i * M] = A[i][j];
-        }
-    }
+    // call the threaded version
+    start = benchmarkNow();
+    matrixVectorMultiplyThreadedStrided(N, M, A_strided, x, b_threaded);
+    double wall_time3 = benchmarkNow() - start;
 
-    // call strided matrix vector multiply function and time its runtime
-    start = clock();
-    matrixVectorMultiplyStrided(N, M, A_strided, x, b_strided);
-    end = clock();
-    double cpu_time2 = (double)(end - start) / CLOCKS_PER_SEC;
+    // the product split over the left and right column halves of A, through views
+    matrix_t A_left = matrixView(&A_matrix, 0, 0, N, M / 2);
+    matrix_t A_right = matrixView(&A_matrix, 0, M / 2, N, M - M / 2);
+    matrixVectorMultiplyMatrix(&A_left, x, b_left);
+    matrixVectorMultiplyMatrix(&A_right, x + M / 2, b_right);
 
     // compare the outputs
+    int errors = 0;
     for (int i = 0; i < N; i++) {
         if (b[i] != b_strided[i]) {
             fprintf(stderr, "Error! b[%d] = %ld != b_strided[%d] = %ld.\n", i, b[i], i, b_strided[i]);
-            free(A[0]);
-            free(A);
-            free(x);
-            free(b);
-            free(b_strided);
-            exit(-1);
+            errors = 1;
+            break;
+        }
+        if (b[i] != b_threaded[i]) {
+            fprintf(stderr, "Error! b[%d] = %ld != b_threaded[%d] = %ld.\n", i, b[i], i, b_threaded[i]);
+            errors = 1;
+            break;
+        }
+        if (b[i] != b_left[i] + b_right[i]) {
+            fprintf(stderr, "Error! b[%d] = %ld != b_left[%d] + b_right[%d] = %ld.\n", i, b[i], i, i, b_left[i] + b_right[i]);
+            errors = 1;
+            break;
         }
     }
 
     // output the runtimes, free memory, and return
-    printf("matrixVectorMultiply: %e \t matrixVectorMultiplyStrided: %e\n", cpu_time1, cpu_time2);
-    free(A[0]);
-    free(A);
-    free(x);
-    free(b);
-    free(b_strided);
-    return 0;
-}
\ No newline at end of file
+    printf("matrixVectorMultiply: %e \t matrixVectorMultiplyStrided (%s): %e \t matrixVectorMultiplyThreadedStrided (%d threads): %e\n",
+           wall_time1, simdIsaNames[simdIsa], wall_time2, threadsConfig.count, wall_time3);
+    matrixArenaDestroy(&arena);
+    return errors ? -1 : 0;
+}
@@ -0,0 +1,106 @@
+/**
+ * @file parallel_matrix_transpose.c
+ * @author Navid Shamszadeh
+ * @brief Distributed transpose of a row-block distributed matrix with all-to-all exchanges using open-mpi.
+ * @details A is scattered by rows and transposed with rowBlockTranspose from distributed.h, which leaves B = A^T
+ * distributed by rows as well: every rank transposes the blocks of its rows with the tiled kernel while packing
+ * them, one all-to-all exchanges them, and the receivers unpack them (or receive them in place through derived
+ * datatypes). The driver times the unpacking and the datatype exchange, once in a single exchange and once pipelined
+ * in chunks, checks B against the serial transpose on rank 0 and checks that transposing B again gives back A.
+ * Run with e.g. mpirun -np 4 ./parallel_matrix_transpose N M [chunks].
+ * @date 2021-05-24
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <mpi.h>
+#include "../printMatrix.h"
+#include "../distributed.h"
+
+// default number of chunks of the pipelined exchange
+#define TRANSPOSE_CHUNKS 4
+
+int main(int argc, char* argv[]) {
+    hybridInit(&argc, &argv);
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (argc < 3) {
+        if (rank == 0)
+            fprintf(stderr, "Usage: %s N M [chunks]\n", argv[0]);
+        MPI_Finalize();
+        return -1;
+    }
+    int N = atoi(argv[1]);
+    int M = atoi(argv[2]);
+    int chunks = (argc > 3) ? atoi(argv[3]) : TRANSPOSE_CHUNKS;
+    if (chunks < 1)
+        chunks = 1;
+
+    // only rank 0 holds the full matrices
+    long int *A = NULL, *B = NULL, *B_serial = NULL;
+    if (rank == 0) {
+        srandom(time(NULL));
+        A = (long int *)malloc(((size_t)N * M + 1) * sizeof(long int));
+        B = (long int *)malloc(((size_t)N * M + 1) * sizeof(long int));
+        B_serial = (long int *)malloc(((size_t)N * M + 1) * sizeof(long int));
+        for (long int i = 0; i < (long int)N * M; i++) {
+            A[i] = random();
+        }
+        double start = MPI_Wtime();
+        transposeStrided(N, M, A, M, B_serial, N);
+        printf("transposeStrided: %e\n", MPI_Wtime() - start);
+    }
+
+    row_block_t block_A;
+    rowBlockScatter(N, M, A, 0, MPI_COMM_WORLD, &block_A);
+
+    int errors = 0;
+    const int variant_chunks[4] = {1, 1, chunks, chunks};
+    const int variant_datatypes[4] = {0, 1, 0, 1};
+    for (int v = 0; v < 4; v++) {
+        char label[64];
+        snprintf(label, sizeof(label), "rowBlockTranspose (%s, %d chunk%s)", variant_datatypes[v] ? "datatypes" : "unpack",
+                 variant_chunks[v], variant_chunks[v] > 1 ? "s" : "");
+        row_block_t block_B, block_C;
+        mpi_timing_t timing;
+        MPI_Barrier(MPI_COMM_WORLD);
+        double start = MPI_Wtime();
+        rowBlockTranspose(&block_A, &block_B, variant_chunks[v], variant_datatypes[v], MPI_COMM_WORLD, &timing);
+        MPI_Barrier(MPI_COMM_WORLD);
+        double elapsed = MPI_Wtime() - start;
+        if (rank == 0)
+            printf("%s over %d ranks: %e\n", label, size, elapsed);
+        printRankTimings(label, timing);
+
+        // B against the serial transpose, then (A^T)^T against A block by block
+        rowBlockGather(&block_B, B, 0, MPI_COMM_WORLD);
+        int failed = 0;
+        for (long int i = 0; rank == 0 && i < (long int)N * M; i++) {
+            if (B[i] != B_serial[i]) {
+                fprintf(stderr, "Error: %s B[%ld] = %ld != B_serial[%ld] = %ld!\n", label, i, B[i], i, B_serial[i]);
+                failed = 1;
+                break;
+            }
+        }
+        rowBlockTranspose(&block_B, &block_C, variant_chunks[v], variant_datatypes[v], MPI_COMM_WORLD, NULL);
+        if (memcmp(block_C.local, block_A.local, (size_t)block_A.rows * M * sizeof(long int)) != 0) {
+            fprintf(stderr, "Error: %s transposing twice on rank %d does not give back A!\n", label, rank);
+            failed = 1;
+        }
+        MPI_Allreduce(MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+        errors |= failed;
+        free(block_B.local);
+        free(block_C.local);
+    }
+
+    free(block_A.local);
+    free(A);
+    free(B);
+    free(B_serial);
+    MPI_Finalize();
+    return errors ? -1 : 0;
+}
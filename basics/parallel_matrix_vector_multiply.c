@@ -0,0 +1,496 @@
+/**
+ * @file parallel_matrix_vector_multiply.c
+ * @author Navid Shamszadeh
+ * @brief Distributed matrix vector multiplication b = A x with a 1D row-block or a 2D grid decomposition of A using
+ * open-mpi, with A resident on the ranks across repeated products.
+ * @details The decomposed matrix lives in a context created once and reused by every product, as in power
+ * iteration, so only the vectors move per call.
+ *
+ * 1D: every rank owns a block of rows of A and the matching piece of x (the block decomposition of the M entries).
+ * A product all-gathers x and multiplies locally; b comes out distributed like the rows, so when A is square it is
+ * already laid out like x for the next product. The overlapped version posts MPI_Iallgatherv and meanwhile
+ * multiplies the columns of its block matching the piece of x it owns, then adds the remaining columns once x is
+ * complete.
+ *
+ * 2D: process (i, j) of a Pr x Pc grid owns block (i, j) of A. Segment j of x (the columns of grid column j) is held
+ * by process (j % Pr, j) and broadcast down grid column j; the partial sums of segment i of b are reduced along grid
+ * row i to process (i, i % Pc). On a square grid with a square A both owners are the diagonal processes, so b is
+ * again laid out like x. The overlapped version broadcasts x in chunks of GEMV_CHUNK_COLUMNS columns and reduces b in
+ * panels of GEMV_PANEL_ROWS rows: the first row panel is multiplied chunk by chunk as the chunks arrive, and the
+ * reduction of every finished panel proceeds while the next panels are multiplied.
+ *
+ * Each call records the time spent multiplying, in the calls distributing x (posting, polling and waiting) and in the
+ * calls reducing b, so the three add up to the call; the driver repeats the product
+ * with x = b % 1000 (when b is laid out like x, otherwise with the same x), checks the last b against the serial
+ * kernel and prints per-call breakdowns for the blocking and overlapped versions of both decompositions.
+ * Run with e.g. mpirun -np 4 ./parallel_matrix_vector_multiply N M [iterations] [Pr Pc].
+ * @date 2021-05-24
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <mpi.h>
+#include "../printMatrix.h"
+#include "../distributed.h"
+
+// columns of x broadcast per request in the overlapped 2D product
+#define GEMV_CHUNK_COLUMNS 1024
+// rows of b reduced per request in the overlapped 2D product
+#define GEMV_PANEL_ROWS 256
+// rows multiplied between two polls of the outstanding 1D all-gather
+#define GEMV_POLL_ROWS 256
+// default number of repeated products
+#define GEMV_ITERATIONS 10
+
+/**
+ * @brief Wall clock time spent by one rank in each phase of the distributed products, summed over calls.
+ */
+typedef struct {
+    double compute;   // local multiplications and additions
+    double broadcast; // distributing x: posting, polling and waiting for it
+    double reduce;    // reducing b: posting, polling and waiting for it
+    double total;     // whole calls
+} gemv_timing_t;
+
+/**
+ * @brief A resident 1D row-block decomposition of A and the buffers its products reuse.
+ */
+typedef struct {
+    row_block_t A;      // this rank's rows of A
+    int x_count;        // entries of x owned by this rank
+    int x_first;        // global index of the first owned entry
+    int *counts;        // entries of x owned by every rank
+    int *displs;        // first entry of x owned by every rank
+    long int *x;        // all of x, gathered by every product
+    long int *scratch;  // partial products of the rows of the block
+} gemv_row_t;
+
+/**
+ * @brief A resident 2D block decomposition of A and the buffers its products reuse.
+ */
+typedef struct {
+    const process_grid_t *grid;
+    grid_block_t A;         // this process's block of A
+    int x_root;             // grid row holding segment my_col of x
+    int b_root;             // grid column receiving segment my_row of b
+    long int *x;            // segment my_col of x, broadcast by every product
+    long int *b;            // partial sums of segment my_row of b
+    long int *scratch;      // partial products of the rows of the first panel
+    MPI_Request *requests;  // one per chunk of x and per panel of b
+} gemv_grid_t;
+
+/**
+ * @brief Scatters the N x M matrix A from rank 0 into a resident row-block decomposition over comm.
+ *
+ * @param N Number of rows
+ * @param M Number of columns
+ * @param A Strided N x M matrix, only significant on rank 0
+ * @param comm Communicator
+ * @param gemv Output context. Release with gemvRowFree.
+ */
+void gemvRowCreate(int N, int M, long int *A, MPI_Comm comm, gemv_row_t *gemv) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    rowBlockScatter(N, M, A, 0, comm, &gemv->A);
+    rowBlockRange(M, size, rank, &gemv->x_count, &gemv->x_first);
+    gemv->counts = (int *)malloc(size * sizeof(int));
+    gemv->displs = (int *)malloc(size * sizeof(int));
+    rowBlockCounts(M, 1, size, gemv->counts, gemv->displs);
+    gemv->x = (long int *)malloc(((size_t)M + 1) * sizeof(long int));
+    gemv->scratch = (long int *)malloc(((size_t)gemv->A.rows + 1) * sizeof(long int));
+}
+
+/**
+ * @brief Releases a row-block decomposition.
+ */
+void gemvRowFree(gemv_row_t *gemv) {
+    free(gemv->A.local);
+    free(gemv->counts);
+    free(gemv->displs);
+    free(gemv->x);
+    free(gemv->scratch);
+}
+
+/**
+ * @brief Adds the rows x count strided matrix A times x to b, computing the product into scratch first.
+ */
+void gemvAccumulate(int rows, int count, const long int *A, int lda, const long int *x, long int *scratch, long int *b) {
+    if (rows == 0 || count == 0)
+        return;
+    parallelGemv(rows, count, A, lda, x, scratch);
+    for (int i = 0; i < rows; i++) {
+        b[i] += scratch[i];
+    }
+}
+
+/**
+ * @brief Distributed b = A x on a row-block decomposition. Must be called by every rank of the communicator.
+ *
+ * @param gemv Row-block decomposition of A
+ * @param comm Communicator the decomposition was created on
+ * @param x_local This rank's piece of x, x_count entries
+ * @param b_local Output rows of b owned by this rank, A.rows entries
+ * @param overlap 0 to gather x before multiplying, 1 to multiply the owned columns while x is gathered
+ * @param timing If not NULL, the time of this call is added to it
+ */
+void gemvRowMultiply(gemv_row_t *gemv, MPI_Comm comm, const long int *x_local, long int *b_local, int overlap, gemv_timing_t *timing) {
+    int rows = gemv->A.rows, M = gemv->A.M;
+    double compute = 0.0, broadcast = 0.0;
+    double start = MPI_Wtime();
+
+    if (!overlap) {
+        MPI_Allgatherv(x_local, gemv->x_count, MPI_LONG, gemv->x, gemv->counts, gemv->displs, MPI_LONG, comm);
+        double t0 = MPI_Wtime();
+        parallelGemv(rows, M, gemv->A.local, M, gemv->x, b_local);
+        broadcast = t0 - start;
+        compute = MPI_Wtime() - t0;
+    } else {
+        MPI_Request request;
+        MPI_Iallgatherv(x_local, gemv->x_count, MPI_LONG, gemv->x, gemv->counts, gemv->displs, MPI_LONG, comm, &request);
+        broadcast = MPI_Wtime() - start;
+
+        // the owned columns need only the owned piece of x; poll the gather in between so it progresses
+        const long int *A_own = gemv->A.local + gemv->x_first;
+        for (int i0 = 0; i0 < rows; i0 += GEMV_POLL_ROWS) {
+            int mr = (rows - i0 < GEMV_POLL_ROWS) ? rows - i0 : GEMV_POLL_ROWS;
+            double t0 = MPI_Wtime();
+            parallelGemv(mr, gemv->x_count, A_own + (long int)M * i0, M, x_local, b_local + i0);
+            double t1 = MPI_Wtime();
+            int done;
+            MPI_Test(&request, &done, MPI_STATUS_IGNORE);
+            compute += t1 - t0;
+            broadcast += MPI_Wtime() - t1;
+        }
+
+        double t0 = MPI_Wtime();
+        MPI_Wait(&request, MPI_STATUS_IGNORE);
+        double t1 = MPI_Wtime();
+        int x_last = gemv->x_first + gemv->x_count;
+        gemvAccumulate(rows, gemv->x_first, gemv->A.local, M, gemv->x, gemv->scratch, b_local);
+        gemvAccumulate(rows, M - x_last, gemv->A.local + x_last, M, gemv->x + x_last, gemv->scratch, b_local);
+        broadcast += t1 - t0;
+        compute += MPI_Wtime() - t1;
+    }
+
+    if (timing != NULL) {
+        timing->compute += compute;
+        timing->broadcast += broadcast;
+        timing->total += MPI_Wtime() - start;
+    }
+}
+
+/**
+ * @brief Scatters the N x M matrix A from grid rank 0 into a resident block decomposition over grid.
+ *
+ * @param grid Process grid
+ * @param N Number of rows
+ * @param M Number of columns
+ * @param A Strided N x M matrix, only significant on grid rank 0
+ * @param gemv Output context. Release with gemvGridFree.
+ */
+void gemvGridCreate(const process_grid_t *grid, int N, int M, long int *A, gemv_grid_t *gemv) {
+    gemv->grid = grid;
+    gridBlockScatter(grid, N, M, A, &gemv->A);
+    gemv->x_root = grid->my_col % grid->Pr;
+    gemv->b_root = grid->my_row % grid->Pc;
+    gemv->x = (long int *)malloc(((size_t)gemv->A.cols + 1) * sizeof(long int));
+    gemv->b = (long int *)malloc(((size_t)gemv->A.rows + 1) * sizeof(long int));
+    gemv->scratch = (long int *)malloc(((size_t)GEMV_PANEL_ROWS + 1) * sizeof(long int));
+    int chunks = (gemv->A.cols + GEMV_CHUNK_COLUMNS - 1) / GEMV_CHUNK_COLUMNS;
+    int panels = (gemv->A.rows + GEMV_PANEL_ROWS - 1) / GEMV_PANEL_ROWS;
+    gemv->requests = (MPI_Request *)malloc((chunks + panels + 1) * sizeof(MPI_Request));
+}
+
+/**
+ * @brief Releases a block decomposition; the grid itself is left alone.
+ */
+void gemvGridFree(gemv_grid_t *gemv) {
+    free(gemv->A.local);
+    free(gemv->x);
+    free(gemv->b);
+    free(gemv->scratch);
+    free(gemv->requests);
+}
+
+/**
+ * @brief Distributed b = A x on a block decomposition. Must be called by every process of the grid.
+ *
+ * @param gemv Block decomposition of A
+ * @param x_segment Segment my_col of x (A.cols entries), only significant on grid row x_root
+ * @param b_segment Output segment my_row of b (A.rows entries), only significant on grid column b_root
+ * @param overlap 0 to broadcast, multiply and reduce one after the other, 1 to pipeline them in chunks and panels
+ * @param timing If not NULL, the time of this call is added to it
+ */
+void gemvGridMultiply(gemv_grid_t *gemv, const long int *x_segment, long int *b_segment, int overlap, gemv_timing_t *timing) {
+    const process_grid_t *grid = gemv->grid;
+    int rows = gemv->A.rows, cols = gemv->A.cols;
+    const long int *A = gemv->A.local;
+    long int *b_out = (grid->my_col == gemv->b_root) ? b_segment : NULL;
+    double compute = 0.0, broadcast = 0.0, reduce = 0.0;
+    double start = MPI_Wtime();
+
+    if (grid->my_row == gemv->x_root)
+        memcpy(gemv->x, x_segment, (size_t)cols * sizeof(long int));
+
+    if (!overlap) {
+        MPI_Bcast(gemv->x, cols, MPI_LONG, gemv->x_root, grid->col_comm);
+        double t0 = MPI_Wtime();
+        parallelGemv(rows, cols, A, cols, gemv->x, gemv->b);
+        double t1 = MPI_Wtime();
+        MPI_Reduce(gemv->b, b_out, rows, MPI_LONG, MPI_SUM, gemv->b_root, grid->row_comm);
+        broadcast = t0 - start;
+        compute = t1 - t0;
+        reduce = MPI_Wtime() - t1;
+    } else {
+        int chunks = (cols + GEMV_CHUNK_COLUMNS - 1) / GEMV_CHUNK_COLUMNS;
+        int panels = (rows + GEMV_PANEL_ROWS - 1) / GEMV_PANEL_ROWS;
+        MPI_Request *chunk_requests = gemv->requests;
+        MPI_Request *panel_requests = gemv->requests + chunks;
+        for (int c = 0; c < chunks; c++) {
+            int c0 = c * GEMV_CHUNK_COLUMNS;
+            int cb = (cols - c0 < GEMV_CHUNK_COLUMNS) ? cols - c0 : GEMV_CHUNK_COLUMNS;
+            MPI_Ibcast(gemv->x + c0, cb, MPI_LONG, gemv->x_root, grid->col_comm, &chunk_requests[c]);
+        }
+        broadcast = MPI_Wtime() - start;
+
+        for (int p = 0; p < panels; p++) {
+            int r0 = p * GEMV_PANEL_ROWS;
+            int pr = (rows - r0 < GEMV_PANEL_ROWS) ? rows - r0 : GEMV_PANEL_ROWS;
+            if (p == 0) {
+                // x arrives chunk by chunk while the first panel is multiplied
+                for (int c = 0; c < chunks; c++) {
+                    int c0 = c * GEMV_CHUNK_COLUMNS;
+                    int cb = (cols - c0 < GEMV_CHUNK_COLUMNS) ? cols - c0 : GEMV_CHUNK_COLUMNS;
+                    double t0 = MPI_Wtime();
+                    MPI_Wait(&chunk_requests[c], MPI_STATUS_IGNORE);
+                    double t1 = MPI_Wtime();
+                    if (c == 0)
+                        parallelGemv(pr, cb, A + c0, cols, gemv->x + c0, gemv->b);
+                    else
+                        gemvAccumulate(pr, cb, A + c0, cols, gemv->x + c0, gemv->scratch, gemv->b);
+                    broadcast += t1 - t0;
+                    compute += MPI_Wtime() - t1;
+                }
+                if (chunks == 0)
+                    memset(gemv->b, 0, (size_t)pr * sizeof(long int));
+            } else {
+                double t0 = MPI_Wtime();
+                parallelGemv(pr, cols, A + (long int)cols * r0, cols, gemv->x, gemv->b + r0);
+                compute += MPI_Wtime() - t0;
+            }
+            double t0 = MPI_Wtime();
+            MPI_Ireduce(gemv->b + r0, b_out ? b_out + r0 : NULL, pr, MPI_LONG, MPI_SUM, gemv->b_root, grid->row_comm, &panel_requests[p]);
+            int done;
+            MPI_Testall(p + 1, panel_requests, &done, MPI_STATUSES_IGNORE);
+            reduce += MPI_Wtime() - t0;
+        }
+
+        // without rows the chunks of x were never waited for
+        double t0 = MPI_Wtime();
+        if (panels == 0)
+            MPI_Waitall(chunks, chunk_requests, MPI_STATUSES_IGNORE);
+        double t1 = MPI_Wtime();
+        MPI_Waitall(panels, panel_requests, MPI_STATUSES_IGNORE);
+        broadcast += t1 - t0;
+        reduce += MPI_Wtime() - t1;
+    }
+
+    if (timing != NULL) {
+        timing->compute += compute;
+        timing->broadcast += broadcast;
+        timing->reduce += reduce;
+        timing->total += MPI_Wtime() - start;
+    }
+}
+
+/**
+ * @brief The products the distributed versions repeat, computed serially: b = A x, then x = b % 1000 if feedback.
+ *
+ * @param N Number of rows of A
+ * @param M Number of columns of A
+ * @param A Strided N x M matrix
+ * @param x0 Initial x, M entries
+ * @param iterations Number of products
+ * @param feedback 1 to feed b back into x (needs N == M)
+ * @param b Output b of the last product, N entries
+ */
+void gemvReference(int N, int M, const long int *A, const long int *x0, int iterations, int feedback, long int *b) {
+    long int *x = (long int *)malloc(((size_t)M + 1) * sizeof(long int));
+    memcpy(x, x0, (size_t)M * sizeof(long int));
+    for (int t = 0; t < iterations; t++) {
+        simdGemv(N, M, A, M, x, b);
+        for (int i = 0; feedback && i < M; i++) {
+            x[i] = b[i] % 1000;
+        }
+    }
+    free(x);
+}
+
+/**
+ * @brief Prints the per-call time of each phase, the maximum over ranks, and the per-rank split of each call into
+ * computation and exposed communication.
+ * @details "other" is whatever part of the slowest call none of the phases accounts for, loop and bookkeeping
+ * overhead, and should stay near zero.
+ */
+void gemvReport(const char *label, gemv_timing_t timing, int iterations) {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    double other = timing.total - timing.compute - timing.broadcast - timing.reduce;
+    double mine[5] = {timing.total, timing.compute, timing.broadcast, timing.reduce, other};
+    double slowest[5];
+    MPI_Reduce(mine, slowest, 5, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        printf("%s per call: %e \t compute %e \t x %e \t b %e \t other %e\n", label, slowest[0] / iterations,
+               slowest[1] / iterations, slowest[2] / iterations, slowest[3] / iterations, slowest[4] / iterations);
+    }
+    mpi_timing_t per_call = {timing.compute / iterations, (timing.total - timing.compute) / iterations};
+    printRankTimings(label, per_call);
+}
+
+/**
+ * @brief Compares b with the reference on rank 0 and tells every rank whether they match.
+ */
+int gemvCheck(const char *label, int N, const long int *b, const long int *b_reference) {
+    int rank, errors = 0;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (rank == 0) {
+        for (int i = 0; i < N; i++) {
+            if (b[i] != b_reference[i]) {
+                fprintf(stderr, "Error: %s b[%d] = %ld != b_reference[%d] = %ld!\n", label, i, b[i], i, b_reference[i]);
+                errors = 1;
+                break;
+            }
+        }
+    }
+    MPI_Bcast(&errors, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    return errors;
+}
+
+int main(int argc, char* argv[]) {
+    hybridInit(&argc, &argv);
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (argc < 3) {
+        if (rank == 0)
+            fprintf(stderr, "Usage: %s N M [iterations] [Pr Pc]\n", argv[0]);
+        MPI_Finalize();
+        return -1;
+    }
+    int N = atoi(argv[1]);
+    int M = atoi(argv[2]);
+    int iterations = (argc > 3) ? atoi(argv[3]) : GEMV_ITERATIONS;
+    int Pr = (argc > 5) ? atoi(argv[4]) : 0;
+    int Pc = (argc > 5) ? atoi(argv[5]) : 0;
+    if (iterations < 1)
+        iterations = 1;
+    process_grid_t grid;
+    if (processGridCreate(MPI_COMM_WORLD, Pr, Pc, &grid) != 0) {
+        if (rank == 0)
+            fprintf(stderr, "Usage: %s N M [iterations] [Pr Pc], with Pr * Pc processes\n", argv[0]);
+        MPI_Finalize();
+        return -1;
+    }
+
+    // rank 0 builds A; every rank gets the initial x and takes the part it owns
+    long int *A = NULL, *b = NULL, *b_reference = NULL;
+    long int *x0 = (long int *)malloc(((size_t)M + 1) * sizeof(long int));
+    if (rank == 0) {
+        srandom(time(NULL));
+        A = (long int *)malloc(((size_t)N * M + 1) * sizeof(long int));
+        b = (long int *)malloc(((size_t)N + 1) * sizeof(long int));
+        b_reference = (long int *)malloc(((size_t)N + 1) * sizeof(long int));
+        for (long int i = 0; i < (long int)N * M; i++) {
+            A[i] = random() % 1000;
+        }
+        for (int i = 0; i < M; i++) {
+            x0[i] = random() % 1000;
+        }
+    }
+    MPI_Bcast(x0, M, MPI_LONG, 0, MPI_COMM_WORLD);
+    int errors = 0;
+
+    // 1D row blocks: b is laid out like x whenever A is square
+    gemv_row_t row;
+    gemvRowCreate(N, M, A, MPI_COMM_WORLD, &row);
+    int row_feedback = (N == M);
+    if (rank == 0) {
+        gemvReference(N, M, A, x0, iterations, row_feedback, b_reference);
+        printf("1D row blocks over %d ranks, %d products, x %s\n", size, iterations, row_feedback ? "= b % 1000" : "fixed");
+    }
+    long int *x_local = (long int *)malloc(((size_t)row.x_count + 1) * sizeof(long int));
+    row_block_t b_rows = {N, 1, row.A.rows, row.A.first_row, NULL};
+    b_rows.local = (long int *)malloc(((size_t)row.A.rows + 1) * sizeof(long int));
+    for (int overlap = 0; overlap < 2; overlap++) {
+        const char *label = overlap ? "gemvRowMultiply (overlapped)" : "gemvRowMultiply (blocking)";
+        gemv_timing_t timing = {0};
+        memcpy(x_local, x0 + row.x_first, (size_t)row.x_count * sizeof(long int));
+        MPI_Barrier(MPI_COMM_WORLD);
+        for (int t = 0; t < iterations; t++) {
+            gemvRowMultiply(&row, MPI_COMM_WORLD, x_local, b_rows.local, overlap, &timing);
+            for (int i = 0; row_feedback && i < row.x_count; i++) {
+                x_local[i] = b_rows.local[i] % 1000;
+            }
+        }
+        gemvReport(label, timing, iterations);
+        rowBlockGather(&b_rows, b, 0, MPI_COMM_WORLD);
+        errors |= gemvCheck(label, N, b, b_reference);
+    }
+    free(x_local);
+    free(b_rows.local);
+    gemvRowFree(&row);
+
+    // 2D blocks: b is laid out like x on a square grid with a square A
+    gemv_grid_t block;
+    gemvGridCreate(&grid, N, M, A, &block);
+    int grid_feedback = (N == M && grid.Pr == grid.Pc);
+    if (rank == 0) {
+        if (grid_feedback != row_feedback)
+            gemvReference(N, M, A, x0, iterations, grid_feedback, b_reference);
+        printf("2D blocks on a %d x %d grid, %d products, x %s\n", grid.Pr, grid.Pc, iterations, grid_feedback ? "= b % 1000" : "fixed");
+    }
+    long int *x_segment = (long int *)malloc(((size_t)block.A.cols + 1) * sizeof(long int));
+    long int *b_segment = (long int *)malloc(((size_t)block.A.rows + 1) * sizeof(long int));
+    long int *b_sum = (long int *)calloc((size_t)N + 1, sizeof(long int));
+    for (int overlap = 0; overlap < 2; overlap++) {
+        const char *label = overlap ? "gemvGridMultiply (overlapped)" : "gemvGridMultiply (blocking)";
+        gemv_timing_t timing = {0};
+        memcpy(x_segment, x0 + block.A.first_col, (size_t)block.A.cols * sizeof(long int));
+        MPI_Barrier(MPI_COMM_WORLD);
+        for (int t = 0; t < iterations; t++) {
+            gemvGridMultiply(&block, x_segment, b_segment, overlap, &timing);
+            for (int i = 0; grid_feedback && grid.my_row == grid.my_col && i < block.A.cols; i++) {
+                x_segment[i] = b_segment[i] % 1000;
+            }
+        }
+        gemvReport(label, timing, iterations);
+
+        // the owner of each segment of b contributes it, everyone else zeros
+        memset(b_sum, 0, (size_t)N * sizeof(long int));
+        if (grid.my_col == block.b_root)
+            memcpy(b_sum + block.A.first_row, b_segment, (size_t)block.A.rows * sizeof(long int));
+        MPI_Reduce(b_sum, b, N, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        errors |= gemvCheck(label, N, b, b_reference);
+    }
+    free(x_segment);
+    free(b_segment);
+    free(b_sum);
+    gemvGridFree(&block);
+    processGridFree(&grid);
+
+    if (rank == 0) {
+        double start = MPI_Wtime();
+        gemvReference(N, M, A, x0, 1, 0, b_reference);
+        printf("serial simdGemv (%s): %e\n", simdIsaNames[simdIsa], MPI_Wtime() - start);
+    }
+    free(A);
+    free(b);
+    free(b_reference);
+    free(x0);
+    MPI_Finalize();
+    return errors ? -1 : 0;
+}
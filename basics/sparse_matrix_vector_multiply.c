@@ -0,0 +1,199 @@
+/**
+ * @file sparse_matrix_vector_multiply.c
+ * @author Navid Shamszadeh
+ * @brief Sparse matrix vector multiplication (CSR, CSC, SELL-C-sigma) benchmarked against the dense strided GEMV.
+ * @details Builds a random N x M double matrix with the given fraction of nonzeros in the strided dense layout,
+ * converts it to the sparse formats, checks every product against the dense one and reports the timings through
+ * the benchmark harness. With --skewed every 64th row is 16 times denser than the others, which shows the effect of
+ * splitting the threaded product by nonzeros instead of by rows.
+ * Run with e.g. ./sparse_matrix_vector_multiply 20000 20000 0.001 --csv
+ * @date 2021-05-20
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../benchmark.h"
+#include "../kernels.h"
+#include "../threads.h"
+#include "../sparse.h"
+
+// rows per window sorted by length in the SELL-C-sigma layout
+#define SPARSE_SIGMA 256
+
+/**
+ * @brief Operands of every variant.
+ */
+typedef struct {
+    int N;
+    int M;
+    const double *A; // dense strided matrix
+    sparse_csr_t csr;
+    sparse_csc_t csc;
+    sparse_sell_t sell;
+    const double *x;
+    double *b;
+} sparse_operands_t;
+
+void benchDense(void *args) {
+    sparse_operands_t *op = (sparse_operands_t *)args;
+    gemvDouble(op->N, op->M, op->A, op->M, op->x, op->b);
+}
+
+void benchCsr(void *args) {
+    sparse_operands_t *op = (sparse_operands_t *)args;
+    sparseCsrMultiplyVector(&op->csr, op->x, op->b);
+}
+
+void benchCsrThreaded(void *args) {
+    sparse_operands_t *op = (sparse_operands_t *)args;
+    parallelSparseCsrMultiplyVector(&op->csr, op->x, op->b);
+}
+
+void benchCsc(void *args) {
+    sparse_operands_t *op = (sparse_operands_t *)args;
+    sparseCscMultiplyVector(&op->csc, op->x, op->b);
+}
+
+void benchSell(void *args) {
+    sparse_operands_t *op = (sparse_operands_t *)args;
+    sparseSellMultiplyVector(&op->sell, op->x, op->b);
+}
+
+void benchSellThreaded(void *args) {
+    sparse_operands_t *op = (sparse_operands_t *)args;
+    parallelSparseSellMultiplyVector(&op->sell, op->x, op->b);
+}
+
+/**
+ * @brief Compares b against the reference product, the values are small integers so the sums are exact.
+ */
+int sparseCheck(const char *name, int N, const double *reference, const double *b) {
+    for (int i = 0; i < N; i++) {
+        if (reference[i] != b[i]) {
+            fprintf(stderr, "Error! %s: b[%d] = %f != %f.\n", name, i, b[i], reference[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    int N = (argc > 3) ? atoi(argv[1]) : 0;
+    int M = (argc > 3) ? atoi(argv[2]) : 0;
+    if (N < 1 || M < 1) {
+        fprintf(stderr, "Usage: %s N M density [--csv | --json] [--trials T] [--skewed]\n", argv[0]);
+        return -1;
+    }
+    double density = atof(argv[3]);
+    benchmark_format_t format = BENCHMARK_TEXT;
+    int trials = BENCHMARK_TRIALS;
+    int skewed = 0;
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0)
+            format = BENCHMARK_CSV;
+        else if (strcmp(argv[i], "--json") == 0)
+            format = BENCHMARK_JSON;
+        else if (strcmp(argv[i], "--trials") == 0 && i + 1 < argc)
+            trials = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--skewed") == 0)
+            skewed = 1;
+    }
+
+    // get a random seed
+    srandom(time(NULL));
+
+    // random sparse matrix in the dense strided layout, small integer values
+    double *A = (double *)malloc((size_t)N * M * sizeof(double));
+    double *x = (double *)malloc(M * sizeof(double));
+    double *reference = (double *)malloc(N * sizeof(double));
+    double *b = (double *)malloc(N * sizeof(double));
+    if (A == NULL || x == NULL || reference == NULL || b == NULL) {
+        fprintf(stderr, "Error: could not allocate the matrix!\n");
+        exit(-1);
+    }
+    for (int i = 0; i < N; i++) {
+        double p = (skewed && i % 64 == 0) ? 16.0 * density : density;
+        for (int j = 0; j < M; j++) {
+            A[j + (long int)M * i] = ((double)random() / RAND_MAX < p) ? (double)(random() % 19 - 9) : 0.0;
+        }
+    }
+    for (int j = 0; j < M; j++) {
+        x[j] = (double)(random() % 7 - 3);
+    }
+
+    sparse_operands_t op = {N, M, A, {0}, {0}, {0}, x, b};
+    double start = benchmarkNow();
+    if (sparseCsrFromDense(N, M, A, M, &op.csr) != 0 || sparseCscFromCsr(&op.csr, &op.csc) != 0
+        || sparseSellFromCsr(&op.csr, SPARSE_SIGMA, &op.sell) != 0) {
+        fprintf(stderr, "Error: could not allocate the sparse matrix!\n");
+        exit(-1);
+    }
+    double convert_time = benchmarkNow() - start;
+    long int nnz = op.csr.nnz;
+    long int stored = op.sell.sliceStart[op.sell.slices];
+
+    // check every variant against the dense product
+    gemvDouble(N, M, A, M, x, reference);
+    int errors = 0;
+    sparseCsrMultiplyVector(&op.csr, x, b);
+    errors |= sparseCheck("sparseCsrMultiplyVector", N, reference, b);
+    parallelSparseCsrMultiplyVector(&op.csr, x, b);
+    errors |= sparseCheck("parallelSparseCsrMultiplyVector", N, reference, b);
+    sparseCscMultiplyVector(&op.csc, x, b);
+    errors |= sparseCheck("sparseCscMultiplyVector", N, reference, b);
+    sparseSellMultiplyVector(&op.sell, x, b);
+    errors |= sparseCheck("sparseSellMultiplyVector", N, reference, b);
+    parallelSparseSellMultiplyVector(&op.sell, x, b);
+    errors |= sparseCheck("parallelSparseSellMultiplyVector", N, reference, b);
+
+    // traffic: the dense path reads all of A, the sparse ones each stored value with its index, plus x and b
+    double dense_bytes = 8.0 * ((double)N * M + M + N);
+    double csr_bytes = 12.0 * nnz + 8.0 * (N + 1) + 8.0 * (M + N);
+    double sell_bytes = 12.0 * stored + 4.0 * N + 8.0 * (M + N);
+    struct {
+        const char *kernel;
+        const char *variant;
+        void (*run)(void *);
+        int threaded;
+        double bytes;
+    } variants[] = {
+        {"gemv", "dense", benchDense, 0, dense_bytes},
+        {"spmv-csr", "serial", benchCsr, 0, csr_bytes},
+        {"spmv-csr", "threaded", benchCsrThreaded, 1, csr_bytes},
+        {"spmv-csc", "serial", benchCsc, 0, csr_bytes + 8.0 * nnz},
+        {"spmv-sell", "serial", benchSell, 0, sell_bytes},
+        {"spmv-sell", "threaded", benchSellThreaded, 1, sell_bytes},
+    };
+
+    benchmark_report_t report;
+    benchmarkReportBegin(&report, stdout, format, 0.0);
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+        benchmark_result_t result;
+        result.kernel = variants[v].kernel;
+        result.variant = variants[v].variant;
+        result.N = N;
+        result.M = M;
+        result.K = 0;
+        result.threads = variants[v].threaded ? threadsConfig.count : 1;
+        result.flops = (v == 0) ? 2.0 * N * M : 2.0 * nnz;
+        result.bytes = variants[v].bytes;
+        result.stats = benchmarkRun(variants[v].run, &op, BENCHMARK_WARMUP, trials);
+        benchmarkReportAdd(&report, &result);
+    }
+    benchmarkReportEnd(&report);
+    if (format == BENCHMARK_TEXT) {
+        printf("nnz: %ld (%.3f%%) \t SELL-%d-%d padding: %.1f%% \t conversion: %e s\n", nnz,
+               100.0 * nnz / ((double)N * M), SPARSE_SELL_C, op.sell.sigma, nnz ? 100.0 * (stored - nnz) / nnz : 0.0, convert_time);
+    }
+
+    sparseCsrFree(&op.csr);
+    sparseCscFree(&op.csc);
+    sparseSellFree(&op.sell);
+    free(A);
+    free(x);
+    free(reference);
+    free(b);
+    return errors ? -1 : 0;
+}
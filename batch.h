@@ -0,0 +1,48 @@
+/**
+ * @file batch.h
+ * @author Navid Shamszadeh
+ * @brief Batched GEMM, LU and triangular solve for many independent small matrices (about 4 x 4 to 32 x 32).
+ * @details Calling the general kernels once per tiny matrix spends most of the time on call overhead, blocking
+ * logic and edge handling sized for large matrices. The batched calls take the whole batch at once, either as
+ * packed matrices at a fixed stride or as an array of pointers, split it across the threading layer and run small
+ * kernels with no blocking at all. For square 4, 8, 16 and 32 the kernels are specialized at compile time, so the
+ * loops are fully unrolled; other sizes use the same code with run time bounds.
+ *
+ * Packed matrices are row-major with leading dimension equal to their width. In the interleaved layout BATCH_LANES
+ * matrices are stored element by element side by side (see batchInterleave), so one SIMD instruction works on the
+ * same element of BATCH_LANES different matrices and no lane is ever idle, however small the matrices are.
+ *
+ * The kernels come from batchTemplate.h, instantiated for double and float (suffixes Double and Float, e.g.
+ * batchGemmStridedDouble).
+ * @date 2021-05-21
+ */
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "simd.h"
+#include "threads.h"
+
+// matrices side by side in the interleaved layout, one AVX-512 register of doubles
+#define BATCH_LANES 8
+// smallest number of matrices (or interleaved groups) handed to a thread at once
+#define BATCH_GRAIN 16
+
+/**
+ * @brief Elements needed to hold count rows x cols matrices in the interleaved layout, including the padding lanes
+ * of the last group.
+ */
+long int batchInterleavedSize(long int count, int rows, int cols) {
+    return (count + BATCH_LANES - 1) / BATCH_LANES * BATCH_LANES * (long int)rows * cols;
+}
+
+#define BATCH_T double
+#define BATCH_NAME(x) x##Double
+#include "batchTemplate.h"
+
+#define BATCH_T float
+#define BATCH_NAME(x) x##Float
+#include "batchTemplate.h"
+
+#endif
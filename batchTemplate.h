@@ -0,0 +1,618 @@
+/**
+ * @file batchTemplate.h
+ * @author Navid Shamszadeh
+ * @brief Type-generic batched small-matrix GEMM, LU and triangular solve kernels, included by batch.h once per
+ * floating point type.
+ * @details Before including, define BATCH_T as the element type and BATCH_NAME(x) to append the type's suffix to a
+ * function name. Both are undefined again at the end of this file.
+ * The small kernels take their dimensions as arguments but are always inlined; the batch loops call them with
+ * literal sizes for the common square cases, so the compiler generates a fully unrolled kernel per size. Each batch
+ * loop is compiled once per instruction set with target attributes and selected at startup like kernelsTemplate.h.
+ * The batched calls are recorded by perf.h with the batch count as the first size and the matrix order after it.
+ * @date 2021-05-21
+ */
+
+/**
+ * @brief Arguments of one batched call. A, B and C are either a base pointer with a stride between matrices or,
+ * if the pointer array is given, one pointer per matrix.
+ */
+typedef struct {
+    int m, n, k;      // C is m x n, A is m x k, B is k x n; LU and triangular solves use n (and k right-hand sides)
+    int lower;        // triangular solve with the lower (nonzero) or upper triangle
+    int unit_diagonal;
+    const BATCH_T *A;
+    long int strideA;
+    const BATCH_T *const *Aptr;
+    BATCH_T *B;
+    long int strideB;
+    BATCH_T *const *Bptr;
+    BATCH_T *C;
+    long int strideC;
+    BATCH_T *const *Cptr;
+    int *pivots;
+    int *info;
+} BATCH_NAME(batch_args_t);
+
+/**
+ * @brief C = A * B for one packed small matrix product (row-major, leading dimensions equal to the widths).
+ */
+static inline __attribute__((always_inline)) void BATCH_NAME(gemmSmall)(int m, int n, int k, const BATCH_T *A, const BATCH_T *B, BATCH_T *C) {
+    for (int i = 0; i < m; i++) {
+        BATCH_T *c = C + (long int)n * i;
+        for (int j = 0; j < n; j++) {
+            c[j] = 0;
+        }
+        for (int p = 0; p < k; p++) {
+            BATCH_T a = A[p + (long int)k * i];
+            const BATCH_T *b = B + (long int)n * p;
+            for (int j = 0; j < n; j++) {
+                c[j] += a * b[j];
+            }
+        }
+    }
+}
+
+/**
+ * @brief Unblocked LU with partial pivoting of one packed n x n matrix, as luFactorStrided.
+ * @return 0, or i + 1 if U[i][i] is exactly zero
+ */
+static inline __attribute__((always_inline)) int BATCH_NAME(luSmall)(int n, BATCH_T *A, int *pivots) {
+    int info = 0;
+    for (int k = 0; k < n; k++) {
+        int p = k;
+        BATCH_T max = (A[k + n * k] < 0) ? -A[k + n * k] : A[k + n * k];
+        for (int i = k + 1; i < n; i++) {
+            BATCH_T v = (A[k + n * i] < 0) ? -A[k + n * i] : A[k + n * i];
+            if (v > max) {
+                max = v;
+                p = i;
+            }
+        }
+        pivots[k] = p;
+        if (max == 0) {
+            if (info == 0)
+                info = k + 1;
+            continue;
+        }
+        if (p != k) {
+            for (int j = 0; j < n; j++) {
+                BATCH_T temp = A[j + n * k];
+                A[j + n * k] = A[j + n * p];
+                A[j + n * p] = temp;
+            }
+        }
+        BATCH_T inverse = 1 / A[k + n * k];
+        for (int i = k + 1; i < n; i++) {
+            BATCH_T l = A[k + n * i] *= inverse;
+            for (int j = k + 1; j < n; j++) {
+                A[j + n * i] -= l * A[j + n * k];
+            }
+        }
+    }
+    return info;
+}
+
+/**
+ * @brief T X = B for one packed n x n triangular T and n x nrhs right-hand sides, B overwritten with X.
+ */
+static inline __attribute__((always_inline)) void BATCH_NAME(trsmSmall)(int n, int nrhs, int lower, int unit_diagonal, const BATCH_T *T, BATCH_T *B) {
+    for (int step = 0; step < n; step++) {
+        int i = lower ? step : n - 1 - step;
+        BATCH_T *row_i = B + (long int)nrhs * i;
+        int k_begin = lower ? 0 : i + 1;
+        int k_end = lower ? i : n;
+        for (int k = k_begin; k < k_end; k++) {
+            BATCH_T t = T[k + n * i];
+            const BATCH_T *row_k = B + (long int)nrhs * k;
+            for (int j = 0; j < nrhs; j++) {
+                row_i[j] -= t * row_k[j];
+            }
+        }
+        if (!unit_diagonal) {
+            BATCH_T inverse = 1 / T[i + n * i];
+            for (int j = 0; j < nrhs; j++) {
+                row_i[j] *= inverse;
+            }
+        }
+    }
+}
+
+/**
+ * @brief C = A * B for one group of BATCH_LANES interleaved products: the lanes are independent matrices, so the
+ * innermost loop is one SIMD operation across them.
+ */
+static inline __attribute__((always_inline)) void BATCH_NAME(gemmInterleavedSmall)(int m, int n, int k, const BATCH_T *A, const BATCH_T *B, BATCH_T *C) {
+    for (int i = 0; i < m; i++) {
+        for (int j = 0; j < n; j++) {
+            BATCH_T sum[BATCH_LANES] = {0};
+            for (int p = 0; p < k; p++) {
+                const BATCH_T *a = A + ((long int)k * i + p) * BATCH_LANES;
+                const BATCH_T *b = B + ((long int)n * p + j) * BATCH_LANES;
+                for (int l = 0; l < BATCH_LANES; l++) {
+                    sum[l] += a[l] * b[l];
+                }
+            }
+            memcpy(C + ((long int)n * i + j) * BATCH_LANES, sum, sizeof(sum));
+        }
+    }
+}
+
+/**
+ * @brief LU with partial pivoting of one group of BATCH_LANES interleaved n x n matrices.
+ * @details Every lane picks and swaps its own pivot row, then the elimination runs across all lanes at once. A
+ * singular lane gets a zero multiplier column and its info entry set, the other lanes are unaffected.
+ */
+static inline __attribute__((always_inline)) void BATCH_NAME(luInterleavedSmall)(int n, BATCH_T *A, int *pivots, int *info) {
+    for (int l = 0; l < BATCH_LANES; l++) {
+        info[l] = 0;
+    }
+    for (int k = 0; k < n; k++) {
+        BATCH_T *row_k = A + (long int)n * k * BATCH_LANES;
+        for (int l = 0; l < BATCH_LANES; l++) {
+            int p = k;
+            BATCH_T max = (row_k[k * BATCH_LANES + l] < 0) ? -row_k[k * BATCH_LANES + l] : row_k[k * BATCH_LANES + l];
+            for (int i = k + 1; i < n; i++) {
+                BATCH_T a = A[((long int)n * i + k) * BATCH_LANES + l];
+                BATCH_T v = (a < 0) ? -a : a;
+                if (v > max) {
+                    max = v;
+                    p = i;
+                }
+            }
+            pivots[k * BATCH_LANES + l] = p;
+            if (max == 0 && info[l] == 0)
+                info[l] = k + 1;
+            if (p != k) {
+                BATCH_T *row_p = A + (long int)n * p * BATCH_LANES;
+                for (int j = 0; j < n; j++) {
+                    BATCH_T temp = row_k[j * BATCH_LANES + l];
+                    row_k[j * BATCH_LANES + l] = row_p[j * BATCH_LANES + l];
+                    row_p[j * BATCH_LANES + l] = temp;
+                }
+            }
+        }
+        BATCH_T inverse[BATCH_LANES];
+        for (int l = 0; l < BATCH_LANES; l++) {
+            BATCH_T d = row_k[k * BATCH_LANES + l];
+            inverse[l] = (d != 0) ? 1 / d : 0;
+        }
+        for (int i = k + 1; i < n; i++) {
+            BATCH_T *row_i = A + (long int)n * i * BATCH_LANES;
+            for (int l = 0; l < BATCH_LANES; l++) {
+                row_i[k * BATCH_LANES + l] *= inverse[l];
+            }
+            for (int j = k + 1; j < n; j++) {
+                for (int l = 0; l < BATCH_LANES; l++) {
+                    row_i[j * BATCH_LANES + l] -= row_i[k * BATCH_LANES + l] * row_k[j * BATCH_LANES + l];
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Solves A x = b for one group of interleaved LU factors and interleaved right-hand side vectors.
+ */
+static inline __attribute__((always_inline)) void BATCH_NAME(luSolveInterleavedSmall)(int n, const BATCH_T *LU, const int *pivots, BATCH_T *b) {
+    for (int k = 0; k < n; k++) {
+        for (int l = 0; l < BATCH_LANES; l++) {
+            int p = pivots[k * BATCH_LANES + l];
+            BATCH_T temp = b[k * BATCH_LANES + l];
+            b[k * BATCH_LANES + l] = b[p * BATCH_LANES + l];
+            b[p * BATCH_LANES + l] = temp;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        for (int p = 0; p < i; p++) {
+            const BATCH_T *a = LU + ((long int)n * i + p) * BATCH_LANES;
+            for (int l = 0; l < BATCH_LANES; l++) {
+                b[i * BATCH_LANES + l] -= a[l] * b[p * BATCH_LANES + l];
+            }
+        }
+    }
+    for (int i = n - 1; i >= 0; i--) {
+        for (int p = i + 1; p < n; p++) {
+            const BATCH_T *a = LU + ((long int)n * i + p) * BATCH_LANES;
+            for (int l = 0; l < BATCH_LANES; l++) {
+                b[i * BATCH_LANES + l] -= a[l] * b[p * BATCH_LANES + l];
+            }
+        }
+        const BATCH_T *d = LU + ((long int)n * i + i) * BATCH_LANES;
+        for (int l = 0; l < BATCH_LANES; l++) {
+            b[i * BATCH_LANES + l] /= d[l];
+        }
+    }
+}
+
+// matrix b of a batch argument
+#define BATCH_A(args, b) ((args)->Aptr ? (args)->Aptr[b] : (args)->A + (args)->strideA * (b))
+#define BATCH_B(args, b) ((args)->Bptr ? (args)->Bptr[b] : (args)->B + (args)->strideB * (b))
+#define BATCH_C(args, b) ((args)->Cptr ? (args)->Cptr[b] : (args)->C + (args)->strideC * (b))
+
+/**
+ * @brief Products begin..end of a batched GEMM, with fixed-size kernels for square 4, 8, 16 and 32.
+ */
+static inline __attribute__((always_inline)) void BATCH_NAME(gemmRangeBody)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+#define BATCH_GEMM_LOOP(m, n, k) \
+    for (long int b = begin; b < end; b++) BATCH_NAME(gemmSmall)(m, n, k, BATCH_A(args, b), BATCH_B(args, b), BATCH_C(args, b))
+    int n = args->n;
+    if (args->m == n && args->k == n) {
+        switch (n) {
+        case 4: BATCH_GEMM_LOOP(4, 4, 4); return;
+        case 8: BATCH_GEMM_LOOP(8, 8, 8); return;
+        case 16: BATCH_GEMM_LOOP(16, 16, 16); return;
+        case 32: BATCH_GEMM_LOOP(32, 32, 32); return;
+        }
+    }
+    BATCH_GEMM_LOOP(args->m, n, args->k);
+#undef BATCH_GEMM_LOOP
+}
+
+/**
+ * @brief Factorizations begin..end of a batched LU (matrices in A, pivots n per matrix, info one per matrix).
+ */
+static inline __attribute__((always_inline)) void BATCH_NAME(luRangeBody)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+#define BATCH_LU_LOOP(n) \
+    for (long int b = begin; b < end; b++) args->info[b] = BATCH_NAME(luSmall)(n, (BATCH_T *)BATCH_A(args, b), args->pivots + (long int)(n) * b)
+    switch (args->n) {
+    case 4: BATCH_LU_LOOP(4); return;
+    case 8: BATCH_LU_LOOP(8); return;
+    case 16: BATCH_LU_LOOP(16); return;
+    case 32: BATCH_LU_LOOP(32); return;
+    }
+    BATCH_LU_LOOP(args->n);
+#undef BATCH_LU_LOOP
+}
+
+/**
+ * @brief Solves begin..end of a batched triangular solve (triangles in A, right-hand sides in B).
+ */
+static inline __attribute__((always_inline)) void BATCH_NAME(trsmRangeBody)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+#define BATCH_TRSM_LOOP(n) \
+    for (long int b = begin; b < end; b++) BATCH_NAME(trsmSmall)(n, args->k, args->lower, args->unit_diagonal, BATCH_A(args, b), BATCH_B(args, b))
+    switch (args->n) {
+    case 4: BATCH_TRSM_LOOP(4); return;
+    case 8: BATCH_TRSM_LOOP(8); return;
+    case 16: BATCH_TRSM_LOOP(16); return;
+    case 32: BATCH_TRSM_LOOP(32); return;
+    }
+    BATCH_TRSM_LOOP(args->n);
+#undef BATCH_TRSM_LOOP
+}
+
+/**
+ * @brief Groups begin..end of an interleaved batched GEMM (group strides in strideA, strideB, strideC).
+ */
+static inline __attribute__((always_inline)) void BATCH_NAME(gemmInterleavedRangeBody)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+#define BATCH_GEMM_LOOP(m, n, k) \
+    for (long int g = begin; g < end; g++) BATCH_NAME(gemmInterleavedSmall)(m, n, k, args->A + args->strideA * g, args->B + args->strideB * g, args->C + args->strideC * g)
+    int n = args->n;
+    if (args->m == n && args->k == n) {
+        switch (n) {
+        case 4: BATCH_GEMM_LOOP(4, 4, 4); return;
+        case 8: BATCH_GEMM_LOOP(8, 8, 8); return;
+        case 16: BATCH_GEMM_LOOP(16, 16, 16); return;
+        case 32: BATCH_GEMM_LOOP(32, 32, 32); return;
+        }
+    }
+    BATCH_GEMM_LOOP(args->m, n, args->k);
+#undef BATCH_GEMM_LOOP
+}
+
+/**
+ * @brief Groups begin..end of an interleaved batched LU (factors in C, pivots and info interleaved by group).
+ */
+static inline __attribute__((always_inline)) void BATCH_NAME(luInterleavedRangeBody)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+#define BATCH_LU_LOOP(n)                                                                                          \
+    for (long int g = begin; g < end; g++)                                                                        \
+        BATCH_NAME(luInterleavedSmall)(n, args->C + args->strideC * g, args->pivots + (long int)(n) * BATCH_LANES * g, \
+                                       args->info + (long int)BATCH_LANES * g)
+    switch (args->n) {
+    case 4: BATCH_LU_LOOP(4); return;
+    case 8: BATCH_LU_LOOP(8); return;
+    case 16: BATCH_LU_LOOP(16); return;
+    case 32: BATCH_LU_LOOP(32); return;
+    }
+    BATCH_LU_LOOP(args->n);
+#undef BATCH_LU_LOOP
+}
+
+/**
+ * @brief Groups begin..end of an interleaved batched LU solve (factors in A, right-hand sides in B).
+ */
+static inline __attribute__((always_inline)) void BATCH_NAME(luSolveInterleavedRangeBody)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+#define BATCH_SOLVE_LOOP(n)                                                                                            \
+    for (long int g = begin; g < end; g++)                                                                             \
+        BATCH_NAME(luSolveInterleavedSmall)(n, args->A + args->strideA * g, args->pivots + (long int)(n) * BATCH_LANES * g, \
+                                            args->B + args->strideB * g)
+    switch (args->n) {
+    case 4: BATCH_SOLVE_LOOP(4); return;
+    case 8: BATCH_SOLVE_LOOP(8); return;
+    case 16: BATCH_SOLVE_LOOP(16); return;
+    case 32: BATCH_SOLVE_LOOP(32); return;
+    }
+    BATCH_SOLVE_LOOP(args->n);
+#undef BATCH_SOLVE_LOOP
+}
+
+#undef BATCH_A
+#undef BATCH_B
+#undef BATCH_C
+
+void BATCH_NAME(gemmRangeScalar)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+    BATCH_NAME(gemmRangeBody)(args, begin, end);
+}
+
+__attribute__((target("avx2,fma"))) void BATCH_NAME(gemmRangeAVX2)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+    BATCH_NAME(gemmRangeBody)(args, begin, end);
+}
+
+__attribute__((target("avx512f,avx512dq,avx512vl,avx2,fma"))) void BATCH_NAME(gemmRangeAVX512)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+    BATCH_NAME(gemmRangeBody)(args, begin, end);
+}
+
+void BATCH_NAME(luRangeScalar)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+    BATCH_NAME(luRangeBody)(args, begin, end);
+}
+
+__attribute__((target("avx2,fma"))) void BATCH_NAME(luRangeAVX2)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+    BATCH_NAME(luRangeBody)(args, begin, end);
+}
+
+__attribute__((target("avx512f,avx512dq,avx512vl,avx2,fma"))) void BATCH_NAME(luRangeAVX512)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+    BATCH_NAME(luRangeBody)(args, begin, end);
+}
+
+void BATCH_NAME(trsmRangeScalar)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+    BATCH_NAME(trsmRangeBody)(args, begin, end);
+}
+
+__attribute__((target("avx2,fma"))) void BATCH_NAME(trsmRangeAVX2)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+    BATCH_NAME(trsmRangeBody)(args, begin, end);
+}
+
+__attribute__((target("avx512f,avx512dq,avx512vl,avx2,fma"))) void BATCH_NAME(trsmRangeAVX512)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+    BATCH_NAME(trsmRangeBody)(args, begin, end);
+}
+
+void BATCH_NAME(gemmInterleavedRangeScalar)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+    BATCH_NAME(gemmInterleavedRangeBody)(args, begin, end);
+}
+
+__attribute__((target("avx2,fma"))) void BATCH_NAME(gemmInterleavedRangeAVX2)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+    BATCH_NAME(gemmInterleavedRangeBody)(args, begin, end);
+}
+
+__attribute__((target("avx512f,avx512dq,avx512vl,avx2,fma"))) void BATCH_NAME(gemmInterleavedRangeAVX512)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+    BATCH_NAME(gemmInterleavedRangeBody)(args, begin, end);
+}
+
+void BATCH_NAME(luInterleavedRangeScalar)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+    BATCH_NAME(luInterleavedRangeBody)(args, begin, end);
+}
+
+__attribute__((target("avx2,fma"))) void BATCH_NAME(luInterleavedRangeAVX2)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+    BATCH_NAME(luInterleavedRangeBody)(args, begin, end);
+}
+
+__attribute__((target("avx512f,avx512dq,avx512vl,avx2,fma"))) void BATCH_NAME(luInterleavedRangeAVX512)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+    BATCH_NAME(luInterleavedRangeBody)(args, begin, end);
+}
+
+void BATCH_NAME(luSolveInterleavedRangeScalar)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+    BATCH_NAME(luSolveInterleavedRangeBody)(args, begin, end);
+}
+
+__attribute__((target("avx2,fma"))) void BATCH_NAME(luSolveInterleavedRangeAVX2)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+    BATCH_NAME(luSolveInterleavedRangeBody)(args, begin, end);
+}
+
+__attribute__((target("avx512f,avx512dq,avx512vl,avx2,fma"))) void BATCH_NAME(luSolveInterleavedRangeAVX512)(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) {
+    BATCH_NAME(luSolveInterleavedRangeBody)(args, begin, end);
+}
+
+void (*BATCH_NAME(gemmRange))(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) = BATCH_NAME(gemmRangeScalar);
+void (*BATCH_NAME(luRange))(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) = BATCH_NAME(luRangeScalar);
+void (*BATCH_NAME(trsmRange))(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) = BATCH_NAME(trsmRangeScalar);
+void (*BATCH_NAME(gemmInterleavedRange))(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) = BATCH_NAME(gemmInterleavedRangeScalar);
+void (*BATCH_NAME(luInterleavedRange))(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) = BATCH_NAME(luInterleavedRangeScalar);
+void (*BATCH_NAME(luSolveInterleavedRange))(const BATCH_NAME(batch_args_t) *args, long int begin, long int end) = BATCH_NAME(luSolveInterleavedRangeScalar);
+
+/**
+ * @brief Selects the batch loops for the current CPU from the instruction set found by simdInit. Runs before main.
+ */
+__attribute__((constructor(102))) void BATCH_NAME(batchInit)(void) {
+    if (simdIsa == SIMD_AVX512) {
+        BATCH_NAME(gemmRange) = BATCH_NAME(gemmRangeAVX512);
+        BATCH_NAME(luRange) = BATCH_NAME(luRangeAVX512);
+        BATCH_NAME(trsmRange) = BATCH_NAME(trsmRangeAVX512);
+        BATCH_NAME(gemmInterleavedRange) = BATCH_NAME(gemmInterleavedRangeAVX512);
+        BATCH_NAME(luInterleavedRange) = BATCH_NAME(luInterleavedRangeAVX512);
+        BATCH_NAME(luSolveInterleavedRange) = BATCH_NAME(luSolveInterleavedRangeAVX512);
+    } else if (simdIsa == SIMD_AVX2) {
+        BATCH_NAME(gemmRange) = BATCH_NAME(gemmRangeAVX2);
+        BATCH_NAME(luRange) = BATCH_NAME(luRangeAVX2);
+        BATCH_NAME(trsmRange) = BATCH_NAME(trsmRangeAVX2);
+        BATCH_NAME(gemmInterleavedRange) = BATCH_NAME(gemmInterleavedRangeAVX2);
+        BATCH_NAME(luInterleavedRange) = BATCH_NAME(luInterleavedRangeAVX2);
+        BATCH_NAME(luSolveInterleavedRange) = BATCH_NAME(luSolveInterleavedRangeAVX2);
+    } else {
+        BATCH_NAME(gemmRange) = BATCH_NAME(gemmRangeScalar);
+        BATCH_NAME(luRange) = BATCH_NAME(luRangeScalar);
+        BATCH_NAME(trsmRange) = BATCH_NAME(trsmRangeScalar);
+        BATCH_NAME(gemmInterleavedRange) = BATCH_NAME(gemmInterleavedRangeScalar);
+        BATCH_NAME(luInterleavedRange) = BATCH_NAME(luInterleavedRangeScalar);
+        BATCH_NAME(luSolveInterleavedRange) = BATCH_NAME(luSolveInterleavedRangeScalar);
+    }
+}
+
+/**
+ * @brief Runs a batch loop over items (matrices or interleaved groups), split across the threading layer.
+ */
+void BATCH_NAME(batchRun)(void (*range)(const BATCH_NAME(batch_args_t) *, long int, long int), const BATCH_NAME(batch_args_t) *args, long int items) {
+    // chunks of at least BATCH_GRAIN items, so a thread never wakes up for a handful of tiny matrices
+    long int grains = (items + BATCH_GRAIN - 1) / BATCH_GRAIN;
+    int threads = threadsFor(grains);
+    long int chunks = threadsChunks(threads, grains);
+    long int next = 0;
+    #pragma omp parallel num_threads(threads) if (threads > 1)
+    {
+        long int step = 0;
+        for (long int ch; (ch = threadsNextChunk(&next, &step, chunks)) >= 0; ) {
+            long int begin = threadsChunkStart(items, chunks, ch);
+            long int end = threadsChunkStart(items, chunks, ch + 1);
+            range(args, begin, end);
+        }
+    }
+}
+
+/**
+ * @brief C_b = A_b * B_b for count packed matrices stored at a fixed stride from each other.
+ *
+ * @param count Number of products
+ * @param m Rows of every A and C
+ * @param n Columns of every B and C
+ * @param k Columns of every A and rows of every B
+ * @param A First m x k matrix, row-major with leading dimension k
+ * @param strideA Elements between consecutive A matrices
+ * @param B First k x n matrix, leading dimension n
+ * @param strideB Elements between consecutive B matrices
+ * @param C First m x n output matrix, leading dimension n
+ * @param strideC Elements between consecutive C matrices
+ */
+void BATCH_NAME(batchGemmStrided)(long int count, int m, int n, int k, const BATCH_T *A, long int strideA, const BATCH_T *B, long int strideB, BATCH_T *C, long int strideC) {
+    PERF_BEGIN();
+    BATCH_NAME(batch_args_t) args = {m, n, k, 0, 0, A, strideA, NULL, (BATCH_T *)B, strideB, NULL, C, strideC, NULL, NULL, NULL};
+    BATCH_NAME(batchRun)(BATCH_NAME(gemmRange), &args, count);
+    PERF_END(__func__, count, m, n);
+}
+
+/**
+ * @brief C[b] = A[b] * B[b] for count packed matrices given by pointer arrays. Dimensions as for batchGemmStrided.
+ */
+void BATCH_NAME(batchGemmPointers)(long int count, int m, int n, int k, const BATCH_T *const *A, const BATCH_T *const *B, BATCH_T *const *C) {
+    PERF_BEGIN();
+    BATCH_NAME(batch_args_t) args = {m, n, k, 0, 0, NULL, 0, A, NULL, 0, (BATCH_T *const *)B, NULL, 0, C, NULL, NULL};
+    BATCH_NAME(batchRun)(BATCH_NAME(gemmRange), &args, count);
+    PERF_END(__func__, count, m, n);
+}
+
+/**
+ * @brief LU with partial pivoting of count packed n x n matrices at a fixed stride, overwritten with their factors.
+ *
+ * @param pivots Output, n pivot indices per matrix
+ * @param info Output, one entry per matrix: 0, or i + 1 if U[i][i] is exactly zero
+ */
+void BATCH_NAME(batchLuStrided)(long int count, int n, BATCH_T *A, long int strideA, int *pivots, int *info) {
+    PERF_BEGIN();
+    BATCH_NAME(batch_args_t) args = {n, n, n, 0, 0, A, strideA, NULL, NULL, 0, NULL, NULL, 0, NULL, pivots, info};
+    BATCH_NAME(batchRun)(BATCH_NAME(luRange), &args, count);
+    PERF_END(__func__, count, n, 1);
+}
+
+/**
+ * @brief LU with partial pivoting of count packed n x n matrices given by a pointer array.
+ */
+void BATCH_NAME(batchLuPointers)(long int count, int n, BATCH_T *const *A, int *pivots, int *info) {
+    PERF_BEGIN();
+    BATCH_NAME(batch_args_t) args = {n, n, n, 0, 0, NULL, 0, (const BATCH_T *const *)A, NULL, 0, NULL, NULL, 0, NULL, pivots, info};
+    BATCH_NAME(batchRun)(BATCH_NAME(luRange), &args, count);
+    PERF_END(__func__, count, n, 1);
+}
+
+/**
+ * @brief T_b X_b = B_b for count packed n x n triangular matrices and n x nrhs right-hand sides at fixed strides.
+ *
+ * @param lower Nonzero to use the lower triangle of each T, zero for the upper
+ * @param unit_diagonal Nonzero if the diagonal is implicitly one (e.g. the L of an LU factorization)
+ */
+void BATCH_NAME(batchTriangularSolveStrided)(long int count, int n, int nrhs, int lower, int unit_diagonal, const BATCH_T *T, long int strideT, BATCH_T *B, long int strideB) {
+    PERF_BEGIN();
+    BATCH_NAME(batch_args_t) args = {n, n, nrhs, lower, unit_diagonal, T, strideT, NULL, B, strideB, NULL, NULL, 0, NULL, NULL, NULL};
+    BATCH_NAME(batchRun)(BATCH_NAME(trsmRange), &args, count);
+    PERF_END(__func__, count, n, nrhs);
+}
+
+/**
+ * @brief T[b] X[b] = B[b] for triangular matrices and right-hand sides given by pointer arrays.
+ */
+void BATCH_NAME(batchTriangularSolvePointers)(long int count, int n, int nrhs, int lower, int unit_diagonal, const BATCH_T *const *T, BATCH_T *const *B) {
+    PERF_BEGIN();
+    BATCH_NAME(batch_args_t) args = {n, n, nrhs, lower, unit_diagonal, NULL, 0, T, NULL, 0, B, NULL, 0, NULL, NULL, NULL};
+    BATCH_NAME(batchRun)(BATCH_NAME(trsmRange), &args, count);
+    PERF_END(__func__, count, n, nrhs);
+}
+
+/**
+ * @brief Copies count packed rows x cols matrices at a fixed stride into the interleaved layout.
+ * @details Element (i, j) of matrix b goes to dst[(g * rows * cols + i * cols + j) * BATCH_LANES + l] with
+ * g = b / BATCH_LANES and l = b % BATCH_LANES. The lanes of the last group past count are zero filled.
+ */
+void BATCH_NAME(batchInterleave)(long int count, int rows, int cols, const BATCH_T *src, long int stride, BATCH_T *dst) {
+    long int size = (long int)rows * cols;
+    long int groups = (count + BATCH_LANES - 1) / BATCH_LANES;
+    for (long int g = 0; g < groups; g++) {
+        BATCH_T *group = dst + g * size * BATCH_LANES;
+        for (int l = 0; l < BATCH_LANES; l++) {
+            long int b = g * BATCH_LANES + l;
+            for (long int e = 0; e < size; e++) {
+                group[e * BATCH_LANES + l] = (b < count) ? src[stride * b + e] : 0;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Copies count matrices from the interleaved layout back to packed matrices at a fixed stride.
+ */
+void BATCH_NAME(batchDeinterleave)(long int count, int rows, int cols, const BATCH_T *src, BATCH_T *dst, long int stride) {
+    long int size = (long int)rows * cols;
+    for (long int b = 0; b < count; b++) {
+        const BATCH_T *group = src + (b / BATCH_LANES) * size * BATCH_LANES;
+        int l = (int)(b % BATCH_LANES);
+        for (long int e = 0; e < size; e++) {
+            dst[stride * b + e] = group[e * BATCH_LANES + l];
+        }
+    }
+}
+
+/**
+ * @brief C_b = A_b * B_b for count matrices in the interleaved layout, SIMD lanes across matrices.
+ */
+void BATCH_NAME(batchGemmInterleaved)(long int count, int m, int n, int k, const BATCH_T *A, const BATCH_T *B, BATCH_T *C) {
+    PERF_BEGIN();
+    long int groups = (count + BATCH_LANES - 1) / BATCH_LANES;
+    BATCH_NAME(batch_args_t) args = {m, n, k, 0, 0, A, (long int)m * k * BATCH_LANES, NULL, (BATCH_T *)B,
+                                     (long int)k * n * BATCH_LANES, NULL, C, (long int)m * n * BATCH_LANES, NULL, NULL, NULL};
+    BATCH_NAME(batchRun)(BATCH_NAME(gemmInterleavedRange), &args, groups);
+    PERF_END(__func__, count, m, n);
+}
+
+/**
+ * @brief LU with partial pivoting of count interleaved n x n matrices, overwritten with their factors.
+ * @details pivots holds n * BATCH_LANES entries and info BATCH_LANES entries per group, interleaved like the
+ * matrices: pivot k of matrix b is pivots[(g * n + k) * BATCH_LANES + l].
+ */
+void BATCH_NAME(batchLuInterleaved)(long int count, int n, BATCH_T *A, int *pivots, int *info) {
+    PERF_BEGIN();
+    long int groups = (count + BATCH_LANES - 1) / BATCH_LANES;
+    BATCH_NAME(batch_args_t) args = {n, n, n, 0, 0, NULL, 0, NULL, NULL, 0, NULL, A, (long int)n * n * BATCH_LANES, NULL, pivots, info};
+    BATCH_NAME(batchRun)(BATCH_NAME(luInterleavedRange), &args, groups);
+    PERF_END(__func__, count, n, 1);
+}
+
+/**
+ * @brief Solves A_b x_b = b_b with the interleaved factors of batchLuInterleaved and interleaved n x 1 right-hand
+ * sides, overwritten with the solutions.
+ */
+void BATCH_NAME(batchLuSolveInterleaved)(long int count, int n, const BATCH_T *LU, const int *pivots, BATCH_T *b) {
+    PERF_BEGIN();
+    long int groups = (count + BATCH_LANES - 1) / BATCH_LANES;
+    BATCH_NAME(batch_args_t) args = {n, n, 1, 0, 0, LU, (long int)n * n * BATCH_LANES, NULL, b, (long int)n * BATCH_LANES,
+                                     NULL, NULL, 0, NULL, (int *)pivots, NULL};
+    BATCH_NAME(batchRun)(BATCH_NAME(luSolveInterleavedRange), &args, groups);
+    PERF_END(__func__, count, n, 1);
+}
+
+#undef BATCH_T
+#undef BATCH_NAME
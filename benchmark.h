@@ -0,0 +1,238 @@
+/**
+ * @file benchmark.h
+ * @author Navid Shamszadeh
+ * @brief Benchmark harness: wall clock timing with warm-up and repeated trials, summary statistics, a STREAM triad
+ * baseline and text/CSV/JSON reports.
+ * @details Kernels are timed with the monotonic wall clock, not clock(), which adds up the CPU time of every thread
+ * and so overstates the run time of anything threaded. Each measurement discards a few warm-up calls (cold caches,
+ * page faults on first touch, lazy dispatch), then times every trial separately and reports the median, minimum,
+ * mean and standard deviation. The median is the number to track for regressions, the minimum the best case.
+ * Achieved bandwidth is reported next to the STREAM triad bandwidth measured on the same machine, so memory bound
+ * kernels can be judged against what the memory system actually delivers.
+ * @date 2021-05-18
+ */
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// default number of untimed calls before the trials
+#define BENCHMARK_WARMUP 2
+// default number of timed trials
+#define BENCHMARK_TRIALS 10
+// elements per array of the STREAM triad, large enough to stay out of the last level cache
+#define BENCHMARK_STREAM_SIZE (1L << 23)
+
+/**
+ * @brief Summary of the trials of one measurement, in seconds.
+ */
+typedef struct {
+    int trials;
+    double median;
+    double min;
+    double mean;
+    double stddev;
+} benchmark_stats_t;
+
+/**
+ * @brief One row of a benchmark report.
+ */
+typedef struct {
+    const char *kernel;  // operation, e.g. "gemm"
+    const char *variant; // implementation, e.g. "threaded"
+    int N, M, K;         // problem dimensions, unused ones are 0
+    int threads;         // threads the variant ran on
+    double flops;        // floating point (or integer) operations per call
+    double bytes;        // compulsory memory traffic per call
+    benchmark_stats_t stats;
+} benchmark_result_t;
+
+typedef enum {
+    BENCHMARK_TEXT = 0,
+    BENCHMARK_CSV,
+    BENCHMARK_JSON
+} benchmark_format_t;
+
+/**
+ * @brief Report being written to a stream.
+ */
+typedef struct {
+    FILE *out;
+    benchmark_format_t format;
+    double stream_bandwidth; // STREAM triad bandwidth in GB/s, 0 if not measured
+    int rows;                // results written so far
+} benchmark_report_t;
+
+/**
+ * @brief Current monotonic wall clock time in seconds.
+ */
+double benchmarkNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+int benchmarkCompareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Summary statistics of n timings. The timings are sorted in place.
+ *
+ * @param n Number of timings
+ * @param times Timings in seconds
+ * @return The statistics
+ */
+benchmark_stats_t benchmarkStats(int n, double *times) {
+    benchmark_stats_t stats = {n, 0.0, 0.0, 0.0, 0.0};
+    if (n <= 0)
+        return stats;
+    qsort(times, n, sizeof(double), benchmarkCompareDoubles);
+    stats.min = times[0];
+    stats.median = (n % 2) ? times[n / 2] : 0.5 * (times[n / 2 - 1] + times[n / 2]);
+    for (int i = 0; i < n; i++) {
+        stats.mean += times[i];
+    }
+    stats.mean /= n;
+    for (int i = 0; i < n; i++) {
+        stats.stddev += (times[i] - stats.mean) * (times[i] - stats.mean);
+    }
+    stats.stddev = (n > 1) ? sqrt(stats.stddev / (n - 1)) : 0.0;
+    return stats;
+}
+
+/**
+ * @brief Times kernel(args): warmup untimed calls, then trials calls timed one by one.
+ *
+ * @param kernel Function to time
+ * @param args Passed to kernel unchanged
+ * @param warmup Number of untimed calls
+ * @param trials Number of timed calls
+ * @return Statistics of the timed calls
+ */
+benchmark_stats_t benchmarkRun(void (*kernel)(void *), void *args, int warmup, int trials) {
+    double *times = (double *)malloc((trials > 0 ? trials : 1) * sizeof(double));
+    for (int i = 0; i < warmup; i++) {
+        kernel(args);
+    }
+    for (int i = 0; i < trials; i++) {
+        double start = benchmarkNow();
+        kernel(args);
+        times[i] = benchmarkNow() - start;
+    }
+    benchmark_stats_t stats = benchmarkStats(trials, times);
+    free(times);
+    return stats;
+}
+
+/**
+ * @brief Measures the STREAM triad bandwidth a[i] = b[i] + s * c[i] on n doubles per array with all threads.
+ * @details Counts 24 bytes per element like STREAM does (no write allocate traffic) and returns the best of trials.
+ *
+ * @param n Elements per array
+ * @param trials Number of timed passes
+ * @return Bandwidth in GB/s
+ */
+double benchmarkStreamTriad(long int n, int trials) {
+    double *a = (double *)malloc(n * sizeof(double));
+    double *b = (double *)malloc(n * sizeof(double));
+    double *c = (double *)malloc(n * sizeof(double));
+    // first touch in parallel so the pages land next to the threads that stream them
+    #pragma omp parallel for schedule(static)
+    for (long int i = 0; i < n; i++) {
+        a[i] = 0.0;
+        b[i] = 1.0;
+        c[i] = 2.0;
+    }
+    double best = 0.0;
+    for (int t = 0; t <= trials; t++) {
+        double start = benchmarkNow();
+        #pragma omp parallel for schedule(static)
+        for (long int i = 0; i < n; i++) {
+            a[i] = b[i] + 3.0 * c[i];
+        }
+        double elapsed = benchmarkNow() - start;
+        // the first pass is a warm-up
+        if (t > 0 && 24.0 * n / elapsed * 1e-9 > best)
+            best = 24.0 * n / elapsed * 1e-9;
+    }
+    if (a[n / 2] != 7.0)
+        fprintf(stderr, "Warning: STREAM triad produced %f instead of 7!\n", a[n / 2]);
+    free(a);
+    free(b);
+    free(c);
+    return best;
+}
+
+/**
+ * @brief Starts a report and writes its header.
+ *
+ * @param report Report to initialize
+ * @param out Stream to write to
+ * @param format BENCHMARK_TEXT, BENCHMARK_CSV or BENCHMARK_JSON
+ * @param stream_bandwidth STREAM triad bandwidth in GB/s, 0 if not measured
+ */
+void benchmarkReportBegin(benchmark_report_t *report, FILE *out, benchmark_format_t format, double stream_bandwidth) {
+    report->out = out;
+    report->format = format;
+    report->stream_bandwidth = stream_bandwidth;
+    report->rows = 0;
+    if (format == BENCHMARK_CSV) {
+        fprintf(out, "kernel,variant,N,M,K,threads,trials,median_s,min_s,mean_s,stddev_s,gflops,gbytes_per_s,stream_fraction\n");
+    } else if (format == BENCHMARK_JSON) {
+        fprintf(out, "{\n  \"stream_triad_gbytes_per_s\": %.3f,\n  \"results\": [", stream_bandwidth);
+    } else {
+        if (stream_bandwidth > 0.0)
+            fprintf(out, "STREAM triad: %.2f GB/s\n", stream_bandwidth);
+        fprintf(out, "%-10s %-10s %6s %6s %6s %4s %12s %12s %10s %9s %9s %7s\n", "kernel", "variant", "N", "M", "K",
+                "thr", "median (s)", "min (s)", "stddev %", "GFLOP/s", "GB/s", "STREAM");
+    }
+}
+
+/**
+ * @brief Appends one result to a report. Rates are computed from the median time.
+ */
+void benchmarkReportAdd(benchmark_report_t *report, const benchmark_result_t *result) {
+    const benchmark_stats_t *s = &result->stats;
+    double gflops = (s->median > 0.0) ? result->flops / s->median * 1e-9 : 0.0;
+    double gbytes = (s->median > 0.0) ? result->bytes / s->median * 1e-9 : 0.0;
+    double fraction = (report->stream_bandwidth > 0.0) ? gbytes / report->stream_bandwidth : 0.0;
+    FILE *out = report->out;
+    if (report->format == BENCHMARK_CSV) {
+        fprintf(out, "%s,%s,%d,%d,%d,%d,%d,%.9e,%.9e,%.9e,%.9e,%.4f,%.4f,%.4f\n", result->kernel, result->variant,
+                result->N, result->M, result->K, result->threads, s->trials, s->median, s->min, s->mean, s->stddev,
+                gflops, gbytes, fraction);
+    } else if (report->format == BENCHMARK_JSON) {
+        fprintf(out, "%s\n    {\"kernel\": \"%s\", \"variant\": \"%s\", \"N\": %d, \"M\": %d, \"K\": %d, \"threads\": %d, "
+                "\"trials\": %d, \"median_s\": %.9e, \"min_s\": %.9e, \"mean_s\": %.9e, \"stddev_s\": %.9e, "
+                "\"gflops\": %.4f, \"gbytes_per_s\": %.4f, \"stream_fraction\": %.4f}",
+                report->rows ? "," : "", result->kernel, result->variant, result->N, result->M, result->K,
+                result->threads, s->trials, s->median, s->min, s->mean, s->stddev, gflops, gbytes, fraction);
+    } else {
+        fprintf(out, "%-10s %-10s %6d %6d %6d %4d %12.4e %12.4e %10.2f %9.3f %9.3f %6.1f%%\n", result->kernel,
+                result->variant, result->N, result->M, result->K, result->threads, s->median, s->min,
+                (s->mean > 0.0) ? 100.0 * s->stddev / s->mean : 0.0, gflops, gbytes, 100.0 * fraction);
+    }
+    fflush(out);
+    report->rows++;
+}
+
+/**
+ * @brief Finishes a report.
+ */
+void benchmarkReportEnd(benchmark_report_t *report) {
+    if (report->format == BENCHMARK_JSON)
+        fprintf(report->out, "\n  ]\n}\n");
+    fflush(report->out);
+}
+
+#endif
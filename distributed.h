@@ -0,0 +1,543 @@
+/**
+ * @file distributed.h
+ * @author Navid Shamszadeh
+ * @brief Helpers shared by the MPI programs: 1D row-block and 2D grid decompositions, scattering/gathering blocks,
+ * the all-to-all transpose of row-block distributed matrices and timing reports.
+ * @details Rows (or any other dimension) are split into contiguous blocks, one per rank. When the dimension is not
+ * divisible by the number of ranks the first N % size ranks get one extra element.
+ * @date 2021-05-17
+ */
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <mpi.h>
+#include "threads.h"
+
+/**
+ * @brief Wall clock time spent by one rank in each phase of a distributed operation.
+ */
+typedef struct {
+    double compute;
+    double communication;
+} mpi_timing_t;
+
+/**
+ * @brief A block of consecutive rows of an N x M strided matrix owned by one rank.
+ */
+typedef struct {
+    int N;            // global number of rows
+    int M;            // number of columns
+    int rows;         // number of rows owned by this rank
+    int first_row;    // global index of the first owned row
+    long int *local;  // rows x M strided block
+} row_block_t;
+
+/**
+ * @brief Computes the number of rows and the first row owned by a rank in the block decomposition of N rows.
+ *
+ * @param N Number of rows
+ * @param size Number of ranks
+ * @param rank Rank to compute the block for
+ * @param rows Output number of rows owned by rank
+ * @param first_row Output global index of the first row owned by rank
+ */
+void rowBlockRange(int N, int size, int rank, int *rows, int *first_row) {
+    int base = N / size;
+    int extra = N % size;
+    *rows = base + (rank < extra);
+    *first_row = rank * base + (rank < extra ? rank : extra);
+}
+
+/**
+ * @brief Fills the element counts and displacements of every rank's row block, as used by MPI_Scatterv/MPI_Gatherv.
+ *
+ * @param N Number of rows
+ * @param M Number of columns
+ * @param size Number of ranks
+ * @param counts Output array of size elements
+ * @param displs Output array of size elements
+ */
+void rowBlockCounts(int N, int M, int size, int *counts, int *displs) {
+    for (int r = 0; r < size; r++) {
+        int rows, first_row;
+        rowBlockRange(N, size, r, &rows, &first_row);
+        counts[r] = rows * M;
+        displs[r] = first_row * M;
+    }
+}
+
+/**
+ * @brief Allocates this rank's block of an N x M matrix and scatters it from root.
+ *
+ * @param N Number of rows
+ * @param M Number of columns
+ * @param matrix Strided N x M matrix, only significant on root
+ * @param root Rank holding the full matrix
+ * @param comm Communicator
+ * @param block Output row block. Free block->local when done.
+ */
+void rowBlockScatter(int N, int M, long int *matrix, int root, MPI_Comm comm, row_block_t *block) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    block->N = N;
+    block->M = M;
+    rowBlockRange(N, size, rank, &block->rows, &block->first_row);
+    block->local = (long int *)malloc(((size_t)block->rows * M + 1) * sizeof(long int));
+
+    int *counts = (int *)malloc(size * sizeof(int));
+    int *displs = (int *)malloc(size * sizeof(int));
+    rowBlockCounts(N, M, size, counts, displs);
+    MPI_Scatterv(matrix, counts, displs, MPI_LONG, block->local, block->rows * M, MPI_LONG, root, comm);
+    free(counts);
+    free(displs);
+}
+
+/**
+ * @brief Gathers every rank's row block into the full matrix on root.
+ *
+ * @param block This rank's row block
+ * @param matrix Strided N x M output matrix, only significant on root
+ * @param root Rank receiving the full matrix
+ * @param comm Communicator
+ */
+void rowBlockGather(const row_block_t *block, long int *matrix, int root, MPI_Comm comm) {
+    int size;
+    MPI_Comm_size(comm, &size);
+
+    int *counts = (int *)malloc(size * sizeof(int));
+    int *displs = (int *)malloc(size * sizeof(int));
+    rowBlockCounts(block->N, block->M, size, counts, displs);
+    MPI_Gatherv(block->local, block->rows * block->M, MPI_LONG, matrix, counts, displs, MPI_LONG, root, comm);
+    free(counts);
+    free(displs);
+}
+
+/**
+ * @brief A two dimensional Pr x Pc grid of processes with communicators along its rows and columns.
+ */
+typedef struct {
+    MPI_Comm grid;      // cartesian communicator over the whole grid
+    MPI_Comm row_comm;  // processes in the same grid row, ranked by grid column
+    MPI_Comm col_comm;  // processes in the same grid column, ranked by grid row
+    int Pr;             // number of grid rows
+    int Pc;             // number of grid columns
+    int my_row;         // grid row of this process
+    int my_col;         // grid column of this process
+} process_grid_t;
+
+/**
+ * @brief A two dimensional block of an N x M strided matrix owned by one process of a grid.
+ */
+typedef struct {
+    int N;            // global number of rows
+    int M;            // global number of columns
+    int rows;         // number of rows owned by this process
+    int cols;         // number of columns owned by this process
+    int first_row;    // global index of the first owned row
+    int first_col;    // global index of the first owned column
+    long int *local;  // rows x cols strided block
+} grid_block_t;
+
+/**
+ * @brief Arranges the processes of comm in a Pr x Pc grid.
+ * @details Passing 0 for Pr and/or Pc lets MPI_Dims_create choose them. Grid ranks are assigned row by row.
+ * The given dimensions must use every process of comm: Pr * Pc must be its size, and a single given dimension must
+ * divide it. Otherwise nothing is created and rank 0 of comm reports the mismatch.
+ *
+ * @param comm Communicator to build the grid from
+ * @param Pr Number of grid rows, or 0
+ * @param Pc Number of grid columns, or 0
+ * @param grid Output process grid. Release with processGridFree.
+ * @return 0 on success, -1 if the dimensions do not match the size of comm
+ */
+int processGridCreate(MPI_Comm comm, int Pr, int Pc, process_grid_t *grid) {
+    int size, rank;
+    MPI_Comm_size(comm, &size);
+    MPI_Comm_rank(comm, &rank);
+    int valid = Pr >= 0 && Pc >= 0;
+    if (valid && Pr > 0 && Pc > 0)
+        valid = ((long int)Pr * Pc == size);
+    else if (valid && (Pr > 0 || Pc > 0))
+        valid = (size % (Pr > 0 ? Pr : Pc) == 0);
+    if (!valid) {
+        if (rank == 0)
+            fprintf(stderr, "Error: a %d x %d process grid does not match %d processes!\n", Pr, Pc, size);
+        return -1;
+    }
+    int dims[2] = {Pr, Pc};
+    int periods[2] = {0, 0};
+    int coords[2];
+    MPI_Dims_create(size, 2, dims);
+    MPI_Cart_create(comm, 2, dims, periods, 0, &grid->grid);
+
+    MPI_Comm_rank(grid->grid, &rank);
+    MPI_Cart_coords(grid->grid, rank, 2, coords);
+    grid->Pr = dims[0];
+    grid->Pc = dims[1];
+    grid->my_row = coords[0];
+    grid->my_col = coords[1];
+
+    int keep_cols[2] = {0, 1};
+    int keep_rows[2] = {1, 0};
+    MPI_Cart_sub(grid->grid, keep_cols, &grid->row_comm);
+    MPI_Cart_sub(grid->grid, keep_rows, &grid->col_comm);
+    return 0;
+}
+
+/**
+ * @brief Frees the communicators of a process grid.
+ *
+ * @param grid Process grid
+ */
+void processGridFree(process_grid_t *grid) {
+    MPI_Comm_free(&grid->row_comm);
+    MPI_Comm_free(&grid->col_comm);
+    MPI_Comm_free(&grid->grid);
+}
+
+/**
+ * @brief Computes the block of an N x M matrix owned by grid position (row, col).
+ *
+ * @param grid Process grid
+ * @param N Number of rows
+ * @param M Number of columns
+ * @param row Grid row
+ * @param col Grid column
+ * @param block Output block, block->local is left untouched
+ */
+void gridBlockRange(const process_grid_t *grid, int N, int M, int row, int col, grid_block_t *block) {
+    block->N = N;
+    block->M = M;
+    rowBlockRange(N, grid->Pr, row, &block->rows, &block->first_row);
+    rowBlockRange(M, grid->Pc, col, &block->cols, &block->first_col);
+}
+
+/**
+ * @brief Allocates this process's block of an N x M matrix and scatters it from grid rank 0.
+ *
+ * @param grid Process grid
+ * @param N Number of rows
+ * @param M Number of columns
+ * @param matrix Strided N x M matrix, only significant on grid rank 0
+ * @param block Output block. Free block->local when done.
+ */
+void gridBlockScatter(const process_grid_t *grid, int N, int M, long int *matrix, grid_block_t *block) {
+    int rank, size;
+    MPI_Comm_rank(grid->grid, &rank);
+    MPI_Comm_size(grid->grid, &size);
+
+    gridBlockRange(grid, N, M, grid->my_row, grid->my_col, block);
+    block->local = (long int *)malloc(((size_t)block->rows * block->cols + 1) * sizeof(long int));
+
+    int *counts = NULL, *displs = NULL;
+    long int *packed = NULL;
+    if (rank == 0) {
+        // pack every process's block contiguously in grid rank order
+        counts = (int *)malloc(size * sizeof(int));
+        displs = (int *)malloc(size * sizeof(int));
+        packed = (long int *)malloc(((size_t)N * M + 1) * sizeof(long int));
+        int offset = 0;
+        for (int r = 0; r < size; r++) {
+            int coords[2];
+            grid_block_t b;
+            MPI_Cart_coords(grid->grid, r, 2, coords);
+            gridBlockRange(grid, N, M, coords[0], coords[1], &b);
+            counts[r] = b.rows * b.cols;
+            displs[r] = offset;
+            for (int i = 0; i < b.rows; i++) {
+                memcpy(packed + offset + (long int)b.cols * i, matrix + b.first_col + (long int)M * (b.first_row + i), b.cols * sizeof(long int));
+            }
+            offset += counts[r];
+        }
+    }
+    MPI_Scatterv(packed, counts, displs, MPI_LONG, block->local, block->rows * block->cols, MPI_LONG, 0, grid->grid);
+    free(counts);
+    free(displs);
+    free(packed);
+}
+
+/**
+ * @brief Gathers every process's block into the full matrix on grid rank 0.
+ *
+ * @param grid Process grid
+ * @param block This process's block
+ * @param matrix Strided N x M output matrix, only significant on grid rank 0
+ */
+void gridBlockGather(const process_grid_t *grid, const grid_block_t *block, long int *matrix) {
+    int rank, size;
+    MPI_Comm_rank(grid->grid, &rank);
+    MPI_Comm_size(grid->grid, &size);
+    int N = block->N, M = block->M;
+
+    int *counts = NULL, *displs = NULL;
+    long int *packed = NULL;
+    if (rank == 0) {
+        counts = (int *)malloc(size * sizeof(int));
+        displs = (int *)malloc(size * sizeof(int));
+        packed = (long int *)malloc(((size_t)N * M + 1) * sizeof(long int));
+        int offset = 0;
+        for (int r = 0; r < size; r++) {
+            int coords[2];
+            grid_block_t b;
+            MPI_Cart_coords(grid->grid, r, 2, coords);
+            gridBlockRange(grid, N, M, coords[0], coords[1], &b);
+            counts[r] = b.rows * b.cols;
+            displs[r] = offset;
+            offset += counts[r];
+        }
+    }
+    MPI_Gatherv(block->local, block->rows * block->cols, MPI_LONG, packed, counts, displs, MPI_LONG, 0, grid->grid);
+    if (rank == 0) {
+        for (int r = 0; r < size; r++) {
+            int coords[2];
+            grid_block_t b;
+            MPI_Cart_coords(grid->grid, r, 2, coords);
+            gridBlockRange(grid, N, M, coords[0], coords[1], &b);
+            for (int i = 0; i < b.rows; i++) {
+                memcpy(matrix + b.first_col + (long int)M * (b.first_row + i), packed + displs[r] + (long int)b.cols * i, b.cols * sizeof(long int));
+            }
+        }
+    }
+    free(counts);
+    free(displs);
+    free(packed);
+}
+
+/**
+ * @brief Transposes a row-block distributed matrix: B = A^T, with B distributed by row blocks like A.
+ * @details Rank p owns rows first_row_p.. of the N x M matrix A and receives rows first_col_p.. of the M x N matrix
+ * B, i.e. the columns of A given by the block decomposition of M. Block (p, q) of A, its rows times the columns
+ * owned by q, becomes block (q, p) of B. The sender transposes it with the tiled kernel while packing it into the
+ * send buffer, so the exchange itself is a plain MPI_Ialltoallv; the receiver copies the blocks into their columns
+ * of B (unpack) or, with use_datatypes, lets MPI place them directly through one strided vector type per source
+ * and MPI_Ialltoallw. The diagonal block is transposed straight into B and never goes through MPI.
+ * With chunks > 1 the rows of B owned by every rank are split into chunks exchanged one after another, and the
+ * next chunk is packed while the current one is in flight. The send and receive buffers then hold two chunks,
+ * about 4 N M / (P chunks) elements per rank instead of 2 N M / P (half of that with use_datatypes, which needs no
+ * receive buffer).
+ * MPI counts and element displacements are ints, so a chunk of the blocks one rank sends or receives is limited to
+ * INT_MAX elements (16 GiB); larger transposes need more chunks and abort otherwise. Byte displacements into B
+ * exceed that much sooner, so with use_datatypes they are carried in MPI_Aint inside the datatypes instead.
+ * Must be called by every rank of comm.
+ *
+ * @param A This rank's row block of A
+ * @param B Output row block of B. Free B->local when done.
+ * @param chunks Number of chunks the exchange is pipelined in, at least 1
+ * @param use_datatypes 1 to receive through derived datatypes instead of unpacking
+ * @param comm Communicator A is distributed over
+ * @param timing If not NULL, receives the time this rank spent transposing, packing and unpacking (compute) and
+ * waiting for the exchange (communication)
+ */
+void rowBlockTranspose(const row_block_t *A, row_block_t *B, int chunks, int use_datatypes, MPI_Comm comm, mpi_timing_t *timing) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int N = A->N, M = A->M, rows = A->rows;
+    double compute = 0.0;
+    double start = MPI_Wtime();
+    if (chunks < 1)
+        chunks = 1;
+
+    B->N = M;
+    B->M = N;
+    rowBlockRange(M, size, rank, &B->rows, &B->first_row);
+    B->local = (long int *)malloc(((size_t)B->rows * N + 1) * sizeof(long int));
+
+    // rows and first row of A, and rows and first row of B, of every rank
+    int *layout = (int *)malloc(4 * size * sizeof(int));
+    int *a_rows = layout, *a_first = layout + size, *b_rows = layout + 2 * size, *b_first = layout + 3 * size;
+    for (int r = 0; r < size; r++) {
+        rowBlockRange(N, size, r, &a_rows[r], &a_first[r]);
+        rowBlockRange(M, size, r, &b_rows[r], &b_first[r]);
+    }
+
+    // the first chunk of every block is the largest
+    size_t send_size = 0, recv_size = 0;
+    for (int r = 0; r < size; r++) {
+        int count, first;
+        rowBlockRange(b_rows[r], chunks, 0, &count, &first);
+        if (r != rank)
+            send_size += (size_t)count * rows;
+        rowBlockRange(B->rows, chunks, 0, &count, &first);
+        if (r != rank)
+            recv_size += (size_t)count * a_rows[r];
+    }
+    if (send_size > INT_MAX || recv_size > INT_MAX) {
+        fprintf(stderr, "Error: rowBlockTranspose chunks of %zu and %zu elements do not fit an MPI count, use more than %d chunks!\n",
+                send_size, recv_size, chunks);
+        MPI_Abort(comm, -1);
+    }
+    int slots = (chunks > 1) ? 2 : 1;
+    long int *send = (long int *)malloc((slots * send_size + 1) * sizeof(long int));
+    long int *recv = use_datatypes ? NULL : (long int *)malloc((slots * recv_size + 1) * sizeof(long int));
+
+    /* per slot: send counts and displacements, receive counts and displacements; MPI_Ialltoallw takes its byte
+     * displacements as int, so with datatypes they are all 0 and the types themselves start at an MPI_Aint offset */
+    int *arrays = (int *)malloc(slots * 4 * size * sizeof(int));
+    MPI_Datatype *types = (MPI_Datatype *)malloc(slots * 2 * size * sizeof(MPI_Datatype));
+    MPI_Request requests[2];
+
+    for (int k = 0; k <= chunks; k++) {
+        // pack chunk k and post its exchange while chunk k - 1 is in flight
+        if (k < chunks) {
+            int slot = k % slots;
+            int *send_counts = arrays + slot * 4 * size, *send_displs = send_counts + size;
+            int *recv_counts = send_counts + 2 * size, *recv_displs = send_counts + 3 * size;
+            MPI_Datatype *send_types = types + slot * 2 * size, *recv_types = send_types + size;
+            long int *send_chunk = send + slot * send_size;
+            long int *recv_chunk = use_datatypes ? B->local : recv + slot * recv_size;
+            int offset = 0;
+            for (int q = 0; q < size; q++) {
+                int count, first;
+                rowBlockRange(b_rows[q], chunks, k, &count, &first);
+                const long int *block = A->local + b_first[q] + first;
+                double t0 = MPI_Wtime();
+                if (q == rank) {
+                    parallelTranspose(rows, count, block, M, B->local + (long int)N * first + a_first[rank], N);
+                    send_counts[q] = 0;
+                } else {
+                    parallelTranspose(rows, count, block, M, send_chunk + offset, rows);
+                    send_counts[q] = count * rows;
+                }
+                compute += MPI_Wtime() - t0;
+                send_displs[q] = use_datatypes ? 0 : offset;
+                send_types[q] = MPI_LONG;
+                if (use_datatypes && send_counts[q] > 0) {
+                    MPI_Aint displacement = (MPI_Aint)offset * (MPI_Aint)sizeof(long int);
+                    MPI_Type_create_hindexed_block(1, send_counts[q], &displacement, MPI_LONG, &send_types[q]);
+                    MPI_Type_commit(&send_types[q]);
+                    offset += send_counts[q];
+                    send_counts[q] = 1;
+                } else {
+                    offset += send_counts[q];
+                }
+                if (k > 0) {
+                    int done;
+                    MPI_Test(&requests[1 - slot], &done, MPI_STATUS_IGNORE);
+                }
+            }
+            int count, first;
+            rowBlockRange(B->rows, chunks, k, &count, &first);
+            offset = 0;
+            for (int p = 0; p < size; p++) {
+                if (use_datatypes) {
+                    recv_types[p] = MPI_LONG;
+                    recv_counts[p] = 0;
+                    recv_displs[p] = 0;
+                    if (p != rank && count > 0 && a_rows[p] > 0) {
+                        MPI_Datatype columns;
+                        MPI_Aint displacement = ((MPI_Aint)N * first + a_first[p]) * (MPI_Aint)sizeof(long int);
+                        MPI_Type_vector(count, a_rows[p], N, MPI_LONG, &columns);
+                        MPI_Type_create_hindexed_block(1, 1, &displacement, columns, &recv_types[p]);
+                        MPI_Type_commit(&recv_types[p]);
+                        MPI_Type_free(&columns);
+                        recv_counts[p] = 1;
+                    }
+                } else {
+                    recv_counts[p] = (p == rank) ? 0 : count * a_rows[p];
+                    recv_displs[p] = offset;
+                    offset += recv_counts[p];
+                }
+            }
+            if (use_datatypes)
+                MPI_Ialltoallw(send_chunk, send_counts, send_displs, send_types, recv_chunk, recv_counts, recv_displs, recv_types, comm, &requests[slot]);
+            else
+                MPI_Ialltoallv(send_chunk, send_counts, send_displs, MPI_LONG, recv_chunk, recv_counts, recv_displs, MPI_LONG, comm, &requests[slot]);
+        }
+
+        // finish chunk k - 1
+        if (k > 0) {
+            int slot = (k - 1) % slots;
+            MPI_Wait(&requests[slot], MPI_STATUS_IGNORE);
+            int *recv_counts = arrays + slot * 4 * size + 2 * size, *recv_displs = recv_counts + size;
+            MPI_Datatype *send_types = types + slot * 2 * size, *recv_types = send_types + size;
+            int count, first;
+            rowBlockRange(B->rows, chunks, k - 1, &count, &first);
+            double t0 = MPI_Wtime();
+            for (int p = 0; p < size; p++) {
+                if (use_datatypes) {
+                    if (send_types[p] != MPI_LONG)
+                        MPI_Type_free(&send_types[p]);
+                    if (recv_types[p] != MPI_LONG)
+                        MPI_Type_free(&recv_types[p]);
+                    continue;
+                }
+                const long int *block = recv + slot * recv_size + recv_displs[p];
+                for (int i = 0; i < count && recv_counts[p] > 0; i++) {
+                    memcpy(B->local + (long int)N * (first + i) + a_first[p], block + (long int)a_rows[p] * i, a_rows[p] * sizeof(long int));
+                }
+            }
+            compute += MPI_Wtime() - t0;
+        }
+    }
+
+    free(layout);
+    free(send);
+    free(recv);
+    free(arrays);
+    free(types);
+
+    if (timing != NULL) {
+        timing->compute = compute;
+        timing->communication = MPI_Wtime() - start - compute;
+    }
+}
+
+/**
+ * @brief Initializes MPI for hybrid MPI + threads runs and sizes the thread pool of each rank.
+ * @details Only the main thread of a rank makes MPI calls (MPI_THREAD_FUNNELED); the threaded kernels run between
+ * them. Unless NLA_THREADS is set, the cores of each node are divided evenly between the ranks sharing it, so
+ * mpirun -np 2 on an 8 core node runs 2 ranks x 4 threads without oversubscribing.
+ *
+ * @param argc Pointer to main's argc
+ * @param argv Pointer to main's argv
+ */
+void hybridInit(int *argc, char ***argv) {
+    int provided;
+    MPI_Init_thread(argc, argv, MPI_THREAD_FUNNELED, &provided);
+
+    MPI_Comm node;
+    int local_ranks;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+    MPI_Comm_size(node, &local_ranks);
+    MPI_Comm_free(&node);
+
+    if (provided < MPI_THREAD_FUNNELED) {
+        threadsConfigure(1, threadsConfig.schedule);
+    } else if (getenv("NLA_THREADS") == NULL) {
+#ifdef _OPENMP
+        int per_rank = omp_get_num_procs() / local_ranks;
+        threadsConfigure(per_rank > 0 ? per_rank : 1, threadsConfig.schedule);
+#endif
+    }
+}
+
+/**
+ * @brief Gathers every rank's timing on rank 0 and prints one line per rank.
+ *
+ * @param label Name of the operation that was timed
+ * @param timing This rank's timing
+ */
+void printRankTimings(const char *label, mpi_timing_t timing) {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    double mine[2] = {timing.compute, timing.communication};
+    double *all = (rank == 0) ? (double *)malloc(2 * size * sizeof(double)) : NULL;
+    MPI_Gather(mine, 2, MPI_DOUBLE, all, 2, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        for (int r = 0; r < size; r++) {
+            printf("%s rank %d: compute %e \t communication %e\n", label, r, all[2 * r], all[2 * r + 1]);
+        }
+        free(all);
+    }
+}
+
+#endif
@@ -0,0 +1,253 @@
+/**
+ * @file fused.h
+ * @author Navid Shamszadeh
+ * @brief Fused BLAS-style updates and lazy elementwise expressions, so update loops make one pass over memory
+ * instead of one per operation and need no temporaries.
+ * @details The fused kernels come from fusedTemplate.h, instantiated for long int (unsuffixed names, e.g. axpby),
+ * int, double and float (suffixes Int, Double and Float), and are reachable through the _Generic macros kernelAxpy,
+ * kernelAxpby, kernelAddMultiple and kernelGemvGeneral next to those of kernels.h. GEMM with alpha and beta is
+ * kernelGemm itself: gemmGeneral scales C while it writes the product back, so C = alpha * A * B + beta * C needs
+ * neither a scratch matrix nor a second pass.
+ *
+ * The expression API builds a small tree of elementwise double operations (exprVector, exprScalar, exprAdd,
+ * exprSub, exprMul, exprScale) and exprEvaluate runs it over the data in cache-sized blocks: every node of the tree
+ * is computed for one block in L1 before the next block is touched, so each input is read once and the result is
+ * written once however long the chain is. For example w = 2 * x + y .* z is
+ *
+ *     expr_t e;
+ *     exprInit(&e);
+ *     int root = exprAdd(&e, exprScale(&e, 2.0, exprVector(&e, x)), exprMul(&e, exprVector(&e, y), exprVector(&e, z)));
+ *     exprEvaluate(&e, root, n, w);
+ *
+ * @date 2021-05-19
+ */
+#ifndef FUSED_H
+#define FUSED_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kernels.h"
+#include "perf.h"
+
+// elements per block of the expression evaluator and of multi-operand adds of more than four operands, small enough to stay in L1
+#define FUSED_BLOCK 512
+// maximum number of nodes in one expression
+#define EXPR_MAX_NODES 32
+
+#define FUSED_T long int
+#define FUSED_NAME(x) x
+#include "fusedTemplate.h"
+
+#define FUSED_T int
+#define FUSED_NAME(x) x##Int
+#include "fusedTemplate.h"
+
+#define FUSED_T double
+#define FUSED_NAME(x) x##Double
+#include "fusedTemplate.h"
+
+#define FUSED_T float
+#define FUSED_NAME(x) x##Float
+#include "fusedTemplate.h"
+
+/**
+ * @brief y += alpha * x over n elements.
+ */
+#define kernelAxpy(n, alpha, x, y) _Generic((y), \
+    long int *: axpy,                           \
+    int *: axpyInt,                             \
+    double *: axpyDouble,                       \
+    float *: axpyFloat)(n, alpha, x, y)
+
+/**
+ * @brief y = alpha * x + beta * y over n elements.
+ */
+#define kernelAxpby(n, alpha, x, beta, y) _Generic((y), \
+    long int *: axpby,                                 \
+    int *: axpbyInt,                                   \
+    double *: axpbyDouble,                             \
+    float *: axpbyFloat)(n, alpha, x, beta, y)
+
+/**
+ * @brief c = sum of weights[k] * operands[k] for k < count over n elements, in one pass. weights may be NULL.
+ */
+#define kernelAddMultiple(n, count, operands, weights, c) _Generic((c), \
+    long int *: addMultiple,                                           \
+    int *: addMultipleInt,                                             \
+    double *: addMultipleDouble,                                       \
+    float *: addMultipleFloat)(n, count, operands, weights, c)
+
+/**
+ * @brief y = alpha * A * x + beta * z for an N x M matrix A with leading dimension lda. z may be y.
+ */
+#define kernelGemvGeneral(N, M, alpha, A, lda, x, beta, z, y) _Generic((y), \
+    long int *: gemvGeneral,                                               \
+    int *: gemvGeneralInt,                                                 \
+    double *: gemvGeneralDouble,                                           \
+    float *: gemvGeneralFloat)(N, M, alpha, A, lda, x, beta, z, y)
+
+typedef enum {
+    EXPR_VECTOR = 0,
+    EXPR_SCALAR,
+    EXPR_ADD,
+    EXPR_SUB,
+    EXPR_MUL
+} expr_op_t;
+
+/**
+ * @brief One node of an expression: a leaf (vector or scalar) or an elementwise binary operation.
+ */
+typedef struct {
+    expr_op_t op;
+    const double *vector; // EXPR_VECTOR
+    double scalar;        // EXPR_SCALAR
+    int left;             // operands of a binary operation, indices into the node array
+    int right;
+} expr_node_t;
+
+/**
+ * @brief An expression under construction. Nodes are referred to by their index, -1 is an invalid node.
+ */
+typedef struct {
+    int count;
+    expr_node_t nodes[EXPR_MAX_NODES];
+} expr_t;
+
+void exprInit(expr_t *e) {
+    e->count = 0;
+}
+
+/**
+ * @brief Appends a node. The operands of a binary operation must be nodes added before it, which also keeps the
+ * expression free of cycles.
+ *
+ * @return Index of the new node, or -1 if the expression is full or an operand is not an existing node
+ */
+int exprNode(expr_t *e, expr_op_t op, const double *vector, double scalar, int left, int right) {
+    if (e->count == EXPR_MAX_NODES || (op >= EXPR_ADD && (left < 0 || right < 0 || left >= e->count || right >= e->count))) {
+        fprintf(stderr, "Error: expression has too many nodes or an invalid operand!\n");
+        return -1;
+    }
+    expr_node_t node = {op, vector, scalar, left, right};
+    e->nodes[e->count] = node;
+    return e->count++;
+}
+
+/**
+ * @brief Leaf reading x[i].
+ */
+int exprVector(expr_t *e, const double *x) {
+    return exprNode(e, EXPR_VECTOR, x, 0.0, -1, -1);
+}
+
+/**
+ * @brief Leaf with the same value s for every element.
+ */
+int exprScalar(expr_t *e, double s) {
+    return exprNode(e, EXPR_SCALAR, NULL, s, -1, -1);
+}
+
+int exprAdd(expr_t *e, int a, int b) {
+    return exprNode(e, EXPR_ADD, NULL, 0.0, a, b);
+}
+
+int exprSub(expr_t *e, int a, int b) {
+    return exprNode(e, EXPR_SUB, NULL, 0.0, a, b);
+}
+
+/**
+ * @brief Elementwise product a .* b.
+ */
+int exprMul(expr_t *e, int a, int b) {
+    return exprNode(e, EXPR_MUL, NULL, 0.0, a, b);
+}
+
+/**
+ * @brief alpha * a.
+ */
+int exprScale(expr_t *e, double alpha, int a) {
+    return exprMul(e, exprScalar(e, alpha), a);
+}
+
+/**
+ * @brief Computes node for elements begin..begin+len and returns a pointer to the results.
+ * @details Vector leaves return a pointer into their input, everything else is computed into the node's scratch
+ * block (or into dst for the root) after its operands.
+ */
+const double *exprBlock(const expr_t *e, int node, long int begin, long int len, double *scratch, double *dst) {
+    const expr_node_t *n = &e->nodes[node];
+    double *out = dst ? dst : scratch + (long int)FUSED_BLOCK * node;
+    if (n->op == EXPR_VECTOR)
+        return n->vector + begin;
+    if (n->op == EXPR_SCALAR) {
+        for (long int i = 0; i < len; i++) {
+            out[i] = n->scalar;
+        }
+        return out;
+    }
+    const expr_node_t *l = &e->nodes[n->left];
+    const expr_node_t *r = &e->nodes[n->right];
+    // a scalar operand is applied as a constant instead of being expanded into a block
+    if (n->op == EXPR_MUL && l->op == EXPR_SCALAR) {
+        const double *b = exprBlock(e, n->right, begin, len, scratch, NULL);
+        for (long int i = 0; i < len; i++) {
+            out[i] = l->scalar * b[i];
+        }
+        return out;
+    }
+    if (n->op == EXPR_ADD && r->op == EXPR_SCALAR) {
+        const double *a = exprBlock(e, n->left, begin, len, scratch, NULL);
+        for (long int i = 0; i < len; i++) {
+            out[i] = a[i] + r->scalar;
+        }
+        return out;
+    }
+    const double *a = exprBlock(e, n->left, begin, len, scratch, NULL);
+    const double *b = exprBlock(e, n->right, begin, len, scratch, NULL);
+    switch (n->op) {
+    case EXPR_ADD:
+        for (long int i = 0; i < len; i++) {
+            out[i] = a[i] + b[i];
+        }
+        break;
+    case EXPR_SUB:
+        for (long int i = 0; i < len; i++) {
+            out[i] = a[i] - b[i];
+        }
+        break;
+    default:
+        for (long int i = 0; i < len; i++) {
+            out[i] = a[i] * b[i];
+        }
+        break;
+    }
+    return out;
+}
+
+/**
+ * @brief Evaluates the expression rooted at root over n elements into out, in one pass over the data.
+ * @details out may be one of the vectors of the expression (e.g. y = y + alpha * x): every block is read completely
+ * before it is written.
+ *
+ * @return 0 on success, -1 if the expression is invalid
+ */
+int exprEvaluate(const expr_t *e, int root, long int n, double *out) {
+    if (root < 0 || root >= e->count)
+        return -1;
+    double *scratch = (double *)aligned_alloc(64, (size_t)FUSED_BLOCK * e->count * sizeof(double));
+    if (scratch == NULL)
+        return -1;
+    PERF_BEGIN();
+    for (long int i0 = 0; i0 < n; i0 += FUSED_BLOCK) {
+        long int len = (n - i0 < FUSED_BLOCK) ? n - i0 : FUSED_BLOCK;
+        const double *result = exprBlock(e, root, i0, len, scratch, out + i0);
+        if (result != out + i0)
+            memmove(out + i0, result, len * sizeof(double));
+    }
+    free(scratch);
+    PERF_END("exprEvaluate", n, e->count, 1);
+    return 0;
+}
+
+#endif
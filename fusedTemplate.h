@@ -0,0 +1,186 @@
+/**
+ * @file fusedTemplate.h
+ * @author Navid Shamszadeh
+ * @brief Type-generic fused update kernels (AXPY, AXPBY, multi-operand add, GEMV with accumulate), included by
+ * fused.h once per element type.
+ * @details Before including, define FUSED_T as the element type and FUSED_NAME(x) to append the type's suffix to a
+ * function name. Both are undefined again at the end of this file. Like kernelsTemplate.h, the AXPBY and
+ * multi-operand add bodies are compiled once per instruction set with target attributes and selected at startup;
+ * the GEMV reuses the already dispatched GEMV kernels. perf.h records each kernel under its full name from __func__,
+ * suffix and instruction set included (e.g. axpbyAVX2Double).
+ * @date 2021-05-19
+ */
+
+/**
+ * @brief y = alpha * x + beta * y. beta == 0 does not read y, so y may hold garbage.
+ */
+static inline __attribute__((always_inline)) void FUSED_NAME(axpbyBody)(long int n, FUSED_T alpha, const FUSED_T *x, FUSED_T beta, FUSED_T *y) {
+    if (beta == 0) {
+        for (long int i = 0; i < n; i++) {
+            y[i] = alpha * x[i];
+        }
+    } else if (beta == 1) {
+        for (long int i = 0; i < n; i++) {
+            y[i] += alpha * x[i];
+        }
+    } else {
+        for (long int i = 0; i < n; i++) {
+            y[i] = alpha * x[i] + beta * y[i];
+        }
+    }
+}
+
+/**
+ * @brief c = sum over k of weights[k] * operands[k] (weights NULL for all ones).
+ * @details Up to four operands are summed in a single loop that reads every operand and writes every element of c
+ * once, so the hardware prefetchers see count + 1 uninterrupted streams. With more operands that many streams
+ * would thrash them, so c is built up FUSED_BLOCK elements at a time in L1 instead, one operand after another.
+ * c may be one of the operands.
+ */
+static inline __attribute__((always_inline)) void FUSED_NAME(addMultipleBody)(long int n, int count, const FUSED_T *const *operands, const FUSED_T *weights, FUSED_T *c) {
+    FUSED_T w0 = weights ? weights[0] : 1, w1 = (weights && count > 1) ? weights[1] : 1;
+    FUSED_T w2 = (weights && count > 2) ? weights[2] : 1, w3 = (weights && count > 3) ? weights[3] : 1;
+    const FUSED_T *a = operands[0], *b = (count > 1) ? operands[1] : NULL;
+    const FUSED_T *d = (count > 2) ? operands[2] : NULL, *e = (count > 3) ? operands[3] : NULL;
+    switch (count) {
+    case 1:
+        for (long int i = 0; i < n; i++) {
+            c[i] = w0 * a[i];
+        }
+        return;
+    case 2:
+        for (long int i = 0; i < n; i++) {
+            c[i] = w0 * a[i] + w1 * b[i];
+        }
+        return;
+    case 3:
+        for (long int i = 0; i < n; i++) {
+            c[i] = w0 * a[i] + w1 * b[i] + w2 * d[i];
+        }
+        return;
+    case 4:
+        for (long int i = 0; i < n; i++) {
+            c[i] = w0 * a[i] + w1 * b[i] + w2 * d[i] + w3 * e[i];
+        }
+        return;
+    }
+    for (long int i0 = 0; i0 < n; i0 += FUSED_BLOCK) {
+        long int len = (n - i0 < FUSED_BLOCK) ? n - i0 : FUSED_BLOCK;
+        FUSED_T block[FUSED_BLOCK];
+        FUSED_T w = w0;
+        a = operands[0] + i0;
+        for (long int i = 0; i < len; i++) {
+            block[i] = w * a[i];
+        }
+        for (int k = 1; k < count; k++) {
+            w = weights ? weights[k] : 1;
+            a = operands[k] + i0;
+            for (long int i = 0; i < len; i++) {
+                block[i] += w * a[i];
+            }
+        }
+        memcpy(c + i0, block, len * sizeof(FUSED_T));
+    }
+}
+
+void FUSED_NAME(axpbyScalar)(long int n, FUSED_T alpha, const FUSED_T *x, FUSED_T beta, FUSED_T *y) {
+    PERF_BEGIN();
+    FUSED_NAME(axpbyBody)(n, alpha, x, beta, y);
+    PERF_END(__func__, n, 1, 1);
+}
+
+__attribute__((target("avx2,fma"))) void FUSED_NAME(axpbyAVX2)(long int n, FUSED_T alpha, const FUSED_T *x, FUSED_T beta, FUSED_T *y) {
+    PERF_BEGIN();
+    FUSED_NAME(axpbyBody)(n, alpha, x, beta, y);
+    PERF_END(__func__, n, 1, 1);
+}
+
+__attribute__((target("avx512f,avx512dq,avx512vl,avx2,fma"))) void FUSED_NAME(axpbyAVX512)(long int n, FUSED_T alpha, const FUSED_T *x, FUSED_T beta, FUSED_T *y) {
+    PERF_BEGIN();
+    FUSED_NAME(axpbyBody)(n, alpha, x, beta, y);
+    PERF_END(__func__, n, 1, 1);
+}
+
+void FUSED_NAME(addMultipleScalar)(long int n, int count, const FUSED_T *const *operands, const FUSED_T *weights, FUSED_T *c) {
+    PERF_BEGIN();
+    FUSED_NAME(addMultipleBody)(n, count, operands, weights, c);
+    PERF_END(__func__, n, count, 1);
+}
+
+__attribute__((target("avx2,fma"))) void FUSED_NAME(addMultipleAVX2)(long int n, int count, const FUSED_T *const *operands, const FUSED_T *weights, FUSED_T *c) {
+    PERF_BEGIN();
+    FUSED_NAME(addMultipleBody)(n, count, operands, weights, c);
+    PERF_END(__func__, n, count, 1);
+}
+
+__attribute__((target("avx512f,avx512dq,avx512vl,avx2,fma"))) void FUSED_NAME(addMultipleAVX512)(long int n, int count, const FUSED_T *const *operands, const FUSED_T *weights, FUSED_T *c) {
+    PERF_BEGIN();
+    FUSED_NAME(addMultipleBody)(n, count, operands, weights, c);
+    PERF_END(__func__, n, count, 1);
+}
+
+/**
+ * @brief y = alpha * x + beta * y over n elements, dispatched to the best available instruction set.
+ */
+void (*FUSED_NAME(axpby))(long int n, FUSED_T alpha, const FUSED_T *x, FUSED_T beta, FUSED_T *y) = FUSED_NAME(axpbyScalar);
+
+/**
+ * @brief c = sum of weights[k] * operands[k] for k < count over n elements, in one pass. weights may be NULL.
+ */
+void (*FUSED_NAME(addMultiple))(long int n, int count, const FUSED_T *const *operands, const FUSED_T *weights, FUSED_T *c) = FUSED_NAME(addMultipleScalar);
+
+/**
+ * @brief y = alpha * A * x + beta * z for an N x M matrix A with leading dimension lda. z may be y.
+ * @details The product runs on the type's GEMV kernel of kernels.h (simdGemv for long int), FUSED_BLOCK rows at a
+ * time into a block that stays in L1, and alpha and beta are applied in an epilogue over that block, so y and z are
+ * each touched once and the matrix is streamed by the same SIMD kernel as a plain GEMV. z is not read when
+ * beta == 0.
+ */
+void FUSED_NAME(gemvGeneral)(int N, int M, FUSED_T alpha, const FUSED_T *A, int lda, const FUSED_T *x, FUSED_T beta, const FUSED_T *z, FUSED_T *y) {
+    PERF_BEGIN();
+    FUSED_T t[FUSED_BLOCK];
+    for (int i0 = 0; i0 < N; i0 += FUSED_BLOCK) {
+        int rows = (N - i0 < FUSED_BLOCK) ? N - i0 : FUSED_BLOCK;
+        kernelGemv(rows, M, A + (long int)lda * i0, lda, x, t);
+        if (beta == 0) {
+            for (int i = 0; i < rows; i++) {
+                y[i0 + i] = alpha * t[i];
+            }
+        } else if (alpha == 1 && beta == 1) {
+            for (int i = 0; i < rows; i++) {
+                y[i0 + i] = t[i] + z[i0 + i];
+            }
+        } else {
+            for (int i = 0; i < rows; i++) {
+                y[i0 + i] = alpha * t[i] + beta * z[i0 + i];
+            }
+        }
+    }
+    PERF_END(__func__, N, M, 1);
+}
+
+/**
+ * @brief y += alpha * x over n elements.
+ */
+void FUSED_NAME(axpy)(long int n, FUSED_T alpha, const FUSED_T *x, FUSED_T *y) {
+    FUSED_NAME(axpby)(n, alpha, x, 1, y);
+}
+
+/**
+ * @brief Selects the kernels for the current CPU from the instruction set found by simdInit. Runs before main.
+ */
+__attribute__((constructor(102))) void FUSED_NAME(fusedInit)(void) {
+    if (simdIsa == SIMD_AVX512) {
+        FUSED_NAME(axpby) = FUSED_NAME(axpbyAVX512);
+        FUSED_NAME(addMultiple) = FUSED_NAME(addMultipleAVX512);
+    } else if (simdIsa == SIMD_AVX2) {
+        FUSED_NAME(axpby) = FUSED_NAME(axpbyAVX2);
+        FUSED_NAME(addMultiple) = FUSED_NAME(addMultipleAVX2);
+    } else {
+        FUSED_NAME(axpby) = FUSED_NAME(axpbyScalar);
+        FUSED_NAME(addMultiple) = FUSED_NAME(addMultipleScalar);
+    }
+}
+
+#undef FUSED_T
+#undef FUSED_NAME
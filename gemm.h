@@ -0,0 +1,368 @@
+/**
+ * @file gemm.h
+ * @author Navid Shamszadeh
+ * @brief Cache-blocked, register-tiled matrix multiplication engine.
+ * @details The layout follows the usual Goto/BLIS scheme: B is packed KC x NC at a time into a buffer that stays in L3,
+ * A is packed MC x KC at a time into a buffer that stays in L2, and a GEMM_MR x GEMM_NR micro-kernel streams
+ * the packed panels out of L1 while keeping its block of C in registers. The micro-kernel is chosen at startup
+ * from the instruction sets detected in simd.h. The type-generic part lives in gemmTemplate.h and is instantiated
+ * for long int (unsuffixed names, e.g. gemmStrided), double (suffix Double, e.g. gemmStridedDouble), float (suffix
+ * Float) and int (suffix Int). Float uses a wider GEMM_MR_FLOAT x GEMM_NR_FLOAT register tile so that its AVX2 and
+ * AVX-512 micro-kernels fill all 8 or 16 lanes; int has no hand-written micro-kernel yet and relies on the compiler
+ * vectorizing the scalar one. The block sizes and the unrolling of the double micro-kernels below are defaults that
+ * tune.h can override per machine.
+ * @date 2021-05-17
+ */
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "simd.h"
+
+// register tile of C held by the micro-kernel
+#define GEMM_MR 4
+#define GEMM_NR 4
+// register tile of the float micro-kernels: one 16-lane AVX-512 register (two AVX2 registers) per row of C
+#define GEMM_MR_FLOAT 8
+#define GEMM_NR_FLOAT 16
+// cache blocking parameters: MC x KC block of A lives in L2, KC x NR panel of B lives in L1, KC x NC block of B lives in L3
+#define GEMM_MC 96
+#define GEMM_KC 256
+#define GEMM_NC 2048
+// k steps per iteration of the AVX2 and AVX-512 double micro-kernels, each into its own accumulators (1, 2 or 4)
+#define GEMM_UNROLL 2
+
+#define GEMM_ALIGNMENT 64
+
+#define GEMM_T long int
+#define GEMM_NAME(x) x
+#define GEMM_TILE_MR GEMM_MR
+#define GEMM_TILE_NR GEMM_NR
+#include "gemmTemplate.h"
+
+#define GEMM_T double
+#define GEMM_NAME(x) x##Double
+#define GEMM_TILE_MR GEMM_MR
+#define GEMM_TILE_NR GEMM_NR
+#include "gemmTemplate.h"
+
+#define GEMM_T float
+#define GEMM_NAME(x) x##Float
+#define GEMM_TILE_MR GEMM_MR_FLOAT
+#define GEMM_TILE_NR GEMM_NR_FLOAT
+#include "gemmTemplate.h"
+
+#define GEMM_T int
+#define GEMM_NAME(x) x##Int
+#define GEMM_TILE_MR GEMM_MR
+#define GEMM_TILE_NR GEMM_NR
+#include "gemmTemplate.h"
+
+// the vector micro-kernels hold one row of the 4 x 4 tile per register (two registers for SSE2, half a register for AVX-512)
+#if GEMM_MR != 4 || GEMM_NR != 4
+#error "the SIMD micro-kernels assume a 4 x 4 register tile"
+#endif
+
+void gemmMicroKernelSSE2(int kc, const long int *a, const long int *b, int mr, int nr, long int *C, int ldc, int accumulate) {
+    __m128i c0l = _mm_setzero_si128(), c0h = _mm_setzero_si128(), c1l = _mm_setzero_si128(), c1h = _mm_setzero_si128();
+    __m128i c2l = _mm_setzero_si128(), c2h = _mm_setzero_si128(), c3l = _mm_setzero_si128(), c3h = _mm_setzero_si128();
+    for (int k = 0; k < kc; k++) {
+        __m128i bl = _mm_load_si128((const __m128i *)b);
+        __m128i bh = _mm_load_si128((const __m128i *)(b + 2));
+        __m128i a0 = _mm_set1_epi64x(a[0]), a1 = _mm_set1_epi64x(a[1]), a2 = _mm_set1_epi64x(a[2]), a3 = _mm_set1_epi64x(a[3]);
+        c0l = _mm_add_epi64(c0l, simdMul64SSE2(a0, bl));
+        c0h = _mm_add_epi64(c0h, simdMul64SSE2(a0, bh));
+        c1l = _mm_add_epi64(c1l, simdMul64SSE2(a1, bl));
+        c1h = _mm_add_epi64(c1h, simdMul64SSE2(a1, bh));
+        c2l = _mm_add_epi64(c2l, simdMul64SSE2(a2, bl));
+        c2h = _mm_add_epi64(c2h, simdMul64SSE2(a2, bh));
+        c3l = _mm_add_epi64(c3l, simdMul64SSE2(a3, bl));
+        c3h = _mm_add_epi64(c3h, simdMul64SSE2(a3, bh));
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+    long int c[GEMM_MR][GEMM_NR];
+    _mm_storeu_si128((__m128i *)&c[0][0], c0l);
+    _mm_storeu_si128((__m128i *)&c[0][2], c0h);
+    _mm_storeu_si128((__m128i *)&c[1][0], c1l);
+    _mm_storeu_si128((__m128i *)&c[1][2], c1h);
+    _mm_storeu_si128((__m128i *)&c[2][0], c2l);
+    _mm_storeu_si128((__m128i *)&c[2][2], c2h);
+    _mm_storeu_si128((__m128i *)&c[3][0], c3l);
+    _mm_storeu_si128((__m128i *)&c[3][2], c3h);
+    gemmWriteBack(c, mr, nr, C, ldc, accumulate);
+}
+
+__attribute__((target("avx2"))) void gemmMicroKernelAVX2(int kc, const long int *a, const long int *b, int mr, int nr, long int *C, int ldc, int accumulate) {
+    __m256i c0 = _mm256_setzero_si256(), c1 = _mm256_setzero_si256(), c2 = _mm256_setzero_si256(), c3 = _mm256_setzero_si256();
+    for (int k = 0; k < kc; k++) {
+        __m256i bv = _mm256_load_si256((const __m256i *)b);
+        c0 = _mm256_add_epi64(c0, simdMul64AVX2(_mm256_set1_epi64x(a[0]), bv));
+        c1 = _mm256_add_epi64(c1, simdMul64AVX2(_mm256_set1_epi64x(a[1]), bv));
+        c2 = _mm256_add_epi64(c2, simdMul64AVX2(_mm256_set1_epi64x(a[2]), bv));
+        c3 = _mm256_add_epi64(c3, simdMul64AVX2(_mm256_set1_epi64x(a[3]), bv));
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+    long int c[GEMM_MR][GEMM_NR];
+    _mm256_storeu_si256((__m256i *)c[0], c0);
+    _mm256_storeu_si256((__m256i *)c[1], c1);
+    _mm256_storeu_si256((__m256i *)c[2], c2);
+    _mm256_storeu_si256((__m256i *)c[3], c3);
+    gemmWriteBack(c, mr, nr, C, ldc, accumulate);
+}
+
+// AVX-512 holds two rows of the tile per register, so a k step costs two 64-bit multiplies instead of four
+__attribute__((target("avx512f,avx512dq"))) void gemmMicroKernelAVX512(int kc, const long int *a, const long int *b, int mr, int nr, long int *C, int ldc, int accumulate) {
+    __m512i c01 = _mm512_setzero_si512(), c23 = _mm512_setzero_si512();
+    for (int k = 0; k < kc; k++) {
+        __m512i bv = _mm512_broadcast_i64x4(_mm256_load_si256((const __m256i *)b));
+        __m512i a01 = _mm512_set_epi64(a[1], a[1], a[1], a[1], a[0], a[0], a[0], a[0]);
+        __m512i a23 = _mm512_set_epi64(a[3], a[3], a[3], a[3], a[2], a[2], a[2], a[2]);
+        c01 = _mm512_add_epi64(c01, _mm512_mullo_epi64(a01, bv));
+        c23 = _mm512_add_epi64(c23, _mm512_mullo_epi64(a23, bv));
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+    long int c[GEMM_MR][GEMM_NR];
+    _mm512_storeu_si512(c[0], c01);
+    _mm512_storeu_si512(c[2], c23);
+    gemmWriteBack(c, mr, nr, C, ldc, accumulate);
+}
+
+
+// double precision micro-kernels; only the FMA variants (AVX2, AVX-512) take the unroll factor from tune.h
+void gemmMicroKernelSSE2Double(int kc, const double *a, const double *b, int mr, int nr, double *C, int ldc, int accumulate) {
+    __m128d c0l = _mm_setzero_pd(), c0h = _mm_setzero_pd(), c1l = _mm_setzero_pd(), c1h = _mm_setzero_pd();
+    __m128d c2l = _mm_setzero_pd(), c2h = _mm_setzero_pd(), c3l = _mm_setzero_pd(), c3h = _mm_setzero_pd();
+    for (int k = 0; k < kc; k++) {
+        __m128d bl = _mm_load_pd(b);
+        __m128d bh = _mm_load_pd(b + 2);
+        __m128d a0 = _mm_set1_pd(a[0]), a1 = _mm_set1_pd(a[1]), a2 = _mm_set1_pd(a[2]), a3 = _mm_set1_pd(a[3]);
+        c0l = _mm_add_pd(c0l, _mm_mul_pd(a0, bl));
+        c0h = _mm_add_pd(c0h, _mm_mul_pd(a0, bh));
+        c1l = _mm_add_pd(c1l, _mm_mul_pd(a1, bl));
+        c1h = _mm_add_pd(c1h, _mm_mul_pd(a1, bh));
+        c2l = _mm_add_pd(c2l, _mm_mul_pd(a2, bl));
+        c2h = _mm_add_pd(c2h, _mm_mul_pd(a2, bh));
+        c3l = _mm_add_pd(c3l, _mm_mul_pd(a3, bl));
+        c3h = _mm_add_pd(c3h, _mm_mul_pd(a3, bh));
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+    double c[GEMM_MR][GEMM_NR];
+    _mm_storeu_pd(&c[0][0], c0l);
+    _mm_storeu_pd(&c[0][2], c0h);
+    _mm_storeu_pd(&c[1][0], c1l);
+    _mm_storeu_pd(&c[1][2], c1h);
+    _mm_storeu_pd(&c[2][0], c2l);
+    _mm_storeu_pd(&c[2][2], c2h);
+    _mm_storeu_pd(&c[3][0], c3l);
+    _mm_storeu_pd(&c[3][2], c3h);
+    gemmWriteBackDouble(c, mr, nr, C, ldc, accumulate);
+}
+
+// the AVX2 and AVX-512 bodies take the unroll factor as a constant, so each wrapper below gets its own fully
+// unrolled loop; more independent accumulators hide more FMA latency but leave fewer registers for the operands
+static inline __attribute__((always_inline, target("avx2,fma"))) void gemmMicroKernelAVX2DoubleBody(int kc, const double *a, const double *b, int mr, int nr, double *C, int ldc, int accumulate, const int unroll) {
+    __m256d c[4][4];
+    for (int u = 0; u < unroll; u++) {
+        for (int i = 0; i < GEMM_MR; i++) {
+            c[u][i] = _mm256_setzero_pd();
+        }
+    }
+    int k = 0;
+    for (; k + unroll <= kc; k += unroll) {
+        for (int u = 0; u < unroll; u++) {
+            __m256d bv = _mm256_load_pd(b + u * GEMM_NR);
+            for (int i = 0; i < GEMM_MR; i++) {
+                c[u][i] = _mm256_fmadd_pd(_mm256_broadcast_sd(a + u * GEMM_MR + i), bv, c[u][i]);
+            }
+        }
+        a += unroll * GEMM_MR;
+        b += unroll * GEMM_NR;
+    }
+    for (; k < kc; k++) {
+        __m256d bv = _mm256_load_pd(b);
+        for (int i = 0; i < GEMM_MR; i++) {
+            c[0][i] = _mm256_fmadd_pd(_mm256_broadcast_sd(a + i), bv, c[0][i]);
+        }
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+    double tile[GEMM_MR][GEMM_NR];
+    for (int i = 0; i < GEMM_MR; i++) {
+        for (int u = 1; u < unroll; u++) {
+            c[0][i] = _mm256_add_pd(c[0][i], c[u][i]);
+        }
+        _mm256_storeu_pd(tile[i], c[0][i]);
+    }
+    gemmWriteBackDouble(tile, mr, nr, C, ldc, accumulate);
+}
+
+__attribute__((target("avx2,fma"))) void gemmMicroKernelAVX2Double1(int kc, const double *a, const double *b, int mr, int nr, double *C, int ldc, int accumulate) {
+    gemmMicroKernelAVX2DoubleBody(kc, a, b, mr, nr, C, ldc, accumulate, 1);
+}
+
+__attribute__((target("avx2,fma"))) void gemmMicroKernelAVX2Double2(int kc, const double *a, const double *b, int mr, int nr, double *C, int ldc, int accumulate) {
+    gemmMicroKernelAVX2DoubleBody(kc, a, b, mr, nr, C, ldc, accumulate, 2);
+}
+
+__attribute__((target("avx2,fma"))) void gemmMicroKernelAVX2Double4(int kc, const double *a, const double *b, int mr, int nr, double *C, int ldc, int accumulate) {
+    gemmMicroKernelAVX2DoubleBody(kc, a, b, mr, nr, C, ldc, accumulate, 4);
+}
+
+// AVX-512 holds rows 0-1 and 2-3 of the tile in one register each
+static inline __attribute__((always_inline, target("avx512f"))) void gemmMicroKernelAVX512DoubleBody(int kc, const double *a, const double *b, int mr, int nr, double *C, int ldc, int accumulate, const int unroll) {
+    __m512d c01[4], c23[4];
+    for (int u = 0; u < unroll; u++) {
+        c01[u] = _mm512_setzero_pd();
+        c23[u] = _mm512_setzero_pd();
+    }
+    int k = 0;
+    for (; k + unroll <= kc; k += unroll) {
+        for (int u = 0; u < unroll; u++) {
+            const double *au = a + u * GEMM_MR;
+            __m512d bv = _mm512_broadcast_f64x4(_mm256_load_pd(b + u * GEMM_NR));
+            c01[u] = _mm512_fmadd_pd(_mm512_set_pd(au[1], au[1], au[1], au[1], au[0], au[0], au[0], au[0]), bv, c01[u]);
+            c23[u] = _mm512_fmadd_pd(_mm512_set_pd(au[3], au[3], au[3], au[3], au[2], au[2], au[2], au[2]), bv, c23[u]);
+        }
+        a += unroll * GEMM_MR;
+        b += unroll * GEMM_NR;
+    }
+    for (; k < kc; k++) {
+        __m512d bv = _mm512_broadcast_f64x4(_mm256_load_pd(b));
+        c01[0] = _mm512_fmadd_pd(_mm512_set_pd(a[1], a[1], a[1], a[1], a[0], a[0], a[0], a[0]), bv, c01[0]);
+        c23[0] = _mm512_fmadd_pd(_mm512_set_pd(a[3], a[3], a[3], a[3], a[2], a[2], a[2], a[2]), bv, c23[0]);
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+    for (int u = 1; u < unroll; u++) {
+        c01[0] = _mm512_add_pd(c01[0], c01[u]);
+        c23[0] = _mm512_add_pd(c23[0], c23[u]);
+    }
+    double tile[GEMM_MR][GEMM_NR];
+    _mm512_storeu_pd(tile[0], c01[0]);
+    _mm512_storeu_pd(tile[2], c23[0]);
+    gemmWriteBackDouble(tile, mr, nr, C, ldc, accumulate);
+}
+
+__attribute__((target("avx512f"))) void gemmMicroKernelAVX512Double1(int kc, const double *a, const double *b, int mr, int nr, double *C, int ldc, int accumulate) {
+    gemmMicroKernelAVX512DoubleBody(kc, a, b, mr, nr, C, ldc, accumulate, 1);
+}
+
+__attribute__((target("avx512f"))) void gemmMicroKernelAVX512Double2(int kc, const double *a, const double *b, int mr, int nr, double *C, int ldc, int accumulate) {
+    gemmMicroKernelAVX512DoubleBody(kc, a, b, mr, nr, C, ldc, accumulate, 2);
+}
+
+__attribute__((target("avx512f"))) void gemmMicroKernelAVX512Double4(int kc, const double *a, const double *b, int mr, int nr, double *C, int ldc, int accumulate) {
+    gemmMicroKernelAVX512DoubleBody(kc, a, b, mr, nr, C, ldc, accumulate, 4);
+}
+
+// single precision micro-kernels on the 8 x 16 tile; full tiles are added to C with vector loads and stores
+#if GEMM_MR_FLOAT != 8 || GEMM_NR_FLOAT != 16
+#error "the float micro-kernels assume an 8 x 16 register tile"
+#endif
+
+// AVX2 covers a row of the tile with two registers, so it runs over the panels twice, four rows at a time, to keep
+// its accumulators at 8 of the 16 registers
+__attribute__((target("avx2,fma"))) void gemmMicroKernelAVX2Float(int kc, const float *a, const float *b, int mr, int nr, float *C, int ldc, int accumulate) {
+    __m256 c[GEMM_MR_FLOAT][2];
+    for (int i0 = 0; i0 < GEMM_MR_FLOAT; i0 += 4) {
+        for (int i = i0; i < i0 + 4; i++) {
+            c[i][0] = _mm256_setzero_ps();
+            c[i][1] = _mm256_setzero_ps();
+        }
+        const float *ak = a + i0, *bk = b;
+        for (int k = 0; k < kc; k++) {
+            __m256 b0 = _mm256_load_ps(bk);
+            __m256 b1 = _mm256_load_ps(bk + 8);
+            for (int i = 0; i < 4; i++) {
+                __m256 av = _mm256_broadcast_ss(ak + i);
+                c[i0 + i][0] = _mm256_fmadd_ps(av, b0, c[i0 + i][0]);
+                c[i0 + i][1] = _mm256_fmadd_ps(av, b1, c[i0 + i][1]);
+            }
+            ak += GEMM_MR_FLOAT;
+            bk += GEMM_NR_FLOAT;
+        }
+    }
+    if (mr == GEMM_MR_FLOAT && nr == GEMM_NR_FLOAT) {
+        for (int i = 0; i < GEMM_MR_FLOAT; i++) {
+            float *row = C + (long int)ldc * i;
+            if (accumulate) {
+                c[i][0] = _mm256_add_ps(c[i][0], _mm256_loadu_ps(row));
+                c[i][1] = _mm256_add_ps(c[i][1], _mm256_loadu_ps(row + 8));
+            }
+            _mm256_storeu_ps(row, c[i][0]);
+            _mm256_storeu_ps(row + 8, c[i][1]);
+        }
+        return;
+    }
+    float tile[GEMM_MR_FLOAT][GEMM_NR_FLOAT];
+    for (int i = 0; i < GEMM_MR_FLOAT; i++) {
+        _mm256_storeu_ps(tile[i], c[i][0]);
+        _mm256_storeu_ps(tile[i] + 8, c[i][1]);
+    }
+    gemmWriteBackFloat(tile, mr, nr, C, ldc, accumulate);
+}
+
+__attribute__((target("avx512f"))) void gemmMicroKernelAVX512Float(int kc, const float *a, const float *b, int mr, int nr, float *C, int ldc, int accumulate) {
+    __m512 c[GEMM_MR_FLOAT];
+    for (int i = 0; i < GEMM_MR_FLOAT; i++) {
+        c[i] = _mm512_setzero_ps();
+    }
+    for (int k = 0; k < kc; k++) {
+        __m512 bv = _mm512_load_ps(b);
+        for (int i = 0; i < GEMM_MR_FLOAT; i++) {
+            c[i] = _mm512_fmadd_ps(_mm512_set1_ps(a[i]), bv, c[i]);
+        }
+        a += GEMM_MR_FLOAT;
+        b += GEMM_NR_FLOAT;
+    }
+    if (mr == GEMM_MR_FLOAT && nr == GEMM_NR_FLOAT) {
+        for (int i = 0; i < GEMM_MR_FLOAT; i++) {
+            float *row = C + (long int)ldc * i;
+            _mm512_storeu_ps(row, accumulate ? _mm512_add_ps(c[i], _mm512_loadu_ps(row)) : c[i]);
+        }
+        return;
+    }
+    float tile[GEMM_MR_FLOAT][GEMM_NR_FLOAT];
+    for (int i = 0; i < GEMM_MR_FLOAT; i++) {
+        _mm512_storeu_ps(tile[i], c[i]);
+    }
+    gemmWriteBackFloat(tile, mr, nr, C, ldc, accumulate);
+}
+
+/**
+ * @brief Points the micro-kernels of every element type at the widest variant the CPU supports, with the double
+ * unrolling from tune.h. Runs automatically before main, after simdInit and tuneInit; call it again after changing
+ * tuneParams.gemmUnroll.
+ */
+__attribute__((constructor(102))) void gemmInit(void) {
+    int unroll = TUNED(gemmUnroll, GEMM_UNROLL);
+    switch (simdIsa) {
+        case SIMD_AVX512:
+            gemmMicroKernel = gemmMicroKernelAVX512;
+            gemmMicroKernelDouble = (unroll >= 4) ? gemmMicroKernelAVX512Double4 : (unroll == 1) ? gemmMicroKernelAVX512Double1 : gemmMicroKernelAVX512Double2;
+            gemmMicroKernelFloat = gemmMicroKernelAVX512Float;
+            break;
+        case SIMD_AVX2:
+            gemmMicroKernel = gemmMicroKernelAVX2;
+            gemmMicroKernelDouble = (unroll >= 4) ? gemmMicroKernelAVX2Double4 : (unroll == 1) ? gemmMicroKernelAVX2Double1 : gemmMicroKernelAVX2Double2;
+            gemmMicroKernelFloat = gemmMicroKernelAVX2Float;
+            break;
+        case SIMD_SSE2:
+            gemmMicroKernel = gemmMicroKernelSSE2;
+            gemmMicroKernelDouble = gemmMicroKernelSSE2Double;
+            gemmMicroKernelFloat = gemmMicroKernelScalarFloat;
+            break;
+        default:
+            gemmMicroKernel = gemmMicroKernelScalar;
+            gemmMicroKernelDouble = gemmMicroKernelScalarDouble;
+            gemmMicroKernelFloat = gemmMicroKernelScalarFloat;
+            break;
+    }
+}
+
+#endif
@@ -0,0 +1,264 @@
+/**
+ * @file gemmTemplate.h
+ * @author Navid Shamszadeh
+ * @brief Type-generic part of the blocked matrix multiplication engine, included by gemm.h once per element type.
+ * @details Before including, define GEMM_T as the element type, GEMM_NAME(x) to append the type's suffix to a
+ * function name and GEMM_TILE_MR x GEMM_TILE_NR as the register tile of the type's micro-kernels. All four are
+ * undefined again at the end of this file. The instruction set specific micro-kernels live in gemm.h.
+ * @date 2021-05-18
+ */
+
+/**
+ * @brief Packs alpha times an mc x kc block of A into micro-panels of GEMM_TILE_MR rows, stored column by column.
+ * @details Rows past mc are zero padded so the micro-kernel never needs to check bounds.
+ *
+ * @param mc Number of rows of the block
+ * @param kc Number of columns of the block
+ * @param alpha Scalar applied to every packed element
+ * @param A Pointer to the top left element of the block
+ * @param lda Leading dimension (row stride) of A
+ * @param buffer Output buffer of at least ceil(mc / GEMM_TILE_MR) * GEMM_TILE_MR * kc elements
+ */
+void GEMM_NAME(gemmPackA)(int mc, int kc, GEMM_T alpha, const GEMM_T *A, int lda, GEMM_T *buffer) {
+    for (int i0 = 0; i0 < mc; i0 += GEMM_TILE_MR) {
+        int mr = (mc - i0 < GEMM_TILE_MR) ? mc - i0 : GEMM_TILE_MR;
+        for (int k = 0; k < kc; k++) {
+            for (int i = 0; i < mr; i++) {
+                buffer[i] = alpha * A[k + (long int)lda * (i0 + i)];
+            }
+            for (int i = mr; i < GEMM_TILE_MR; i++) {
+                buffer[i] = 0;
+            }
+            buffer += GEMM_TILE_MR;
+        }
+    }
+}
+
+/**
+ * @brief Packs a kc x nc block of B into micro-panels of GEMM_TILE_NR columns, stored row by row.
+ * @details Columns past nc are zero padded so the micro-kernel never needs to check bounds.
+ *
+ * @param kc Number of rows of the block
+ * @param nc Number of columns of the block
+ * @param B Pointer to the top left element of the block
+ * @param ldb Leading dimension (row stride) of B
+ * @param buffer Output buffer of at least ceil(nc / GEMM_TILE_NR) * GEMM_TILE_NR * kc elements
+ */
+void GEMM_NAME(gemmPackB)(int kc, int nc, const GEMM_T *B, int ldb, GEMM_T *buffer) {
+    for (int j0 = 0; j0 < nc; j0 += GEMM_TILE_NR) {
+        int nr = (nc - j0 < GEMM_TILE_NR) ? nc - j0 : GEMM_TILE_NR;
+        for (int k = 0; k < kc; k++) {
+            const GEMM_T *row = B + j0 + (long int)ldb * k;
+            for (int j = 0; j < nr; j++) {
+                buffer[j] = row[j];
+            }
+            for (int j = nr; j < GEMM_TILE_NR; j++) {
+                buffer[j] = 0;
+            }
+            buffer += GEMM_TILE_NR;
+        }
+    }
+}
+
+/**
+ * @brief Writes the top left mr x nr corner of a register tile back to C.
+ *
+ * @param c GEMM_TILE_MR x GEMM_TILE_NR tile
+ * @param mr Number of valid rows of the tile
+ * @param nr Number of valid columns of the tile
+ * @param C Pointer to the top left element of the tile of C
+ * @param ldc Leading dimension (row stride) of C
+ * @param accumulate If nonzero the tile is added to C, otherwise it overwrites C
+ */
+void GEMM_NAME(gemmWriteBack)(GEMM_T c[GEMM_TILE_MR][GEMM_TILE_NR], int mr, int nr, GEMM_T *C, int ldc, int accumulate) {
+    for (int i = 0; i < mr; i++) {
+        for (int j = 0; j < nr; j++) {
+            if (accumulate)
+                C[j + (long int)ldc * i] += c[i][j];
+            else
+                C[j + (long int)ldc * i] = c[i][j];
+        }
+    }
+}
+
+/**
+ * @brief Computes the GEMM_TILE_MR x GEMM_TILE_NR product of a packed A micro-panel and a packed B micro-panel.
+ * @details Only the top left mr x nr corner is written back, which handles the fringe of C.
+ *
+ * @param kc Inner dimension of the product
+ * @param a Packed A micro-panel (kc x GEMM_TILE_MR)
+ * @param b Packed B micro-panel (kc x GEMM_TILE_NR)
+ * @param mr Number of valid rows of the tile
+ * @param nr Number of valid columns of the tile
+ * @param C Pointer to the top left element of the tile of C
+ * @param ldc Leading dimension (row stride) of C
+ * @param accumulate If nonzero the product is added to C, otherwise it overwrites C
+ */
+void GEMM_NAME(gemmMicroKernelScalar)(int kc, const GEMM_T *a, const GEMM_T *b, int mr, int nr, GEMM_T *C, int ldc, int accumulate) {
+    GEMM_T c[GEMM_TILE_MR][GEMM_TILE_NR] = {{0}};
+    for (int k = 0; k < kc; k++) {
+        for (int i = 0; i < GEMM_TILE_MR; i++) {
+            for (int j = 0; j < GEMM_TILE_NR; j++) {
+                c[i][j] += a[i] * b[j];
+            }
+        }
+        a += GEMM_TILE_MR;
+        b += GEMM_TILE_NR;
+    }
+    GEMM_NAME(gemmWriteBack)(c, mr, nr, C, ldc, accumulate);
+}
+
+/**
+ * @brief Micro-kernel used by the blocked engine, selected at startup by gemmInit.
+ */
+void (*GEMM_NAME(gemmMicroKernel))(int kc, const GEMM_T *a, const GEMM_T *b, int mr, int nr, GEMM_T *C, int ldc, int accumulate) = GEMM_NAME(gemmMicroKernelScalar);
+
+/**
+ * @brief Blocked matrix multiplication C = alpha * A * B + beta * C on strided matrices with arbitrary leading dimensions.
+ * @details alpha is folded into the packing of A. beta == 0 overwrites C without reading it.
+ *
+ * @param N Number of rows of A and C
+ * @param M Number of columns of A and rows of B
+ * @param K Number of columns of B and C
+ * @param alpha Scalar multiplying A * B
+ * @param A Matrix of size N x M with row stride lda
+ * @param lda Leading dimension of A
+ * @param B Matrix of size M x K with row stride ldb
+ * @param ldb Leading dimension of B
+ * @param beta Scalar multiplying C
+ * @param C Matrix of size N x K with row stride ldc
+ * @param ldc Leading dimension of C
+ */
+void GEMM_NAME(gemmGeneral)(int N, int M, int K, GEMM_T alpha, const GEMM_T *A, int lda, const GEMM_T *B, int ldb, GEMM_T beta, GEMM_T *C, int ldc) {
+    if (N <= 0 || K <= 0)
+        return;
+    if (beta != 0 && beta != 1) {
+        for (int i = 0; i < N; i++) {
+            for (int j = 0; j < K; j++) {
+                C[j + (long int)ldc * i] *= beta;
+            }
+        }
+    }
+    if (M <= 0 || alpha == 0) {
+        if (beta == 0) {
+            for (int i = 0; i < N; i++) {
+                memset(C + (long int)ldc * i, 0, K * sizeof(GEMM_T));
+            }
+        }
+        return;
+    }
+
+    // blocking from tune.h when tuned, rounded to whole micro-panels
+    int block_mc = (TUNED(gemmMc, GEMM_MC) + GEMM_TILE_MR - 1) / GEMM_TILE_MR * GEMM_TILE_MR;
+    int block_kc = TUNED(gemmKc, GEMM_KC);
+    int block_nc = (TUNED(gemmNc, GEMM_NC) + GEMM_TILE_NR - 1) / GEMM_TILE_NR * GEMM_TILE_NR;
+
+    // size the packing buffers for the blocks actually used so small products (e.g. tiles) do not pay for full ones
+    int kc_max = (M < block_kc) ? M : block_kc;
+    int mc_max = ((N < block_mc ? N : block_mc) + GEMM_TILE_MR - 1) / GEMM_TILE_MR * GEMM_TILE_MR;
+    int nc_max = ((K < block_nc ? K : block_nc) + GEMM_TILE_NR - 1) / GEMM_TILE_NR * GEMM_TILE_NR;
+    size_t bytes_A = ((size_t)mc_max * kc_max * sizeof(GEMM_T) + GEMM_ALIGNMENT - 1) / GEMM_ALIGNMENT * GEMM_ALIGNMENT;
+    size_t bytes_B = ((size_t)kc_max * nc_max * sizeof(GEMM_T) + GEMM_ALIGNMENT - 1) / GEMM_ALIGNMENT * GEMM_ALIGNMENT;
+    GEMM_T *packed_A = (GEMM_T *)aligned_alloc(GEMM_ALIGNMENT, bytes_A);
+    GEMM_T *packed_B = (GEMM_T *)aligned_alloc(GEMM_ALIGNMENT, bytes_B);
+
+    for (int jc = 0; jc < K; jc += block_nc) {
+        int nc = (K - jc < block_nc) ? K - jc : block_nc;
+        for (int pc = 0; pc < M; pc += block_kc) {
+            int kc = (M - pc < block_kc) ? M - pc : block_kc;
+            // the first pass over the inner dimension initializes C when beta is zero
+            int acc = beta != 0 || pc > 0;
+            GEMM_NAME(gemmPackB)(kc, nc, B + jc + (long int)ldb * pc, ldb, packed_B);
+            for (int ic = 0; ic < N; ic += block_mc) {
+                int mc = (N - ic < block_mc) ? N - ic : block_mc;
+                GEMM_NAME(gemmPackA)(mc, kc, alpha, A + pc + (long int)lda * ic, lda, packed_A);
+                for (int jr = 0; jr < nc; jr += GEMM_TILE_NR) {
+                    int nr = (nc - jr < GEMM_TILE_NR) ? nc - jr : GEMM_TILE_NR;
+                    for (int ir = 0; ir < mc; ir += GEMM_TILE_MR) {
+                        int mr = (mc - ir < GEMM_TILE_MR) ? mc - ir : GEMM_TILE_MR;
+                        GEMM_NAME(gemmMicroKernel)(kc, packed_A + ir * kc, packed_B + jr * kc, mr, nr,
+                                                   C + (jc + jr) + (long int)ldc * (ic + ir), ldc, acc);
+                    }
+                }
+            }
+        }
+    }
+
+    free(packed_A);
+    free(packed_B);
+}
+
+/**
+ * @brief Blocked matrix multiplication C = A * B (or C += A * B) on strided matrices with arbitrary leading dimensions.
+ *
+ * @param N Number of rows of A and C
+ * @param M Number of columns of A and rows of B
+ * @param K Number of columns of B and C
+ * @param A Matrix of size N x M with row stride lda
+ * @param lda Leading dimension of A
+ * @param B Matrix of size M x K with row stride ldb
+ * @param ldb Leading dimension of B
+ * @param C Matrix of size N x K with row stride ldc
+ * @param ldc Leading dimension of C
+ * @param accumulate If nonzero the product is added to C, otherwise it overwrites C
+ */
+void GEMM_NAME(gemmStrided)(int N, int M, int K, const GEMM_T *A, int lda, const GEMM_T *B, int ldb, GEMM_T *C, int ldc, int accumulate) {
+    GEMM_NAME(gemmGeneral)(N, M, K, 1, A, lda, B, ldb, accumulate ? 1 : 0, C, ldc);
+}
+
+/**
+ * @brief Blocked matrix multiplication C = A * B on row-pointer matrices.
+ * @details When the rows of a matrix are evenly spaced in memory (as they are when carved out of a single A[0] block)
+ * the matrix is multiplied in place with its row spacing as the leading dimension. Otherwise it is copied into a
+ * contiguous buffer first.
+ *
+ * @param N Number of rows of A and C
+ * @param M Number of columns of A and rows of B
+ * @param K Number of columns of B and C
+ * @param A Matrix of size N x M
+ * @param B Matrix of size M x K
+ * @param C Matrix of size N x K
+ */
+void GEMM_NAME(gemmRows)(int N, int M, int K, GEMM_T **A, GEMM_T **B, GEMM_T **C) {
+    GEMM_T **rows[3] = {A, B, C};
+    int nrows[3] = {N, M, N};
+    int ncols[3] = {M, K, K};
+    GEMM_T *base[3];
+    int ld[3];
+    int copied[3];
+
+    for (int m = 0; m < 3; m++) {
+        GEMM_T **X = rows[m];
+        ld[m] = (nrows[m] > 1) ? (int)(X[1] - X[0]) : ncols[m];
+        copied[m] = ld[m] < ncols[m];
+        for (int i = 2; i < nrows[m] && !copied[m]; i++) {
+            copied[m] = (X[i] - X[i - 1]) != ld[m];
+        }
+        if (copied[m]) {
+            ld[m] = ncols[m];
+            base[m] = (GEMM_T *)malloc((size_t)nrows[m] * ncols[m] * sizeof(GEMM_T));
+            for (int i = 0; i < nrows[m] && m < 2; i++) {
+                memcpy(base[m] + (long int)ncols[m] * i, X[i], ncols[m] * sizeof(GEMM_T));
+            }
+        } else {
+            base[m] = X[0];
+        }
+    }
+
+    GEMM_NAME(gemmStrided)(N, M, K, base[0], ld[0], base[1], ld[1], base[2], ld[2], 0);
+
+    if (copied[2]) {
+        for (int i = 0; i < N; i++) {
+            memcpy(C[i], base[2] + (long int)K * i, K * sizeof(GEMM_T));
+        }
+    }
+    for (int m = 0; m < 3; m++) {
+        if (copied[m])
+            free(base[m]);
+    }
+}
+
+#undef GEMM_T
+#undef GEMM_NAME
+#undef GEMM_TILE_MR
+#undef GEMM_TILE_NR
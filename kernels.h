@@ -0,0 +1,85 @@
+/**
+ * @file kernels.h
+ * @author Navid Shamszadeh
+ * @brief One type-dispatched API for the add, GEMV, GEMM, transpose and triangular solve kernels over long int
+ * (int64), int (int32), double and float.
+ * @details The kernelAdd, kernelGemv, kernelGemm, kernelTranspose and kernelTriangularSolve macros pick the kernel
+ * for the element type of their output argument at compile time with _Generic, so the same call works on any of the
+ * four types. long int goes to the hand-written kernels of simd.h, transpose.h and gemm.h; the other types go to the
+ * kernels generated from kernelsTemplate.h (suffixes Int, Double and Float, e.g. vectorAddInt) and to the GEMM engine
+ * instantiated in gemm.h. The triangular solve exists for double and float only.
+ * The add and GEMV kernels are bandwidth bound, so storing data as int or float instead of long int or double halves
+ * the bytes moved per element and roughly doubles their throughput.
+ * @date 2021-05-19
+ */
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stdlib.h>
+#include "simd.h"
+#include "gemm.h"
+#include "transpose.h"
+
+// independent partial sums per row in the generic GEMV, enough to fill an AVX-512 register of float or int
+#define KERNEL_LANES 16
+// rows of the diagonal blocks solved directly by the blocked triangular solve
+#define KERNEL_TRSM_BLOCK 64
+
+#define KERNEL_T int
+#define KERNEL_NAME(x) x##Int
+#include "kernelsTemplate.h"
+
+#define KERNEL_T double
+#define KERNEL_NAME(x) x##Double
+#define KERNEL_FLOATING
+#include "kernelsTemplate.h"
+
+#define KERNEL_T float
+#define KERNEL_NAME(x) x##Float
+#define KERNEL_FLOATING
+#include "kernelsTemplate.h"
+
+/**
+ * @brief c[i] = a[i] + b[i] for 0 <= i < n.
+ */
+#define kernelAdd(n, a, b, c) _Generic((c), \
+    long int *: simdAdd,                    \
+    int *: vectorAddInt,                    \
+    double *: vectorAddDouble,              \
+    float *: vectorAddFloat)(n, a, b, c)
+
+/**
+ * @brief b = A * x for an N x M matrix A with leading dimension lda.
+ */
+#define kernelGemv(N, M, A, lda, x, b) _Generic((b), \
+    long int *: simdGemv,                            \
+    int *: gemvInt,                                  \
+    double *: gemvDouble,                            \
+    float *: gemvFloat)(N, M, A, lda, x, b)
+
+/**
+ * @brief C = alpha * A * B + beta * C for an N x M matrix A and an M x K matrix B.
+ */
+#define kernelGemm(N, M, K, alpha, A, lda, B, ldb, beta, C, ldc) _Generic((C), \
+    long int *: gemmGeneral,                                                   \
+    int *: gemmGeneralInt,                                                     \
+    double *: gemmGeneralDouble,                                               \
+    float *: gemmGeneralFloat)(N, M, K, alpha, A, lda, B, ldb, beta, C, ldc)
+
+/**
+ * @brief Out-of-place transpose B = A^T of an N x M matrix A.
+ */
+#define kernelTranspose(N, M, A, lda, B, ldb) _Generic((B), \
+    long int *: transposeStrided,                           \
+    int *: transposeStridedInt,                             \
+    double *: transposeStridedDouble,                       \
+    float *: transposeStridedFloat)(N, M, A, lda, B, ldb)
+
+/**
+ * @brief Blocked triangular solve op(T) X = B with nrhs right-hand sides, B overwritten with X.
+ */
+#define kernelTriangularSolve(N, nrhs, lower, transpose, unit_diagonal, T, ldt, B, ldb) _Generic((B), \
+    double *: triangularSolveStridedDouble,                                                          \
+    float *: triangularSolveStridedFloat)(N, nrhs, lower, transpose, unit_diagonal, T, ldt, B, ldb)
+
+#endif
@@ -0,0 +1,224 @@
+/**
+ * @file kernelsTemplate.h
+ * @author Navid Shamszadeh
+ * @brief Type-generic add, GEMV, transpose and triangular solve kernels, included by kernels.h once per element type.
+ * @details Before including, define KERNEL_T as the element type and KERNEL_NAME(x) to append the type's suffix to
+ * a function name, and define KERNEL_FLOATING for floating point types (the triangular solve divides, so it is only
+ * generated for those). All three macros are undefined again at the end of this file.
+ * The add and GEMV bodies are written so the compiler vectorizes them (independent lanes, no reassociation needed)
+ * and are compiled once per instruction set with target attributes, then selected at startup like simd.h does.
+ * @date 2021-05-19
+ */
+
+/**
+ * @brief c[i] = a[i] + b[i] for 0 <= i < n. Inlined into the per instruction set variants below.
+ */
+static inline __attribute__((always_inline)) void KERNEL_NAME(vectorAddBody)(long int n, const KERNEL_T *a, const KERNEL_T *b, KERNEL_T *c) {
+    for (long int i = 0; i < n; i++) {
+        c[i] = a[i] + b[i];
+    }
+}
+
+/**
+ * @brief b = A * x for an N x M matrix A with leading dimension lda, four rows at a time.
+ * @details Each row keeps KERNEL_LANES partial sums that are only added together at the end of the row, so the
+ * inner loop vectorizes without reordering a floating point reduction.
+ */
+static inline __attribute__((always_inline)) void KERNEL_NAME(gemvBody)(int N, int M, const KERNEL_T *A, int lda, const KERNEL_T *x, KERNEL_T *b) {
+    int i = 0;
+    for (; i + 4 <= N; i += 4) {
+        const KERNEL_T *a0 = A + (long int)lda * i, *a1 = a0 + lda, *a2 = a1 + lda, *a3 = a2 + lda;
+        KERNEL_T s0[KERNEL_LANES] = {0}, s1[KERNEL_LANES] = {0}, s2[KERNEL_LANES] = {0}, s3[KERNEL_LANES] = {0};
+        int j = 0;
+        for (; j + KERNEL_LANES <= M; j += KERNEL_LANES) {
+            for (int l = 0; l < KERNEL_LANES; l++) {
+                s0[l] += a0[j + l] * x[j + l];
+                s1[l] += a1[j + l] * x[j + l];
+                s2[l] += a2[j + l] * x[j + l];
+                s3[l] += a3[j + l] * x[j + l];
+            }
+        }
+        KERNEL_T t0 = 0, t1 = 0, t2 = 0, t3 = 0;
+        for (int l = 0; l < KERNEL_LANES; l++) {
+            t0 += s0[l];
+            t1 += s1[l];
+            t2 += s2[l];
+            t3 += s3[l];
+        }
+        for (; j < M; j++) {
+            t0 += a0[j] * x[j];
+            t1 += a1[j] * x[j];
+            t2 += a2[j] * x[j];
+            t3 += a3[j] * x[j];
+        }
+        b[i] = t0;
+        b[i + 1] = t1;
+        b[i + 2] = t2;
+        b[i + 3] = t3;
+    }
+    for (; i < N; i++) {
+        const KERNEL_T *a0 = A + (long int)lda * i;
+        KERNEL_T t = 0;
+        for (int j = 0; j < M; j++) {
+            t += a0[j] * x[j];
+        }
+        b[i] = t;
+    }
+}
+
+void KERNEL_NAME(vectorAddScalar)(long int n, const KERNEL_T *a, const KERNEL_T *b, KERNEL_T *c) {
+    KERNEL_NAME(vectorAddBody)(n, a, b, c);
+}
+
+__attribute__((target("avx2,fma"))) void KERNEL_NAME(vectorAddAVX2)(long int n, const KERNEL_T *a, const KERNEL_T *b, KERNEL_T *c) {
+    KERNEL_NAME(vectorAddBody)(n, a, b, c);
+}
+
+__attribute__((target("avx512f,avx512dq,avx512vl,avx2,fma"))) void KERNEL_NAME(vectorAddAVX512)(long int n, const KERNEL_T *a, const KERNEL_T *b, KERNEL_T *c) {
+    KERNEL_NAME(vectorAddBody)(n, a, b, c);
+}
+
+void KERNEL_NAME(gemvScalar)(int N, int M, const KERNEL_T *A, int lda, const KERNEL_T *x, KERNEL_T *b) {
+    KERNEL_NAME(gemvBody)(N, M, A, lda, x, b);
+}
+
+__attribute__((target("avx2,fma"))) void KERNEL_NAME(gemvAVX2)(int N, int M, const KERNEL_T *A, int lda, const KERNEL_T *x, KERNEL_T *b) {
+    KERNEL_NAME(gemvBody)(N, M, A, lda, x, b);
+}
+
+__attribute__((target("avx512f,avx512dq,avx512vl,avx2,fma"))) void KERNEL_NAME(gemvAVX512)(int N, int M, const KERNEL_T *A, int lda, const KERNEL_T *x, KERNEL_T *b) {
+    KERNEL_NAME(gemvBody)(N, M, A, lda, x, b);
+}
+
+/**
+ * @brief c[i] = a[i] + b[i] for 0 <= i < n, dispatched to the best available instruction set. c may alias a or b.
+ */
+void (*KERNEL_NAME(vectorAdd))(long int n, const KERNEL_T *a, const KERNEL_T *b, KERNEL_T *c) = KERNEL_NAME(vectorAddScalar);
+
+/**
+ * @brief b = A * x for an N x M matrix A with leading dimension lda, dispatched to the best available instruction set.
+ */
+void (*KERNEL_NAME(gemv))(int N, int M, const KERNEL_T *A, int lda, const KERNEL_T *x, KERNEL_T *b) = KERNEL_NAME(gemvScalar);
+
+/**
+ * @brief Selects the kernels for the current CPU from the instruction set found by simdInit. Runs before main.
+ */
+__attribute__((constructor(102))) void KERNEL_NAME(kernelsInit)(void) {
+    if (simdIsa == SIMD_AVX512) {
+        KERNEL_NAME(vectorAdd) = KERNEL_NAME(vectorAddAVX512);
+        KERNEL_NAME(gemv) = KERNEL_NAME(gemvAVX512);
+    } else if (simdIsa == SIMD_AVX2) {
+        KERNEL_NAME(vectorAdd) = KERNEL_NAME(vectorAddAVX2);
+        KERNEL_NAME(gemv) = KERNEL_NAME(gemvAVX2);
+    } else {
+        KERNEL_NAME(vectorAdd) = KERNEL_NAME(vectorAddScalar);
+        KERNEL_NAME(gemv) = KERNEL_NAME(gemvScalar);
+    }
+}
+
+/**
+ * @brief Out-of-place transpose B = A^T of an N x M matrix, one transposeTileSize() square tile at a time.
+ *
+ * @param N Number of rows of A
+ * @param M Number of columns of A
+ * @param A Input matrix with row stride lda
+ * @param lda Leading dimension of A
+ * @param B Output M x N matrix with row stride ldb
+ * @param ldb Leading dimension of B
+ */
+void KERNEL_NAME(transposeStrided)(int N, int M, const KERNEL_T *A, int lda, KERNEL_T *B, int ldb) {
+    int tile = transposeTileSize();
+    for (int i0 = 0; i0 < N; i0 += tile) {
+        int rows = (N - i0 < tile) ? N - i0 : tile;
+        for (int j0 = 0; j0 < M; j0 += tile) {
+            int cols = (M - j0 < tile) ? M - j0 : tile;
+            for (int j = 0; j < cols; j++) {
+                for (int i = 0; i < rows; i++) {
+                    B[(i0 + i) + (long int)ldb * (j0 + j)] = A[(j0 + j) + (long int)lda * (i0 + i)];
+                }
+            }
+        }
+    }
+}
+
+#ifdef KERNEL_FLOATING
+
+/**
+ * @brief Unblocked triangular solve op(T) X = B for a small diagonal block and a block of right-hand sides.
+ * @details Works row by row of X, so the inner loop runs along the contiguous rows of B.
+ *
+ * @param n Order of T and number of rows of B
+ * @param nrhs Number of columns of B
+ * @param lower Nonzero if T is lower triangular, zero if upper triangular
+ * @param transpose Nonzero to solve with T^T instead of T
+ * @param unit_diagonal Nonzero if the diagonal of T is implicitly one
+ * @param T Triangular matrix with row stride ldt
+ * @param ldt Leading dimension of T
+ * @param B Right-hand sides with row stride ldb, overwritten with X
+ * @param ldb Leading dimension of B
+ */
+void KERNEL_NAME(triangularSolveUnblocked)(int n, int nrhs, int lower, int transpose, int unit_diagonal, const KERNEL_T *T, int ldt, KERNEL_T *B, int ldb) {
+    // op(T) is lower triangular exactly when one of lower and transpose is set
+    int forward = (lower != 0) != (transpose != 0);
+    for (int step = 0; step < n; step++) {
+        int i = forward ? step : n - 1 - step;
+        KERNEL_T *row_i = B + (long int)ldb * i;
+        int k_begin = forward ? 0 : i + 1;
+        int k_end = forward ? i : n;
+        for (int k = k_begin; k < k_end; k++) {
+            KERNEL_T t = transpose ? T[i + (long int)ldt * k] : T[k + (long int)ldt * i];
+            const KERNEL_T *row_k = B + (long int)ldb * k;
+            for (int j = 0; j < nrhs; j++) {
+                row_i[j] -= t * row_k[j];
+            }
+        }
+        if (!unit_diagonal) {
+            KERNEL_T inverse = 1 / T[i + (long int)ldt * i];
+            for (int j = 0; j < nrhs; j++) {
+                row_i[j] *= inverse;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Blocked triangular solve op(T) X = B (TRSM) on the calling thread.
+ * @details Right-looking: each KERNEL_TRSM_BLOCK x KERNEL_TRSM_BLOCK diagonal block is solved directly, then the
+ * rows still to be solved are updated with a single GEMM against the block column of op(T) below (or above) it.
+ * For the transposed variants that block column is a block row of T, which is transposed into a scratch panel first.
+ * Parameters as for triangularSolveUnblocked, with N the order of T.
+ */
+void KERNEL_NAME(triangularSolveStrided)(int N, int nrhs, int lower, int transpose, int unit_diagonal, const KERNEL_T *T, int ldt, KERNEL_T *B, int ldb) {
+    int forward = (lower != 0) != (transpose != 0);
+    KERNEL_T *panel = transpose ? (KERNEL_T *)malloc(((size_t)N * KERNEL_TRSM_BLOCK + 1) * sizeof(KERNEL_T)) : NULL;
+
+    for (int step = 0; step < N; step += KERNEL_TRSM_BLOCK) {
+        int ib = (N - step < KERNEL_TRSM_BLOCK) ? N - step : KERNEL_TRSM_BLOCK;
+        // rows i0..i0+ib are solved in this step, rows r0..r0+nr are updated with them
+        int i0 = forward ? step : N - step - ib;
+        int r0 = forward ? i0 + ib : 0;
+        int nr = forward ? N - i0 - ib : i0;
+        KERNEL_T *X = B + (long int)ldb * i0;
+
+        KERNEL_NAME(triangularSolveUnblocked)(ib, nrhs, lower, transpose, unit_diagonal, T + i0 + (long int)ldt * i0, ldt, X, ldb);
+        if (nr == 0)
+            continue;
+
+        // op(T)[r0..r0+nr, i0..i0+ib]
+        const KERNEL_T *update = T + i0 + (long int)ldt * r0;
+        int ldu = ldt;
+        if (transpose) {
+            KERNEL_NAME(transposeStrided)(ib, nr, T + r0 + (long int)ldt * i0, ldt, panel, ib);
+            update = panel;
+            ldu = ib;
+        }
+        KERNEL_NAME(gemmGeneral)(nr, ib, nrhs, -1, update, ldu, X, ldb, 1, B + (long int)ldb * r0, ldb);
+    }
+    free(panel);
+}
+
+#endif
+
+#undef KERNEL_T
+#undef KERNEL_NAME
+#undef KERNEL_FLOATING
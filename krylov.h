@@ -0,0 +1,885 @@
+/**
+ * @file krylov.h
+ * @author Navid Shamszadeh
+ * @brief Krylov iterative solvers for A x = b: preconditioned conjugate gradient (CG) for symmetric positive
+ * definite A and restarted GMRES for general A, with Jacobi, IC(0) and ILU(0) preconditioners.
+ * @details A dense factorization costs O(n^3) work and O(n^2) memory whatever A looks like. A Krylov solver only
+ * needs products with A, so a sparse A with a few nonzeros per row costs O(nnz) per iteration, and a good
+ * preconditioner keeps the iteration count small. The operator is either a CSR matrix (threaded SpMV of sparse.h)
+ * or a dense double matrix_t (GEMV of fused.h), and any other product can be plugged in through krylov_operator_t.
+ *
+ * Every dot product or norm is a reduction across all threads, a global synchronization point the whole team
+ * waits on (and, distributed, an allreduce across all ranks). The plain solvers need two of them per CG iteration
+ * and j + 2 in step j of GMRES (modified Gram-Schmidt). The pipelined variants restructure the recurrences so the
+ * reductions of an iteration are fused into a single pass that also carries the vector updates:
+ * krylovCgPipelined is the pipelined CG of Ghysels and Vanroose (one reduction per iteration, three more vectors),
+ * and krylovGmresPipelined orthogonalizes with classical Gram-Schmidt done twice, where each projection is one
+ * pass over the basis and the norm of the new vector rides along with the second one (two reductions per step
+ * however large j gets). The pipelined recurrences drift a little further from the true residual, which is why
+ * every solver recomputes ||b - A x|| at the end.
+ *
+ * Each solve fills a krylov_stats_t: iterations, operator and preconditioner applications, reductions, wall time,
+ * final relative residual and, if the caller provides a buffer, the relative residual after every iteration.
+ * @date 2021-05-22
+ */
+#ifndef KRYLOV_H
+#define KRYLOV_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "benchmark.h"
+#include "matrix.h"
+#include "fused.h"
+#include "sparse.h"
+#include "threads.h"
+
+// vector operations work on chunks that are a multiple of this many elements
+#define KRYLOV_GRAIN 2048
+// most dot products fused into one reduction by krylovDots
+#define KRYLOV_MAX_DOTS 4
+
+/**
+ * @brief y = A x for an n x n operator; data is whatever apply needs (a sparse_csr_t, a matrix_t, ...).
+ */
+typedef struct {
+    int n;
+    void (*apply)(const void *data, const double *x, double *y);
+    const void *data;
+} krylov_operator_t;
+
+typedef enum {
+    KRYLOV_NONE = 0,
+    KRYLOV_JACOBI, // inverse of the diagonal
+    KRYLOV_IC0,    // incomplete Cholesky L L^T on the pattern of the lower triangle, for CG
+    KRYLOV_ILU0    // incomplete L U on the pattern of A, for GMRES
+} krylov_preconditioner_type_t;
+
+/**
+ * @brief Preconditioner M, applied as z = M^-1 r.
+ */
+typedef struct {
+    krylov_preconditioner_type_t type;
+    int n;
+    double *inverseDiagonal; // KRYLOV_JACOBI
+    sparse_csr_t factor;     // KRYLOV_IC0: L, KRYLOV_ILU0: L (unit, below the diagonal) and U in one matrix
+    long int *diagonal;      // position of the diagonal entry of every row of factor
+} krylov_preconditioner_t;
+
+/**
+ * @brief Convergence telemetry of one solve.
+ */
+typedef struct {
+    int iterations;      // CG iterations or GMRES Arnoldi steps
+    int converged;
+    long int matvecs;    // applications of the operator
+    long int preconditions; // applications of the preconditioner
+    long int reductions; // global synchronization points (each fused group of dot products counts once)
+    double residual;     // ||b - A x|| / ||b||, recomputed after the solve
+    double time;         // seconds, without the final residual check
+    double *history;     // optional, caller allocated: relative residual (estimate) after every iteration
+    int historyCapacity;
+    int historyLength;
+} krylov_stats_t;
+
+/**
+ * @brief y = A x for a CSR matrix, with the threaded product.
+ */
+void krylovApplyCsr(const void *data, const double *x, double *y) {
+    parallelSparseCsrMultiplyVector((const sparse_csr_t *)data, x, y);
+}
+
+/**
+ * @brief y = A x for a dense double matrix_t, split by rows across the threads.
+ */
+void krylovApplyMatrix(const void *data, const double *x, double *y) {
+    const matrix_t *A = (const matrix_t *)data;
+    long int blocks = (A->rows + 3) / 4;
+    int threads = threadsFor(blocks);
+    long int chunks = threadsChunks(threads, blocks);
+    long int next = 0;
+    #pragma omp parallel num_threads(threads) if (threads > 1)
+    {
+        long int step = 0;
+        for (long int ch; (ch = threadsNextChunk(&next, &step, chunks)) >= 0; ) {
+            int begin = (int)(threadsChunkStart(blocks, chunks, ch) * 4);
+            int end = (int)(threadsChunkStart(blocks, chunks, ch + 1) * 4);
+            if (end > A->rows)
+                end = A->rows;
+            gemvGeneralDouble(end - begin, A->cols, 1.0, &MATRIX_AT(double, A, begin, 0), A->ld, x, 0.0, y + begin, y + begin);
+        }
+    }
+}
+
+/**
+ * @brief Operator for a square CSR matrix. A must outlive the operator.
+ */
+krylov_operator_t krylovOperatorCsr(const sparse_csr_t *A) {
+    krylov_operator_t op = {A->rows, krylovApplyCsr, A};
+    return op;
+}
+
+/**
+ * @brief Operator for a square dense MATRIX_DOUBLE matrix. A must outlive the operator.
+ */
+krylov_operator_t krylovOperatorMatrix(const matrix_t *A) {
+    matrixCheckType("krylovOperatorMatrix", MATRIX_DOUBLE, A);
+    krylov_operator_t op = {A->rows, krylovApplyMatrix, A};
+    return op;
+}
+
+/**
+ * @brief result[k] = x[k] . y[k] for k < count (at most KRYLOV_MAX_DOTS), all in one pass and one reduction.
+ */
+void krylovDots(long int n, int count, const double *const *x, const double *const *y, double *result) {
+    long int grains = (n + KRYLOV_GRAIN - 1) / KRYLOV_GRAIN;
+    int threads = threadsFor(grains);
+    long int chunks = threadsChunks(threads, grains);
+    long int next = 0;
+    for (int k = 0; k < count; k++) {
+        result[k] = 0.0;
+    }
+    #pragma omp parallel num_threads(threads) if (threads > 1)
+    {
+        long int step = 0;
+        double sum[KRYLOV_MAX_DOTS] = {0.0};
+        for (long int ch; (ch = threadsNextChunk(&next, &step, chunks)) >= 0; ) {
+            long int begin = threadsChunkStart(grains, chunks, ch) * KRYLOV_GRAIN;
+            long int end = threadsChunkStart(grains, chunks, ch + 1) * KRYLOV_GRAIN;
+            if (end > n)
+                end = n;
+            for (int k = 0; k < count; k++) {
+                double part;
+                gemvGeneralDouble(1, (int)(end - begin), 1.0, x[k] + begin, 0, y[k] + begin, 0.0, &part, &part);
+                sum[k] += part;
+            }
+        }
+        for (int k = 0; k < count; k++) {
+            #pragma omp atomic
+            result[k] += sum[k];
+        }
+    }
+}
+
+/**
+ * @brief Euclidean norm of x, one reduction.
+ */
+double krylovNorm(long int n, const double *x) {
+    const double *v[1] = {x};
+    double dot;
+    krylovDots(n, 1, v, v, &dot);
+    return sqrt(dot);
+}
+
+/**
+ * @brief Threaded y = alpha * x + beta * y.
+ */
+void krylovAxpby(long int n, double alpha, const double *x, double beta, double *y) {
+    long int grains = (n + KRYLOV_GRAIN - 1) / KRYLOV_GRAIN;
+    int threads = threadsFor(grains);
+    long int chunks = threadsChunks(threads, grains);
+    long int next = 0;
+    #pragma omp parallel num_threads(threads) if (threads > 1)
+    {
+        long int step = 0;
+        for (long int ch; (ch = threadsNextChunk(&next, &step, chunks)) >= 0; ) {
+            long int begin = threadsChunkStart(grains, chunks, ch) * KRYLOV_GRAIN;
+            long int end = threadsChunkStart(grains, chunks, ch + 1) * KRYLOV_GRAIN;
+            if (end > n)
+                end = n;
+            axpbyDouble(end - begin, alpha, x + begin, beta, y + begin);
+        }
+    }
+}
+
+/**
+ * @brief h[k] = V_k . w for the count rows V_k of the row-major count x n matrix V, in one pass over w and one
+ * reduction.
+ */
+void krylovProject(long int n, int count, const double *V, const double *w, double *h) {
+    long int grains = (n + KRYLOV_GRAIN - 1) / KRYLOV_GRAIN;
+    int threads = threadsFor(grains);
+    long int chunks = threadsChunks(threads, grains);
+    long int next = 0;
+    for (int k = 0; k < count; k++) {
+        h[k] = 0.0;
+    }
+    #pragma omp parallel num_threads(threads) if (threads > 1)
+    {
+        long int step = 0;
+        double sum[count], part[count];
+        for (int k = 0; k < count; k++) {
+            sum[k] = 0.0;
+        }
+        for (long int ch; (ch = threadsNextChunk(&next, &step, chunks)) >= 0; ) {
+            long int begin = threadsChunkStart(grains, chunks, ch) * KRYLOV_GRAIN;
+            long int end = threadsChunkStart(grains, chunks, ch + 1) * KRYLOV_GRAIN;
+            if (end > n)
+                end = n;
+            gemvGeneralDouble(count, (int)(end - begin), 1.0, V + begin, (int)n, w + begin, 0.0, part, part);
+            for (int k = 0; k < count; k++) {
+                sum[k] += part[k];
+            }
+        }
+        for (int k = 0; k < count; k++) {
+            #pragma omp atomic
+            h[k] += sum[k];
+        }
+    }
+}
+
+/**
+ * @brief w = sum of c[k] * V_k over the count rows of the row-major count x n matrix V, plus w itself if
+ * accumulate is set, in one pass.
+ */
+void krylovCombine(long int n, int count, const double *V, const double *c, int accumulate, double *w) {
+    long int grains = (n + KRYLOV_GRAIN - 1) / KRYLOV_GRAIN;
+    int threads = threadsFor(grains);
+    long int chunks = threadsChunks(threads, grains);
+    long int next = 0;
+    int operands = count + (accumulate != 0);
+    double weights[operands];
+    for (int k = 0; k < count; k++) {
+        weights[k] = c[k];
+    }
+    if (accumulate)
+        weights[count] = 1.0;
+    #pragma omp parallel num_threads(threads) if (threads > 1)
+    {
+        long int step = 0;
+        const double *rows[operands];
+        for (long int ch; (ch = threadsNextChunk(&next, &step, chunks)) >= 0; ) {
+            long int begin = threadsChunkStart(grains, chunks, ch) * KRYLOV_GRAIN;
+            long int end = threadsChunkStart(grains, chunks, ch + 1) * KRYLOV_GRAIN;
+            if (end > n)
+                end = n;
+            for (int k = 0; k < count; k++) {
+                rows[k] = V + n * k + begin;
+            }
+            if (accumulate)
+                rows[count] = w + begin;
+            addMultipleDouble(end - begin, operands, rows, weights, w + begin);
+        }
+    }
+}
+
+/**
+ * @brief Position of the entry (i, i) in row i of a CSR matrix with sorted columns, -1 if it is not stored.
+ */
+long int krylovFindDiagonal(const sparse_csr_t *A, int i) {
+    for (long int p = A->rowStart[i]; p < A->rowStart[i + 1]; p++) {
+        if (A->colIndex[p] == i)
+            return p;
+    }
+    return -1;
+}
+
+/**
+ * @brief IC(0) of the symmetric positive definite A, in place on the lower triangle held by M->factor.
+ * @details Row by row, L_ik = (A_ik - sum_{j<k} L_ij L_kj) / L_kk over the stored entries only, then
+ * L_ii = sqrt(A_ii - sum_{j<i} L_ij^2).
+ *
+ * @return 0, or 1 if a pivot is not positive (A is not positive definite, or IC(0) breaks down on it)
+ */
+int krylovFactorIc0(krylov_preconditioner_t *M, long int *position) {
+    sparse_csr_t *L = &M->factor;
+    for (int i = 0; i < L->rows; i++) {
+        long int first = L->rowStart[i], diag = M->diagonal[i];
+        for (long int p = first; p < diag; p++) {
+            position[L->colIndex[p]] = p;
+        }
+        for (long int p = first; p < diag; p++) {
+            int k = L->colIndex[p];
+            double s = L->values[p];
+            for (long int q = L->rowStart[k]; q < M->diagonal[k]; q++) {
+                long int r = position[L->colIndex[q]];
+                if (r >= 0)
+                    s -= L->values[r] * L->values[q];
+            }
+            L->values[p] = s / L->values[M->diagonal[k]];
+        }
+        double d = L->values[diag];
+        for (long int p = first; p < diag; p++) {
+            position[L->colIndex[p]] = -1;
+            d -= L->values[p] * L->values[p];
+        }
+        if (!(d > 0.0))
+            return 1;
+        L->values[diag] = sqrt(d);
+    }
+    return 0;
+}
+
+/**
+ * @brief ILU(0) of A, in place on the copy held by M->factor (IKJ order, updates restricted to the pattern of A).
+ *
+ * @return 0, or 1 if a zero pivot shows up
+ */
+int krylovFactorIlu0(krylov_preconditioner_t *M, long int *position) {
+    sparse_csr_t *F = &M->factor;
+    for (int i = 0; i < F->rows; i++) {
+        long int first = F->rowStart[i], last = F->rowStart[i + 1];
+        for (long int p = first; p < last; p++) {
+            position[F->colIndex[p]] = p;
+        }
+        for (long int p = first; p < M->diagonal[i]; p++) {
+            int k = F->colIndex[p];
+            F->values[p] /= F->values[M->diagonal[k]];
+            for (long int q = M->diagonal[k] + 1; q < F->rowStart[k + 1]; q++) {
+                long int r = position[F->colIndex[q]];
+                if (r >= 0)
+                    F->values[r] -= F->values[p] * F->values[q];
+            }
+        }
+        for (long int p = first; p < last; p++) {
+            position[F->colIndex[p]] = -1;
+        }
+        if (F->values[M->diagonal[i]] == 0.0)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Releases the memory held by a preconditioner.
+ */
+void krylovPreconditionerFree(krylov_preconditioner_t *M) {
+    free(M->inverseDiagonal);
+    free(M->diagonal);
+    sparseCsrFree(&M->factor);
+    M->inverseDiagonal = NULL;
+    M->diagonal = NULL;
+}
+
+/**
+ * @brief Builds a preconditioner for the square CSR matrix A (columns sorted within each row, as sparseCsrFromDense
+ * produces them).
+ *
+ * @param A Matrix to precondition, every diagonal entry must be stored unless type is KRYLOV_NONE
+ * @param type KRYLOV_NONE, KRYLOV_JACOBI, KRYLOV_IC0 (A symmetric positive definite) or KRYLOV_ILU0
+ * @param M Preconditioner to fill, release with krylovPreconditionerFree
+ * @return 0 on success, -1 if memory could not be allocated, 1 if the factorization broke down (missing or zero
+ * diagonal, or a non-positive pivot in IC(0)); M is then left empty
+ */
+int krylovPreconditionerCreate(const sparse_csr_t *A, krylov_preconditioner_type_t type, krylov_preconditioner_t *M) {
+    memset(M, 0, sizeof(*M));
+    M->type = type;
+    M->n = A->rows;
+    if (type == KRYLOV_NONE)
+        return 0;
+    int n = A->rows;
+    if (type == KRYLOV_JACOBI) {
+        M->inverseDiagonal = (double *)malloc(n * sizeof(double));
+        if (M->inverseDiagonal == NULL)
+            return -1;
+        for (int i = 0; i < n; i++) {
+            long int p = krylovFindDiagonal(A, i);
+            if (p < 0 || A->values[p] == 0.0) {
+                krylovPreconditionerFree(M);
+                return 1;
+            }
+            M->inverseDiagonal[i] = 1.0 / A->values[p];
+        }
+        return 0;
+    }
+
+    // copy A, or its lower triangle for IC(0), into the factor
+    sparse_csr_t *F = &M->factor;
+    long int nnz = 0;
+    for (int i = 0; i < n; i++) {
+        for (long int p = A->rowStart[i]; p < A->rowStart[i + 1]; p++) {
+            nnz += (type == KRYLOV_ILU0 || A->colIndex[p] <= i);
+        }
+    }
+    F->rows = n;
+    F->cols = n;
+    F->nnz = nnz;
+    F->rowStart = (long int *)malloc((n + 1) * sizeof(long int));
+    F->colIndex = (int *)malloc((nnz > 0 ? nnz : 1) * sizeof(int));
+    F->values = (double *)malloc((nnz > 0 ? nnz : 1) * sizeof(double));
+    M->diagonal = (long int *)malloc((n > 0 ? n : 1) * sizeof(long int));
+    long int *position = (long int *)malloc((n > 0 ? n : 1) * sizeof(long int));
+    if (F->rowStart == NULL || F->colIndex == NULL || F->values == NULL || M->diagonal == NULL || position == NULL) {
+        free(position);
+        krylovPreconditionerFree(M);
+        return -1;
+    }
+    nnz = 0;
+    for (int i = 0; i < n; i++) {
+        F->rowStart[i] = nnz;
+        for (long int p = A->rowStart[i]; p < A->rowStart[i + 1]; p++) {
+            if (type == KRYLOV_ILU0 || A->colIndex[p] <= i) {
+                F->colIndex[nnz] = A->colIndex[p];
+                F->values[nnz++] = A->values[p];
+            }
+        }
+    }
+    F->rowStart[n] = nnz;
+
+    int status = 0;
+    for (int i = 0; i < n && status == 0; i++) {
+        M->diagonal[i] = krylovFindDiagonal(F, i);
+        status = (M->diagonal[i] < 0);
+        position[i] = -1;
+    }
+    if (status == 0)
+        status = (type == KRYLOV_IC0) ? krylovFactorIc0(M, position) : krylovFactorIlu0(M, position);
+    free(position);
+    if (status != 0)
+        krylovPreconditionerFree(M);
+    return status;
+}
+
+/**
+ * @brief z = M^-1 r. z must not alias r.
+ * @details The triangular solves of IC(0) and ILU(0) are sequential: every row depends on the rows before it.
+ */
+void krylovPreconditionerApply(const krylov_preconditioner_t *M, const double *r, double *z) {
+    int n = M->n;
+    const sparse_csr_t *F = &M->factor;
+    switch (M->type) {
+    case KRYLOV_NONE:
+        memcpy(z, r, n * sizeof(double));
+        break;
+    case KRYLOV_JACOBI:
+        for (int i = 0; i < n; i++) {
+            z[i] = M->inverseDiagonal[i] * r[i];
+        }
+        break;
+    case KRYLOV_IC0:
+        // L y = r, then L^T z = y column by column
+        for (int i = 0; i < n; i++) {
+            double s = r[i];
+            for (long int p = F->rowStart[i]; p < M->diagonal[i]; p++) {
+                s -= F->values[p] * z[F->colIndex[p]];
+            }
+            z[i] = s / F->values[M->diagonal[i]];
+        }
+        for (int i = n - 1; i >= 0; i--) {
+            z[i] /= F->values[M->diagonal[i]];
+            for (long int p = F->rowStart[i]; p < M->diagonal[i]; p++) {
+                z[F->colIndex[p]] -= F->values[p] * z[i];
+            }
+        }
+        break;
+    case KRYLOV_ILU0:
+        // L y = r with unit L, then U z = y
+        for (int i = 0; i < n; i++) {
+            double s = r[i];
+            for (long int p = F->rowStart[i]; p < M->diagonal[i]; p++) {
+                s -= F->values[p] * z[F->colIndex[p]];
+            }
+            z[i] = s;
+        }
+        for (int i = n - 1; i >= 0; i--) {
+            double s = z[i];
+            for (long int p = M->diagonal[i] + 1; p < F->rowStart[i + 1]; p++) {
+                s -= F->values[p] * z[F->colIndex[p]];
+            }
+            z[i] = s / F->values[M->diagonal[i]];
+        }
+        break;
+    }
+}
+
+/**
+ * @brief Clears the counters of stats, keeping its history buffer.
+ */
+void krylovStatsStart(krylov_stats_t *stats) {
+    double *history = stats->history;
+    int capacity = stats->historyCapacity;
+    memset(stats, 0, sizeof(*stats));
+    stats->history = history;
+    stats->historyCapacity = capacity;
+    stats->time = benchmarkNow();
+}
+
+/**
+ * @brief Appends a relative residual to the history, if there is room.
+ */
+void krylovStatsRecord(krylov_stats_t *stats, double residual) {
+    if (stats->history != NULL && stats->historyLength < stats->historyCapacity)
+        stats->history[stats->historyLength++] = residual;
+}
+
+/**
+ * @brief Stops the clock and recomputes the true relative residual ||b - A x|| / ||b|| into stats.
+ */
+void krylovStatsFinish(krylov_stats_t *stats, const krylov_operator_t *A, const double *b, const double *x, double *work) {
+    stats->time = benchmarkNow() - stats->time;
+    A->apply(A->data, x, work);
+    krylovAxpby(A->n, 1.0, b, -1.0, work);
+    double bnorm = krylovNorm(A->n, b);
+    double rnorm = krylovNorm(A->n, work);
+    stats->residual = (bnorm > 0.0) ? rnorm / bnorm : rnorm;
+}
+
+/**
+ * @brief Preconditioned conjugate gradient for symmetric positive definite A, two reductions per iteration.
+ *
+ * @param A Operator, symmetric positive definite
+ * @param M Preconditioner, symmetric positive definite (KRYLOV_NONE, KRYLOV_JACOBI or KRYLOV_IC0), or NULL
+ * @param b Right-hand side of n elements
+ * @param x Initial guess on entry, solution on exit
+ * @param tolerance Stop when ||r|| <= tolerance * ||b||
+ * @param maxIterations Most iterations to run
+ * @param stats Telemetry, may be NULL
+ * @return 0 if converged, 1 if not, -1 if memory could not be allocated
+ */
+int krylovCg(const krylov_operator_t *A, const krylov_preconditioner_t *M, const double *b, double *x, double tolerance, int maxIterations, krylov_stats_t *stats) {
+    long int n = A->n;
+    krylov_stats_t own = {0};
+    krylov_preconditioner_t identity = {KRYLOV_NONE, A->n, NULL, {0}, NULL};
+    if (stats == NULL)
+        stats = &own;
+    if (M == NULL)
+        M = &identity;
+    double *r = (double *)malloc(n * sizeof(double));
+    double *z = (double *)malloc(n * sizeof(double));
+    double *p = (double *)malloc(n * sizeof(double));
+    double *q = (double *)malloc(n * sizeof(double));
+    if (r == NULL || z == NULL || p == NULL || q == NULL) {
+        free(r);
+        free(z);
+        free(p);
+        free(q);
+        return -1;
+    }
+    PERF_BEGIN();
+    krylovStatsStart(stats);
+
+    // r = b - A x, z = M^-1 r, p = z
+    A->apply(A->data, x, r);
+    krylovAxpby(n, 1.0, b, -1.0, r);
+    krylovPreconditionerApply(M, r, z);
+    memcpy(p, z, n * sizeof(double));
+    const double *left[3] = {b, r, r}, *right[3] = {b, r, z};
+    double dots[3];
+    krylovDots(n, 3, left, right, dots);
+    double bnorm = sqrt(dots[0]), rnorm = sqrt(dots[1]), rz = dots[2];
+    stats->matvecs++;
+    stats->preconditions++;
+    stats->reductions++;
+    if (bnorm == 0.0)
+        bnorm = 1.0;
+    krylovStatsRecord(stats, rnorm / bnorm);
+
+    while (rnorm > tolerance * bnorm && stats->iterations < maxIterations) {
+        // alpha = (r, z) / (p, A p)
+        A->apply(A->data, p, q);
+        const double *pp[1] = {p}, *qq[1] = {q};
+        double pq;
+        krylovDots(n, 1, pp, qq, &pq);
+        double alpha = rz / pq;
+        krylovAxpby(n, alpha, p, 1.0, x);
+        krylovAxpby(n, -alpha, q, 1.0, r);
+        krylovPreconditionerApply(M, r, z);
+        const double *rr[2] = {r, r}, *rzz[2] = {r, z};
+        krylovDots(n, 2, rr, rzz, dots);
+        rnorm = sqrt(dots[0]);
+        double beta = dots[1] / rz;
+        rz = dots[1];
+        krylovAxpby(n, 1.0, z, beta, p);
+        stats->iterations++;
+        stats->matvecs++;
+        stats->preconditions++;
+        stats->reductions += 2;
+        krylovStatsRecord(stats, rnorm / bnorm);
+    }
+    stats->converged = (rnorm <= tolerance * bnorm);
+    krylovStatsFinish(stats, A, b, x, q);
+    free(r);
+    free(z);
+    free(p);
+    free(q);
+    PERF_END("krylovCg", n, 1, 1);
+    return stats->converged ? 0 : 1;
+}
+
+/**
+ * @brief The vector updates of one pipelined CG iteration and the three dot products of the next, in one pass.
+ * @details z = nv + beta z, q = m + beta q, s = w + beta s, p = u + beta p, x += alpha p, r -= alpha s,
+ * u -= alpha q, w -= alpha z, then dots = ((r, u), (w, u), (r, r)) of the updated vectors.
+ */
+void krylovCgPipelinedStep(long int n, double alpha, double beta, const double *m, const double *nv, double *z, double *q,
+                           double *s, double *p, double *x, double *r, double *u, double *w, double *dots) {
+    long int grains = (n + KRYLOV_GRAIN - 1) / KRYLOV_GRAIN;
+    int threads = threadsFor(grains);
+    long int chunks = threadsChunks(threads, grains);
+    long int next = 0;
+    double gamma = 0.0, delta = 0.0, rr = 0.0;
+    #pragma omp parallel num_threads(threads) if (threads > 1) reduction(+:gamma, delta, rr)
+    {
+        long int step = 0;
+        for (long int ch; (ch = threadsNextChunk(&next, &step, chunks)) >= 0; ) {
+            long int begin = threadsChunkStart(grains, chunks, ch) * KRYLOV_GRAIN;
+            long int end = threadsChunkStart(grains, chunks, ch + 1) * KRYLOV_GRAIN;
+            if (end > n)
+                end = n;
+            for (long int i = begin; i < end; i++) {
+                z[i] = nv[i] + beta * z[i];
+                q[i] = m[i] + beta * q[i];
+                s[i] = w[i] + beta * s[i];
+                p[i] = u[i] + beta * p[i];
+                x[i] += alpha * p[i];
+                r[i] -= alpha * s[i];
+                u[i] -= alpha * q[i];
+                w[i] -= alpha * z[i];
+                gamma += r[i] * u[i];
+                delta += w[i] * u[i];
+                rr += r[i] * r[i];
+            }
+        }
+    }
+    dots[0] = gamma;
+    dots[1] = delta;
+    dots[2] = rr;
+}
+
+/**
+ * @brief Pipelined preconditioned conjugate gradient (Ghysels and Vanroose), one reduction per iteration.
+ * @details Besides r, the recurrences carry u = M^-1 r and w = A u, so the scalars of an iteration need only
+ * (r, u), (w, u) and (r, r), computed in the same pass as the vector updates. The reduction no longer sits between
+ * the operator and preconditioner applications, so, distributed, it can be overlapped with them. Costs three
+ * more vectors than krylovCg and slightly looser attainable accuracy.
+ *
+ * Same parameters and return value as krylovCg.
+ */
+int krylovCgPipelined(const krylov_operator_t *A, const krylov_preconditioner_t *M, const double *b, double *x, double tolerance, int maxIterations, krylov_stats_t *stats) {
+    long int n = A->n;
+    krylov_stats_t own = {0};
+    krylov_preconditioner_t identity = {KRYLOV_NONE, A->n, NULL, {0}, NULL};
+    if (stats == NULL)
+        stats = &own;
+    if (M == NULL)
+        M = &identity;
+    double *work = (double *)calloc(10 * n + 1, sizeof(double));
+    if (work == NULL)
+        return -1;
+    double *r = work, *u = r + n, *w = u + n, *m = w + n, *nv = m + n;
+    double *z = nv + n, *q = z + n, *s = q + n, *p = s + n, *check = p + n;
+    PERF_BEGIN();
+    krylovStatsStart(stats);
+
+    // r = b - A x, u = M^-1 r, w = A u
+    A->apply(A->data, x, r);
+    krylovAxpby(n, 1.0, b, -1.0, r);
+    krylovPreconditionerApply(M, r, u);
+    A->apply(A->data, u, w);
+    const double *left[4] = {r, w, r, b}, *right[4] = {u, u, r, b};
+    double dots[4];
+    krylovDots(n, 4, left, right, dots);
+    stats->matvecs += 2;
+    stats->preconditions++;
+    stats->reductions++;
+    double bnorm = (dots[3] > 0.0) ? sqrt(dots[3]) : 1.0;
+    double gamma_old = 0.0, alpha = 0.0;
+    krylovStatsRecord(stats, sqrt(dots[2]) / bnorm);
+
+    while (sqrt(dots[2]) > tolerance * bnorm && stats->iterations < maxIterations) {
+        double gamma = dots[0], delta = dots[1];
+        krylovPreconditionerApply(M, w, m);
+        A->apply(A->data, m, nv);
+        double beta = 0.0;
+        if (stats->iterations > 0) {
+            beta = gamma / gamma_old;
+            alpha = gamma / (delta - beta * gamma / alpha);
+        } else {
+            alpha = gamma / delta;
+        }
+        gamma_old = gamma;
+        krylovCgPipelinedStep(n, alpha, beta, m, nv, z, q, s, p, x, r, u, w, dots);
+        stats->iterations++;
+        stats->matvecs++;
+        stats->preconditions++;
+        stats->reductions++;
+        krylovStatsRecord(stats, sqrt(dots[2]) / bnorm);
+    }
+    stats->converged = (sqrt(dots[2]) <= tolerance * bnorm);
+    krylovStatsFinish(stats, A, b, x, check);
+    free(work);
+    PERF_END("krylovCgPipelined", n, 1, 1);
+    return stats->converged ? 0 : 1;
+}
+
+/**
+ * @brief Restarted right-preconditioned GMRES(restart), shared by krylovGmres and krylovGmresPipelined.
+ * @details Each cycle builds an orthonormal basis V of the Krylov space of A M^-1 from r / ||r|| with the Arnoldi
+ * process, reduces the Hessenberg matrix to triangular form with Givens rotations as it grows (which gives the
+ * residual norm at every step for free), and updates x += M^-1 V y once at the end of the cycle. With right
+ * preconditioning the residual being minimized is the true one, b - A x.
+ *
+ * @param pipelined Zero for modified Gram-Schmidt (j + 2 reductions in step j), nonzero for classical Gram-Schmidt
+ * done twice (two reductions per step)
+ */
+int krylovGmresCycles(const krylov_operator_t *A, const krylov_preconditioner_t *M, const double *b, double *x, double tolerance, int restart, int maxIterations, int pipelined, krylov_stats_t *stats) {
+    long int n = A->n;
+    int m = (restart > 0) ? restart : 30;
+    krylov_stats_t own = {0};
+    krylov_preconditioner_t identity = {KRYLOV_NONE, A->n, NULL, {0}, NULL};
+    if (stats == NULL)
+        stats = &own;
+    if (M == NULL)
+        M = &identity;
+    double *V = (double *)malloc(((m + 1) * n + 1) * sizeof(double));
+    double *work = (double *)malloc((n + 1) * sizeof(double));
+    double *H = (double *)calloc((long int)(m + 1) * m, sizeof(double)); // column j holds the m + 1 entries of H(:, j)
+    double *small = (double *)malloc(5 * (m + 2) * sizeof(double));
+    if (V == NULL || work == NULL || H == NULL || small == NULL) {
+        free(V);
+        free(work);
+        free(H);
+        free(small);
+        return -1;
+    }
+    double *cs = small, *sn = cs + m + 2, *g = sn + m + 2, *y = g + m + 2, *h = y + m + 2;
+    krylovStatsStart(stats);
+
+    double bnorm = krylovNorm(n, b);
+    stats->reductions++;
+    if (bnorm == 0.0)
+        bnorm = 1.0;
+    double rnorm = 0.0;
+    while (1) {
+        // V_0 = (b - A x) / ||b - A x||
+        A->apply(A->data, x, V);
+        krylovAxpby(n, 1.0, b, -1.0, V);
+        rnorm = krylovNorm(n, V);
+        stats->matvecs++;
+        stats->reductions++;
+        if (stats->iterations == 0)
+            krylovStatsRecord(stats, rnorm / bnorm);
+        if (rnorm <= tolerance * bnorm || stats->iterations >= maxIterations)
+            break;
+        krylovAxpby(n, 0.0, V, 1.0 / rnorm, V);
+        for (int i = 0; i <= m; i++) {
+            g[i] = 0.0;
+        }
+        g[0] = rnorm;
+
+        int j = 0;
+        while (j < m && stats->iterations < maxIterations) {
+            // w = A M^-1 v_j, stored as the next basis vector
+            double *w = V + n * (j + 1);
+            double *Hj = H + (long int)(m + 1) * j;
+            krylovPreconditionerApply(M, V + n * j, work);
+            A->apply(A->data, work, w);
+            stats->preconditions++;
+            stats->matvecs++;
+            double hnorm;
+            if (pipelined) {
+                // project twice; the second pass also gives (w, w) and ||w - V h||^2 = (w, w) - ||h||^2
+                krylovProject(n, j + 1, V, w, Hj);
+                for (int i = 0; i <= j; i++) {
+                    h[i] = -Hj[i];
+                }
+                krylovCombine(n, j + 1, V, h, 1, w);
+                krylovProject(n, j + 2, V, w, h);
+                double norm2 = h[j + 1];
+                for (int i = 0; i <= j; i++) {
+                    Hj[i] += h[i];
+                    norm2 -= h[i] * h[i];
+                    h[i] = -h[i];
+                }
+                krylovCombine(n, j + 1, V, h, 1, w);
+                stats->reductions += 2;
+                if (norm2 > 1e-4 * h[j + 1]) {
+                    hnorm = sqrt(norm2);
+                } else {
+                    // cancellation: (w, w) was mostly the part just removed
+                    hnorm = krylovNorm(n, w);
+                    stats->reductions++;
+                }
+            } else {
+                for (int i = 0; i <= j; i++) {
+                    const double *vi[1] = {V + n * i}, *ww[1] = {w};
+                    krylovDots(n, 1, vi, ww, &Hj[i]);
+                    krylovAxpby(n, -Hj[i], V + n * i, 1.0, w);
+                }
+                hnorm = krylovNorm(n, w);
+                stats->reductions += j + 2;
+            }
+            Hj[j + 1] = hnorm;
+            if (hnorm > 0.0)
+                krylovAxpby(n, 0.0, w, 1.0 / hnorm, w);
+
+            // apply the previous rotations to the new column, then zero its subdiagonal entry
+            for (int i = 0; i < j; i++) {
+                double t = cs[i] * Hj[i] + sn[i] * Hj[i + 1];
+                Hj[i + 1] = -sn[i] * Hj[i] + cs[i] * Hj[i + 1];
+                Hj[i] = t;
+            }
+            double d = hypot(Hj[j], Hj[j + 1]);
+            cs[j] = (d > 0.0) ? Hj[j] / d : 1.0;
+            sn[j] = (d > 0.0) ? Hj[j + 1] / d : 0.0;
+            Hj[j] = d;
+            Hj[j + 1] = 0.0;
+            g[j + 1] = -sn[j] * g[j];
+            g[j] = cs[j] * g[j];
+            j++;
+            stats->iterations++;
+            krylovStatsRecord(stats, fabs(g[j]) / bnorm);
+            if (fabs(g[j]) <= tolerance * bnorm || hnorm == 0.0)
+                break;
+        }
+
+        // y = R^-1 g, x += M^-1 V y
+        for (int i = j - 1; i >= 0; i--) {
+            double s = g[i];
+            for (int k = i + 1; k < j; k++) {
+                s -= H[(long int)(m + 1) * k + i] * y[k];
+            }
+            double diag = H[(long int)(m + 1) * i + i];
+            y[i] = (diag != 0.0) ? s / diag : 0.0;
+        }
+        double *t = V + n * m; // the last basis vector is not needed any more
+        krylovCombine(n, j, V, y, 0, t);
+        krylovPreconditionerApply(M, t, work);
+        krylovAxpby(n, 1.0, work, 1.0, x);
+        stats->preconditions++;
+    }
+    stats->converged = (rnorm <= tolerance * bnorm);
+    krylovStatsFinish(stats, A, b, x, work);
+    free(V);
+    free(work);
+    free(H);
+    free(small);
+    return stats->converged ? 0 : 1;
+}
+
+/**
+ * @brief Restarted GMRES(restart) with right preconditioning and modified Gram-Schmidt.
+ *
+ * @param A Operator
+ * @param M Preconditioner (any type, typically KRYLOV_ILU0), or NULL
+ * @param b Right-hand side of n elements
+ * @param x Initial guess on entry, solution on exit
+ * @param tolerance Stop when ||b - A x|| <= tolerance * ||b||
+ * @param restart Basis vectors per cycle, 0 for 30
+ * @param maxIterations Most Arnoldi steps over all cycles
+ * @param stats Telemetry, may be NULL
+ * @return 0 if converged, 1 if not, -1 if memory could not be allocated
+ */
+int krylovGmres(const krylov_operator_t *A, const krylov_preconditioner_t *M, const double *b, double *x, double tolerance, int restart, int maxIterations, krylov_stats_t *stats) {
+    PERF_BEGIN();
+    int status = krylovGmresCycles(A, M, b, x, tolerance, restart, maxIterations, 0, stats);
+    PERF_END("krylovGmres", A->n, restart, 1);
+    return status;
+}
+
+/**
+ * @brief Restarted GMRES(restart) with the reductions of each Arnoldi step fused into two passes over the basis.
+ * @details Classical Gram-Schmidt run twice keeps the basis as orthogonal as modified Gram-Schmidt does, but each
+ * projection is one pass and one reduction for all previous vectors together instead of one per vector.
+ *
+ * Same parameters and return value as krylovGmres.
+ */
+int krylovGmresPipelined(const krylov_operator_t *A, const krylov_preconditioner_t *M, const double *b, double *x, double tolerance, int restart, int maxIterations, krylov_stats_t *stats) {
+    PERF_BEGIN();
+    int status = krylovGmresCycles(A, M, b, x, tolerance, restart, maxIterations, 1, stats);
+    PERF_END("krylovGmresPipelined", A->n, restart, 1);
+    return status;
+}
+
+#endif
@@ -2,16 +2,27 @@
  * @file back_substitution.c
  * @author Navid Shamszadeh
  * @brief Back substitution algorithm for solving linear N x N systems.
+ * @details Also checks the blocked triangular solve in every variant, and the packed (TRSV, TRMV, symmetric
+ * multiply) and RFP (TRSM) kernels of packed.h, which keep only the upper triangle of U in half the memory.
+ * Run with e.g. ./back_substitution 2000 64
  * @date 2021-05-16
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <omp.h>
 #include "../printMatrix.h"
+#include "../packed.h"
+
+// minimum number of right-hand side columns given to one thread
+#define TRSM_MIN_COLUMNS 16
 
 /**
  * @brief Back substitution algorithm for solving a linear system.
- * 
+ *
  * @param N Dimensions of U and x and b
  * @param U Upper triangular matrix allocated as a 1-dimensional array
  * @param b Input vector
@@ -21,9 +32,277 @@ void backSubstitution(const int N, float *U, float *b, float *x) {
     x[N - 1] = b[N - 1] / U[N*N - 1];
     for (int i = N - 2; i >= 0; i--) {
         x[i] = b[i];
-        for (int j = i + 1; j < N; i++) {
+        for (int j = i + 1; j < N; j++) {
             x[i] -= U[j + N * i] * x[j];
         }
         x[i] /= U[i + N * i];
     }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Back substitution on a packed upper triangular matrix, which holds only the N (N + 1) / 2 elements on and
+ * above the diagonal.
+ *
+ * @param N Dimensions of U and x and b
+ * @param UP Upper triangular matrix in packed storage (see packed.h)
+ * @param b Input vector
+ * @param x Output vector
+ */
+void backSubstitutionPacked(const int N, const float *UP, const float *b, float *x) {
+    memcpy(x, b, N * sizeof(float));
+    packedTriangularSolveFloat(N, 0, 0, 0, UP, x);
+}
+
+/**
+ * @brief Blocked triangular solve op(T) X = B with many right-hand sides (TRSM).
+ * @details B holds the N x nrhs right-hand sides as a strided matrix, one right-hand side per column, and is
+ * overwritten with the solutions. The columns are split into slices solved independently by the OpenMP threads,
+ * each with the blocked solve of kernels.h.
+ *
+ * @param N Order of T and number of rows of B
+ * @param nrhs Number of right-hand sides
+ * @param lower Nonzero if T is lower triangular, zero if upper triangular
+ * @param transpose Nonzero to solve with T^T instead of T
+ * @param unit_diagonal Nonzero if the diagonal of T is implicitly one
+ * @param T Triangular matrix with row stride ldt, the other triangle is not referenced
+ * @param ldt Leading dimension of T
+ * @param B Right-hand sides with row stride ldb, overwritten with X
+ * @param ldb Leading dimension of B
+ */
+void triangularSolveBlocked(int N, int nrhs, int lower, int transpose, int unit_diagonal, const float *T, int ldt, float *B, int ldb) {
+    int threads = omp_in_parallel() ? 1 : omp_get_max_threads();
+    int slices = (nrhs + TRSM_MIN_COLUMNS - 1) / TRSM_MIN_COLUMNS;
+    if (slices > threads)
+        slices = threads;
+    if (slices < 1)
+        slices = 1;
+    int width = (nrhs + slices - 1) / slices;
+
+    #pragma omp parallel for schedule(static) num_threads(slices) if (slices > 1)
+    for (int s = 0; s < slices; s++) {
+        int c0 = s * width;
+        int nc = (nrhs - c0 < width) ? nrhs - c0 : width;
+        if (nc > 0)
+            triangularSolveStridedFloat(N, nc, lower, transpose, unit_diagonal, T, ldt, B + c0, ldb);
+    }
+}
+
+/**
+ * @brief Back substitution for many right-hand sides at once, U X = B with U upper triangular.
+ *
+ * @param N Order of U and number of rows of B
+ * @param nrhs Number of right-hand sides (columns of B)
+ * @param U Upper triangular matrix allocated as a 1-dimensional N x N array
+ * @param B N x nrhs right-hand sides, overwritten with the solutions
+ */
+void backSubstitutionMultiple(const int N, const int nrhs, float *U, float *B) {
+    triangularSolveBlocked(N, nrhs, 0, 0, 0, U, N, B, nrhs);
+}
+
+int main(int argc, char* argv[]) {
+    int N = atoi(argv[1]);
+    int nrhs = (argc > 2) ? atoi(argv[2]) : 256;
+    srandom(time(NULL));
+
+    // well conditioned triangular matrix: random off-diagonal entries, dominant diagonal
+    float *T = (float *)malloc((size_t)N * N * sizeof(float));
+    for (int i = 0; i < N; i++) {
+        for (int j = 0; j < N; j++) {
+            T[j + (long int)N * i] = (float)random() / RAND_MAX - 0.5f;
+        }
+        T[i + (long int)N * i] = (float)N;
+    }
+    float *X = (float *)malloc((size_t)N * nrhs * sizeof(float));
+    for (long int i = 0; i < (long int)N * nrhs; i++) {
+        X[i] = (float)random() / RAND_MAX - 0.5f;
+    }
+
+    // check every variant: B = op(T) X with the other triangle of T masked out, then solve and compare against X
+    float *Tri = (float *)malloc((size_t)N * N * sizeof(float));
+    float *B = (float *)malloc((size_t)N * nrhs * sizeof(float));
+    float *B_t = (float *)malloc((size_t)N * N * sizeof(float));
+    int errors = 0;
+    const char *names[2][2] = {{"upper", "upper transposed"}, {"lower", "lower transposed"}};
+    for (int lower = 0; lower <= 1; lower++) {
+        for (int transpose = 0; transpose <= 1; transpose++) {
+            for (int i = 0; i < N; i++) {
+                for (int j = 0; j < N; j++) {
+                    int keep = lower ? j <= i : j >= i;
+                    Tri[j + (long int)N * i] = keep ? T[j + (long int)N * i] : 0.0f;
+                    B_t[i + (long int)N * j] = Tri[j + (long int)N * i];
+                }
+            }
+            gemmGeneralFloat(N, N, nrhs, 1.0f, transpose ? B_t : Tri, N, X, nrhs, 0.0f, B, nrhs);
+
+            double start = omp_get_wtime();
+            triangularSolveBlocked(N, nrhs, lower, transpose, 0, T, N, B, nrhs);
+            double elapsed = omp_get_wtime() - start;
+
+            double error = 0.0;
+            for (long int i = 0; i < (long int)N * nrhs; i++) {
+                error = fmax(error, fabs(B[i] - X[i]));
+            }
+            printf("triangularSolveBlocked (%s): %e (%.2f GFLOP/s) \t max error: %e\n",
+                   names[lower][transpose], elapsed, (double)N * N * nrhs / elapsed * 1e-9, error);
+            errors |= error > 1e-4;
+        }
+    }
+
+    // compare against one backSubstitution per right-hand side
+    float *b = (float *)malloc(N * sizeof(float));
+    float *x = (float *)malloc(N * sizeof(float));
+    for (int i = 0; i < N; i++) {
+        for (int j = 0; j < N; j++) {
+            Tri[j + (long int)N * i] = j >= i ? T[j + (long int)N * i] : 0.0f;
+        }
+    }
+    gemmGeneralFloat(N, N, nrhs, 1.0f, Tri, N, X, nrhs, 0.0f, B, nrhs);
+    double single = 0.0, single_error = 0.0, start;
+    for (int c = 0; c < nrhs; c++) {
+        for (int i = 0; i < N; i++) {
+            b[i] = B[c + (long int)nrhs * i];
+        }
+        start = omp_get_wtime();
+        backSubstitution(N, Tri, b, x);
+        single += omp_get_wtime() - start;
+        for (int i = 0; i < N; i++) {
+            single_error = fmax(single_error, fabs(x[i] - X[c + (long int)nrhs * i]));
+        }
+    }
+    start = omp_get_wtime();
+    backSubstitutionMultiple(N, nrhs, Tri, B);
+    double multiple = omp_get_wtime() - start;
+    double multiple_error = 0.0;
+    for (long int i = 0; i < (long int)N * nrhs; i++) {
+        multiple_error = fmax(multiple_error, fabs(B[i] - X[i]));
+    }
+    printf("backSubstitution x %d: %e (max error %e) \t backSubstitutionMultiple: %e (max error %e)\n", nrhs, single,
+           single_error, multiple, multiple_error);
+    errors |= single_error > 1e-4 || multiple_error > 1e-4;
+
+    // the same solves on packed U: half the bytes per solve
+    float *UP = (float *)malloc(packedSize(N) * sizeof(float));
+    float *x_packed = (float *)malloc(N * sizeof(float));
+    packedFromStridedFloat(N, 0, Tri, N, UP);
+    gemmGeneralFloat(N, N, nrhs, 1.0f, Tri, N, X, nrhs, 0.0f, B, nrhs);
+    double packed = 0.0, difference = 0.0;
+    single = 0.0;
+    for (int c = 0; c < nrhs; c++) {
+        for (int i = 0; i < N; i++) {
+            b[i] = B[c + (long int)nrhs * i];
+        }
+        start = omp_get_wtime();
+        backSubstitution(N, Tri, b, x);
+        single += omp_get_wtime() - start;
+        start = omp_get_wtime();
+        backSubstitutionPacked(N, UP, b, x_packed);
+        packed += omp_get_wtime() - start;
+        for (int i = 0; i < N; i++) {
+            difference = fmax(difference, fabs(x[i] - x_packed[i]));
+        }
+    }
+    printf("backSubstitution x %d: %e (%.1f MB) \t backSubstitutionPacked: %e (%.1f MB) \t max difference: %e\n",
+           nrhs, single, (double)N * N * sizeof(float) * 1e-6, packed, (double)packedSize(N) * sizeof(float) * 1e-6, difference);
+    errors |= difference > 1e-4;
+
+    // every packed TRSV and TRMV variant and the RFP TRSM against the strided kernels, for N and N + 1 (odd and even)
+    for (int n = N; n <= N + 1; n++) {
+        float *S = (float *)malloc((size_t)n * n * sizeof(float));
+        float *S_unpacked = (float *)malloc((size_t)n * n * sizeof(float));
+        float *TP = (float *)malloc(packedSize(n) * sizeof(float));
+        float *R = (float *)malloc(packedSize(n) * sizeof(float));
+        float *v = (float *)malloc(n * sizeof(float));
+        float *w = (float *)malloc(n * sizeof(float));
+        float *Y = (float *)malloc((size_t)n * nrhs * sizeof(float));
+        float *Y_rfp = (float *)malloc((size_t)n * nrhs * sizeof(float));
+        float *Y_strided = (float *)malloc((size_t)n * nrhs * sizeof(float));
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                S[j + (long int)n * i] = (float)random() / RAND_MAX - 0.5f;
+            }
+            S[i + (long int)n * i] = (float)n;
+        }
+        for (long int i = 0; i < (long int)n * nrhs; i++) {
+            Y[i] = (float)random() / RAND_MAX - 0.5f;
+        }
+        for (int lower = 0; lower <= 1; lower++) {
+            double conversion = 0.0, error = 0.0;
+            packedFromStridedFloat(n, lower, S, n, TP);
+            packedToStridedFloat(n, lower, PACKED_MIRROR, TP, S_unpacked, n);
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < n; j++) {
+                    int r = (lower ? j <= i : j >= i) ? i : j, c = (r == i) ? j : i;
+                    conversion = fmax(conversion, fabs(S_unpacked[j + (long int)n * i] - S[c + (long int)n * r]));
+                }
+            }
+            rfpFromStridedFloat(n, lower, S, n, R);
+            rfpToStridedFloat(n, lower, PACKED_MIRROR, R, S_unpacked, n);
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < n; j++) {
+                    int r = (lower ? j <= i : j >= i) ? i : j, c = (r == i) ? j : i;
+                    conversion = fmax(conversion, fabs(S_unpacked[j + (long int)n * i] - S[c + (long int)n * r]));
+                }
+            }
+            // symmetric multiply against the mirrored strided matrix
+            packedSymmetricMultiplyFloat(n, lower, TP, Y, w);
+            gemvFloat(n, n, S_unpacked, n, Y, v);
+            for (int i = 0; i < n; i++) {
+                error = fmax(error, fabs(v[i] - w[i]) / n);
+            }
+            for (int transpose = 0; transpose <= 1; transpose++) {
+                // TRMV then TRSV must give back the vector, and TRMV must match the strided GEMV on the masked matrix
+                for (int i = 0; i < n; i++) {
+                    v[i] = Y[i];
+                    for (int j = 0; j < n; j++) {
+                        int keep = lower ? j <= i : j >= i;
+                        S_unpacked[(transpose ? i : j) + (long int)n * (transpose ? j : i)] = keep ? S[j + (long int)n * i] : 0.0f;
+                    }
+                }
+                packedTriangularMultiplyFloat(n, lower, transpose, 0, TP, v);
+                gemvFloat(n, n, S_unpacked, n, Y, w);
+                for (int i = 0; i < n; i++) {
+                    error = fmax(error, fabs(v[i] - w[i]) / n);
+                }
+                packedTriangularSolveFloat(n, lower, transpose, 0, TP, v);
+                for (int i = 0; i < n; i++) {
+                    error = fmax(error, fabs(v[i] - Y[i]));
+                }
+                // RFP TRSM against the strided TRSM
+                memcpy(Y_rfp, Y, (size_t)n * nrhs * sizeof(float));
+                memcpy(Y_strided, Y, (size_t)n * nrhs * sizeof(float));
+                start = omp_get_wtime();
+                rfpTriangularSolveFloat(n, nrhs, lower, transpose, 0, R, Y_rfp, nrhs);
+                double rfp = omp_get_wtime() - start;
+                start = omp_get_wtime();
+                triangularSolveStridedFloat(n, nrhs, lower, transpose, 0, S, n, Y_strided, nrhs);
+                double strided = omp_get_wtime() - start;
+                for (long int i = 0; i < (long int)n * nrhs; i++) {
+                    error = fmax(error, fabs(Y_rfp[i] - Y_strided[i]));
+                }
+                printf("n = %d %s%s: rfpTriangularSolve %e \t triangularSolveStrided %e \t conversion error %e \t max error %e\n",
+                       n, lower ? "lower" : "upper", transpose ? " transposed" : "", rfp, strided, conversion, error);
+                errors |= conversion != 0.0 || error > 1e-4;
+            }
+        }
+        free(S);
+        free(S_unpacked);
+        free(TP);
+        free(R);
+        free(v);
+        free(w);
+        free(Y);
+        free(Y_rfp);
+        free(Y_strided);
+    }
+
+    free(T);
+    free(Tri);
+    free(X);
+    free(B);
+    free(B_t);
+    free(b);
+    free(x);
+    free(UP);
+    free(x_packed);
+    return errors ? -1 : 0;
+}
@@ -0,0 +1,226 @@
+/**
+ * @file iterative_solvers.c
+ * @author Navid Shamszadeh
+ * @brief Krylov solvers (CG, GMRES, and their pipelined variants) with Jacobi, IC(0) and ILU(0) preconditioners on
+ * a sparse 2D convection-diffusion problem.
+ * @details Builds the 5-point finite difference matrix of -u'' + c u_x on a g x g grid in CSR form (symmetric
+ * positive definite for c = 0, nonsymmetric otherwise), sets b = A x for a known x and solves with every applicable
+ * solver and preconditioner, printing iterations, operator applications, reductions, time and the true residual.
+ * --dense also runs on a dense copy of A (only for small g), --history writes the residual histories as CSV.
+ * Run with e.g. ./iterative_solvers 256 --convection 0.5
+ * @date 2021-05-22
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "../krylov.h"
+
+/**
+ * @brief CSR matrix of the 5-point convection-diffusion operator on a g x g grid with upwind convection c.
+ */
+int poissonCsr(int g, double c, sparse_csr_t *S) {
+    int n = g * g;
+    S->rows = n;
+    S->cols = n;
+    S->rowStart = (long int *)malloc((n + 1) * sizeof(long int));
+    S->colIndex = (int *)malloc(5L * n * sizeof(int));
+    S->values = (double *)malloc(5L * n * sizeof(double));
+    if (S->rowStart == NULL || S->colIndex == NULL || S->values == NULL) {
+        sparseCsrFree(S);
+        return -1;
+    }
+    long int nnz = 0;
+    for (int i = 0; i < g; i++) {
+        for (int j = 0; j < g; j++) {
+            int row = i * g + j;
+            S->rowStart[row] = nnz;
+            // neighbours in increasing column order: north, west, centre, east, south
+            int cols[5] = {row - g, row - 1, row, row + 1, row + g};
+            double vals[5] = {-1.0, -1.0 - c, 4.0 + c, -1.0, -1.0};
+            int keep[5] = {i > 0, j > 0, 1, j < g - 1, i < g - 1};
+            for (int k = 0; k < 5; k++) {
+                if (keep[k]) {
+                    S->colIndex[nnz] = cols[k];
+                    S->values[nnz++] = vals[k];
+                }
+            }
+        }
+    }
+    S->rowStart[n] = nnz;
+    S->nnz = nnz;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    int g = (argc > 1) ? atoi(argv[1]) : 0;
+    if (g < 1) {
+        fprintf(stderr, "Usage: %s g [--convection c] [--tol t] [--restart m] [--maxit k] [--dense] [--history file.csv]\n", argv[0]);
+        return -1;
+    }
+    double convection = 0.0, tolerance = 1e-8;
+    int restart = 30, maxIterations = 0, dense = 0;
+    const char *history_path = NULL;
+    for (int a = 2; a < argc; a++) {
+        if (strcmp(argv[a], "--convection") == 0 && a + 1 < argc) {
+            convection = atof(argv[++a]);
+        } else if (strcmp(argv[a], "--tol") == 0 && a + 1 < argc) {
+            tolerance = atof(argv[++a]);
+        } else if (strcmp(argv[a], "--restart") == 0 && a + 1 < argc) {
+            restart = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--maxit") == 0 && a + 1 < argc) {
+            maxIterations = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--dense") == 0) {
+            dense = 1;
+        } else if (strcmp(argv[a], "--history") == 0 && a + 1 < argc) {
+            history_path = argv[++a];
+        }
+    }
+    int n = g * g;
+    // with the default limit every solver is expected to converge, with a user limit stopping early is fine
+    int defaultMaxIterations = (maxIterations <= 0);
+    if (defaultMaxIterations)
+        maxIterations = 10 * n;
+    srandom(time(NULL));
+
+    sparse_csr_t A;
+    if (poissonCsr(g, convection, &A) != 0) {
+        fprintf(stderr, "Error: could not allocate the matrix!\n");
+        return -1;
+    }
+    double *x_true = (double *)malloc(n * sizeof(double));
+    double *b = (double *)malloc(n * sizeof(double));
+    double *x = (double *)malloc(n * sizeof(double));
+    double *history = (double *)malloc((maxIterations + 1) * sizeof(double));
+    if (x_true == NULL || b == NULL || x == NULL || history == NULL) {
+        fprintf(stderr, "Error: could not allocate the vectors!\n");
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        x_true[i] = 2.0 * random() / RAND_MAX - 1.0;
+    }
+    sparseCsrMultiplyVector(&A, x_true, b);
+    double x_norm = 0.0;
+    for (int i = 0; i < n; i++) {
+        x_norm += x_true[i] * x_true[i];
+    }
+    x_norm = sqrt(x_norm);
+    /* 2-norm condition number of the Laplacian part, lambda_max / lambda_min = cot^2(pi / (2 (g + 1))); the upwind
+     * convection adds at most 2 |c| to ||A|| and does not lower the smallest eigenvalue of the symmetric part for
+     * c >= 0, so this bounds the condition number of A as well */
+    double angle = M_PI / (2.0 * (g + 1));
+    double condition = (8.0 * cos(angle) * cos(angle) + 2.0 * fabs(convection)) / (8.0 * sin(angle) * sin(angle));
+
+    matrix_t D = {0};
+    krylov_operator_t sparse_op = krylovOperatorCsr(&A), dense_op = sparse_op;
+    if (dense) {
+        D = matrixCreate(NULL, n, n, MATRIX_DOUBLE);
+        if (D.data == NULL) {
+            fprintf(stderr, "Error: could not allocate the dense matrix!\n");
+            return -1;
+        }
+        memset(D.data, 0, matrixBytes(n, n, MATRIX_DOUBLE));
+        for (int i = 0; i < n; i++) {
+            for (long int p = A.rowStart[i]; p < A.rowStart[i + 1]; p++) {
+                MATRIX_AT(double, &D, i, A.colIndex[p]) = A.values[p];
+            }
+        }
+        dense_op = krylovOperatorMatrix(&D);
+    }
+
+    int symmetric = (convection == 0.0);
+    const char *preconditioner_names[4] = {"none", "jacobi", "ic0", "ilu0"};
+    krylov_preconditioner_t M[4];
+    double setup[4];
+    for (int t = 0; t < 4; t++) {
+        double start = benchmarkNow();
+        int status = (t == KRYLOV_IC0 && !symmetric) ? 1 : krylovPreconditionerCreate(&A, (krylov_preconditioner_type_t)t, &M[t]);
+        setup[t] = benchmarkNow() - start;
+        if (status != 0) {
+            M[t].type = (krylov_preconditioner_type_t)-1;
+        }
+    }
+
+    FILE *history_file = history_path ? fopen(history_path, "w") : NULL;
+    if (history_file)
+        fprintf(history_file, "solver,preconditioner,iteration,residual\n");
+    printf("n = %d, nnz = %ld, convection = %g, tolerance = %g, condition estimate = %e\n", n, A.nnz, convection,
+           tolerance, condition);
+    printf("%-16s %-7s %-6s %10s %8s %8s %10s %12s %12s %12s\n", "solver", "M", "A", "iterations", "matvecs",
+           "precond", "reductions", "setup", "time", "residual");
+    int errors = 0;
+    const char *solver_names[4] = {"cg", "cg-pipelined", "gmres", "gmres-pipelined"};
+    for (int op = 0; op <= dense; op++) {
+        for (int solver = 0; solver < 4; solver++) {
+            for (int t = 0; t < 4; t++) {
+                int cg = (solver < 2);
+                if (cg && (!symmetric || t == KRYLOV_ILU0))
+                    continue;
+                if (M[t].type != (krylov_preconditioner_type_t)t)
+                    continue;
+                memset(x, 0, n * sizeof(double));
+                krylov_stats_t stats = {0};
+                stats.history = history;
+                stats.historyCapacity = maxIterations + 1;
+                const krylov_operator_t *Aop = op ? &dense_op : &sparse_op;
+                int status;
+                switch (solver) {
+                case 0:
+                    status = krylovCg(Aop, &M[t], b, x, tolerance, maxIterations, &stats);
+                    break;
+                case 1:
+                    status = krylovCgPipelined(Aop, &M[t], b, x, tolerance, maxIterations, &stats);
+                    break;
+                case 2:
+                    status = krylovGmres(Aop, &M[t], b, x, tolerance, restart, maxIterations, &stats);
+                    break;
+                default:
+                    status = krylovGmresPipelined(Aop, &M[t], b, x, tolerance, restart, maxIterations, &stats);
+                    break;
+                }
+                double error = 0.0;
+                for (int i = 0; i < n; i++) {
+                    error = fmax(error, fabs(x[i] - x_true[i]));
+                }
+                printf("%-16s %-7s %-6s %10d %8ld %8ld %10ld %12e %12e %12e%s\n", solver_names[solver],
+                       preconditioner_names[t], op ? "dense" : "csr", stats.iterations, stats.matvecs,
+                       stats.preconditions, stats.reductions, setup[t], stats.time, stats.residual,
+                       status == 0 ? "" : " (not converged)");
+                /* the pipelined recurrences may stop a little above the requested tolerance; the forward error is
+                 * bounded by ||x - x_true|| <= cond(A) ||b - A x|| / ||b|| ||x_true|| */
+                double residual_bound = 100 * tolerance;
+                double error_bound = condition * residual_bound * x_norm;
+                if (status < 0 || (status != 0 && defaultMaxIterations)) {
+                    fprintf(stderr, "Error! %s with %s did not converge in %d iterations.\n", solver_names[solver],
+                            preconditioner_names[t], stats.iterations);
+                    errors = 1;
+                } else if (status == 0 && (stats.residual > residual_bound || error > error_bound)) {
+                    fprintf(stderr, "Error! %s with %s: true residual %e (bound %e), max error %e (bound %e).\n",
+                            solver_names[solver], preconditioner_names[t], stats.residual, residual_bound, error,
+                            error_bound);
+                    errors = 1;
+                }
+                for (int k = 0; history_file && k < stats.historyLength; k++) {
+                    fprintf(history_file, "%s,%s,%d,%e\n", solver_names[solver], preconditioner_names[t], k, history[k]);
+                }
+            }
+        }
+    }
+
+    if (history_file)
+        fclose(history_file);
+    for (int t = 0; t < 4; t++) {
+        if (M[t].type == (krylov_preconditioner_type_t)t)
+            krylovPreconditionerFree(&M[t]);
+    }
+    if (dense)
+        matrixFree(&D);
+    sparseCsrFree(&A);
+    free(x_true);
+    free(b);
+    free(x);
+    free(history);
+    return errors ? -1 : 0;
+}
@@ -0,0 +1,247 @@
+/**
+ * @file lu.h
+ * @author Navid Shamszadeh
+ * @brief Blocked LU factorization with partial pivoting for double and float, and a mixed-precision solver that
+ * factors in float and refines the solution to double accuracy.
+ * @details The factorization and solve come from luTemplate.h, instantiated for double (unsuffixed names, e.g.
+ * luFactorStrided, as in Factorizations/LU.c) and float (suffix Float). A float factorization moves half the bytes,
+ * and its trailing updates run on the 8 x 16 float micro-kernels of gemm.h, which fill every SIMD lane;
+ * Factorizations/mixed_precision_LU.c measures how much faster that makes it than the double one on the host.
+ *
+ * luSolveMixed factors A in float, then runs iterative refinement: the residual r = b - A x is computed in double,
+ * the correction A d = r is solved with the float factors and x += d. Each step gains roughly the float accuracy
+ * relative to the previous error, so a few steps reach the accuracy of a double solve as long as the condition
+ * number of A stays well below 1 / (float epsilon). When it does not, refinement stalls; the solver detects that
+ * (or an overflow or a zero pivot in float) and falls back to a full double factorization. The stopping test is
+ * that of LAPACK dsgesv, ||r|| <= ||x|| ||A|| eps sqrt(N) in the max norm for every right-hand side.
+ * @date 2021-05-22
+ */
+#ifndef LU_H
+#define LU_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "benchmark.h"
+#include "kernels.h"
+#include "perf.h"
+
+// width of the block columns of the right-looking factorization, unless tune.h overrides it
+#define LU_BLOCK 128
+// most refinement steps before luSolveMixed falls back to double
+#define LU_REFINE_MAX_ITERATIONS 30
+// a refinement step that shrinks the residual by less than this factor counts as stalled
+#define LU_REFINE_STALL 0.5
+
+#define LU_T double
+#define LU_NAME(x) x
+#include "luTemplate.h"
+
+#define LU_T float
+#define LU_NAME(x) x##Float
+#include "luTemplate.h"
+
+typedef enum {
+    LU_MIXED_CONVERGED = 0,
+    LU_MIXED_OVERFLOW,     // A does not fit in float
+    LU_MIXED_SINGULAR,     // zero pivot in the float factorization
+    LU_MIXED_STALLED,      // the residual stopped shrinking
+    LU_MIXED_MAX_ITERATIONS
+} lu_mixed_status_t;
+
+const char *luMixedStatusNames[] = {"converged", "overflow", "singular in float", "stalled", "too many iterations"};
+
+/**
+ * @brief Outcome of one mixed-precision solve.
+ */
+typedef struct {
+    lu_mixed_status_t status; // why refinement stopped; anything but LU_MIXED_CONVERGED means it fell back to double
+    int iterations;           // refinement steps taken
+    int fallback;             // 1 if the solution came from the double factorization
+    double backwardError;     // max over the right-hand sides of ||b - A x|| / (||A|| ||x|| + ||b||), max norm
+    double factorTime;        // seconds in the float factorization
+    double refineTime;        // seconds in the refinement loop
+    double fallbackTime;      // seconds in the double factorization and solve, 0 without fallback
+} lu_mixed_stats_t;
+
+/**
+ * @brief Normwise backward error max_j ||b_j - A x_j|| / (||A|| ||x_j|| + ||b_j||) in the max norm.
+ *
+ * @param N Order of A
+ * @param nrhs Number of right-hand sides
+ * @param A Matrix with row stride lda
+ * @param lda Leading dimension of A
+ * @param B Right-hand sides with row stride ldb
+ * @param ldb Leading dimension of B
+ * @param X Solutions with row stride ldx
+ * @param ldx Leading dimension of X
+ * @return The backward error, or -1 if the workspace could not be allocated
+ */
+double luBackwardError(int N, int nrhs, const double *A, int lda, const double *B, int ldb, const double *X, int ldx) {
+    double *R = (double *)malloc(((long int)N * nrhs + 1) * sizeof(double));
+    if (R == NULL)
+        return -1.0;
+    double norm_A = 0.0;
+    for (int i = 0; i < N; i++) {
+        double row_sum = 0.0;
+        for (int j = 0; j < N; j++) {
+            row_sum += fabs(A[j + (long int)lda * i]);
+        }
+        norm_A = fmax(norm_A, row_sum);
+        memcpy(R + (long int)nrhs * i, B + (long int)ldb * i, nrhs * sizeof(double));
+    }
+    gemmGeneralDouble(N, N, nrhs, -1.0, A, lda, X, ldx, 1.0, R, nrhs);
+    double error = 0.0;
+    for (int j = 0; j < nrhs; j++) {
+        double norm_r = 0.0, norm_x = 0.0, norm_b = 0.0;
+        for (int i = 0; i < N; i++) {
+            norm_r = fmax(norm_r, fabs(R[j + (long int)nrhs * i]));
+            norm_x = fmax(norm_x, fabs(X[j + (long int)ldx * i]));
+            norm_b = fmax(norm_b, fabs(B[j + (long int)ldb * i]));
+        }
+        double scale = norm_A * norm_x + norm_b;
+        error = fmax(error, (scale > 0.0) ? norm_r / scale : norm_r);
+    }
+    free(R);
+    return error;
+}
+
+/**
+ * @brief Solves A X = B to double accuracy with a float LU factorization and iterative refinement, falling back to
+ * a double factorization when refinement cannot get there.
+ *
+ * @param N Order of A
+ * @param nrhs Number of right-hand sides (columns of B and X)
+ * @param A Matrix with row stride lda, not modified
+ * @param lda Leading dimension of A
+ * @param B N x nrhs right-hand sides with row stride ldb, not modified
+ * @param ldb Leading dimension of B
+ * @param X N x nrhs solutions with row stride ldx
+ * @param ldx Leading dimension of X
+ * @param stats Outcome of the solve, may be NULL
+ * @return 0 on success, -1 if memory could not be allocated, or i + 1 if the fallback found U[i][i] exactly zero
+ */
+int luSolveMixed(int N, int nrhs, const double *A, int lda, const double *B, int ldb, double *X, int ldx, lu_mixed_stats_t *stats) {
+    PERF_BEGIN();
+    lu_mixed_stats_t own;
+    if (stats == NULL)
+        stats = &own;
+    memset(stats, 0, sizeof(*stats));
+    long int n2 = (long int)N * N, nb = (long int)N * nrhs;
+    float *As = (float *)malloc((n2 + 1) * sizeof(float));
+    float *Rs = (float *)malloc((nb + 1) * sizeof(float));
+    double *R = (double *)malloc((nb + 1) * sizeof(double));
+    int *pivots = (int *)malloc((N + 1) * sizeof(int));
+    if (As == NULL || Rs == NULL || R == NULL || pivots == NULL) {
+        free(As);
+        free(Rs);
+        free(R);
+        free(pivots);
+        PERF_END("luSolveMixed", N, nrhs, 1);
+        return -1;
+    }
+
+    // round A to float, unless some entry is out of range
+    double start = benchmarkNow();
+    double norm_A = 0.0;
+    stats->status = LU_MIXED_CONVERGED;
+    for (int i = 0; i < N; i++) {
+        double row_sum = 0.0;
+        for (int j = 0; j < N; j++) {
+            double a = A[j + (long int)lda * i];
+            if (fabs(a) > FLT_MAX)
+                stats->status = LU_MIXED_OVERFLOW;
+            As[j + (long int)N * i] = (float)a;
+            row_sum += fabs(a);
+        }
+        norm_A = fmax(norm_A, row_sum);
+    }
+    if (stats->status == LU_MIXED_CONVERGED && luFactorStridedFloat(N, As, N, pivots) != 0)
+        stats->status = LU_MIXED_SINGULAR;
+    stats->factorTime = benchmarkNow() - start;
+
+    start = benchmarkNow();
+    if (stats->status == LU_MIXED_CONVERGED) {
+        // x_0 from the float factors, then x += A^-1 (b - A x) with the residual in double
+        double threshold = norm_A * (DBL_EPSILON / 2) * sqrt((double)N);
+        double previous = INFINITY;
+        for (int i = 0; i < N; i++) {
+            memcpy(R + (long int)nrhs * i, B + (long int)ldb * i, nrhs * sizeof(double));
+        }
+        stats->status = LU_MIXED_MAX_ITERATIONS;
+        for (int iteration = 0; ; iteration++) {
+            if (iteration > 0) {
+                for (int i = 0; i < N; i++) {
+                    memcpy(R + (long int)nrhs * i, B + (long int)ldb * i, nrhs * sizeof(double));
+                }
+                gemmGeneralDouble(N, N, nrhs, -1.0, A, lda, X, ldx, 1.0, R, nrhs);
+                int converged = 1;
+                double norm_r = 0.0;
+                for (int j = 0; j < nrhs; j++) {
+                    double col_r = 0.0, col_x = 0.0;
+                    for (int i = 0; i < N; i++) {
+                        col_r = fmax(col_r, fabs(R[j + (long int)nrhs * i]));
+                        col_x = fmax(col_x, fabs(X[j + (long int)ldx * i]));
+                    }
+                    converged &= (col_r <= col_x * threshold);
+                    norm_r = fmax(norm_r, col_r);
+                }
+                if (converged) {
+                    stats->status = LU_MIXED_CONVERGED;
+                    break;
+                }
+                if (!(norm_r < LU_REFINE_STALL * previous)) {
+                    stats->status = LU_MIXED_STALLED;
+                    break;
+                }
+                if (iteration > LU_REFINE_MAX_ITERATIONS)
+                    break;
+                previous = norm_r;
+                stats->iterations = iteration;
+            }
+            for (long int k = 0; k < nb; k++) {
+                Rs[k] = (float)R[k];
+            }
+            luSolveStridedFloat(N, nrhs, As, N, pivots, Rs, nrhs);
+            for (int i = 0; i < N; i++) {
+                double *x = X + (long int)ldx * i;
+                const float *d = Rs + (long int)nrhs * i;
+                for (int j = 0; j < nrhs; j++) {
+                    x[j] = (iteration > 0) ? x[j] + d[j] : d[j];
+                }
+            }
+        }
+    }
+    stats->refineTime = benchmarkNow() - start;
+    free(As);
+    free(Rs);
+    free(R);
+
+    int info = 0;
+    if (stats->status != LU_MIXED_CONVERGED) {
+        start = benchmarkNow();
+        double *LU = (double *)malloc((n2 + 1) * sizeof(double));
+        if (LU == NULL) {
+            free(pivots);
+            PERF_END("luSolveMixed", N, nrhs, 1);
+            return -1;
+        }
+        for (int i = 0; i < N; i++) {
+            memcpy(LU + (long int)N * i, A + (long int)lda * i, N * sizeof(double));
+            memcpy(X + (long int)ldx * i, B + (long int)ldb * i, nrhs * sizeof(double));
+        }
+        info = luFactorStrided(N, LU, N, pivots);
+        luSolveStrided(N, nrhs, LU, N, pivots, X, ldx);
+        stats->fallback = 1;
+        stats->fallbackTime = benchmarkNow() - start;
+        free(LU);
+    }
+    free(pivots);
+    stats->backwardError = luBackwardError(N, nrhs, A, lda, B, ldb, X, ldx);
+    PERF_END("luSolveMixed", N, nrhs, 1);
+    return info;
+}
+
+#endif
@@ -0,0 +1,182 @@
+/**
+ * @file luTemplate.h
+ * @author Navid Shamszadeh
+ * @brief Type-generic blocked LU factorization with partial pivoting and the matching solve, included by lu.h once
+ * per element type.
+ * @details Before including, define LU_T as the element type (double or float) and LU_NAME(x) to append the type's
+ * suffix to a function name. Both are undefined again at the end of this file. The triangular solves and the
+ * trailing updates go through kernelTriangularSolve and kernelGemm, which pick the kernels of the same type.
+ * perf.h sees the factorization and the solve under their instantiated names, e.g. luFactorStridedFloat.
+ * @date 2021-05-22
+ */
+
+/**
+ * @brief Applies the row interchanges pivots[k1..k2) to the ncols columns of A.
+ * @details Row i is swapped with row pivots[i], in increasing order of i, as recorded by the factorization.
+ *
+ * @param ncols Number of columns to swap
+ * @param A Strided matrix with row stride lda
+ * @param lda Leading dimension of A
+ * @param k1 First pivot to apply
+ * @param k2 One past the last pivot to apply
+ * @param pivots Pivot indices relative to the first row of A
+ */
+void LU_NAME(luSwapRows)(int ncols, LU_T *A, int lda, int k1, int k2, const int *pivots) {
+    for (int i = k1; i < k2; i++) {
+        int p = pivots[i];
+        if (p != i) {
+            LU_T *row_i = A + (long int)lda * i;
+            LU_T *row_p = A + (long int)lda * p;
+            for (int j = 0; j < ncols; j++) {
+                LU_T temp = row_i[j];
+                row_i[j] = row_p[j];
+                row_p[j] = temp;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Recursive LU factorization with partial pivoting of an m x n panel (m >= n).
+ * @details The left half of the columns is factored recursively, its interchanges are applied to the right half,
+ * the right half is updated with a triangular solve and a GEMM, and then the bottom of the right half is factored
+ * recursively.
+ *
+ * @param m Number of rows of the panel
+ * @param n Number of columns of the panel
+ * @param A Panel with row stride lda, overwritten with its L and U factors
+ * @param lda Leading dimension of A
+ * @param pivots Output pivot indices relative to the first row of the panel
+ * @return 0 on success, or i + 1 if U[i][i] is exactly zero
+ */
+int LU_NAME(luPanelFactor)(int m, int n, LU_T *A, int lda, int *pivots) {
+    if (n == 1) {
+        int p = 0;
+        double max = fabs((double)A[0]);
+        for (int i = 1; i < m; i++) {
+            double v = fabs((double)A[(long int)lda * i]);
+            if (v > max) {
+                max = v;
+                p = i;
+            }
+        }
+        pivots[0] = p;
+        if (max == 0.0)
+            return 1;
+        LU_T temp = A[0];
+        A[0] = A[(long int)lda * p];
+        A[(long int)lda * p] = temp;
+        LU_T inverse = 1 / A[0];
+        for (int i = 1; i < m; i++) {
+            A[(long int)lda * i] *= inverse;
+        }
+        return 0;
+    }
+
+    int n1 = n / 2;
+    int n2 = n - n1;
+    LU_T *A12 = A + n1;
+    LU_T *A21 = A + (long int)lda * n1;
+    LU_T *A22 = A21 + n1;
+
+    int info = LU_NAME(luPanelFactor)(m, n1, A, lda, pivots);
+    LU_NAME(luSwapRows)(n2, A12, lda, 0, n1, pivots);
+    kernelTriangularSolve(n1, n2, 1, 0, 1, A, lda, A12, lda);
+    kernelGemm(m - n1, n1, n2, -1, A21, lda, A12, lda, 1, A22, lda);
+
+    int info2 = LU_NAME(luPanelFactor)(m - n1, n2, A22, lda, pivots + n1);
+    if (info == 0 && info2 != 0)
+        info = info2 + n1;
+    for (int i = n1; i < n; i++) {
+        pivots[i] += n1;
+    }
+    LU_NAME(luSwapRows)(n1, A, lda, n1, n, pivots);
+    return info;
+}
+
+/**
+ * @brief Blocked LU factorization with partial pivoting of a strided N x N matrix, PA = LU.
+ * @details On return the strict lower triangle of A holds L (its unit diagonal is implied) and the upper triangle
+ * holds U. Row i of A was interchanged with row pivots[i], for i = 0 to N - 1 in order.
+ *
+ * @param N Order of A
+ * @param A Matrix with row stride lda, overwritten with L and U
+ * @param lda Leading dimension of A
+ * @param pivots Output array of N pivot indices
+ * @return 0 on success, or i + 1 if U[i][i] is exactly zero (the factorization is completed but U is singular)
+ */
+int LU_NAME(luFactorStrided)(int N, LU_T *A, int lda, int *pivots) {
+    PERF_BEGIN();
+    int info = 0;
+    int block = TUNED(luBlock, LU_BLOCK);
+    for (int j0 = 0; j0 < N; j0 += block) {
+        int jb = (N - j0 < block) ? N - j0 : block;
+        LU_T *A11 = A + j0 + (long int)lda * j0;
+        LU_T *A12 = A11 + jb;
+        LU_T *A21 = A11 + (long int)lda * jb;
+        LU_T *A22 = A21 + jb;
+        int trailing = N - j0 - jb;
+
+        int panel_info = LU_NAME(luPanelFactor)(N - j0, jb, A11, lda, pivots + j0);
+        if (info == 0 && panel_info != 0)
+            info = panel_info + j0;
+
+        // make the pivots global and apply them to the columns left and right of the panel
+        for (int i = j0; i < j0 + jb; i++) {
+            pivots[i] += j0;
+        }
+        LU_NAME(luSwapRows)(j0, A, lda, j0, j0 + jb, pivots);
+        LU_NAME(luSwapRows)(trailing, A + j0 + jb, lda, j0, j0 + jb, pivots);
+
+        if (trailing > 0) {
+            // U12 = L11^-1 A12, then A22 -= L21 U12
+            kernelTriangularSolve(jb, trailing, 1, 0, 1, A11, lda, A12, lda);
+            kernelGemm(trailing, jb, trailing, -1, A21, lda, A12, lda, 1, A22, lda);
+        }
+    }
+    PERF_END(__func__, N, N, 1);
+    return info;
+}
+
+/**
+ * @brief Blocked LU factorization with partial pivoting of a row-pointer N x N matrix.
+ * @details The rows must be evenly spaced in memory, as they are when carved out of a single A[0] block.
+ *
+ * @param N Order of A
+ * @param A Matrix, overwritten with L and U
+ * @param pivots Output array of N pivot indices
+ * @return 0 on success, or i + 1 if U[i][i] is exactly zero
+ */
+int LU_NAME(luFactor)(int N, LU_T **A, int *pivots) {
+    int lda = (N > 1) ? (int)(A[1] - A[0]) : N;
+    for (int i = 2; i < N; i++) {
+        if (A[i] - A[i - 1] != lda) {
+            fprintf(stderr, "Error: luFactor needs evenly spaced rows!\n");
+            exit(-1);
+        }
+    }
+    return LU_NAME(luFactorStrided)(N, A[0], lda, pivots);
+}
+
+/**
+ * @brief Solves A X = B using the factors computed by luFactorStrided.
+ *
+ * @param N Order of A
+ * @param nrhs Number of right-hand sides (columns of B)
+ * @param LU Factors of A with row stride ldlu
+ * @param ldlu Leading dimension of LU
+ * @param pivots Pivot indices from the factorization
+ * @param B N x nrhs right-hand side with row stride ldb, overwritten with the solution X
+ * @param ldb Leading dimension of B
+ */
+void LU_NAME(luSolveStrided)(int N, int nrhs, const LU_T *LU, int ldlu, const int *pivots, LU_T *B, int ldb) {
+    PERF_BEGIN();
+    LU_NAME(luSwapRows)(nrhs, B, ldb, 0, N, pivots);
+    // forward substitution with the unit lower triangle, then back substitution with U
+    kernelTriangularSolve(N, nrhs, 1, 0, 1, LU, ldlu, B, ldb);
+    kernelTriangularSolve(N, nrhs, 0, 0, 0, LU, ldlu, B, ldb);
+    PERF_END(__func__, N, nrhs, 1);
+}
+
+#undef LU_T
+#undef LU_NAME
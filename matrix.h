@@ -0,0 +1,371 @@
+/**
+ * @file matrix.h
+ * @author Navid Shamszadeh
+ * @brief Matrix descriptor (rows, columns, leading dimension, element type, ownership) backed by a 64-byte aligned
+ * arena allocator, with zero-copy sub-matrix and row-pointer views.
+ * @details A matrix_t describes a row-major matrix anywhere in memory: element (i, j) lives at data[j + ld * i].
+ * matrixCreate pads the leading dimension so every row starts on a 64-byte boundary, which keeps the SIMD kernels
+ * on aligned loads; matrixCreatePacked keeps ld == cols for code that expects the classic strided layout.
+ * The operations at the end dispatch on the element type at run time to the kernels of kernels.h.
+ * Views (matrixView, matrixRowPointers) point into the same buffer, so a sub-matrix can be handed to a kernel and
+ * a row-pointer function can run on a strided matrix without copying anything.
+ * Matrices allocated from an arena are released all at once by resetting or destroying the arena; matrices
+ * allocated with a NULL arena own their buffer and are released with matrixFree.
+ * @date 2021-05-18
+ */
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "kernels.h"
+#include "perf.h"
+
+// alignment of every arena allocation and of every row of a padded matrix, one cache line
+#define MATRIX_ALIGNMENT 64
+
+typedef enum {
+    MATRIX_LONG = 0,
+    MATRIX_DOUBLE,
+    MATRIX_FLOAT,
+    MATRIX_INT
+} matrix_type_t;
+
+const size_t matrixTypeSizes[] = {sizeof(long int), sizeof(double), sizeof(float), sizeof(int)};
+const char *matrixTypeNames[] = {"long", "double", "float", "int"};
+
+typedef enum {
+    MATRIX_VIEW = 0, // points into memory owned by someone else
+    MATRIX_OWNED,    // owns its buffer, released by matrixFree
+    MATRIX_ARENA     // lives in an arena, released with the arena
+} matrix_ownership_t;
+
+/**
+ * @brief A row-major matrix: element (i, j) is data[j + ld * i].
+ */
+typedef struct {
+    int rows;
+    int cols;
+    int ld;                       // leading dimension (row stride) in elements, ld >= cols
+    matrix_type_t type;
+    matrix_ownership_t ownership;
+    void *data;
+} matrix_t;
+
+/**
+ * @brief Bump allocator over one aligned block. Allocations are released together by matrixArenaReset.
+ */
+typedef struct {
+    char *base;
+    size_t capacity;
+    size_t used;
+} matrix_arena_t;
+
+// element (i, j) of a matrix_t pointer A holding elements of type T
+#define MATRIX_AT(T, A, i, j) (((T *)(A)->data)[(j) + (long int)(A)->ld * (i)])
+
+/**
+ * @brief Rounds bytes up to a multiple of MATRIX_ALIGNMENT.
+ */
+size_t matrixAlignUp(size_t bytes) {
+    return (bytes + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+}
+
+/**
+ * @brief Creates an arena able to hold capacity bytes of allocations (before alignment padding).
+ *
+ * @param arena Arena to initialize
+ * @param capacity Size of the arena in bytes
+ * @return 0 on success, -1 if the memory could not be allocated
+ */
+int matrixArenaCreate(matrix_arena_t *arena, size_t capacity) {
+    arena->capacity = matrixAlignUp(capacity > 0 ? capacity : 1);
+    arena->used = 0;
+    arena->base = (char *)aligned_alloc(MATRIX_ALIGNMENT, arena->capacity);
+    if (arena->base == NULL) {
+        arena->capacity = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Allocates bytes from the arena, aligned to MATRIX_ALIGNMENT.
+ *
+ * @return The allocation, or NULL if the arena is exhausted
+ */
+void *matrixArenaAlloc(matrix_arena_t *arena, size_t bytes) {
+    size_t size = matrixAlignUp(bytes > 0 ? bytes : 1);
+    if (arena->used + size > arena->capacity)
+        return NULL;
+    void *p = arena->base + arena->used;
+    arena->used += size;
+    return p;
+}
+
+/**
+ * @brief Releases every allocation made after mark (a previous value of arena->used), e.g. per-call scratch space.
+ */
+void matrixArenaReset(matrix_arena_t *arena, size_t mark) {
+    if (mark < arena->used)
+        arena->used = mark;
+}
+
+void matrixArenaDestroy(matrix_arena_t *arena) {
+    free(arena->base);
+    arena->base = NULL;
+    arena->capacity = 0;
+    arena->used = 0;
+}
+
+/**
+ * @brief Bytes an arena needs to hold a matrixCreate matrix of the given shape, for sizing arenas up front.
+ */
+size_t matrixBytes(int rows, int cols, matrix_type_t type) {
+    size_t row_bytes = matrixAlignUp((size_t)cols * matrixTypeSizes[type]);
+    return matrixAlignUp(row_bytes * rows);
+}
+
+/**
+ * @brief Allocates a rows x cols matrix with leading dimension ld from the arena, or on its own if arena is NULL.
+ * @details Exits with an error message if the memory cannot be allocated, like the rest of the drivers do.
+ */
+matrix_t matrixCreateLd(matrix_arena_t *arena, int rows, int cols, int ld, matrix_type_t type) {
+    matrix_t A = {rows, cols, ld, type, MATRIX_ARENA, NULL};
+    size_t bytes = matrixAlignUp((size_t)rows * ld * matrixTypeSizes[type]);
+    if (arena != NULL) {
+        A.data = matrixArenaAlloc(arena, bytes);
+    } else {
+        A.data = aligned_alloc(MATRIX_ALIGNMENT, bytes > 0 ? bytes : MATRIX_ALIGNMENT);
+        A.ownership = MATRIX_OWNED;
+    }
+    if (A.data == NULL) {
+        fprintf(stderr, "Error: could not allocate a %d x %d %s matrix!\n", rows, cols, matrixTypeNames[type]);
+        exit(-1);
+    }
+    return A;
+}
+
+/**
+ * @brief Allocates a rows x cols matrix whose rows all start on a MATRIX_ALIGNMENT boundary.
+ */
+matrix_t matrixCreate(matrix_arena_t *arena, int rows, int cols, matrix_type_t type) {
+    int ld = (int)(matrixAlignUp((size_t)cols * matrixTypeSizes[type]) / matrixTypeSizes[type]);
+    return matrixCreateLd(arena, rows, cols, ld, type);
+}
+
+/**
+ * @brief Allocates a rows x cols matrix with ld == cols, i.e. the strided layout A[j + cols * i].
+ */
+matrix_t matrixCreatePacked(matrix_arena_t *arena, int rows, int cols, matrix_type_t type) {
+    return matrixCreateLd(arena, rows, cols, cols, type);
+}
+
+/**
+ * @brief Describes an existing strided buffer without taking ownership of it.
+ */
+matrix_t matrixWrap(int rows, int cols, int ld, matrix_type_t type, void *data) {
+    matrix_t A = {rows, cols, ld, type, MATRIX_VIEW, data};
+    return A;
+}
+
+/**
+ * @brief Zero-copy view of the rows x cols sub-matrix of A starting at (i0, j0).
+ */
+matrix_t matrixView(const matrix_t *A, int i0, int j0, int rows, int cols) {
+    char *data = (char *)A->data + ((size_t)j0 + (size_t)A->ld * i0) * matrixTypeSizes[A->type];
+    return matrixWrap(rows, cols, A->ld, A->type, data);
+}
+
+/**
+ * @brief Zero-copy row-pointer view of A, for the functions taking T **: element (i, j) is rows[i][j].
+ * @details The pointer array comes from the arena, or from malloc if arena is NULL (release it with free).
+ * Cast the result to the element type, e.g. (long int **)matrixRowPointers(NULL, &A).
+ */
+void **matrixRowPointers(matrix_arena_t *arena, const matrix_t *A) {
+    size_t bytes = (A->rows > 0 ? A->rows : 1) * sizeof(void *);
+    void **rows = (arena != NULL) ? (void **)matrixArenaAlloc(arena, bytes) : (void **)malloc(bytes);
+    if (rows == NULL) {
+        fprintf(stderr, "Error: could not allocate %d row pointers!\n", A->rows);
+        exit(-1);
+    }
+    for (int i = 0; i < A->rows; i++) {
+        rows[i] = (char *)A->data + (size_t)A->ld * i * matrixTypeSizes[A->type];
+    }
+    return rows;
+}
+
+/**
+ * @brief Releases the buffer of a matrix that owns it. Views and arena matrices are left alone.
+ */
+void matrixFree(matrix_t *A) {
+    if (A->ownership == MATRIX_OWNED)
+        free(A->data);
+    A->data = NULL;
+}
+
+/**
+ * @brief Copies the elements of src into dst, which must have the same shape and type.
+ */
+void matrixCopy(const matrix_t *src, matrix_t *dst) {
+    size_t row_bytes = (size_t)src->cols * matrixTypeSizes[src->type];
+    for (int i = 0; i < src->rows; i++) {
+        memcpy((char *)dst->data + (size_t)dst->ld * i * matrixTypeSizes[dst->type],
+               (const char *)src->data + (size_t)src->ld * i * matrixTypeSizes[src->type], row_bytes);
+    }
+}
+
+/**
+ * @brief Checks that every matrix passed has the given element type, exits with an error otherwise.
+ */
+void matrixCheckType(const char *operation, matrix_type_t type, const matrix_t *A) {
+    if (A->type != type) {
+        fprintf(stderr, "Error: %s got a %s matrix where a %s matrix was expected!\n", operation,
+                matrixTypeNames[A->type], matrixTypeNames[type]);
+        exit(-1);
+    }
+}
+
+/**
+ * @brief C = A + B for matrices of the same shape and type, any leading dimensions. C may alias A or B.
+ * @details Contiguous matrices are summed in one streaming pass, otherwise row by row.
+ */
+void matrixAdd(const matrix_t *A, const matrix_t *B, matrix_t *C) {
+    PERF_BEGIN();
+    matrixCheckType("matrixAdd", A->type, B);
+    matrixCheckType("matrixAdd", A->type, C);
+    int contiguous = A->ld == A->cols && B->ld == B->cols && C->ld == C->cols;
+    long int n = contiguous ? (long int)A->rows * A->cols : A->cols;
+    int rows = contiguous ? 1 : A->rows;
+    for (int i = 0; i < rows; i++) {
+        switch (A->type) {
+        case MATRIX_LONG:
+            kernelAdd(n, &MATRIX_AT(long int, A, i, 0), &MATRIX_AT(long int, B, i, 0), &MATRIX_AT(long int, C, i, 0));
+            break;
+        case MATRIX_DOUBLE:
+            kernelAdd(n, &MATRIX_AT(double, A, i, 0), &MATRIX_AT(double, B, i, 0), &MATRIX_AT(double, C, i, 0));
+            break;
+        case MATRIX_FLOAT:
+            kernelAdd(n, &MATRIX_AT(float, A, i, 0), &MATRIX_AT(float, B, i, 0), &MATRIX_AT(float, C, i, 0));
+            break;
+        case MATRIX_INT:
+            kernelAdd(n, &MATRIX_AT(int, A, i, 0), &MATRIX_AT(int, B, i, 0), &MATRIX_AT(int, C, i, 0));
+            break;
+        }
+    }
+    PERF_END("matrixAdd", A->rows, A->cols, 1);
+}
+
+/**
+ * @brief b = A * x. x has A->cols elements and b has A->rows elements, both of A's element type.
+ */
+void matrixVectorMultiplyMatrix(const matrix_t *A, const void *x, void *b) {
+    PERF_BEGIN();
+    switch (A->type) {
+    case MATRIX_LONG:
+        kernelGemv(A->rows, A->cols, (const long int *)A->data, A->ld, (const long int *)x, (long int *)b);
+        break;
+    case MATRIX_DOUBLE:
+        kernelGemv(A->rows, A->cols, (const double *)A->data, A->ld, (const double *)x, (double *)b);
+        break;
+    case MATRIX_FLOAT:
+        kernelGemv(A->rows, A->cols, (const float *)A->data, A->ld, (const float *)x, (float *)b);
+        break;
+    case MATRIX_INT:
+        kernelGemv(A->rows, A->cols, (const int *)A->data, A->ld, (const int *)x, (int *)b);
+        break;
+    }
+    PERF_END("matrixVectorMultiplyMatrix", A->rows, A->cols, 1);
+}
+
+/**
+ * @brief C = A * B, or C += A * B if accumulate is set, through the blocked GEMM engine, for matrices of the same
+ * type.
+ */
+void matrixMultiplyAccumulateMatrix(const matrix_t *A, const matrix_t *B, int accumulate, matrix_t *C) {
+    PERF_BEGIN();
+    matrixCheckType("matrixMultiplyMatrix", A->type, B);
+    matrixCheckType("matrixMultiplyMatrix", A->type, C);
+    if (A->cols != B->rows || C->rows != A->rows || C->cols != B->cols) {
+        fprintf(stderr, "Error: matrixMultiplyMatrix got %d x %d times %d x %d into %d x %d!\n",
+                A->rows, A->cols, B->rows, B->cols, C->rows, C->cols);
+        exit(-1);
+    }
+    int beta = accumulate ? 1 : 0;
+    switch (A->type) {
+    case MATRIX_LONG:
+        kernelGemm(A->rows, A->cols, B->cols, 1, (const long int *)A->data, A->ld, (const long int *)B->data, B->ld,
+                   beta, (long int *)C->data, C->ld);
+        break;
+    case MATRIX_DOUBLE:
+        kernelGemm(A->rows, A->cols, B->cols, 1, (const double *)A->data, A->ld, (const double *)B->data, B->ld,
+                   beta, (double *)C->data, C->ld);
+        break;
+    case MATRIX_FLOAT:
+        kernelGemm(A->rows, A->cols, B->cols, 1, (const float *)A->data, A->ld, (const float *)B->data, B->ld,
+                   beta, (float *)C->data, C->ld);
+        break;
+    case MATRIX_INT:
+        kernelGemm(A->rows, A->cols, B->cols, 1, (const int *)A->data, A->ld, (const int *)B->data, B->ld,
+                   beta, (int *)C->data, C->ld);
+        break;
+    }
+    PERF_END("matrixMultiplyAccumulateMatrix", A->rows, A->cols, B->cols);
+}
+
+/**
+ * @brief C = A * B through the blocked GEMM engine, for matrices of the same type.
+ */
+void matrixMultiplyMatrix(const matrix_t *A, const matrix_t *B, matrix_t *C) {
+    matrixMultiplyAccumulateMatrix(A, B, 0, C);
+}
+
+/**
+ * @brief Out-of-place transpose B = A^T for matrices of the same type, any leading dimensions.
+ */
+void matrixTransposeMatrix(const matrix_t *A, matrix_t *B) {
+    PERF_BEGIN();
+    matrixCheckType("matrixTransposeMatrix", A->type, B);
+    switch (A->type) {
+    case MATRIX_LONG:
+        kernelTranspose(A->rows, A->cols, (const long int *)A->data, A->ld, (long int *)B->data, B->ld);
+        break;
+    case MATRIX_DOUBLE:
+        kernelTranspose(A->rows, A->cols, (const double *)A->data, A->ld, (double *)B->data, B->ld);
+        break;
+    case MATRIX_FLOAT:
+        kernelTranspose(A->rows, A->cols, (const float *)A->data, A->ld, (float *)B->data, B->ld);
+        break;
+    case MATRIX_INT:
+        kernelTranspose(A->rows, A->cols, (const int *)A->data, A->ld, (int *)B->data, B->ld);
+        break;
+    }
+    PERF_END("matrixTransposeMatrix", A->rows, A->cols, 1);
+}
+
+/**
+ * @brief Triangular solve op(T) X = B for double or float matrices, B overwritten with X.
+ *
+ * @param lower Nonzero if T is lower triangular, zero if upper triangular
+ * @param transpose Nonzero to solve with T^T instead of T
+ * @param unit_diagonal Nonzero if the diagonal of T is implicitly one
+ * @param T Square triangular matrix
+ * @param B Right-hand sides, one per column
+ */
+void matrixTriangularSolveMatrix(int lower, int transpose, int unit_diagonal, const matrix_t *T, matrix_t *B) {
+    PERF_BEGIN();
+    matrixCheckType("matrixTriangularSolveMatrix", T->type, B);
+    if (T->type == MATRIX_DOUBLE) {
+        kernelTriangularSolve(T->rows, B->cols, lower, transpose, unit_diagonal, (const double *)T->data, T->ld, (double *)B->data, B->ld);
+    } else if (T->type == MATRIX_FLOAT) {
+        kernelTriangularSolve(T->rows, B->cols, lower, transpose, unit_diagonal, (const float *)T->data, T->ld, (float *)B->data, B->ld);
+    } else {
+        fprintf(stderr, "Error: matrixTriangularSolveMatrix needs a floating point matrix, got %s!\n", matrixTypeNames[T->type]);
+        exit(-1);
+    }
+    PERF_END("matrixTriangularSolveMatrix", T->rows, B->cols, 1);
+}
+
+#endif
@@ -0,0 +1,294 @@
+/**
+ * @file matrixFile.h
+ * @author Navid Shamszadeh
+ * @brief Binary matrix files that are memory mapped zero-copy, and out-of-core GEMV and GEMM that stream them tile by
+ * tile with asynchronous prefetch.
+ * @details A matrix file is a 64-byte header (magic, version, element type, rows, columns, leading dimension, rows
+ * per tile, payload offset) followed, at a page aligned offset, by the rows of the matrix in the usual row-major
+ * strided layout with every row padded to 64 bytes. Values are stored in the byte order of the machine that wrote
+ * them. Because the payload is exactly a matrix_t, matrixFileOpen maps the file and hands it out as a view: nothing
+ * is read until a kernel touches it, and the kernels run on the page cache directly.
+ *
+ * The payload is processed in tiles of tile_rows consecutive rows (about MATRIX_FILE_TILE_BYTES each). The
+ * out-of-core kernels ask the kernel to start reading tile t + 1 (madvise MADV_WILLNEED, which returns immediately)
+ * before they compute on tile t, so the disk works while the CPU does, and they drop every tile of a streamed
+ * operand from memory once it is done with, so matrices larger than RAM run in a bounded resident set without
+ * pushing out the operands that are reused.
+ * @date 2021-05-20
+ */
+#ifndef MATRIX_FILE_H
+#define MATRIX_FILE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "matrix.h"
+
+#define MATRIX_FILE_MAGIC "NLAMATRX"
+#define MATRIX_FILE_VERSION 1
+// payload alignment in the file, one page
+#define MATRIX_FILE_PAGE 4096
+// default size of a tile, large enough for the disk to stream and small enough to keep two of them in memory
+#define MATRIX_FILE_TILE_BYTES (32L << 20)
+
+/**
+ * @brief On-disk header, 64 bytes at the start of the file.
+ */
+typedef struct {
+    char magic[8];     // MATRIX_FILE_MAGIC, not null terminated
+    int32_t version;
+    int32_t type;      // matrix_type_t
+    int64_t rows;
+    int64_t cols;
+    int64_t ld;        // leading dimension of the payload in elements
+    int64_t tile_rows; // rows per tile
+    int64_t offset;    // byte offset of the payload, a multiple of MATRIX_FILE_PAGE
+    char reserved[8];
+} matrix_file_header_t;
+
+/**
+ * @brief An open, mapped matrix file. matrix is a view of the payload.
+ */
+typedef struct {
+    int fd;
+    int writable;
+    size_t bytes; // size of the mapping (the whole file)
+    char *map;
+    matrix_file_header_t header;
+    matrix_t matrix;
+} matrix_file_t;
+
+/**
+ * @brief Maps the whole file and points the matrix view at its payload.
+ */
+int matrixFileMap(matrix_file_t *f) {
+    int protection = f->writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    f->map = (char *)mmap(NULL, f->bytes, protection, MAP_SHARED, f->fd, 0);
+    if (f->map == MAP_FAILED) {
+        perror("Error: could not map the matrix file");
+        close(f->fd);
+        return -1;
+    }
+    f->matrix = matrixWrap((int)f->header.rows, (int)f->header.cols, (int)f->header.ld,
+                           (matrix_type_t)f->header.type, f->map + f->header.offset);
+    return 0;
+}
+
+/**
+ * @brief Creates a rows x cols matrix file, sized and mapped for writing. The payload starts out as zeros.
+ *
+ * @param path File to create, truncated if it exists
+ * @param rows Number of rows
+ * @param cols Number of columns
+ * @param type Element type
+ * @param tile_rows Rows per tile, 0 for tiles of about MATRIX_FILE_TILE_BYTES
+ * @param f Output file, closed with matrixFileClose
+ * @return 0 on success, -1 on error
+ */
+int matrixFileCreate(const char *path, int rows, int cols, matrix_type_t type, int tile_rows, matrix_file_t *f) {
+    size_t element = matrixTypeSizes[type];
+    int64_t ld = (int64_t)(matrixAlignUp((size_t)cols * element) / element);
+    if (tile_rows <= 0) {
+        int64_t fit = MATRIX_FILE_TILE_BYTES / (ld * (int64_t)element > 0 ? ld * (int64_t)element : 1);
+        tile_rows = (int)((fit > 0) ? fit : 1);
+    }
+    matrix_file_header_t header = {MATRIX_FILE_MAGIC, MATRIX_FILE_VERSION, type, rows, cols, ld, tile_rows,
+                                   MATRIX_FILE_PAGE, {0}};
+    f->header = header;
+    f->writable = 1;
+    f->bytes = (size_t)header.offset + (size_t)rows * ld * element;
+    f->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (f->fd < 0 || ftruncate(f->fd, (off_t)f->bytes) != 0) {
+        perror("Error: could not create the matrix file");
+        if (f->fd >= 0)
+            close(f->fd);
+        return -1;
+    }
+    if (matrixFileMap(f) != 0)
+        return -1;
+    memcpy(f->map, &f->header, sizeof(matrix_file_header_t));
+    return 0;
+}
+
+/**
+ * @brief Checks a header read from a file of the given size: the dimensions must fit the int indices of matrix_t
+ * and the payload must fit in the file without overflowing.
+ *
+ * @return 1 if the header is valid, 0 otherwise
+ */
+int matrixFileHeaderValid(const matrix_file_header_t *h, int64_t file_size) {
+    if (memcmp(h->magic, MATRIX_FILE_MAGIC, 8) != 0 || h->version != MATRIX_FILE_VERSION
+        || h->type < MATRIX_LONG || h->type > MATRIX_INT)
+        return 0;
+    if (h->rows < 0 || h->rows > INT_MAX || h->cols < 0 || h->ld < h->cols || h->ld > INT_MAX
+        || h->tile_rows <= 0 || h->tile_rows > INT_MAX)
+        return 0;
+    if (h->offset < (int64_t)sizeof(matrix_file_header_t) || h->offset % MATRIX_FILE_PAGE != 0 || h->offset > file_size)
+        return 0;
+    // rows * ld * element <= file_size - offset, divided through so nothing overflows
+    int64_t payload = file_size - h->offset;
+    int64_t row_bytes = h->ld * (int64_t)matrixTypeSizes[h->type];
+    return h->rows == 0 || row_bytes <= payload / h->rows;
+}
+
+/**
+ * @brief Opens and maps an existing matrix file read-only, after checking its header against its size.
+ *
+ * @return 0 on success, -1 on error
+ */
+int matrixFileOpen(const char *path, matrix_file_t *f) {
+    struct stat st;
+    f->writable = 0;
+    f->fd = open(path, O_RDONLY);
+    if (f->fd < 0 || fstat(f->fd, &st) != 0) {
+        perror("Error: could not open the matrix file");
+        if (f->fd >= 0)
+            close(f->fd);
+        return -1;
+    }
+    if (pread(f->fd, &f->header, sizeof(matrix_file_header_t), 0) != (ssize_t)sizeof(matrix_file_header_t)
+        || !matrixFileHeaderValid(&f->header, (int64_t)st.st_size)) {
+        fprintf(stderr, "Error: %s is not a valid matrix file!\n", path);
+        close(f->fd);
+        return -1;
+    }
+    f->bytes = (size_t)st.st_size;
+    return matrixFileMap(f);
+}
+
+void matrixFileClose(matrix_file_t *f) {
+    munmap(f->map, f->bytes);
+    close(f->fd);
+    f->map = NULL;
+    f->fd = -1;
+}
+
+/**
+ * @brief Writes an in-memory matrix to a new matrix file.
+ *
+ * @return 0 on success, -1 on error
+ */
+int matrixFileSave(const char *path, const matrix_t *A, int tile_rows) {
+    matrix_file_t f;
+    if (matrixFileCreate(path, A->rows, A->cols, A->type, tile_rows, &f) != 0)
+        return -1;
+    matrixCopy(A, &f.matrix);
+    matrixFileClose(&f);
+    return 0;
+}
+
+/**
+ * @brief Page aligned byte range of the file holding rows row0..row0+rows of the payload.
+ */
+void matrixFileRange(const matrix_file_t *f, int row0, int rows, size_t *begin, size_t *length) {
+    size_t row_bytes = (size_t)f->header.ld * matrixTypeSizes[f->header.type];
+    size_t first = (size_t)f->header.offset + row_bytes * row0;
+    size_t last = first + row_bytes * rows;
+    *begin = first / MATRIX_FILE_PAGE * MATRIX_FILE_PAGE;
+    *length = last - *begin;
+}
+
+/**
+ * @brief Starts reading rows row0..row0+rows into the page cache in the background and returns immediately.
+ */
+void matrixFilePrefetch(const matrix_file_t *f, int row0, int rows) {
+    if (rows <= 0)
+        return;
+    size_t begin, length;
+    matrixFileRange(f, row0, rows, &begin, &length);
+    madvise(f->map + begin, length, MADV_WILLNEED);
+}
+
+/**
+ * @brief Drops rows row0..row0+rows from memory once they are no longer needed. Written rows are queued for
+ * writeback first (msync MS_ASYNC) and then unmapped like read ones: the dirty pages stay in the page cache until
+ * they are written, so nothing is lost, and they are dropped from the cache once they are clean.
+ */
+void matrixFileRelease(const matrix_file_t *f, int row0, int rows) {
+    if (rows <= 0)
+        return;
+    size_t begin, length;
+    matrixFileRange(f, row0, rows, &begin, &length);
+    // the first and last pages may be shared with the neighbouring tiles, which are dropped with them
+    if (f->writable)
+        msync(f->map + begin, length, MS_ASYNC);
+    madvise(f->map + begin, length, MADV_DONTNEED);
+    posix_fadvise(f->fd, (off_t)begin, (off_t)length, POSIX_FADV_DONTNEED);
+}
+
+/**
+ * @brief Out-of-core y = A * x for a mapped matrix file, one tile of rows at a time with the next tile prefetched.
+ * @details Every tile is read once and dropped after use, so the resident part of A stays at about two tiles
+ * however large the file is.
+ *
+ * @param A Matrix file
+ * @param x Input vector of A->header.cols elements of A's type
+ * @param y Output vector of A->header.rows elements of A's type
+ */
+void matrixFileGemv(const matrix_file_t *A, const void *x, void *y) {
+    PERF_BEGIN();
+    int rows = (int)A->header.rows, cols = (int)A->header.cols, tile = (int)A->header.tile_rows;
+    size_t element = matrixTypeSizes[A->header.type];
+    matrixFilePrefetch(A, 0, (rows < tile) ? rows : tile);
+    for (int i0 = 0; i0 < rows; i0 += tile) {
+        int ib = (rows - i0 < tile) ? rows - i0 : tile;
+        int next = (rows - i0 - ib < tile) ? rows - i0 - ib : tile;
+        matrixFilePrefetch(A, i0 + ib, next);
+        matrix_t panel = matrixView(&A->matrix, i0, 0, ib, cols);
+        matrixVectorMultiplyMatrix(&panel, x, (char *)y + element * i0);
+        matrixFileRelease(A, i0, ib);
+    }
+    PERF_END("matrixFileGemv", rows, cols, 1);
+}
+
+/**
+ * @brief Out-of-core C = A * B for mapped matrix files of the same type, C created writable with matrixFileCreate.
+ * @details C is computed one tile of rows at a time. For a tile of A (rows i0..i0+ta) the tiles of B are streamed
+ * in order, C_i += A_i,k B_k, with the next tile of B (or the next tile of A with the first tile of B) prefetched
+ * while the current product runs. Tiles of A and C are dropped after use; B is read once per tile of A and left to
+ * the page cache, so a B that fits in memory is only read from disk once.
+ *
+ * @return 0 on success, -1 if the shapes or types do not match
+ */
+int matrixFileGemm(const matrix_file_t *A, const matrix_file_t *B, matrix_file_t *C) {
+    int N = (int)A->header.rows, M = (int)A->header.cols, K = (int)B->header.cols;
+    if (B->header.rows != M || C->header.rows != N || C->header.cols != K || !C->writable
+        || A->header.type != B->header.type || A->header.type != C->header.type) {
+        fprintf(stderr, "Error: matrixFileGemm got incompatible matrix files!\n");
+        return -1;
+    }
+    PERF_BEGIN();
+    int ta = (int)A->header.tile_rows, tb = (int)B->header.tile_rows;
+    matrixFilePrefetch(A, 0, (N < ta) ? N : ta);
+    matrixFilePrefetch(B, 0, (M < tb) ? M : tb);
+    for (int i0 = 0; i0 < N; i0 += ta) {
+        int ib = (N - i0 < ta) ? N - i0 : ta;
+        matrix_t C_tile = matrixView(&C->matrix, i0, 0, ib, K);
+        if (M == 0)
+            memset(C_tile.data, 0, (size_t)ib * C_tile.ld * matrixTypeSizes[C_tile.type]);
+        for (int k0 = 0; k0 < M; k0 += tb) {
+            int kb = (M - k0 < tb) ? M - k0 : tb;
+            if (k0 + kb < M) {
+                matrixFilePrefetch(B, k0 + kb, (M - k0 - kb < tb) ? M - k0 - kb : tb);
+            } else if (i0 + ib < N) {
+                matrixFilePrefetch(A, i0 + ib, (N - i0 - ib < ta) ? N - i0 - ib : ta);
+                matrixFilePrefetch(B, 0, (M < tb) ? M : tb);
+            }
+            matrix_t A_block = matrixView(&A->matrix, i0, k0, ib, kb);
+            matrix_t B_tile = matrixView(&B->matrix, k0, 0, kb, K);
+            matrixMultiplyAccumulateMatrix(&A_block, &B_tile, k0 > 0, &C_tile);
+        }
+        matrixFileRelease(A, i0, ib);
+        matrixFileRelease(C, i0, ib);
+    }
+    PERF_END("matrixFileGemm", N, M, K);
+    return 0;
+}
+
+#endif
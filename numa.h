@@ -0,0 +1,317 @@
+/**
+ * @file numa.h
+ * @author Navid Shamszadeh
+ * @brief NUMA-aware allocation, first-touch placement matching the partitioning of the threaded kernels, and
+ * thread-to-core pinning.
+ * @details Linux places a page on the node of the thread that first writes it. Inputs filled serially by the main
+ * thread therefore all live on one socket, and every other socket reads them across the interconnect. numaAlloc
+ * returns untouched pages, and numaPlace decides where they go before the data is written:
+ *   - NUMA_OFF: touched serially by the calling thread (what a plain malloc plus serial fill does),
+ *   - NUMA_FIRST_TOUCH: touched in parallel, each part by the thread that threads.h gives it to,
+ *   - NUMA_BIND: the same parts, each bound explicitly with mbind to the node its thread runs on,
+ *   - NUMA_INTERLEAVE: pages spread round robin over all nodes, for data without a fixed owner.
+ * Filling the data afterwards, even serially, leaves the pages where they are. The parts match the kernels only
+ * with the static schedule (NLA_SCHEDULE=static, the default) and with threads that do not migrate, hence the
+ * pinning: NLA_PIN=compact fills the cores in order, NLA_PIN=scatter alternates between nodes, and an explicit list
+ * such as NLA_PIN=0,2,4-7 pins thread t to the t-th CPU listed. NLA_NUMA sets by name the policy numaPlace
+ * applies for NUMA_DEFAULT (off unless set).
+ * mbind, getcpu and the affinity calls go straight to the system calls, so there is no libnuma dependency.
+ * @date 2021-05-23
+ */
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "threads.h"
+
+// largest CPU and node numbers handled
+#define NUMA_MAX_CPUS 1024
+#define NUMA_MAX_NODES 64
+
+typedef enum {
+    NUMA_DEFAULT = -1, // numaConfig.policy, set by NLA_NUMA
+    NUMA_OFF = 0,
+    NUMA_FIRST_TOUCH,
+    NUMA_BIND,
+    NUMA_INTERLEAVE
+} numa_policy_t;
+
+const char *numaPolicyNames[] = {"off", "firsttouch", "bind", "interleave"};
+
+/**
+ * @brief Placement policy, node count and the CPUs threads are pinned to.
+ */
+typedef struct {
+    numa_policy_t policy;       // default policy of numaPlace
+    int nodes;                  // NUMA nodes online
+    int pinned;                 // number of CPUs in cpus, 0 if threads are not pinned
+    int cpus[NUMA_MAX_CPUS];    // thread t runs on cpus[t % pinned]
+} numa_config_t;
+
+numa_config_t numaConfig = {NUMA_OFF, 1, 0, {0}};
+
+/**
+ * @brief Parses a CPU list such as "0,2,4-7" into cpus.
+ *
+ * @return Number of CPUs parsed
+ */
+int numaParseList(const char *list, int *cpus, int capacity) {
+    int count = 0;
+    for (const char *p = list; p != NULL && *p && count < capacity; ) {
+        char *end;
+        long int first = strtol(p, &end, 10), last = first;
+        if (end == p)
+            break;
+        if (*end == '-')
+            last = strtol(end + 1, &end, 10);
+        for (long int c = first; c <= last && count < capacity; c++) {
+            if (c >= 0 && c < NUMA_MAX_CPUS)
+                cpus[count++] = (int)c;
+        }
+        p = (*end == ',') ? end + 1 : NULL;
+    }
+    return count;
+}
+
+/**
+ * @brief Node of each CPU, from the cpulist files of /sys/devices/system/node; -1 for CPUs not listed.
+ *
+ * @param node_of Output array of NUMA_MAX_CPUS entries
+ * @return Number of nodes found, at least 1
+ */
+int numaTopology(int *node_of) {
+    int nodes = 0;
+    for (int c = 0; c < NUMA_MAX_CPUS; c++) {
+        node_of[c] = -1;
+    }
+    for (int node = 0; node < NUMA_MAX_NODES; node++) {
+        char path[96], list[4096];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *file = fopen(path, "r");
+        if (file == NULL)
+            continue;
+        int cpus[NUMA_MAX_CPUS];
+        int count = (fgets(list, sizeof(list), file) != NULL) ? numaParseList(list, cpus, NUMA_MAX_CPUS) : 0;
+        fclose(file);
+        for (int i = 0; i < count; i++) {
+            node_of[cpus[i]] = node;
+        }
+        nodes = node + 1;
+    }
+    return (nodes > 0) ? nodes : 1;
+}
+
+/**
+ * @brief Pins the calling thread to one CPU.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int numaPinSelf(int cpu) {
+    unsigned long int mask[NUMA_MAX_CPUS / (8 * sizeof(unsigned long int))] = {0};
+    mask[cpu / (8 * sizeof(unsigned long int))] = 1UL << (cpu % (8 * sizeof(unsigned long int)));
+    return syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Chooses the CPUs for the threads and pins the threads of the OpenMP pool to them.
+ * @details The candidates are the CPUs the process may run on. "compact" takes them in order, "scatter" takes one
+ * per node in turn so consecutive threads land on different sockets, anything else is read as a CPU list. "none"
+ * (or NULL) leaves the threads unpinned.
+ *
+ * @param spec none, compact, scatter or a CPU list
+ * @return Number of threads pinned, 0 if none were
+ */
+int numaPinThreads(const char *spec) {
+    numaConfig.pinned = 0;
+    if (spec == NULL || spec[0] == '\0' || strcmp(spec, "none") == 0)
+        return 0;
+    unsigned long int mask[NUMA_MAX_CPUS / (8 * sizeof(unsigned long int))] = {0};
+    if (syscall(SYS_sched_getaffinity, 0, sizeof(mask), mask) < 0)
+        return 0;
+    int allowed[NUMA_MAX_CPUS], count = 0;
+    for (int c = 0; c < NUMA_MAX_CPUS; c++) {
+        if (mask[c / (8 * sizeof(unsigned long int))] & (1UL << (c % (8 * sizeof(unsigned long int)))))
+            allowed[count++] = c;
+    }
+    if (strcmp(spec, "compact") == 0) {
+        memcpy(numaConfig.cpus, allowed, count * sizeof(int));
+        numaConfig.pinned = count;
+    } else if (strcmp(spec, "scatter") == 0) {
+        int node_of[NUMA_MAX_CPUS], taken[NUMA_MAX_CPUS] = {0};
+        int nodes = numaTopology(node_of);
+        while (numaConfig.pinned < count) {
+            // one CPU from every node that still has a free one
+            for (int node = -1; node < nodes; node++) {
+                for (int i = 0; i < count; i++) {
+                    if (!taken[i] && node_of[allowed[i]] == node) {
+                        taken[i] = 1;
+                        numaConfig.cpus[numaConfig.pinned++] = allowed[i];
+                        break;
+                    }
+                }
+            }
+        }
+    } else {
+        numaConfig.pinned = numaParseList(spec, numaConfig.cpus, NUMA_MAX_CPUS);
+    }
+    if (numaConfig.pinned == 0)
+        return 0;
+
+    int pinned = 0;
+    int threads = threadsConfig.count;
+    #pragma omp parallel num_threads(threads) reduction(+ : pinned)
+    {
+        int t = 0;
+#ifdef _OPENMP
+        t = omp_get_thread_num();
+#endif
+        pinned += (numaPinSelf(numaConfig.cpus[t % numaConfig.pinned]) == 0);
+    }
+    return pinned;
+}
+
+/**
+ * @brief Allocates bytes of page-aligned memory whose pages are not yet placed on any node.
+ *
+ * @return The memory, or NULL on failure; release it with numaFree
+ */
+void *numaAlloc(size_t bytes) {
+    void *data = mmap(NULL, bytes > 0 ? bytes : 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return (data == MAP_FAILED) ? NULL : data;
+}
+
+/**
+ * @brief Releases memory from numaAlloc.
+ */
+void numaFree(void *data, size_t bytes) {
+    if (data != NULL)
+        munmap(data, bytes > 0 ? bytes : 1);
+}
+
+/**
+ * @brief Node the calling thread runs on.
+ */
+int numaCurrentNode(void) {
+    unsigned int cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+        return 0;
+    return (int)node;
+}
+
+/**
+ * @brief Places the pages of data (from numaAlloc) and zeroes them.
+ * @details The data is seen as units of unit_bytes (rows of a matrix, say) cut into chunks exactly like the
+ * threaded kernel does it, so with NUMA_FIRST_TOUCH and NUMA_BIND the thread that will work on a chunk is the one
+ * whose node holds it. A page shared by two chunks goes with the chunk that starts in it.
+ *
+ * @param data Memory from numaAlloc
+ * @param units Number of work units the kernel partitions
+ * @param unit_bytes Bytes per unit
+ * @param kernel Kernel whose partitioning and thread count to follow
+ * @param policy Placement policy, NUMA_DEFAULT for the one NLA_NUMA selects
+ * @return 0 on success, -1 if mbind failed (the pages are still zeroed, first touch decides where they are)
+ */
+int numaPlace(void *data, long int units, size_t unit_bytes, tune_kernel_t kernel, numa_policy_t policy) {
+    if (policy == NUMA_DEFAULT)
+        policy = numaConfig.policy;
+    char *bytes = (char *)data;
+    size_t total = (size_t)units * unit_bytes;
+    long int page = sysconf(_SC_PAGESIZE);
+    int status = 0;
+    if (policy == NUMA_OFF || policy == NUMA_INTERLEAVE) {
+        if (policy == NUMA_INTERLEAVE) {
+            unsigned long int nodes[NUMA_MAX_NODES / (8 * sizeof(unsigned long int)) + 1] = {0};
+            for (int node = 0; node < numaConfig.nodes; node++) {
+                nodes[node / (8 * sizeof(unsigned long int))] |= 1UL << (node % (8 * sizeof(unsigned long int)));
+            }
+            if (syscall(SYS_mbind, bytes, total, MPOL_INTERLEAVE, nodes, NUMA_MAX_NODES, 0) != 0)
+                status = -1;
+        }
+        memset(bytes, 0, total);
+        return status;
+    }
+
+    int threads = threadsForKernel(kernel, units);
+    long int chunks = threadsChunks(threads, units);
+    long int next = 0;
+    #pragma omp parallel num_threads(threads) if (threads > 1) reduction(min : status)
+    {
+        long int step = 0;
+        for (long int ch; (ch = threadsNextChunk(&next, &step, chunks)) >= 0; ) {
+            size_t begin = (size_t)threadsChunkStart(units, chunks, ch) * unit_bytes;
+            size_t end = (size_t)threadsChunkStart(units, chunks, ch + 1) * unit_bytes;
+            if (policy == NUMA_BIND) {
+                // whole pages from the first one starting in the chunk to the first one starting after it
+                size_t first = (begin + page - 1) / page * page, last = (end + page - 1) / page * page;
+                if (last > first) {
+                    int node = numaCurrentNode();
+                    unsigned long int nodes[NUMA_MAX_NODES / (8 * sizeof(unsigned long int)) + 1] = {0};
+                    nodes[node / (8 * sizeof(unsigned long int))] = 1UL << (node % (8 * sizeof(unsigned long int)));
+                    if (syscall(SYS_mbind, bytes + first, last - first, MPOL_BIND, nodes, NUMA_MAX_NODES, MPOL_MF_MOVE) != 0)
+                        status = -1;
+                }
+            }
+            memset(bytes + begin, 0, end - begin);
+        }
+    }
+    return status;
+}
+
+/**
+ * @brief Counts on which node the pages of data currently are, looking at up to 4096 pages spread evenly.
+ *
+ * @param data Memory to inspect
+ * @param bytes Size of data
+ * @param counts Output of NUMA_MAX_NODES page counts
+ * @return Number of pages inspected, 0 if the kernel could not tell
+ */
+long int numaPageNodes(const void *data, size_t bytes, long int *counts) {
+    long int page = sysconf(_SC_PAGESIZE);
+    long int pages = (long int)((bytes + page - 1) / page);
+    long int samples = (pages < 4096) ? pages : 4096;
+    void *addresses[4096];
+    int status[4096];
+    memset(counts, 0, NUMA_MAX_NODES * sizeof(long int));
+    const char *base = (const char *)((size_t)data / page * page);
+    for (long int s = 0; s < samples; s++) {
+        addresses[s] = (void *)(base + pages * s / samples * page);
+    }
+    if (samples == 0 || syscall(SYS_move_pages, 0, samples, addresses, NULL, status, 0) != 0)
+        return 0;
+    long int counted = 0;
+    for (long int s = 0; s < samples; s++) {
+        if (status[s] >= 0 && status[s] < NUMA_MAX_NODES) {
+            counts[status[s]]++;
+            counted++;
+        }
+    }
+    return counted;
+}
+
+/**
+ * @brief Reads NLA_NUMA (default placement policy) and NLA_PIN (thread pinning). Runs automatically before main,
+ * after threadsInit.
+ */
+__attribute__((constructor(105))) void numaInit(void) {
+    int node_of[NUMA_MAX_CPUS];
+    numaConfig.nodes = numaTopology(node_of);
+    const char *policy = getenv("NLA_NUMA");
+    int found = 0;
+    for (int p = NUMA_OFF; policy != NULL && p <= NUMA_INTERLEAVE; p++) {
+        if (strcmp(policy, numaPolicyNames[p]) == 0) {
+            numaConfig.policy = (numa_policy_t)p;
+            found = 1;
+        }
+    }
+    if (policy != NULL && !found)
+        fprintf(stderr, "Warning: unknown NLA_NUMA policy %s, using %s!\n", policy, numaPolicyNames[numaConfig.policy]);
+    numaPinThreads(getenv("NLA_PIN"));
+}
+
+#endif
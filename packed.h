@@ -0,0 +1,104 @@
+/**
+ * @file packed.h
+ * @author Navid Shamszadeh
+ * @brief Packed and rectangular full packed (RFP) storage for triangular and symmetric matrices, conversions from
+ * and to strided matrices, and triangular solve and multiply kernels working on the packed forms.
+ * @details Both formats keep only one triangle, N (N + 1) / 2 elements instead of N * N, so the bandwidth bound
+ * matrix-vector kernels move half the bytes.
+ *
+ * Packed storage lists the rows of the triangle one after another (row-major like the rest of the repo): row i of
+ * an upper triangle holds columns i..N-1 and starts at i N - i (i - 1) / 2, row i of a lower triangle holds columns
+ * 0..i and starts at i (i + 1) / 2. Every row is contiguous, so the TRSV, TRMV and symmetric matrix-vector kernels
+ * run along unit-stride rows; they are generated from packedTemplate.h for double and float (suffixes Double and
+ * Float).
+ *
+ * RFP storage rearranges the same elements into a rectangle so that the blocks of the triangle are ordinary strided
+ * matrices and the level 3 kernels of kernels.h apply to them. With n1 = N / 2, n2 = N - n1 and the lower triangle
+ * L = [L11 0; L21 L22], the rectangle has n2 columns and holds L11^T (upper, n1 x n1) and L22 (lower, n2 x n2)
+ * interleaved in its top n1 + 1 rows, followed by L21^T (n1 x n2). An upper triangle U is stored as the RFP of
+ * L = U^T, which puts U11 and U12 in the rectangle as they are. The rectangle has N + 1 rows for even N and N rows
+ * for odd N, N (N + 1) / 2 elements either way. rfpTriangularSolve solves with many right-hand sides through two
+ * blocked triangular solves and one GEMM.
+ * @date 2021-05-23
+ */
+#ifndef PACKED_H
+#define PACKED_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "kernels.h"
+#include "perf.h"
+
+// rows of the off-diagonal RFP block transposed at a time when a solve needs it the other way round
+#define PACKED_RFP_PANEL 64
+
+/**
+ * @brief What unpacking writes to the triangle that is not stored.
+ */
+typedef enum {
+    PACKED_KEEP = 0, // leave it untouched
+    PACKED_ZERO,     // zero it (triangular matrices)
+    PACKED_MIRROR    // copy the stored triangle into it (symmetric matrices)
+} packed_fill_t;
+
+/**
+ * @brief Number of elements of packed or RFP storage of an N x N triangle.
+ */
+static inline long int packedSize(int N) {
+    return (long int)N * (N + 1) / 2;
+}
+
+/**
+ * @brief Offset of element (i, j) of the stored triangle in packed storage (j >= i for upper, j <= i for lower).
+ */
+static inline long int packedIndex(int N, int lower, int i, int j) {
+    return lower ? (long int)i * (i + 1) / 2 + j : (long int)i * N - (long int)i * (i - 1) / 2 + (j - i);
+}
+
+/**
+ * @brief Block layout of an RFP rectangle, see the file description.
+ */
+typedef struct {
+    int n1;       // order of the leading diagonal block L11
+    int n2;       // order of the trailing diagonal block L22, also the row stride of the rectangle
+    long int a11; // offset of L11^T, an upper triangle with row stride n2
+    long int a22; // offset of L22, a lower triangle with row stride n2
+    long int a21; // offset of L21^T, an n1 x n2 block with row stride n2
+} rfp_layout_t;
+
+/**
+ * @brief Layout of the RFP rectangle of an N x N triangle.
+ */
+static inline rfp_layout_t rfpLayout(int N) {
+    rfp_layout_t layout;
+    layout.n1 = N / 2;
+    layout.n2 = N - layout.n1;
+    // odd N: L22 fills the lower triangle of the n2 x n2 square, L11^T its strict upper one shifted right by one
+    // even N: L11^T fills the upper triangle of the top n1 rows, L22 the strict lower one shifted down by one
+    layout.a11 = layout.n2 - layout.n1;
+    layout.a22 = (long int)(layout.n1 + 1 - layout.n2) * layout.n2;
+    layout.a21 = (long int)(layout.n1 + 1) * layout.n2;
+    return layout;
+}
+
+/**
+ * @brief Offset of element (i, j), i >= j, of a lower triangle in its RFP rectangle; element (j, i) of an upper
+ * triangle is at the same offset.
+ */
+static inline long int rfpIndex(rfp_layout_t layout, int i, int j) {
+    if (i < layout.n1)
+        return layout.a11 + (long int)layout.n2 * j + i;
+    if (j >= layout.n1)
+        return layout.a22 + (long int)layout.n2 * (i - layout.n1) + (j - layout.n1);
+    return layout.a21 + (long int)layout.n2 * j + (i - layout.n1);
+}
+
+#define PACKED_T double
+#define PACKED_NAME(x) x##Double
+#include "packedTemplate.h"
+
+#define PACKED_T float
+#define PACKED_NAME(x) x##Float
+#include "packedTemplate.h"
+
+#endif
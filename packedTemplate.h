@@ -0,0 +1,294 @@
+/**
+ * @file packedTemplate.h
+ * @author Navid Shamszadeh
+ * @brief Type-generic conversions and kernels for packed and RFP triangular and symmetric storage, included by
+ * packed.h once per element type.
+ * @details Before including, define PACKED_T as the element type (double or float) and PACKED_NAME(x) to append the
+ * type's suffix to a function name, which must match the suffixes of kernels.h. Both are undefined again at the end
+ * of this file. The kernels report to perf.h under their suffixed names (packedTriangularSolveFloat, ...).
+ * @date 2021-05-23
+ */
+
+/**
+ * @brief Dot product of two contiguous vectors with KERNEL_LANES partial sums, so it vectorizes without reordering
+ * a floating point reduction.
+ */
+static inline __attribute__((always_inline)) PACKED_T PACKED_NAME(packedDot)(int n, const PACKED_T *a, const PACKED_T *x) {
+    PACKED_T s[KERNEL_LANES] = {0};
+    int j = 0;
+    for (; j + KERNEL_LANES <= n; j += KERNEL_LANES) {
+        for (int l = 0; l < KERNEL_LANES; l++) {
+            s[l] += a[j + l] * x[j + l];
+        }
+    }
+    PACKED_T t = 0;
+    for (int l = 0; l < KERNEL_LANES; l++) {
+        t += s[l];
+    }
+    for (; j < n; j++) {
+        t += a[j] * x[j];
+    }
+    return t;
+}
+
+/**
+ * @brief y[j] += t * a[j] for 0 <= j < n.
+ */
+static inline __attribute__((always_inline)) void PACKED_NAME(packedAxpy)(int n, PACKED_T t, const PACKED_T *a, PACKED_T *y) {
+    for (int j = 0; j < n; j++) {
+        y[j] += t * a[j];
+    }
+}
+
+/**
+ * @brief Packs one triangle of a strided N x N matrix.
+ *
+ * @param N Order of A
+ * @param lower Nonzero to pack the lower triangle, zero for the upper one
+ * @param A Matrix with row stride lda, the other triangle is not referenced
+ * @param lda Leading dimension of A
+ * @param AP Output of packedSize(N) elements
+ */
+void PACKED_NAME(packedFromStrided)(int N, int lower, const PACKED_T *A, int lda, PACKED_T *AP) {
+    for (int i = 0; i < N; i++) {
+        int j0 = lower ? 0 : i;
+        int length = lower ? i + 1 : N - i;
+        memcpy(AP + packedIndex(N, lower, i, j0), A + j0 + (long int)lda * i, length * sizeof(PACKED_T));
+    }
+}
+
+/**
+ * @brief Unpacks a packed triangle into a strided N x N matrix.
+ *
+ * @param N Order of A
+ * @param lower Nonzero if AP holds a lower triangle, zero for an upper one
+ * @param fill What to write to the other triangle of A
+ * @param AP Packed triangle
+ * @param A Output matrix with row stride lda
+ * @param lda Leading dimension of A
+ */
+void PACKED_NAME(packedToStrided)(int N, int lower, packed_fill_t fill, const PACKED_T *AP, PACKED_T *A, int lda) {
+    for (int i = 0; i < N; i++) {
+        int j0 = lower ? 0 : i;
+        int length = lower ? i + 1 : N - i;
+        PACKED_T *row = A + (long int)lda * i;
+        memcpy(row + j0, AP + packedIndex(N, lower, i, j0), length * sizeof(PACKED_T));
+        for (int j = lower ? i + 1 : 0; fill != PACKED_KEEP && j < (lower ? N : i); j++) {
+            row[j] = (fill == PACKED_ZERO) ? 0 : AP[packedIndex(N, lower, j, i)];
+        }
+    }
+}
+
+/**
+ * @brief Packed triangular solve op(T) x = b (TRSV), x overwritten in place.
+ * @details Solves that need a row of T against the solved part of x take a dot product along it; the transposed
+ * ones subtract each solved entry times its row from the rest of x. Either way the packed rows are read with unit
+ * stride, once.
+ *
+ * @param N Order of T
+ * @param lower Nonzero if T is lower triangular, zero if upper triangular
+ * @param transpose Nonzero to solve with T^T instead of T
+ * @param unit_diagonal Nonzero if the diagonal of T is implicitly one
+ * @param TP Packed triangle
+ * @param x Right-hand side of N elements, overwritten with the solution
+ */
+void PACKED_NAME(packedTriangularSolve)(int N, int lower, int transpose, int unit_diagonal, const PACKED_T *TP, PACKED_T *x) {
+    PERF_BEGIN();
+    if (!lower && !transpose) {
+        for (int i = N - 1; i >= 0; i--) {
+            const PACKED_T *row = TP + packedIndex(N, 0, i, i);
+            x[i] -= PACKED_NAME(packedDot)(N - i - 1, row + 1, x + i + 1);
+            if (!unit_diagonal)
+                x[i] /= row[0];
+        }
+    } else if (!lower) {
+        for (int i = 0; i < N; i++) {
+            const PACKED_T *row = TP + packedIndex(N, 0, i, i);
+            if (!unit_diagonal)
+                x[i] /= row[0];
+            PACKED_NAME(packedAxpy)(N - i - 1, -x[i], row + 1, x + i + 1);
+        }
+    } else if (!transpose) {
+        for (int i = 0; i < N; i++) {
+            const PACKED_T *row = TP + packedIndex(N, 1, i, 0);
+            x[i] -= PACKED_NAME(packedDot)(i, row, x);
+            if (!unit_diagonal)
+                x[i] /= row[i];
+        }
+    } else {
+        for (int i = N - 1; i >= 0; i--) {
+            const PACKED_T *row = TP + packedIndex(N, 1, i, 0);
+            if (!unit_diagonal)
+                x[i] /= row[i];
+            PACKED_NAME(packedAxpy)(i, -x[i], row, x);
+        }
+    }
+    PERF_END(__func__, N, 1, 1);
+}
+
+/**
+ * @brief Packed triangular multiply x = op(T) x (TRMV), in place.
+ * @details The rows are visited in the order that leaves every entry of x still needed unchanged. Parameters as for
+ * packedTriangularSolve.
+ */
+void PACKED_NAME(packedTriangularMultiply)(int N, int lower, int transpose, int unit_diagonal, const PACKED_T *TP, PACKED_T *x) {
+    PERF_BEGIN();
+    if (!lower && !transpose) {
+        for (int i = 0; i < N; i++) {
+            const PACKED_T *row = TP + packedIndex(N, 0, i, i);
+            x[i] = (unit_diagonal ? x[i] : row[0] * x[i]) + PACKED_NAME(packedDot)(N - i - 1, row + 1, x + i + 1);
+        }
+    } else if (!lower) {
+        for (int i = N - 1; i >= 0; i--) {
+            const PACKED_T *row = TP + packedIndex(N, 0, i, i);
+            PACKED_T t = x[i];
+            if (!unit_diagonal)
+                x[i] *= row[0];
+            PACKED_NAME(packedAxpy)(N - i - 1, t, row + 1, x + i + 1);
+        }
+    } else if (!transpose) {
+        for (int i = N - 1; i >= 0; i--) {
+            const PACKED_T *row = TP + packedIndex(N, 1, i, 0);
+            x[i] = (unit_diagonal ? x[i] : row[i] * x[i]) + PACKED_NAME(packedDot)(i, row, x);
+        }
+    } else {
+        for (int i = 0; i < N; i++) {
+            const PACKED_T *row = TP + packedIndex(N, 1, i, 0);
+            PACKED_T t = x[i];
+            if (!unit_diagonal)
+                x[i] *= row[i];
+            PACKED_NAME(packedAxpy)(i, t, row, x);
+        }
+    }
+    PERF_END(__func__, N, 1, 1);
+}
+
+/**
+ * @brief Symmetric matrix-vector product y = A x with A in packed storage (SPMV).
+ * @details Each stored row contributes once as a row (dot product) and once as a column (axpy), so the packed
+ * triangle is read once.
+ *
+ * @param N Order of A
+ * @param lower Nonzero if AP holds the lower triangle, zero for the upper one
+ * @param AP Packed triangle of A
+ * @param x Input vector of N elements
+ * @param y Output vector of N elements, must not alias x
+ */
+void PACKED_NAME(packedSymmetricMultiply)(int N, int lower, const PACKED_T *AP, const PACKED_T *x, PACKED_T *y) {
+    PERF_BEGIN();
+    memset(y, 0, N * sizeof(PACKED_T));
+    for (int i = 0; i < N; i++) {
+        // off-diagonal part of row i: columns i+1..N-1 (upper) or 0..i-1 (lower)
+        const PACKED_T *row = AP + packedIndex(N, lower, i, lower ? 0 : i);
+        const PACKED_T *off = lower ? row : row + 1;
+        int j0 = lower ? 0 : i + 1;
+        int length = lower ? i : N - i - 1;
+        y[i] += (lower ? row[i] : row[0]) * x[i] + PACKED_NAME(packedDot)(length, off, x + j0);
+        PACKED_NAME(packedAxpy)(length, x[i], off, y + j0);
+    }
+    PERF_END(__func__, N, 1, 1);
+}
+
+/**
+ * @brief Stores one triangle of a strided N x N matrix in RFP format.
+ *
+ * @param N Order of A
+ * @param lower Nonzero to store the lower triangle, zero for the upper one
+ * @param A Matrix with row stride lda, the other triangle is not referenced
+ * @param lda Leading dimension of A
+ * @param R Output rectangle of packedSize(N) elements
+ */
+void PACKED_NAME(rfpFromStrided)(int N, int lower, const PACKED_T *A, int lda, PACKED_T *R) {
+    rfp_layout_t layout = rfpLayout(N);
+    for (int i = 0; i < N; i++) {
+        const PACKED_T *row = A + (long int)lda * i;
+        for (int j = lower ? 0 : i; j < (lower ? i + 1 : N); j++) {
+            // the RFP of an upper triangle is that of its transpose
+            R[lower ? rfpIndex(layout, i, j) : rfpIndex(layout, j, i)] = row[j];
+        }
+    }
+}
+
+/**
+ * @brief Unpacks an RFP triangle into a strided N x N matrix.
+ *
+ * @param N Order of A
+ * @param lower Nonzero if R holds a lower triangle, zero for an upper one
+ * @param fill What to write to the other triangle of A
+ * @param R RFP rectangle
+ * @param A Output matrix with row stride lda
+ * @param lda Leading dimension of A
+ */
+void PACKED_NAME(rfpToStrided)(int N, int lower, packed_fill_t fill, const PACKED_T *R, PACKED_T *A, int lda) {
+    rfp_layout_t layout = rfpLayout(N);
+    for (int i = 0; i < N; i++) {
+        PACKED_T *row = A + (long int)lda * i;
+        for (int j = 0; j < N; j++) {
+            int stored = lower ? j <= i : j >= i;
+            if (stored || fill == PACKED_MIRROR)
+                row[j] = R[(i >= j) ? rfpIndex(layout, i, j) : rfpIndex(layout, j, i)];
+            else if (fill == PACKED_ZERO)
+                row[j] = 0;
+        }
+    }
+}
+
+/**
+ * @brief Triangular solve op(T) X = B with many right-hand sides and T in RFP format (TRSM).
+ * @details With T = L = [L11 0; L21 L22] (or T = U = L^T), a solve with L runs L11 X1 = B1, B2 -= L21 X1 and
+ * L22 X2 = B2; a solve with L^T runs the same steps backwards with the transposed blocks. The diagonal blocks are
+ * strided triangles of the rectangle and go to the blocked triangularSolveStrided, the update goes to gemmGeneral,
+ * so RFP runs at the speed of full storage with half the memory. L21 is stored transposed, so the forward update
+ * transposes it PACKED_RFP_PANEL rows at a time into a scratch panel.
+ *
+ * @param N Order of T and number of rows of B
+ * @param nrhs Number of right-hand sides
+ * @param lower Nonzero if R holds a lower triangle, zero for an upper one
+ * @param transpose Nonzero to solve with T^T instead of T
+ * @param unit_diagonal Nonzero if the diagonal of T is implicitly one
+ * @param R RFP rectangle of T
+ * @param B Right-hand sides with row stride ldb, overwritten with X
+ * @param ldb Leading dimension of B
+ * @return 0 on success, -1 if the scratch panel could not be allocated
+ */
+int PACKED_NAME(rfpTriangularSolve)(int N, int nrhs, int lower, int transpose, int unit_diagonal, const PACKED_T *R, PACKED_T *B, int ldb) {
+    rfp_layout_t layout = rfpLayout(N);
+    int n1 = layout.n1, n2 = layout.n2;
+    const PACKED_T *L11t = R + layout.a11, *L22 = R + layout.a22, *L21t = R + layout.a21;
+    PACKED_T *B1 = B, *B2 = B + (long int)ldb * n1;
+    if (N <= 0)
+        return 0;
+    PERF_BEGIN();
+
+    if ((lower != 0) != (transpose != 0)) {
+        // L X = B
+        PACKED_NAME(triangularSolveStrided)(n1, nrhs, 0, 1, unit_diagonal, L11t, n2, B1, ldb);
+        if (n1 > 0) {
+            int rows = (n2 < PACKED_RFP_PANEL) ? n2 : PACKED_RFP_PANEL;
+            PACKED_T *panel = (PACKED_T *)malloc((size_t)rows * n1 * sizeof(PACKED_T));
+            if (panel == NULL) {
+                PERF_END(__func__, N, nrhs, 1);
+                return -1;
+            }
+            for (int r0 = 0; r0 < n2; r0 += rows) {
+                int nr = (n2 - r0 < rows) ? n2 - r0 : rows;
+                // rows r0..r0+nr of L21 are columns r0..r0+nr of L21^T
+                PACKED_NAME(transposeStrided)(n1, nr, L21t + r0, n2, panel, n1);
+                PACKED_NAME(gemmGeneral)(nr, n1, nrhs, -1, panel, n1, B1, ldb, 1, B2 + (long int)ldb * r0, ldb);
+            }
+            free(panel);
+        }
+        PACKED_NAME(triangularSolveStrided)(n2, nrhs, 1, 0, unit_diagonal, L22, n2, B2, ldb);
+    } else {
+        // L^T X = B
+        PACKED_NAME(triangularSolveStrided)(n2, nrhs, 1, 1, unit_diagonal, L22, n2, B2, ldb);
+        if (n1 > 0)
+            PACKED_NAME(gemmGeneral)(n1, n2, nrhs, -1, L21t, n2, B2, ldb, 1, B1, ldb);
+        PACKED_NAME(triangularSolveStrided)(n1, nrhs, 0, 0, unit_diagonal, L11t, n2, B1, ldb);
+    }
+    PERF_END(__func__, N, nrhs, 1);
+    return 0;
+}
+
+#undef PACKED_T
+#undef PACKED_NAME
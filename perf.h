@@ -0,0 +1,337 @@
+/**
+ * @file perf.h
+ * @author Navid Shamszadeh
+ * @brief Optional hardware performance counter instrumentation of the kernels with Linux perf_event_open: cycles,
+ * instructions, L1 data cache misses, last level cache misses and floating point operations per call, aggregated
+ * per kernel name and problem size.
+ * @details Off unless the environment variable NLA_PERF is set (to text, csv or json, or anything else for text),
+ * in which case the counters are opened before main and the aggregated table is written to stderr at exit.
+ * perfEnable and perfReport do the same from code. An instrumented kernel brackets its body with PERF_BEGIN and
+ * PERF_END; when instrumentation is off that costs one well-predicted branch per call, and building with
+ * -DNLA_NO_PERF removes it altogether.
+ *
+ * The counters follow the whole process: they are opened with inherit set before the OpenMP threads exist, so the
+ * threaded kernels are counted across all their threads. Nested instrumented calls (e.g. matrixMultiplyMatrix
+ * running parallelGemm) are each recorded, inclusive of what they call. When more events are requested than the
+ * PMU has counters the kernel multiplexes them and the counts are scaled by the fraction of time each was running.
+ * FLOPs come from the FP_ARITH_INST_RETIRED events (Intel since Broadwell, each weighted by its vector width, an
+ * FMA counting twice); on other CPUs, in virtual machines without a virtual PMU, or when perf_event_paranoid forbids
+ * it, the affected columns are reported as unavailable and only calls and time are recorded.
+ * @date 2021-05-22
+ */
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// distinct (kernel, size) entries the aggregation table holds; later ones are counted as dropped
+#define PERF_MAX_ENTRIES 256
+// most perf events open at once: four plain counters and the eight FLOP events
+#define PERF_MAX_FDS 12
+
+typedef enum {
+    PERF_CYCLES = 0,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_FLOPS,
+    PERF_EVENTS
+} perf_event_t;
+
+typedef enum {
+    PERF_TEXT = 0,
+    PERF_CSV,
+    PERF_JSON
+} perf_format_t;
+
+const char *perfEventNames[PERF_EVENTS] = {"cycles", "instructions", "l1d_misses", "llc_misses", "flops"};
+
+/**
+ * @brief Counters read at the start of an instrumented call.
+ */
+typedef struct {
+    int valid;
+    double time;
+    unsigned long long raw[PERF_MAX_FDS][3]; // value, time enabled, time running
+} perf_sample_t;
+
+/**
+ * @brief Totals of one kernel at one problem size.
+ */
+typedef struct {
+    const char *kernel;
+    long int N, M, K;
+    long int calls;
+    double time;
+    double counts[PERF_EVENTS];
+} perf_entry_t;
+
+/**
+ * @brief Open events and the aggregation table.
+ */
+typedef struct {
+    int opened;
+    int fdCount;
+    int fd[PERF_MAX_FDS];
+    perf_event_t event[PERF_MAX_FDS]; // what each open event counts towards
+    double weight[PERF_MAX_FDS];      // operations per counted event (vector width for the FLOP events)
+    int available[PERF_EVENTS];
+    int entries;
+    long int dropped;
+    perf_entry_t table[PERF_MAX_ENTRIES];
+    perf_format_t format;
+} perf_state_t;
+
+int perfEnabled = 0;
+perf_state_t perfState;
+
+/**
+ * @brief Monotonic wall clock in seconds (the clock of benchmarkNow, without pulling in the benchmark harness).
+ */
+double perfNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+/**
+ * @brief Opens one counting event for the calling process and its future threads, -1 if it is not available.
+ */
+int perfOpen(unsigned int type, unsigned long long config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/**
+ * @brief Adds an event to the open set if the CPU and the kernel allow it.
+ */
+void perfAdd(unsigned int type, unsigned long long config, perf_event_t event, double weight) {
+    if (perfState.fdCount == PERF_MAX_FDS)
+        return;
+    int fd = perfOpen(type, config);
+    if (fd < 0)
+        return;
+    perfState.fd[perfState.fdCount] = fd;
+    perfState.event[perfState.fdCount] = event;
+    perfState.weight[perfState.fdCount] = weight;
+    perfState.fdCount++;
+    perfState.available[event] = 1;
+}
+
+/**
+ * @brief Turns instrumentation on or off. The first call that turns it on opens the counters; call it before the
+ * first parallel region so the OpenMP threads inherit them.
+ */
+void perfEnable(int on) {
+    if (on && !perfState.opened) {
+        perfState.opened = 1;
+        unsigned long long l1d = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        perfAdd(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, PERF_CYCLES, 1.0);
+        perfAdd(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, PERF_INSTRUCTIONS, 1.0);
+        perfAdd(PERF_TYPE_HW_CACHE, l1d, PERF_L1D_MISSES, 1.0);
+        perfAdd(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, PERF_LLC_MISSES, 1.0);
+        __builtin_cpu_init();
+        if (__builtin_cpu_is("intel")) {
+            // FP_ARITH_INST_RETIRED (event 0xc7): scalar double and single, 128, 256 and 512-bit double and single
+            const unsigned int umask[8] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80};
+            const double width[8] = {1, 1, 2, 4, 4, 8, 8, 16};
+            for (int i = 0; i < 8; i++) {
+                perfAdd(PERF_TYPE_RAW, 0xc7 | (umask[i] << 8), PERF_FLOPS, width[i]);
+            }
+            // all eight or none: a partial set would undercount
+            int flops = 0;
+            for (int f = 0; f < perfState.fdCount; f++) {
+                flops += (perfState.event[f] == PERF_FLOPS);
+            }
+            if (flops > 0 && flops < 8) {
+                perfState.fdCount -= flops;
+                for (int f = perfState.fdCount; f < perfState.fdCount + flops; f++) {
+                    close(perfState.fd[f]);
+                }
+                perfState.available[PERF_FLOPS] = 0;
+            }
+        }
+    }
+    for (int f = 0; f < perfState.fdCount; f++) {
+        ioctl(perfState.fd[f], on ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+    }
+    perfEnabled = on;
+}
+
+/**
+ * @brief Clears the aggregation table.
+ */
+void perfReset(void) {
+    perfState.entries = 0;
+    perfState.dropped = 0;
+}
+
+/**
+ * @brief Reads the counters at the start of an instrumented call.
+ */
+void perfBegin(perf_sample_t *s) {
+    for (int f = 0; f < perfState.fdCount; f++) {
+        if (read(perfState.fd[f], s->raw[f], sizeof(s->raw[f])) != sizeof(s->raw[f]))
+            memset(s->raw[f], 0, sizeof(s->raw[f]));
+    }
+    s->valid = 1;
+    s->time = perfNow();
+}
+
+/**
+ * @brief Reads the counters at the end of an instrumented call and adds the difference to the entry of kernel at
+ * size N x M x K.
+ */
+void perfEnd(const perf_sample_t *s, const char *kernel, long int N, long int M, long int K) {
+    if (!s->valid)
+        return;
+    double elapsed = perfNow() - s->time;
+    double counts[PERF_EVENTS] = {0.0};
+    for (int f = 0; f < perfState.fdCount; f++) {
+        unsigned long long now[3];
+        if (read(perfState.fd[f], now, sizeof(now)) != sizeof(now))
+            continue;
+        double value = (double)(now[0] - s->raw[f][0]);
+        double enabled = (double)(now[1] - s->raw[f][1]);
+        double running = (double)(now[2] - s->raw[f][2]);
+        if (running > 0.0 && running < enabled)
+            value *= enabled / running;
+        counts[perfState.event[f]] += perfState.weight[f] * value;
+    }
+
+    #pragma omp critical(perf)
+    {
+        int e = 0;
+        while (e < perfState.entries && !(perfState.table[e].N == N && perfState.table[e].M == M && perfState.table[e].K == K
+                                          && strcmp(perfState.table[e].kernel, kernel) == 0)) {
+            e++;
+        }
+        if (e == perfState.entries && e < PERF_MAX_ENTRIES) {
+            perf_entry_t fresh = {kernel, N, M, K, 0, 0.0, {0.0}};
+            perfState.table[perfState.entries++] = fresh;
+        }
+        if (e < perfState.entries) {
+            perf_entry_t *entry = &perfState.table[e];
+            entry->calls++;
+            entry->time += elapsed;
+            for (int k = 0; k < PERF_EVENTS; k++) {
+                entry->counts[k] += counts[k];
+            }
+        } else {
+            perfState.dropped++;
+        }
+    }
+}
+
+/**
+ * @brief Writes the aggregated table. Counts are per call; unavailable counters are -1 in CSV and JSON.
+ *
+ * @param out Stream to write to
+ * @param format PERF_TEXT, PERF_CSV or PERF_JSON
+ */
+void perfReport(FILE *out, perf_format_t format) {
+    if (format == PERF_CSV) {
+        fprintf(out, "kernel,N,M,K,calls,time_s");
+        for (int k = 0; k < PERF_EVENTS; k++) {
+            fprintf(out, ",%s", perfEventNames[k]);
+        }
+        fprintf(out, ",ipc,gflops\n");
+    } else if (format == PERF_JSON) {
+        fprintf(out, "{\n  \"kernels\": [");
+    } else {
+        fprintf(out, "%-36s %8s %8s %8s %8s %12s %12s %12s %12s %12s %12s %6s %9s\n", "kernel", "N", "M", "K", "calls",
+                "time/call", "cycles", "instr", "L1D miss", "LLC miss", "FLOP", "IPC", "GFLOP/s");
+    }
+    for (int e = 0; e < perfState.entries; e++) {
+        const perf_entry_t *entry = &perfState.table[e];
+        double per[PERF_EVENTS];
+        for (int k = 0; k < PERF_EVENTS; k++) {
+            per[k] = perfState.available[k] ? entry->counts[k] / entry->calls : -1.0;
+        }
+        double ipc = (per[PERF_CYCLES] > 0.0 && per[PERF_INSTRUCTIONS] >= 0.0) ? per[PERF_INSTRUCTIONS] / per[PERF_CYCLES] : -1.0;
+        double gflops = (per[PERF_FLOPS] >= 0.0 && entry->time > 0.0) ? entry->counts[PERF_FLOPS] / entry->time * 1e-9 : -1.0;
+        if (format == PERF_CSV) {
+            fprintf(out, "%s,%ld,%ld,%ld,%ld,%.9e", entry->kernel, entry->N, entry->M, entry->K, entry->calls, entry->time / entry->calls);
+            for (int k = 0; k < PERF_EVENTS; k++) {
+                fprintf(out, ",%.0f", per[k]);
+            }
+            fprintf(out, ",%.3f,%.4f\n", ipc, gflops);
+        } else if (format == PERF_JSON) {
+            fprintf(out, "%s\n    {\"kernel\": \"%s\", \"N\": %ld, \"M\": %ld, \"K\": %ld, \"calls\": %ld, \"time_s\": %.9e",
+                    e ? "," : "", entry->kernel, entry->N, entry->M, entry->K, entry->calls, entry->time / entry->calls);
+            for (int k = 0; k < PERF_EVENTS; k++) {
+                fprintf(out, ", \"%s\": %.0f", perfEventNames[k], per[k]);
+            }
+            fprintf(out, ", \"ipc\": %.3f, \"gflops\": %.4f}", ipc, gflops);
+        } else {
+            fprintf(out, "%-36s %8ld %8ld %8ld %8ld %12.4e", entry->kernel, entry->N, entry->M, entry->K, entry->calls,
+                    entry->time / entry->calls);
+            for (int k = 0; k < PERF_EVENTS; k++) {
+                if (per[k] >= 0.0)
+                    fprintf(out, " %12.4e", per[k]);
+                else
+                    fprintf(out, " %12s", "n/a");
+            }
+            if (ipc >= 0.0)
+                fprintf(out, " %6.2f", ipc);
+            else
+                fprintf(out, " %6s", "n/a");
+            if (gflops >= 0.0)
+                fprintf(out, " %9.3f\n", gflops);
+            else
+                fprintf(out, " %9s\n", "n/a");
+        }
+    }
+    if (format == PERF_JSON)
+        fprintf(out, "\n  ],\n  \"dropped_calls\": %ld\n}\n", perfState.dropped);
+    else if (format == PERF_TEXT && perfState.dropped > 0)
+        fprintf(out, "(%ld calls not recorded, more than %d kernel sizes)\n", perfState.dropped, PERF_MAX_ENTRIES);
+    fflush(out);
+}
+
+/**
+ * @brief Writes the report to stderr at exit when instrumentation was turned on through NLA_PERF.
+ */
+void perfReportAtExit(void) {
+    perfReport(stderr, perfState.format);
+}
+
+/**
+ * @brief Reads NLA_PERF and turns instrumentation on if it is set. Runs before main and before any OpenMP thread
+ * is created.
+ */
+__attribute__((constructor(104))) void perfInit(void) {
+    const char *mode = getenv("NLA_PERF");
+    if (mode == NULL || *mode == '\0' || strcmp(mode, "0") == 0)
+        return;
+    perfState.format = (strcmp(mode, "csv") == 0) ? PERF_CSV : (strcmp(mode, "json") == 0) ? PERF_JSON : PERF_TEXT;
+    perfEnable(1);
+    atexit(perfReportAtExit);
+}
+
+#ifndef NLA_NO_PERF
+// starts an instrumented region; declares the sample, so it goes before any early return of the function
+#define PERF_BEGIN() perf_sample_t perf_sample_; perf_sample_.valid = 0; if (perfEnabled) perfBegin(&perf_sample_)
+// ends the region started by PERF_BEGIN, recording it as kernel at size N x M x K
+#define PERF_END(kernel, N, M, K) do { if (perfEnabled) perfEnd(&perf_sample_, kernel, N, M, K); } while (0)
+#else
+#define PERF_BEGIN() do { } while (0)
+#define PERF_END(kernel, N, M, K) do { } while (0)
+#endif
+
+#endif
@@ -0,0 +1,320 @@
+/**
+ * @file simd.h
+ * @author Navid Shamszadeh
+ * @brief Explicit SSE2/AVX2/AVX-512 kernels for the streaming matrix operations, selected at startup from cpuid.
+ * @details Each kernel is compiled for every instruction set with target attributes, so the binary itself only
+ * assumes x86-64 (which implies SSE2). simdInit() runs before main and points the dispatch table at the widest
+ * variant the CPU supports. Setting the environment variable SIMD_ISA to scalar, sse2, avx2 or avx512 caps the
+ * selection, which is handy for comparing variants on one machine.
+ * AVX2 has no 64-bit multiply, so the AVX2 and SSE2 variants build one out of three 32 x 32 -> 64 bit multiplies.
+ * @date 2021-05-17
+ */
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <immintrin.h>
+#include "tune.h"
+
+// arrays larger than this (in elements) are written with non-temporal stores so the output does not evict the inputs
+#define SIMD_STREAM_THRESHOLD (1L << 18)
+
+typedef enum {
+    SIMD_SCALAR = 0,
+    SIMD_SSE2,
+    SIMD_AVX2,
+    SIMD_AVX512
+} simd_isa_t;
+
+const char *simdIsaNames[] = {"scalar", "sse2", "avx2", "avx512"};
+
+/**
+ * @brief Detects the widest instruction set supported by the CPU, capped by the SIMD_ISA environment variable.
+ *
+ * @return The selected instruction set
+ */
+simd_isa_t simdDetect(void) {
+    simd_isa_t isa = SIMD_SCALAR;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        isa = SIMD_SSE2;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        isa = SIMD_AVX2;
+    if (isa == SIMD_AVX2 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl"))
+        isa = SIMD_AVX512;
+
+    const char *cap = getenv("SIMD_ISA");
+    if (cap != NULL) {
+        for (int i = SIMD_SCALAR; i <= SIMD_AVX512; i++) {
+            if (strcmp(cap, simdIsaNames[i]) == 0 && (simd_isa_t)i < isa)
+                isa = (simd_isa_t)i;
+        }
+    }
+    return isa;
+}
+
+/* ---------------------------------------------------------------------------------------------------------------- */
+/* 64-bit lane multiplies                                                                                           */
+/* ---------------------------------------------------------------------------------------------------------------- */
+
+static inline __m128i simdMul64SSE2(__m128i a, __m128i b) {
+    __m128i lo = _mm_mul_epu32(a, b);
+    __m128i cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), b), _mm_mul_epu32(a, _mm_srli_epi64(b, 32)));
+    return _mm_add_epi64(lo, _mm_slli_epi64(cross, 32));
+}
+
+static inline __attribute__((target("avx2"))) __m256i simdMul64AVX2(__m256i a, __m256i b) {
+    __m256i lo = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b), _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+/* ---------------------------------------------------------------------------------------------------------------- */
+/* c = a + b                                                                                                        */
+/* ---------------------------------------------------------------------------------------------------------------- */
+
+void simdAddScalar(long int n, const long int *a, const long int *b, long int *c) {
+    for (long int i = 0; i < n; i++) {
+        c[i] = a[i] + b[i];
+    }
+}
+
+void simdAddSSE2(long int n, const long int *a, const long int *b, long int *c) {
+    long int i = 0;
+    int stream = n >= SIMD_STREAM_THRESHOLD;
+    if (stream) {
+        // peel until c is 16-byte aligned
+        for (; i < n && ((uintptr_t)(c + i) & 15); i++) {
+            c[i] = a[i] + b[i];
+        }
+    }
+    for (; i + 4 <= n; i += 4) {
+        __m128i s0 = _mm_add_epi64(_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i)));
+        __m128i s1 = _mm_add_epi64(_mm_loadu_si128((const __m128i *)(a + i + 2)), _mm_loadu_si128((const __m128i *)(b + i + 2)));
+        if (stream) {
+            _mm_stream_si128((__m128i *)(c + i), s0);
+            _mm_stream_si128((__m128i *)(c + i + 2), s1);
+        } else {
+            _mm_storeu_si128((__m128i *)(c + i), s0);
+            _mm_storeu_si128((__m128i *)(c + i + 2), s1);
+        }
+    }
+    if (stream)
+        _mm_sfence();
+    for (; i < n; i++) {
+        c[i] = a[i] + b[i];
+    }
+}
+
+__attribute__((target("avx2"))) void simdAddAVX2(long int n, const long int *a, const long int *b, long int *c) {
+    long int i = 0;
+    int stream = n >= SIMD_STREAM_THRESHOLD;
+    if (stream) {
+        for (; i < n && ((uintptr_t)(c + i) & 31); i++) {
+            c[i] = a[i] + b[i];
+        }
+    }
+    for (; i + 8 <= n; i += 8) {
+        __m256i s0 = _mm256_add_epi64(_mm256_loadu_si256((const __m256i *)(a + i)), _mm256_loadu_si256((const __m256i *)(b + i)));
+        __m256i s1 = _mm256_add_epi64(_mm256_loadu_si256((const __m256i *)(a + i + 4)), _mm256_loadu_si256((const __m256i *)(b + i + 4)));
+        if (stream) {
+            _mm256_stream_si256((__m256i *)(c + i), s0);
+            _mm256_stream_si256((__m256i *)(c + i + 4), s1);
+        } else {
+            _mm256_storeu_si256((__m256i *)(c + i), s0);
+            _mm256_storeu_si256((__m256i *)(c + i + 4), s1);
+        }
+    }
+    if (stream)
+        _mm_sfence();
+    for (; i < n; i++) {
+        c[i] = a[i] + b[i];
+    }
+}
+
+__attribute__((target("avx512f"))) void simdAddAVX512(long int n, const long int *a, const long int *b, long int *c) {
+    long int i = 0;
+    int stream = n >= SIMD_STREAM_THRESHOLD;
+    if (stream) {
+        for (; i < n && ((uintptr_t)(c + i) & 63); i++) {
+            c[i] = a[i] + b[i];
+        }
+    }
+    for (; i + 16 <= n; i += 16) {
+        __m512i s0 = _mm512_add_epi64(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+        __m512i s1 = _mm512_add_epi64(_mm512_loadu_si512(a + i + 8), _mm512_loadu_si512(b + i + 8));
+        if (stream) {
+            _mm512_stream_si512((__m512i *)(c + i), s0);
+            _mm512_stream_si512((__m512i *)(c + i + 8), s1);
+        } else {
+            _mm512_storeu_si512(c + i, s0);
+            _mm512_storeu_si512(c + i + 8, s1);
+        }
+    }
+    if (stream)
+        _mm_sfence();
+    if (i < n) {
+        __mmask8 lo = (n - i >= 8) ? 0xFF : (__mmask8)((1u << (n - i)) - 1);
+        _mm512_mask_storeu_epi64(c + i, lo, _mm512_add_epi64(_mm512_maskz_loadu_epi64(lo, a + i), _mm512_maskz_loadu_epi64(lo, b + i)));
+        i += 8;
+        if (i < n) {
+            __mmask8 hi = (__mmask8)((1u << (n - i)) - 1);
+            _mm512_mask_storeu_epi64(c + i, hi, _mm512_add_epi64(_mm512_maskz_loadu_epi64(hi, a + i), _mm512_maskz_loadu_epi64(hi, b + i)));
+        }
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------------------------- */
+/* b = A * x, four rows at a time so every load of x is reused four times                                           */
+/* ---------------------------------------------------------------------------------------------------------------- */
+
+void simdGemvScalar(int N, int M, const long int *A, int lda, const long int *x, long int *b) {
+    for (int i = 0; i < N; i++) {
+        const long int *row = A + (long int)lda * i;
+        long int sum = 0;
+        for (int j = 0; j < M; j++) {
+            sum += row[j] * x[j];
+        }
+        b[i] = sum;
+    }
+}
+
+void simdGemvSSE2(int N, int M, const long int *A, int lda, const long int *x, long int *b) {
+    int i = 0;
+    for (; i + 4 <= N; i += 4) {
+        const long int *r0 = A + (long int)lda * i;
+        const long int *r1 = r0 + lda, *r2 = r1 + lda, *r3 = r2 + lda;
+        __m128i s0 = _mm_setzero_si128(), s1 = _mm_setzero_si128(), s2 = _mm_setzero_si128(), s3 = _mm_setzero_si128();
+        int j = 0;
+        for (; j + 2 <= M; j += 2) {
+            __m128i xv = _mm_loadu_si128((const __m128i *)(x + j));
+            s0 = _mm_add_epi64(s0, simdMul64SSE2(_mm_loadu_si128((const __m128i *)(r0 + j)), xv));
+            s1 = _mm_add_epi64(s1, simdMul64SSE2(_mm_loadu_si128((const __m128i *)(r1 + j)), xv));
+            s2 = _mm_add_epi64(s2, simdMul64SSE2(_mm_loadu_si128((const __m128i *)(r2 + j)), xv));
+            s3 = _mm_add_epi64(s3, simdMul64SSE2(_mm_loadu_si128((const __m128i *)(r3 + j)), xv));
+        }
+        long int t[4][2];
+        _mm_storeu_si128((__m128i *)t[0], s0);
+        _mm_storeu_si128((__m128i *)t[1], s1);
+        _mm_storeu_si128((__m128i *)t[2], s2);
+        _mm_storeu_si128((__m128i *)t[3], s3);
+        long int sum[4] = {t[0][0] + t[0][1], t[1][0] + t[1][1], t[2][0] + t[2][1], t[3][0] + t[3][1]};
+        for (; j < M; j++) {
+            sum[0] += r0[j] * x[j];
+            sum[1] += r1[j] * x[j];
+            sum[2] += r2[j] * x[j];
+            sum[3] += r3[j] * x[j];
+        }
+        b[i] = sum[0];
+        b[i + 1] = sum[1];
+        b[i + 2] = sum[2];
+        b[i + 3] = sum[3];
+    }
+    simdGemvScalar(N - i, M, A + (long int)lda * i, lda, x, b + i);
+}
+
+__attribute__((target("avx2"))) void simdGemvAVX2(int N, int M, const long int *A, int lda, const long int *x, long int *b) {
+    int i = 0;
+    for (; i + 4 <= N; i += 4) {
+        const long int *r0 = A + (long int)lda * i;
+        const long int *r1 = r0 + lda, *r2 = r1 + lda, *r3 = r2 + lda;
+        __m256i s0 = _mm256_setzero_si256(), s1 = _mm256_setzero_si256(), s2 = _mm256_setzero_si256(), s3 = _mm256_setzero_si256();
+        int j = 0;
+        for (; j + 4 <= M; j += 4) {
+            __m256i xv = _mm256_loadu_si256((const __m256i *)(x + j));
+            s0 = _mm256_add_epi64(s0, simdMul64AVX2(_mm256_loadu_si256((const __m256i *)(r0 + j)), xv));
+            s1 = _mm256_add_epi64(s1, simdMul64AVX2(_mm256_loadu_si256((const __m256i *)(r1 + j)), xv));
+            s2 = _mm256_add_epi64(s2, simdMul64AVX2(_mm256_loadu_si256((const __m256i *)(r2 + j)), xv));
+            s3 = _mm256_add_epi64(s3, simdMul64AVX2(_mm256_loadu_si256((const __m256i *)(r3 + j)), xv));
+        }
+        long int t[4][4];
+        _mm256_storeu_si256((__m256i *)t[0], s0);
+        _mm256_storeu_si256((__m256i *)t[1], s1);
+        _mm256_storeu_si256((__m256i *)t[2], s2);
+        _mm256_storeu_si256((__m256i *)t[3], s3);
+        long int sum[4];
+        for (int r = 0; r < 4; r++) {
+            sum[r] = t[r][0] + t[r][1] + t[r][2] + t[r][3];
+        }
+        for (; j < M; j++) {
+            sum[0] += r0[j] * x[j];
+            sum[1] += r1[j] * x[j];
+            sum[2] += r2[j] * x[j];
+            sum[3] += r3[j] * x[j];
+        }
+        b[i] = sum[0];
+        b[i + 1] = sum[1];
+        b[i + 2] = sum[2];
+        b[i + 3] = sum[3];
+    }
+    simdGemvScalar(N - i, M, A + (long int)lda * i, lda, x, b + i);
+}
+
+__attribute__((target("avx512f,avx512dq"))) void simdGemvAVX512(int N, int M, const long int *A, int lda, const long int *x, long int *b) {
+    int i = 0;
+    for (; i + 4 <= N; i += 4) {
+        const long int *r0 = A + (long int)lda * i;
+        const long int *r1 = r0 + lda, *r2 = r1 + lda, *r3 = r2 + lda;
+        __m512i s0 = _mm512_setzero_si512(), s1 = _mm512_setzero_si512(), s2 = _mm512_setzero_si512(), s3 = _mm512_setzero_si512();
+        int j = 0;
+        for (; j < M; j += 8) {
+            __mmask8 m = (M - j >= 8) ? 0xFF : (__mmask8)((1u << (M - j)) - 1);
+            __m512i xv = _mm512_maskz_loadu_epi64(m, x + j);
+            s0 = _mm512_add_epi64(s0, _mm512_mullo_epi64(_mm512_maskz_loadu_epi64(m, r0 + j), xv));
+            s1 = _mm512_add_epi64(s1, _mm512_mullo_epi64(_mm512_maskz_loadu_epi64(m, r1 + j), xv));
+            s2 = _mm512_add_epi64(s2, _mm512_mullo_epi64(_mm512_maskz_loadu_epi64(m, r2 + j), xv));
+            s3 = _mm512_add_epi64(s3, _mm512_mullo_epi64(_mm512_maskz_loadu_epi64(m, r3 + j), xv));
+        }
+        b[i] = _mm512_reduce_add_epi64(s0);
+        b[i + 1] = _mm512_reduce_add_epi64(s1);
+        b[i + 2] = _mm512_reduce_add_epi64(s2);
+        b[i + 3] = _mm512_reduce_add_epi64(s3);
+    }
+    simdGemvScalar(N - i, M, A + (long int)lda * i, lda, x, b + i);
+}
+
+/* ---------------------------------------------------------------------------------------------------------------- */
+/* dispatch                                                                                                         */
+/* ---------------------------------------------------------------------------------------------------------------- */
+
+simd_isa_t simdIsa = SIMD_SCALAR;
+
+/**
+ * @brief c[i] = a[i] + b[i] for 0 <= i < n, dispatched to the best available instruction set.
+ */
+void (*simdAdd)(long int n, const long int *a, const long int *b, long int *c) = simdAddScalar;
+
+/**
+ * @brief b = A * x for an N x M matrix A with leading dimension lda, dispatched to the best available instruction set.
+ */
+void (*simdGemv)(int N, int M, const long int *A, int lda, const long int *x, long int *b) = simdGemvScalar;
+
+/**
+ * @brief Selects the kernels for the current CPU. Runs automatically before main.
+ */
+__attribute__((constructor(101))) void simdInit(void) {
+    simdIsa = simdDetect();
+    switch (simdIsa) {
+        case SIMD_AVX512:
+            simdAdd = simdAddAVX512;
+            simdGemv = simdGemvAVX512;
+            break;
+        case SIMD_AVX2:
+            simdAdd = simdAddAVX2;
+            simdGemv = simdGemvAVX2;
+            break;
+        case SIMD_SSE2:
+            simdAdd = simdAddSSE2;
+            simdGemv = simdGemvSSE2;
+            break;
+        default:
+            simdAdd = simdAddScalar;
+            simdGemv = simdGemvScalar;
+            break;
+    }
+}
+
+#endif
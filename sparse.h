@@ -0,0 +1,450 @@
+/**
+ * @file sparse.h
+ * @author Navid Shamszadeh
+ * @brief Sparse double matrices in CSR, CSC and SELL-C-sigma storage, conversion from the strided dense layout, and
+ * sparse matrix vector products (SpMV), serial and threaded.
+ * @details A dense N x M matrix costs N * M work and memory per product whatever its contents; the sparse formats
+ * store only the nonzeros, so a matrix with a few nonzeros per row costs a few loads per row instead.
+ *
+ * CSR keeps the nonzeros row by row (rowStart[i]..rowStart[i + 1] index colIndex and values), which gives a gather
+ * product b[i] = sum values * x[colIndex]. CSC keeps them column by column, which suits A^T x and column access.
+ * The threaded CSR product splits the rows so every chunk holds about the same number of nonzeros plus rows, so a
+ * few dense rows do not leave one thread with most of the work.
+ *
+ * SELL-C-sigma cuts the rows into slices of SPARSE_SELL_C rows (one AVX-512 register of doubles) stored column
+ * major and padded to the longest row of the slice, so one SIMD lane works on each row of the slice. To keep the
+ * padding small, rows are first sorted by length within windows of sigma rows; the output is permuted back on the
+ * fly. Like kernels.h, the slice kernel is compiled for each instruction set and selected at startup.
+ * @date 2021-05-20
+ */
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "simd.h"
+#include "threads.h"
+
+// rows per SELL-C-sigma slice, one AVX-512 register of doubles
+#define SPARSE_SELL_C 8
+
+/**
+ * @brief Compressed sparse row matrix: the nonzeros of row i are values[rowStart[i]..rowStart[i + 1]), in columns
+ * colIndex[...].
+ */
+typedef struct {
+    int rows;
+    int cols;
+    long int nnz;
+    long int *rowStart; // rows + 1 offsets
+    int *colIndex;
+    double *values;
+} sparse_csr_t;
+
+/**
+ * @brief Compressed sparse column matrix: the nonzeros of column j are values[colStart[j]..colStart[j + 1]), in
+ * rows rowIndex[...].
+ */
+typedef struct {
+    int rows;
+    int cols;
+    long int nnz;
+    long int *colStart; // cols + 1 offsets
+    int *rowIndex;
+    double *values;
+} sparse_csc_t;
+
+/**
+ * @brief SELL-C-sigma matrix with C = SPARSE_SELL_C. Entry k of lane r of slice s is at sliceStart[s] + k * C + r;
+ * lane r of slice s holds row perm[s * C + r] (-1 for the padding lanes of the last slice).
+ */
+typedef struct {
+    int rows;
+    int cols;
+    int sigma;          // rows sorted by length within windows of sigma rows
+    int slices;
+    long int nnz;       // nonzeros, without padding
+    long int *sliceStart; // slices + 1 offsets, in stored (padded) entries
+    int *sliceWidth;    // length of the longest row of each slice
+    int *perm;          // row held by each lane
+    int *colIndex;
+    double *values;
+} sparse_sell_t;
+
+/**
+ * @brief Releases a CSR matrix; the arrays may be NULL, as after a failed build.
+ */
+void sparseCsrFree(sparse_csr_t *S) {
+    free(S->rowStart);
+    free(S->colIndex);
+    free(S->values);
+    S->rowStart = NULL;
+    S->colIndex = NULL;
+    S->values = NULL;
+}
+
+void sparseCscFree(sparse_csc_t *S) {
+    free(S->colStart);
+    free(S->rowIndex);
+    free(S->values);
+    S->colStart = NULL;
+    S->rowIndex = NULL;
+    S->values = NULL;
+}
+
+void sparseSellFree(sparse_sell_t *S) {
+    free(S->sliceStart);
+    free(S->sliceWidth);
+    free(S->perm);
+    free(S->colIndex);
+    free(S->values);
+    S->sliceStart = NULL;
+    S->sliceWidth = NULL;
+    S->perm = NULL;
+    S->colIndex = NULL;
+    S->values = NULL;
+}
+
+/**
+ * @brief Builds the CSR form of a strided dense N x M matrix, keeping the entries that are not exactly zero.
+ *
+ * @param N Number of rows of A
+ * @param M Number of columns of A
+ * @param A Dense matrix with row stride lda
+ * @param lda Leading dimension of A
+ * @param S Output matrix, released with sparseCsrFree
+ * @return 0 on success, -1 if the memory could not be allocated
+ */
+int sparseCsrFromDense(int N, int M, const double *A, int lda, sparse_csr_t *S) {
+    long int nnz = 0;
+    for (int i = 0; i < N; i++) {
+        for (int j = 0; j < M; j++) {
+            nnz += (A[j + (long int)lda * i] != 0.0);
+        }
+    }
+    S->rows = N;
+    S->cols = M;
+    S->nnz = nnz;
+    S->rowStart = (long int *)malloc((N + 1) * sizeof(long int));
+    S->colIndex = (int *)malloc((nnz > 0 ? nnz : 1) * sizeof(int));
+    S->values = (double *)malloc((nnz > 0 ? nnz : 1) * sizeof(double));
+    if (S->rowStart == NULL || S->colIndex == NULL || S->values == NULL) {
+        sparseCsrFree(S);
+        return -1;
+    }
+    long int p = 0;
+    for (int i = 0; i < N; i++) {
+        S->rowStart[i] = p;
+        const double *row = A + (long int)lda * i;
+        for (int j = 0; j < M; j++) {
+            if (row[j] != 0.0) {
+                S->colIndex[p] = j;
+                S->values[p++] = row[j];
+            }
+        }
+    }
+    S->rowStart[N] = p;
+    return 0;
+}
+
+/**
+ * @brief Builds the CSC form of a CSR matrix (a counting sort of the nonzeros by column).
+ *
+ * @return 0 on success, -1 if the memory could not be allocated
+ */
+int sparseCscFromCsr(const sparse_csr_t *A, sparse_csc_t *S) {
+    S->rows = A->rows;
+    S->cols = A->cols;
+    S->nnz = A->nnz;
+    S->colStart = (long int *)calloc(A->cols + 1, sizeof(long int));
+    S->rowIndex = (int *)malloc((A->nnz > 0 ? A->nnz : 1) * sizeof(int));
+    S->values = (double *)malloc((A->nnz > 0 ? A->nnz : 1) * sizeof(double));
+    if (S->colStart == NULL || S->rowIndex == NULL || S->values == NULL) {
+        sparseCscFree(S);
+        return -1;
+    }
+    for (long int p = 0; p < A->nnz; p++) {
+        S->colStart[A->colIndex[p] + 1]++;
+    }
+    for (int j = 0; j < A->cols; j++) {
+        S->colStart[j + 1] += S->colStart[j];
+    }
+    // walking the rows in order keeps the row indices of every column sorted
+    long int *next = (long int *)malloc((A->cols > 0 ? A->cols : 1) * sizeof(long int));
+    if (next == NULL) {
+        sparseCscFree(S);
+        return -1;
+    }
+    memcpy(next, S->colStart, A->cols * sizeof(long int));
+    for (int i = 0; i < A->rows; i++) {
+        for (long int p = A->rowStart[i]; p < A->rowStart[i + 1]; p++) {
+            long int q = next[A->colIndex[p]]++;
+            S->rowIndex[q] = i;
+            S->values[q] = A->values[p];
+        }
+    }
+    free(next);
+    return 0;
+}
+
+/**
+ * @brief Builds the CSC form of a strided dense N x M matrix.
+ *
+ * @return 0 on success, -1 if the memory could not be allocated
+ */
+int sparseCscFromDense(int N, int M, const double *A, int lda, sparse_csc_t *S) {
+    sparse_csr_t csr;
+    int status = sparseCsrFromDense(N, M, A, lda, &csr);
+    if (status == 0)
+        status = sparseCscFromCsr(&csr, S);
+    sparseCsrFree(&csr);
+    return status;
+}
+
+// row lengths of the matrix being sorted by sparseSellFromCsr, for the qsort comparison
+const long int *sparseSortStart;
+
+int sparseCompareLength(const void *a, const void *b) {
+    int i = *(const int *)a, j = *(const int *)b;
+    long int li = sparseSortStart[i + 1] - sparseSortStart[i];
+    long int lj = sparseSortStart[j + 1] - sparseSortStart[j];
+    if (li != lj)
+        return (li > lj) ? -1 : 1;
+    return i - j;
+}
+
+/**
+ * @brief Builds the SELL-C-sigma form of a CSR matrix.
+ *
+ * @param A CSR matrix
+ * @param sigma Sorting window in rows, rounded up to a multiple of SPARSE_SELL_C; 1 keeps the row order
+ * @param S Output matrix, released with sparseSellFree
+ * @return 0 on success, -1 if the memory could not be allocated
+ */
+int sparseSellFromCsr(const sparse_csr_t *A, int sigma, sparse_sell_t *S) {
+    int C = SPARSE_SELL_C;
+    sigma = (sigma > 1) ? (sigma + C - 1) / C * C : 1;
+    S->rows = A->rows;
+    S->cols = A->cols;
+    S->sigma = sigma;
+    S->nnz = A->nnz;
+    S->slices = (A->rows + C - 1) / C;
+    S->sliceStart = (long int *)malloc((S->slices + 1) * sizeof(long int));
+    S->sliceWidth = (int *)malloc((S->slices > 0 ? S->slices : 1) * sizeof(int));
+    S->perm = (int *)malloc(((long int)S->slices * C + 1) * sizeof(int));
+    S->colIndex = NULL;
+    S->values = NULL;
+    if (S->sliceStart == NULL || S->sliceWidth == NULL || S->perm == NULL) {
+        sparseSellFree(S);
+        return -1;
+    }
+
+    for (int i = 0; i < S->slices * C; i++) {
+        S->perm[i] = (i < A->rows) ? i : -1;
+    }
+    if (sigma > 1) {
+        sparseSortStart = A->rowStart;
+        for (int i0 = 0; i0 < A->rows; i0 += sigma) {
+            int window = (A->rows - i0 < sigma) ? A->rows - i0 : sigma;
+            qsort(S->perm + i0, window, sizeof(int), sparseCompareLength);
+        }
+    }
+
+    S->sliceStart[0] = 0;
+    for (int s = 0; s < S->slices; s++) {
+        long int width = 0;
+        for (int r = 0; r < C; r++) {
+            int row = S->perm[s * C + r];
+            if (row >= 0 && A->rowStart[row + 1] - A->rowStart[row] > width)
+                width = A->rowStart[row + 1] - A->rowStart[row];
+        }
+        S->sliceWidth[s] = (int)width;
+        S->sliceStart[s + 1] = S->sliceStart[s] + width * C;
+    }
+
+    long int stored = S->sliceStart[S->slices];
+    S->colIndex = (int *)malloc((stored > 0 ? stored : 1) * sizeof(int));
+    S->values = (double *)malloc((stored > 0 ? stored : 1) * sizeof(double));
+    if (S->colIndex == NULL || S->values == NULL) {
+        sparseSellFree(S);
+        return -1;
+    }
+    for (int s = 0; s < S->slices; s++) {
+        for (int r = 0; r < C; r++) {
+            int row = S->perm[s * C + r];
+            long int begin = (row >= 0) ? A->rowStart[row] : 0;
+            long int length = (row >= 0) ? A->rowStart[row + 1] - begin : 0;
+            for (long int k = 0; k < S->sliceWidth[s]; k++) {
+                long int q = S->sliceStart[s] + k * C + r;
+                // padding multiplies column 0 by zero, so the kernel needs no bounds checks
+                S->colIndex[q] = (k < length) ? A->colIndex[begin + k] : 0;
+                S->values[q] = (k < length) ? A->values[begin + k] : 0.0;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief b[i] = row i of A times x for the rows begin..end of a CSR matrix.
+ */
+void sparseCsrRows(const sparse_csr_t *A, int begin, int end, const double *x, double *b) {
+    for (int i = begin; i < end; i++) {
+        double sum = 0.0;
+        for (long int p = A->rowStart[i]; p < A->rowStart[i + 1]; p++) {
+            sum += A->values[p] * x[A->colIndex[p]];
+        }
+        b[i] = sum;
+    }
+}
+
+/**
+ * @brief Products of the slices begin..end of a SELL-C-sigma matrix, written to the rows they hold.
+ * @details The lanes of a slice are independent rows, so the inner loop is a gather and a multiply-add across
+ * SPARSE_SELL_C lanes.
+ */
+static inline __attribute__((always_inline)) void sparseSellSlicesBody(const sparse_sell_t *A, int begin, int end, const double *x, double *b) {
+    for (int s = begin; s < end; s++) {
+        double sum[SPARSE_SELL_C] = {0.0};
+        const int *col = A->colIndex + A->sliceStart[s];
+        const double *val = A->values + A->sliceStart[s];
+        for (int k = 0; k < A->sliceWidth[s]; k++) {
+            for (int r = 0; r < SPARSE_SELL_C; r++) {
+                sum[r] += val[r] * x[col[r]];
+            }
+            col += SPARSE_SELL_C;
+            val += SPARSE_SELL_C;
+        }
+        const int *rows = A->perm + (long int)s * SPARSE_SELL_C;
+        for (int r = 0; r < SPARSE_SELL_C; r++) {
+            if (rows[r] >= 0)
+                b[rows[r]] = sum[r];
+        }
+    }
+}
+
+void sparseSellSlicesScalar(const sparse_sell_t *A, int begin, int end, const double *x, double *b) {
+    sparseSellSlicesBody(A, begin, end, x, b);
+}
+
+__attribute__((target("avx2,fma"))) void sparseSellSlicesAVX2(const sparse_sell_t *A, int begin, int end, const double *x, double *b) {
+    sparseSellSlicesBody(A, begin, end, x, b);
+}
+
+__attribute__((target("avx512f,avx512dq,avx512vl,avx2,fma"))) void sparseSellSlicesAVX512(const sparse_sell_t *A, int begin, int end, const double *x, double *b) {
+    sparseSellSlicesBody(A, begin, end, x, b);
+}
+
+/**
+ * @brief Slice kernel of the SELL-C-sigma product, dispatched to the best available instruction set.
+ */
+void (*sparseSellSlices)(const sparse_sell_t *A, int begin, int end, const double *x, double *b) = sparseSellSlicesScalar;
+
+/**
+ * @brief Selects the SELL-C-sigma kernel for the current CPU from the instruction set found by simdInit.
+ */
+__attribute__((constructor(102))) void sparseInit(void) {
+    if (simdIsa == SIMD_AVX512) {
+        sparseSellSlices = sparseSellSlicesAVX512;
+    } else if (simdIsa == SIMD_AVX2) {
+        sparseSellSlices = sparseSellSlicesAVX2;
+    } else {
+        sparseSellSlices = sparseSellSlicesScalar;
+    }
+}
+
+/**
+ * @brief b = A * x for a CSR matrix.
+ */
+void sparseCsrMultiplyVector(const sparse_csr_t *A, const double *x, double *b) {
+    PERF_BEGIN();
+    sparseCsrRows(A, 0, A->rows, x, b);
+    PERF_END("sparseCsrMultiplyVector", A->rows, A->cols, A->nnz);
+}
+
+/**
+ * @brief b = A * x for a CSC matrix, scattering each column into b.
+ */
+void sparseCscMultiplyVector(const sparse_csc_t *A, const double *x, double *b) {
+    PERF_BEGIN();
+    memset(b, 0, A->rows * sizeof(double));
+    for (int j = 0; j < A->cols; j++) {
+        double xj = x[j];
+        for (long int p = A->colStart[j]; p < A->colStart[j + 1]; p++) {
+            b[A->rowIndex[p]] += A->values[p] * xj;
+        }
+    }
+    PERF_END("sparseCscMultiplyVector", A->rows, A->cols, A->nnz);
+}
+
+/**
+ * @brief b = A * x for a SELL-C-sigma matrix.
+ */
+void sparseSellMultiplyVector(const sparse_sell_t *A, const double *x, double *b) {
+    PERF_BEGIN();
+    sparseSellSlices(A, 0, A->slices, x, b);
+    PERF_END("sparseSellMultiplyVector", A->rows, A->cols, A->nnz);
+}
+
+/**
+ * @brief First i in 0..n with start[i] + i >= target, for start nondecreasing: the split point that gives a chunk
+ * about target stored entries plus rows.
+ */
+int sparseBalancedSplit(const long int *start, int n, long int target) {
+    int low = 0, high = n;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (start[mid] + mid < target)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+/**
+ * @brief Threaded b = A * x for a CSR matrix, split into chunks of consecutive rows with about the same number of
+ * nonzeros plus rows each.
+ */
+void parallelSparseCsrMultiplyVector(const sparse_csr_t *A, const double *x, double *b) {
+    PERF_BEGIN();
+    long int work = A->nnz + A->rows;
+    int threads = threadsFor(A->rows);
+    long int chunks = threadsChunks(threads, A->rows);
+    long int next = 0;
+    #pragma omp parallel num_threads(threads) if (threads > 1)
+    {
+        long int step = 0;
+        for (long int ch; (ch = threadsNextChunk(&next, &step, chunks)) >= 0; ) {
+            int begin = sparseBalancedSplit(A->rowStart, A->rows, threadsChunkStart(work, chunks, ch));
+            int end = (ch + 1 == chunks) ? A->rows : sparseBalancedSplit(A->rowStart, A->rows, threadsChunkStart(work, chunks, ch + 1));
+            sparseCsrRows(A, begin, end, x, b);
+        }
+    }
+    PERF_END("parallelSparseCsrMultiplyVector", A->rows, A->cols, A->nnz);
+}
+
+/**
+ * @brief Threaded b = A * x for a SELL-C-sigma matrix, split into chunks of slices with about the same number of
+ * stored entries each.
+ */
+void parallelSparseSellMultiplyVector(const sparse_sell_t *A, const double *x, double *b) {
+    PERF_BEGIN();
+    long int work = A->sliceStart[A->slices] + A->slices;
+    int threads = threadsFor(A->slices);
+    long int chunks = threadsChunks(threads, A->slices);
+    long int next = 0;
+    #pragma omp parallel num_threads(threads) if (threads > 1)
+    {
+        long int step = 0;
+        for (long int ch; (ch = threadsNextChunk(&next, &step, chunks)) >= 0; ) {
+            int begin = sparseBalancedSplit(A->sliceStart, A->slices, threadsChunkStart(work, chunks, ch));
+            int end = (ch + 1 == chunks) ? A->slices : sparseBalancedSplit(A->sliceStart, A->slices, threadsChunkStart(work, chunks, ch + 1));
+            sparseSellSlices(A, begin, end, x, b);
+        }
+    }
+    PERF_END("parallelSparseSellMultiplyVector", A->rows, A->cols, A->nnz);
+}
+
+#endif
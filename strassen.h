@@ -0,0 +1,187 @@
+/**
+ * @file strassen.h
+ * @author Navid Shamszadeh
+ * @brief Strassen-Winograd fast matrix multiplication on matrix_t, falling back to the blocked GEMM engine below a
+ * cutoff.
+ * @details Each level splits A, B and C into quadrants and forms C from 7 half-size products and 15 additions
+ * (Winograd's variant of Strassen's algorithm) instead of 8 products, so the O(n^3) work shrinks by 7/8 per level
+ * at the cost of O(n^2) extra passes over memory. Below the cutoff, or once any dimension is down to it, the blocked
+ * engine is faster and the recursion stops. Works on rectangular matrices of any type and any leading dimensions:
+ * odd dimensions are peeled, the even part goes through the recursion and the last row, column and rank-one term
+ * are added with ordinary GEMM calls.
+ *
+ * The products are scheduled so that each level needs only two temporaries besides C itself (the schedule of Boyer,
+ * Dumas, Pernet and Zhou for C = A B), about a third of the size of C over all levels together. They are carved out
+ * of an arena sized once with strassenWorkspaceBytes, so a run makes no allocations.
+ *
+ * Integer products are exact. In floating point the bound on the error grows by a modest factor per level compared
+ * with the classic product, so Strassen is opt-in: basics/matrix_multiply.c reports the measured difference.
+ * @date 2021-05-20
+ */
+#ifndef STRASSEN_H
+#define STRASSEN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "matrix.h"
+#include "fused.h"
+
+// default cutoff: dimensions at or below it go straight to the blocked engine
+#define STRASSEN_CUTOFF 256
+
+/**
+ * @brief Bytes of workspace strassenMultiplyMatrix needs for an N x M times M x K product with the given cutoff.
+ */
+size_t strassenWorkspaceBytes(int N, int M, int K, matrix_type_t type, int cutoff) {
+    if (N <= cutoff || M <= cutoff || K <= cutoff)
+        return 0;
+    int n2 = N / 2, m2 = M / 2, k2 = K / 2;
+    return matrixBytes(n2, (m2 > k2) ? m2 : k2, type) + matrixBytes(m2, k2, type)
+         + strassenWorkspaceBytes(n2, m2, k2, type, cutoff);
+}
+
+/**
+ * @brief C = A + B, or C = A - B if subtract is set, for matrices of the same shape and type. C may alias A or B.
+ */
+void strassenCombine(const matrix_t *A, const matrix_t *B, int subtract, matrix_t *C) {
+    if (!subtract) {
+        matrixAdd(A, B, C);
+        return;
+    }
+    long int n = A->cols;
+    for (int i = 0; i < A->rows; i++) {
+        switch (A->type) {
+        case MATRIX_LONG: {
+            const long int *rows[2] = {&MATRIX_AT(long int, A, i, 0), &MATRIX_AT(long int, B, i, 0)};
+            const long int weights[2] = {1, -1};
+            kernelAddMultiple(n, 2, rows, weights, &MATRIX_AT(long int, C, i, 0));
+            break;
+        }
+        case MATRIX_DOUBLE: {
+            const double *rows[2] = {&MATRIX_AT(double, A, i, 0), &MATRIX_AT(double, B, i, 0)};
+            const double weights[2] = {1.0, -1.0};
+            kernelAddMultiple(n, 2, rows, weights, &MATRIX_AT(double, C, i, 0));
+            break;
+        }
+        case MATRIX_FLOAT: {
+            const float *rows[2] = {&MATRIX_AT(float, A, i, 0), &MATRIX_AT(float, B, i, 0)};
+            const float weights[2] = {1.0f, -1.0f};
+            kernelAddMultiple(n, 2, rows, weights, &MATRIX_AT(float, C, i, 0));
+            break;
+        }
+        case MATRIX_INT: {
+            const int *rows[2] = {&MATRIX_AT(int, A, i, 0), &MATRIX_AT(int, B, i, 0)};
+            const int weights[2] = {1, -1};
+            kernelAddMultiple(n, 2, rows, weights, &MATRIX_AT(int, C, i, 0));
+            break;
+        }
+        }
+    }
+}
+
+/**
+ * @brief One level of Strassen-Winograd, C = A * B, recursing into the seven half-size products.
+ *
+ * @param A N x M matrix
+ * @param B M x K matrix
+ * @param C N x K matrix, must not overlap A or B
+ * @param cutoff Dimension at or below which the blocked engine is used
+ * @param workspace Arena with at least strassenWorkspaceBytes free, left as it was found
+ */
+void strassenRecursive(const matrix_t *A, const matrix_t *B, matrix_t *C, int cutoff, matrix_arena_t *workspace) {
+    int N = A->rows, M = A->cols, K = B->cols;
+    if (N <= cutoff || M <= cutoff || K <= cutoff) {
+        matrixMultiplyMatrix(A, B, C);
+        return;
+    }
+    int n2 = N / 2, m2 = M / 2, k2 = K / 2;
+    matrix_t A11 = matrixView(A, 0, 0, n2, m2), A12 = matrixView(A, 0, m2, n2, m2);
+    matrix_t A21 = matrixView(A, n2, 0, n2, m2), A22 = matrixView(A, n2, m2, n2, m2);
+    matrix_t B11 = matrixView(B, 0, 0, m2, k2), B12 = matrixView(B, 0, k2, m2, k2);
+    matrix_t B21 = matrixView(B, m2, 0, m2, k2), B22 = matrixView(B, m2, k2, m2, k2);
+    matrix_t C11 = matrixView(C, 0, 0, n2, k2), C12 = matrixView(C, 0, k2, n2, k2);
+    matrix_t C21 = matrixView(C, n2, 0, n2, k2), C22 = matrixView(C, n2, k2, n2, k2);
+
+    // X holds the sums of A quadrants and then P1, Y the sums of B quadrants
+    size_t mark = workspace->used;
+    matrix_t X = matrixCreate(workspace, n2, (m2 > k2) ? m2 : k2, A->type);
+    matrix_t Y = matrixCreate(workspace, m2, k2, A->type);
+    matrix_t S = matrixView(&X, 0, 0, n2, m2);
+    matrix_t P1 = matrixView(&X, 0, 0, n2, k2);
+
+    strassenCombine(&A11, &A21, 1, &S);          // S3 = A11 - A21
+    strassenCombine(&B22, &B12, 1, &Y);          // T3 = B22 - B12
+    strassenRecursive(&S, &Y, &C21, cutoff, workspace); // P7 = S3 T3
+    strassenCombine(&A21, &A22, 0, &S);          // S1 = A21 + A22
+    strassenCombine(&B12, &B11, 1, &Y);          // T1 = B12 - B11
+    strassenRecursive(&S, &Y, &C22, cutoff, workspace); // P5 = S1 T1
+    strassenCombine(&S, &A11, 1, &S);            // S2 = S1 - A11
+    strassenCombine(&B22, &Y, 1, &Y);            // T2 = B22 - T1
+    strassenRecursive(&S, &Y, &C12, cutoff, workspace); // P6 = S2 T2
+    strassenCombine(&A12, &S, 1, &S);            // S4 = A12 - S2
+    strassenRecursive(&S, &B22, &C11, cutoff, workspace); // P3 = S4 B22
+    strassenRecursive(&A11, &B11, &P1, cutoff, workspace); // P1 = A11 B11
+    strassenCombine(&P1, &C12, 0, &C12);         // U2 = P1 + P6
+    strassenCombine(&C12, &C21, 0, &C21);        // U3 = U2 + P7
+    strassenCombine(&C12, &C22, 0, &C12);        // U4 = U2 + P5
+    strassenCombine(&C21, &C22, 0, &C22);        // U7 = U3 + P5, C22 done
+    strassenCombine(&C12, &C11, 0, &C12);        // U5 = U4 + P3, C12 done
+    strassenCombine(&Y, &B21, 1, &Y);            // T4 = T2 - B21
+    strassenRecursive(&A22, &Y, &C11, cutoff, workspace); // P4 = A22 T4
+    strassenCombine(&C21, &C11, 1, &C21);        // U6 = U3 - P4, C21 done
+    strassenRecursive(&A12, &B21, &C11, cutoff, workspace); // P2 = A12 B21
+    strassenCombine(&P1, &C11, 0, &C11);         // U1 = P1 + P2, C11 done
+    matrixArenaReset(workspace, mark);
+
+    // peel the odd dimensions: the rank-one term of the last column of A, then the last column and row of C
+    if (M % 2) {
+        matrix_t a = matrixView(A, 0, M - 1, 2 * n2, 1), b = matrixView(B, M - 1, 0, 1, 2 * k2);
+        matrix_t c = matrixView(C, 0, 0, 2 * n2, 2 * k2);
+        matrixMultiplyAccumulateMatrix(&a, &b, 1, &c);
+    }
+    if (K % 2) {
+        matrix_t a = matrixView(A, 0, 0, 2 * n2, M), b = matrixView(B, 0, K - 1, M, 1);
+        matrix_t c = matrixView(C, 0, K - 1, 2 * n2, 1);
+        matrixMultiplyMatrix(&a, &b, &c);
+    }
+    if (N % 2) {
+        matrix_t a = matrixView(A, N - 1, 0, 1, M);
+        matrix_t c = matrixView(C, N - 1, 0, 1, K);
+        matrixMultiplyMatrix(&a, B, &c);
+    }
+}
+
+/**
+ * @brief C = A * B by Strassen-Winograd, for matrices of the same type.
+ *
+ * @param A N x M matrix
+ * @param B M x K matrix
+ * @param C N x K matrix, must not overlap A or B
+ * @param cutoff Dimension at or below which the blocked engine is used, 0 for STRASSEN_CUTOFF
+ * @param workspace Arena with strassenWorkspaceBytes free, or NULL to allocate one for this call
+ */
+void strassenMultiplyMatrix(const matrix_t *A, const matrix_t *B, matrix_t *C, int cutoff, matrix_arena_t *workspace) {
+    PERF_BEGIN();
+    matrixCheckType("strassenMultiplyMatrix", A->type, B);
+    matrixCheckType("strassenMultiplyMatrix", A->type, C);
+    if (A->cols != B->rows || C->rows != A->rows || C->cols != B->cols) {
+        fprintf(stderr, "Error: strassenMultiplyMatrix got %d x %d times %d x %d into %d x %d!\n",
+                A->rows, A->cols, B->rows, B->cols, C->rows, C->cols);
+        exit(-1);
+    }
+    if (cutoff <= 0)
+        cutoff = STRASSEN_CUTOFF;
+    matrix_arena_t own;
+    if (workspace == NULL) {
+        if (matrixArenaCreate(&own, strassenWorkspaceBytes(A->rows, A->cols, B->cols, A->type, cutoff)) != 0) {
+            fprintf(stderr, "Error: could not allocate the Strassen workspace!\n");
+            exit(-1);
+        }
+    }
+    strassenRecursive(A, B, C, cutoff, workspace ? workspace : &own);
+    if (workspace == NULL)
+        matrixArenaDestroy(&own);
+    PERF_END("strassenMultiplyMatrix", A->rows, A->cols, B->cols);
+}
+
+#endif
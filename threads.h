@@ -0,0 +1,279 @@
+/**
+ * @file threads.h
+ * @author Navid Shamszadeh
+ * @brief Shared-memory threading layer for the basic kernels (add, GEMV, GEMM, transpose) using OpenMP.
+ * @details The number of threads and the partitioning are configurable with threadsConfigure or the environment
+ * variables NLA_THREADS (thread count, defaults to the OpenMP default) and NLA_SCHEDULE (static or dynamic).
+ * Thread counts tuned per kernel in tune.h cap the configured count for that kernel.
+ * Static partitioning gives every thread one contiguous share of the work, which suits dedicated cores. Dynamic
+ * partitioning cuts the work into several chunks per thread handed out on demand, which copes with busy or
+ * heterogeneous cores. Called from inside an existing parallel region, the kernels run on the calling thread only,
+ * so an already threaded application never oversubscribes the machine.
+ * Without -fopenmp everything still compiles and runs serially.
+ * @date 2021-05-18
+ */
+#ifndef THREADS_H
+#define THREADS_H
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "simd.h"
+#include "gemm.h"
+#include "transpose.h"
+#include "perf.h"
+
+// chunks handed out per thread with dynamic partitioning
+#define THREADS_CHUNKS_PER_THREAD 4
+// add works on chunks that are a multiple of this many elements (one 4 KiB page of long int)
+#define THREADS_ADD_GRAIN 512
+
+typedef enum {
+    THREADS_STATIC = 0,
+    THREADS_DYNAMIC
+} threads_schedule_t;
+
+/**
+ * @brief Thread count and partitioning used by the threaded kernels.
+ */
+typedef struct {
+    int count;                   // threads per kernel call
+    threads_schedule_t schedule; // how work is split between them
+} threads_config_t;
+
+threads_config_t threadsConfig = {1, THREADS_STATIC};
+
+/**
+ * @brief Sets the thread count and partitioning used by the threaded kernels.
+ *
+ * @param count Number of threads, 0 for the OpenMP default
+ * @param schedule THREADS_STATIC or THREADS_DYNAMIC
+ */
+void threadsConfigure(int count, threads_schedule_t schedule) {
+#ifdef _OPENMP
+    threadsConfig.count = (count > 0) ? count : omp_get_max_threads();
+#else
+    threadsConfig.count = 1;
+#endif
+    threadsConfig.schedule = schedule;
+}
+
+/**
+ * @brief Reads NLA_THREADS and NLA_SCHEDULE. Runs automatically before main.
+ */
+__attribute__((constructor(103))) void threadsInit(void) {
+    const char *count = getenv("NLA_THREADS");
+    const char *schedule = getenv("NLA_SCHEDULE");
+    threadsConfigure(count ? atoi(count) : 0, (schedule && strcmp(schedule, "dynamic") == 0) ? THREADS_DYNAMIC : THREADS_STATIC);
+}
+
+/**
+ * @brief Number of threads a kernel called now should use: 1 inside an existing parallel region, the configured
+ * count otherwise, and never more than there are work items.
+ *
+ * @param items Number of independent work items available
+ * @return Number of threads to use
+ */
+int threadsFor(long int items) {
+    int count = threadsConfig.count;
+#ifdef _OPENMP
+    if (omp_in_parallel())
+        count = 1;
+#else
+    count = 1;
+#endif
+    if (items < count)
+        count = (items > 0) ? (int)items : 1;
+    return count;
+}
+
+/**
+ * @brief Like threadsFor, but never more than the thread count tuned for the kernel in tune.h. Bandwidth bound
+ * kernels often saturate memory with fewer threads than there are cores, and extra threads only add overhead.
+ *
+ * @param kernel Kernel about to run
+ * @param items Number of independent work items available
+ * @return Number of threads to use
+ */
+int threadsForKernel(tune_kernel_t kernel, long int items) {
+    int count = threadsFor(items);
+    int tuned = tuneParams.threads[kernel];
+    return (tuned > 0 && tuned < count) ? tuned : count;
+}
+
+/**
+ * @brief Number of chunks to cut the work into for a given thread count under the configured partitioning.
+ */
+long int threadsChunks(int threads, long int items) {
+    long int chunks = (threadsConfig.schedule == THREADS_DYNAMIC) ? (long int)threads * THREADS_CHUNKS_PER_THREAD : threads;
+    return (chunks < items) ? chunks : items;
+}
+
+/**
+ * @brief First item of chunk c when items are cut into chunks pieces whose sizes differ by at most one.
+ */
+long int threadsChunkStart(long int items, long int chunks, long int c) {
+    return items * c / chunks;
+}
+
+/**
+ * @brief Hands out the next chunk to the calling thread of a parallel region.
+ * @details With static partitioning thread t takes chunks t, t + threads, ... in a fixed order, so the same thread
+ * always touches the same part of the data. With dynamic partitioning threads take the next unclaimed chunk.
+ *
+ * @param next Counter shared by the threads of the region, initialized to 0
+ * @param step Counter private to the calling thread, initialized to 0
+ * @param chunks Total number of chunks
+ * @return The chunk to work on, or -1 when there are none left
+ */
+long int threadsNextChunk(long int *next, long int *step, long int chunks) {
+    long int ch;
+#ifdef _OPENMP
+    if (threadsConfig.schedule == THREADS_STATIC) {
+        ch = omp_get_thread_num() + (*step)++ * omp_get_num_threads();
+    } else {
+        #pragma omp atomic capture
+        ch = (*next)++;
+    }
+#else
+    (void)next;
+    ch = (*step)++;
+#endif
+    return (ch < chunks) ? ch : -1;
+}
+
+/**
+ * @brief Threaded c = a + b over n elements.
+ *
+ * @param n Number of elements
+ * @param a First summand
+ * @param b Second summand
+ * @param c Sum, may alias a or b
+ */
+void parallelAdd(long int n, const long int *a, const long int *b, long int *c) {
+    PERF_BEGIN();
+    long int grains = (n + THREADS_ADD_GRAIN - 1) / THREADS_ADD_GRAIN;
+    int threads = threadsForKernel(TUNE_ADD, grains);
+    long int chunks = threadsChunks(threads, grains);
+    long int next = 0;
+    #pragma omp parallel num_threads(threads) if (threads > 1)
+    {
+        long int step = 0;
+        for (long int ch; (ch = threadsNextChunk(&next, &step, chunks)) >= 0; ) {
+            long int begin = threadsChunkStart(grains, chunks, ch) * THREADS_ADD_GRAIN;
+            long int end = threadsChunkStart(grains, chunks, ch + 1) * THREADS_ADD_GRAIN;
+            if (end > n)
+                end = n;
+            simdAdd(end - begin, a + begin, b + begin, c + begin);
+        }
+    }
+    PERF_END("parallelAdd", n, 1, 1);
+}
+
+/**
+ * @brief Threaded b = A * x for an N x M matrix A with leading dimension lda, split by rows.
+ *
+ * @param N Number of rows of A
+ * @param M Number of columns of A
+ * @param A Matrix with row stride lda
+ * @param lda Leading dimension of A
+ * @param x Input vector of M elements
+ * @param b Output vector of N elements
+ */
+void parallelGemv(int N, int M, const long int *A, int lda, const long int *x, long int *b) {
+    PERF_BEGIN();
+    // blocks of four rows so every chunk keeps the four-row SIMD kernel busy
+    long int blocks = (N + 3) / 4;
+    int threads = threadsForKernel(TUNE_GEMV, blocks);
+    long int chunks = threadsChunks(threads, blocks);
+    long int next = 0;
+    #pragma omp parallel num_threads(threads) if (threads > 1)
+    {
+        long int step = 0;
+        for (long int ch; (ch = threadsNextChunk(&next, &step, chunks)) >= 0; ) {
+            int begin = (int)(threadsChunkStart(blocks, chunks, ch) * 4);
+            int end = (int)(threadsChunkStart(blocks, chunks, ch + 1) * 4);
+            if (end > N)
+                end = N;
+            simdGemv(end - begin, M, A + (long int)lda * begin, lda, x, b + begin);
+        }
+    }
+    PERF_END("parallelGemv", N, M, 1);
+}
+
+/**
+ * @brief Threaded C = alpha * A * B + beta * C, split into blocks of rows of C (or columns when C is short and wide).
+ * @details Each thread runs the blocked engine on its block, with its own packing buffers.
+ *
+ * @param N Number of rows of A and C
+ * @param M Number of columns of A and rows of B
+ * @param K Number of columns of B and C
+ * @param alpha Scalar multiplying A * B
+ * @param A Matrix with row stride lda
+ * @param lda Leading dimension of A
+ * @param B Matrix with row stride ldb
+ * @param ldb Leading dimension of B
+ * @param beta Scalar multiplying C
+ * @param C Matrix with row stride ldc
+ * @param ldc Leading dimension of C
+ */
+void parallelGemm(int N, int M, int K, long int alpha, const long int *A, int lda, const long int *B, int ldb, long int beta, long int *C, int ldc) {
+    PERF_BEGIN();
+    int by_rows = (N + GEMM_MR - 1) / GEMM_MR >= (K + GEMM_NR - 1) / GEMM_NR;
+    int unit = by_rows ? GEMM_MR : GEMM_NR;
+    long int units = by_rows ? (N + GEMM_MR - 1) / GEMM_MR : (K + GEMM_NR - 1) / GEMM_NR;
+    int extent = by_rows ? N : K;
+    int threads = threadsForKernel(TUNE_GEMM, units);
+    long int chunks = threadsChunks(threads, units);
+    long int next = 0;
+    #pragma omp parallel num_threads(threads) if (threads > 1)
+    {
+        long int step = 0;
+        for (long int ch; (ch = threadsNextChunk(&next, &step, chunks)) >= 0; ) {
+            int begin = (int)(threadsChunkStart(units, chunks, ch) * unit);
+            int end = (int)(threadsChunkStart(units, chunks, ch + 1) * unit);
+            if (end > extent)
+                end = extent;
+            if (by_rows)
+                gemmGeneral(end - begin, M, K, alpha, A + (long int)lda * begin, lda, B, ldb, beta, C + (long int)ldc * begin, ldc);
+            else
+                gemmGeneral(N, M, end - begin, alpha, A, lda, B + begin, ldb, beta, C + begin, ldc);
+        }
+    }
+    PERF_END("parallelGemm", N, M, K);
+}
+
+/**
+ * @brief Threaded out-of-place transpose B = A^T, split into bands of tile rows of A.
+ *
+ * @param N Number of rows of A
+ * @param M Number of columns of A
+ * @param A Input matrix with row stride lda
+ * @param lda Leading dimension of A
+ * @param B Output M x N matrix with row stride ldb
+ * @param ldb Leading dimension of B
+ */
+void parallelTranspose(int N, int M, const long int *A, int lda, long int *B, int ldb) {
+    PERF_BEGIN();
+    int tile = transposeTileSize();
+    long int bands = (N + tile - 1) / tile;
+    int threads = threadsForKernel(TUNE_TRANSPOSE, bands);
+    long int chunks = threadsChunks(threads, bands);
+    long int next = 0;
+    #pragma omp parallel num_threads(threads) if (threads > 1)
+    {
+        long int step = 0;
+        for (long int ch; (ch = threadsNextChunk(&next, &step, chunks)) >= 0; ) {
+            int begin = (int)(threadsChunkStart(bands, chunks, ch) * tile);
+            int end = (int)(threadsChunkStart(bands, chunks, ch + 1) * tile);
+            if (end > N)
+                end = N;
+            transposeStrided(end - begin, M, A + (long int)lda * begin, lda, B + begin, ldb);
+        }
+    }
+    PERF_END("parallelTranspose", N, M, 1);
+}
+
+#endif
@@ -0,0 +1,207 @@
+/**
+ * @file transpose.h
+ * @author Navid Shamszadeh
+ * @brief Tiled out-of-place and O(NM) in-place matrix transposes.
+ * @details The out-of-place transpose walks the matrix in TRANSPOSE_TILE x TRANSPOSE_TILE tiles so both the rows
+ * read and the rows written stay in L1, and transposes each tile in 4 x 4 (AVX2) or 2 x 2 (SSE2) register blocks
+ * selected at startup from the instruction sets detected in simd.h. The tile size can be tuned per machine in tune.h. The in-place transpose swaps tiles through a
+ * small buffer when the matrix is square and follows the permutation cycles, marking visited elements in a bitmap,
+ * when it is not.
+ * @date 2021-05-17
+ */
+#ifndef TRANSPOSE_H
+#define TRANSPOSE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "simd.h"
+
+// rows and columns of the tiles the transposes work on, unless tune.h overrides it (up to TRANSPOSE_TILE_MAX)
+#define TRANSPOSE_TILE 32
+#define TRANSPOSE_TILE_MAX 64
+
+/**
+ * @brief Tile size in effect: the tuned one capped at TRANSPOSE_TILE_MAX, or TRANSPOSE_TILE.
+ */
+static inline int transposeTileSize(void) {
+    int tile = TUNED(transposeTile, TRANSPOSE_TILE);
+    return (tile < TRANSPOSE_TILE_MAX) ? tile : TRANSPOSE_TILE_MAX;
+}
+
+/**
+ * @brief Writes the transpose of a rows x cols block of src into dst.
+ *
+ * @param rows Number of rows of the source block
+ * @param cols Number of columns of the source block
+ * @param src Source block
+ * @param lds Leading dimension (row stride) of src
+ * @param dst Destination block of size cols x rows
+ * @param ldd Leading dimension (row stride) of dst
+ */
+void transposeBlockScalar(int rows, int cols, const long int *src, int lds, long int *dst, int ldd) {
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+            dst[i + (long int)ldd * j] = src[j + (long int)lds * i];
+        }
+    }
+}
+
+void transposeBlockSSE2(int rows, int cols, const long int *src, int lds, long int *dst, int ldd) {
+    int i = 0;
+    for (; i + 2 <= rows; i += 2) {
+        const long int *s0 = src + (long int)lds * i;
+        const long int *s1 = s0 + lds;
+        int j = 0;
+        for (; j + 2 <= cols; j += 2) {
+            __m128i r0 = _mm_loadu_si128((const __m128i *)(s0 + j));
+            __m128i r1 = _mm_loadu_si128((const __m128i *)(s1 + j));
+            _mm_storeu_si128((__m128i *)(dst + i + (long int)ldd * j), _mm_unpacklo_epi64(r0, r1));
+            _mm_storeu_si128((__m128i *)(dst + i + (long int)ldd * (j + 1)), _mm_unpackhi_epi64(r0, r1));
+        }
+        for (; j < cols; j++) {
+            dst[i + (long int)ldd * j] = s0[j];
+            dst[i + 1 + (long int)ldd * j] = s1[j];
+        }
+    }
+    transposeBlockScalar(rows - i, cols, src + (long int)lds * i, lds, dst + i, ldd);
+}
+
+__attribute__((target("avx2"))) void transposeBlockAVX2(int rows, int cols, const long int *src, int lds, long int *dst, int ldd) {
+    int i = 0;
+    for (; i + 4 <= rows; i += 4) {
+        const long int *s0 = src + (long int)lds * i;
+        int j = 0;
+        for (; j + 4 <= cols; j += 4) {
+            __m256i r0 = _mm256_loadu_si256((const __m256i *)(s0 + j));
+            __m256i r1 = _mm256_loadu_si256((const __m256i *)(s0 + lds + j));
+            __m256i r2 = _mm256_loadu_si256((const __m256i *)(s0 + 2 * lds + j));
+            __m256i r3 = _mm256_loadu_si256((const __m256i *)(s0 + 3 * lds + j));
+            // interleave pairs of rows within each 128-bit lane, then swap lanes to finish the 4 x 4 transpose
+            __m256i t0 = _mm256_unpacklo_epi64(r0, r1);
+            __m256i t1 = _mm256_unpackhi_epi64(r0, r1);
+            __m256i t2 = _mm256_unpacklo_epi64(r2, r3);
+            __m256i t3 = _mm256_unpackhi_epi64(r2, r3);
+            long int *d = dst + i + (long int)ldd * j;
+            _mm256_storeu_si256((__m256i *)d, _mm256_permute2x128_si256(t0, t2, 0x20));
+            _mm256_storeu_si256((__m256i *)(d + ldd), _mm256_permute2x128_si256(t1, t3, 0x20));
+            _mm256_storeu_si256((__m256i *)(d + 2 * ldd), _mm256_permute2x128_si256(t0, t2, 0x31));
+            _mm256_storeu_si256((__m256i *)(d + 3 * ldd), _mm256_permute2x128_si256(t1, t3, 0x31));
+        }
+        if (j < cols)
+            transposeBlockScalar(4, cols - j, s0 + j, lds, dst + i + (long int)ldd * j, ldd);
+    }
+    transposeBlockScalar(rows - i, cols, src + (long int)lds * i, lds, dst + i, ldd);
+}
+
+/**
+ * @brief Tile transpose kernel selected at startup by transposeInit.
+ */
+void (*transposeBlock)(int rows, int cols, const long int *src, int lds, long int *dst, int ldd) = transposeBlockScalar;
+
+/**
+ * @brief Points transposeBlock at the widest variant the CPU supports. Runs automatically before main, after simdInit.
+ * @details AVX-512 machines use the AVX2 kernel: a 4 x 4 block of 64-bit elements already fills a cache line per row.
+ */
+__attribute__((constructor(102))) void transposeInit(void) {
+    if (simdIsa >= SIMD_AVX2)
+        transposeBlock = transposeBlockAVX2;
+    else if (simdIsa == SIMD_SSE2)
+        transposeBlock = transposeBlockSSE2;
+    else
+        transposeBlock = transposeBlockScalar;
+}
+
+/**
+ * @brief Out-of-place transpose B = A^T of an N x M strided matrix.
+ *
+ * @param N Number of rows of A
+ * @param M Number of columns of A
+ * @param A Input matrix with row stride lda
+ * @param lda Leading dimension of A
+ * @param B Output M x N matrix with row stride ldb
+ * @param ldb Leading dimension of B
+ */
+void transposeStrided(int N, int M, const long int *A, int lda, long int *B, int ldb) {
+    int tile = transposeTileSize();
+    for (int i0 = 0; i0 < N; i0 += tile) {
+        int rows = (N - i0 < tile) ? N - i0 : tile;
+        for (int j0 = 0; j0 < M; j0 += tile) {
+            int cols = (M - j0 < tile) ? M - j0 : tile;
+            transposeBlock(rows, cols, A + j0 + (long int)lda * i0, lda, B + i0 + (long int)ldb * j0, ldb);
+        }
+    }
+}
+
+/**
+ * @brief In-place transpose of an N x N strided matrix, swapping pairs of tiles through a stack buffer.
+ *
+ * @param N Number of rows and columns of A
+ * @param A Matrix with row stride lda
+ * @param lda Leading dimension of A
+ */
+void transposeSquareInPlace(int N, long int *A, int lda) {
+    long int buffer[TRANSPOSE_TILE_MAX * TRANSPOSE_TILE_MAX];
+    int tile = transposeTileSize();
+    for (int i0 = 0; i0 < N; i0 += tile) {
+        int rows = (N - i0 < tile) ? N - i0 : tile;
+        // diagonal tile: transpose into the buffer and copy back
+        long int *diag = A + i0 + (long int)lda * i0;
+        transposeBlock(rows, rows, diag, lda, buffer, tile);
+        for (int i = 0; i < rows; i++) {
+            memcpy(diag + (long int)lda * i, buffer + tile * i, rows * sizeof(long int));
+        }
+        // off-diagonal pair: X = A(i0, j0) and Y = A(j0, i0) become Y^T and X^T
+        for (int j0 = i0 + tile; j0 < N; j0 += tile) {
+            int cols = (N - j0 < tile) ? N - j0 : tile;
+            long int *X = A + j0 + (long int)lda * i0;
+            long int *Y = A + i0 + (long int)lda * j0;
+            transposeBlock(rows, cols, X, lda, buffer, tile);
+            transposeBlock(cols, rows, Y, lda, X, lda);
+            for (int j = 0; j < cols; j++) {
+                memcpy(Y + (long int)lda * j, buffer + tile * j, rows * sizeof(long int));
+            }
+        }
+    }
+}
+
+/**
+ * @brief In-place transpose of a contiguous N x M strided matrix; afterwards A holds the M x N transpose.
+ * @details Square matrices are transposed tile by tile. Otherwise the element at position p moves to position
+ * p * N mod (NM - 1), and each cycle of that permutation is followed exactly once, with a bitmap of NM bits
+ * recording which positions have already been moved. Either way the cost is O(NM).
+ *
+ * @param N Number of rows of A
+ * @param M Number of columns of A
+ * @param A Matrix of N * M contiguous elements
+ */
+void transposeInPlace(int N, int M, long int *A) {
+    if (N == M) {
+        transposeSquareInPlace(N, A, M);
+        return;
+    }
+    long int size = (long int)N * M;
+    if (N <= 1 || M <= 1)
+        return;
+
+    uint64_t *visited = (uint64_t *)calloc((size + 63) / 64, sizeof(uint64_t));
+    // positions 0 and NM - 1 are fixed points
+    for (long int start = 1; start < size - 1; start++) {
+        if (visited[start >> 6] & (1ULL << (start & 63)))
+            continue;
+        long int value = A[start];
+        long int p = start;
+        do {
+            // p = i * M + j moves to j * N + i
+            long int next = (p % M) * N + p / M;
+            long int displaced = A[next];
+            A[next] = value;
+            value = displaced;
+            visited[next >> 6] |= 1ULL << (next & 63);
+            p = next;
+        } while (p != start);
+    }
+    free(visited);
+}
+
+#endif
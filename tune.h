@@ -0,0 +1,271 @@
+/**
+ * @file tune.h
+ * @author Navid Shamszadeh
+ * @brief Per-machine tuning parameters (GEMM blocking and unrolling, transpose tile, LU block, threads per kernel)
+ * and the cache file that persists them.
+ * @details Every tunable has a compile-time default next to the code that uses it (GEMM_MC, TRANSPOSE_TILE,
+ * LU_BLOCK, ...); a zero entry in tuneParams means "use the default", so a program behaves exactly as before until
+ * a tuned value is loaded. basics/auto_tune.c searches the parameters on the current host and writes the winners to
+ * the cache file, one line per host keyed by the CPU model and the L1d, L2 and L3 sizes. tuneInit loads the line
+ * matching the host before main (and before gemmInit picks the micro-kernels), so tuned runs pay no search cost.
+ * The cache file is $NLA_TUNE_FILE, or ~/.nla_tune when that is unset; NLA_TUNE=off skips loading it.
+ * @date 2021-05-23
+ */
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// longest host key and cache file line
+#define TUNE_KEY_LENGTH 256
+#define TUNE_LINE_LENGTH 1024
+
+// the threaded kernels of threads.h, each of which gets its own thread count
+typedef enum {
+    TUNE_ADD = 0,
+    TUNE_GEMV,
+    TUNE_GEMM,
+    TUNE_TRANSPOSE,
+    TUNE_KERNELS
+} tune_kernel_t;
+
+const char *tuneKernelNames[] = {"add", "gemv", "gemm", "transpose"};
+
+/**
+ * @brief Tuned parameters; 0 leaves the compile-time default in place.
+ */
+typedef struct {
+    int gemmMc;                // rows of the packed block of A (GEMM_MC), a multiple of GEMM_MR
+    int gemmKc;                // depth of the packed blocks (GEMM_KC)
+    int gemmNc;                // columns of the packed block of B (GEMM_NC), a multiple of GEMM_NR
+    int gemmUnroll;            // k unrolling of the double micro-kernels: 1, 2 or 4 (GEMM_UNROLL)
+    int transposeTile;         // tile of the blocked transposes (TRANSPOSE_TILE)
+    int luBlock;               // block columns of the LU factorization (LU_BLOCK)
+    int threads[TUNE_KERNELS]; // most threads worth using per kernel, further capped by threadsConfig.count
+} tune_params_t;
+
+tune_params_t tuneParams;
+// 1 once tuneParams came from the cache file
+int tuneLoaded = 0;
+
+// the tuned value of field, or fallback when it was not tuned
+#define TUNED(field, fallback) (tuneParams.field > 0 ? tuneParams.field : (fallback))
+
+// cache file keys, in the order of the fields of tune_params_t
+const char *tuneParamNames[] = {"gemm_mc", "gemm_kc", "gemm_nc", "gemm_unroll", "transpose_tile", "lu_block",
+                                "threads_add", "threads_gemv", "threads_gemm", "threads_transpose"};
+#define TUNE_PARAMS (int)(sizeof(tune_params_t) / sizeof(int))
+
+/**
+ * @brief Size in bytes of the cache of the given level (1 for L1 data), from sysconf or sysfs; 0 if unknown.
+ */
+long int tuneCacheSize(int level) {
+    long int size = 0;
+#if defined(_SC_LEVEL1_DCACHE_SIZE) && defined(_SC_LEVEL2_CACHE_SIZE) && defined(_SC_LEVEL3_CACHE_SIZE)
+    size = sysconf(level == 1 ? _SC_LEVEL1_DCACHE_SIZE : level == 2 ? _SC_LEVEL2_CACHE_SIZE : _SC_LEVEL3_CACHE_SIZE);
+#endif
+    if (size > 0)
+        return size;
+    // sysfs lists the caches of cpu0 as index0, index1, ...; skip the L1 instruction cache
+    size = 0;
+    for (int index = 0; index < 8 && size == 0; index++) {
+        char path[128], text[64];
+        int cache_level = 0;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", index);
+        FILE *file = fopen(path, "r");
+        if (file == NULL)
+            break;
+        if (fscanf(file, "%d", &cache_level) != 1)
+            cache_level = 0;
+        fclose(file);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+        file = fopen(path, "r");
+        if (file == NULL || fgets(text, sizeof(text), file) == NULL || cache_level != level || strncmp(text, "Instruction", 11) == 0) {
+            if (file)
+                fclose(file);
+            continue;
+        }
+        fclose(file);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+        file = fopen(path, "r");
+        long int kib = 0;
+        if (file != NULL && fscanf(file, "%ldK", &kib) == 1)
+            size = kib * 1024;
+        if (file)
+            fclose(file);
+    }
+    return size;
+}
+
+/**
+ * @brief Writes the key identifying this host in the cache file: the CPU model and the L1d, L2 and L3 sizes,
+ * separated by tabs.
+ *
+ * @param key Buffer of TUNE_KEY_LENGTH characters
+ */
+void tuneHostKey(char *key) {
+    char model[TUNE_KEY_LENGTH] = "unknown";
+    char line[TUNE_LINE_LENGTH];
+    FILE *cpuinfo = fopen("/proc/cpuinfo", "r");
+    while (cpuinfo != NULL && fgets(line, sizeof(line), cpuinfo) != NULL) {
+        char *colon = strchr(line, ':');
+        if (strncmp(line, "model name", 10) == 0 && colon != NULL) {
+            char *start = colon + 1;
+            while (*start == ' ')
+                start++;
+            snprintf(model, sizeof(model), "%s", start);
+            model[strcspn(model, "\t\n")] = '\0';
+            break;
+        }
+    }
+    if (cpuinfo)
+        fclose(cpuinfo);
+    snprintf(key, TUNE_KEY_LENGTH, "%.200s\t%ld\t%ld\t%ld", model, tuneCacheSize(1), tuneCacheSize(2), tuneCacheSize(3));
+}
+
+/**
+ * @brief Path of the cache file: $NLA_TUNE_FILE, else ~/.nla_tune, else .nla_tune in the working directory.
+ *
+ * @param path Buffer of TUNE_LINE_LENGTH characters
+ */
+void tuneCachePath(char *path) {
+    const char *file = getenv("NLA_TUNE_FILE");
+    const char *home = getenv("HOME");
+    if (file != NULL && file[0] != '\0')
+        snprintf(path, TUNE_LINE_LENGTH, "%s", file);
+    else if (home != NULL && home[0] != '\0')
+        snprintf(path, TUNE_LINE_LENGTH, "%s/.nla_tune", home);
+    else
+        snprintf(path, TUNE_LINE_LENGTH, ".nla_tune");
+}
+
+/**
+ * @brief Length of the key at the start of a cache file line (the part before the fourth tab), 0 if malformed.
+ */
+size_t tuneKeyLength(const char *line) {
+    const char *p = line;
+    for (int tabs = 0; tabs < 4; tabs++) {
+        p = strchr(p, '\t');
+        if (p == NULL)
+            return 0;
+        if (tabs < 3)
+            p++;
+    }
+    return (size_t)(p - line);
+}
+
+/**
+ * @brief Loads the parameters stored for this host from the cache file into params.
+ * @details Each line is the host key followed by tab-separated name=value pairs. Unknown names and values that are
+ * not positive are ignored, so files written by other versions still load.
+ *
+ * @param path Cache file
+ * @param params Parameters to fill; untouched when the host has no entry
+ * @return 0 if an entry was found, -1 otherwise
+ */
+int tuneLoad(const char *path, tune_params_t *params) {
+    char key[TUNE_KEY_LENGTH], line[TUNE_LINE_LENGTH];
+    tuneHostKey(key);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return -1;
+    int found = -1;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        size_t length = tuneKeyLength(line);
+        if (line[0] == '#' || length == 0 || length != strlen(key) || strncmp(line, key, length) != 0)
+            continue;
+        tune_params_t loaded = {0};
+        int *values = (int *)&loaded;
+        for (char *field = strtok(line + length, "\t\n"); field != NULL; field = strtok(NULL, "\t\n")) {
+            char *equals = strchr(field, '=');
+            if (equals == NULL)
+                continue;
+            *equals = '\0';
+            for (int p = 0; p < TUNE_PARAMS; p++) {
+                if (strcmp(field, tuneParamNames[p]) == 0 && atoi(equals + 1) > 0)
+                    values[p] = atoi(equals + 1);
+            }
+        }
+        *params = loaded;
+        found = 0;
+    }
+    fclose(file);
+    return found;
+}
+
+/**
+ * @brief Stores params as the entry of this host in the cache file, replacing any previous entry and keeping the
+ * entries of other hosts. The file is rewritten through a temporary file so readers never see half of it.
+ *
+ * @param path Cache file
+ * @param params Parameters to store; zero entries are left out
+ * @return 0 on success, -1 if the file could not be written
+ */
+int tuneSave(const char *path, const tune_params_t *params) {
+    char key[TUNE_KEY_LENGTH], line[TUNE_LINE_LENGTH], temporary[TUNE_LINE_LENGTH + 16];
+    tuneHostKey(key);
+    snprintf(temporary, sizeof(temporary), "%s.%d", path, (int)getpid());
+    FILE *out = fopen(temporary, "w");
+    if (out == NULL)
+        return -1;
+    FILE *in = fopen(path, "r");
+    int header = 0;
+    while (in != NULL && fgets(line, sizeof(line), in) != NULL) {
+        size_t length = tuneKeyLength(line);
+        header |= (line[0] == '#');
+        if (line[0] != '#' && length == strlen(key) && strncmp(line, key, length) == 0)
+            continue;
+        fputs(line, out);
+    }
+    if (in)
+        fclose(in);
+    if (!header)
+        fprintf(out, "# cpu model\tL1d bytes\tL2 bytes\tL3 bytes\ttuned parameters (written by auto_tune)\n");
+    fputs(key, out);
+    const int *values = (const int *)params;
+    for (int p = 0; p < TUNE_PARAMS; p++) {
+        if (values[p] > 0)
+            fprintf(out, "\t%s=%d", tuneParamNames[p], values[p]);
+    }
+    fputc('\n', out);
+    if (fclose(out) != 0 || rename(temporary, path) != 0) {
+        remove(temporary);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Prints the parameters in effect, marking the ones that come from the defaults.
+ *
+ * @param out Stream to write to
+ * @param params Parameters to print
+ */
+void tunePrint(FILE *out, const tune_params_t *params) {
+    const int *values = (const int *)params;
+    for (int p = 0; p < TUNE_PARAMS; p++) {
+        if (values[p] > 0)
+            fprintf(out, "%s=%d ", tuneParamNames[p], values[p]);
+        else
+            fprintf(out, "%s=default ", tuneParamNames[p]);
+    }
+    fputc('\n', out);
+}
+
+/**
+ * @brief Loads the tuned parameters of this host from the cache file unless NLA_TUNE=off. Runs automatically before
+ * main, ahead of the initializers that depend on the parameters.
+ */
+__attribute__((constructor(101))) void tuneInit(void) {
+    const char *mode = getenv("NLA_TUNE");
+    if (mode != NULL && strcmp(mode, "off") == 0)
+        return;
+    char path[TUNE_LINE_LENGTH];
+    tuneCachePath(path);
+    tuneLoaded = (tuneLoad(path, &tuneParams) == 0);
+}
+
+#endif